@@ -21,10 +21,9 @@
 #include <math.h>
 #include <grass/gis.h>
 #include <grass/raster.h>
-#include <grass/segment.h>
 #include <grass/imagery.h>
 #include <grass/glocale.h>
-#include "cache.h"
+#include "tilecache.h"
 
 #ifndef MAX
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
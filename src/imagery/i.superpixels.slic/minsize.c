@@ -1,10 +1,9 @@
 #include <grass/gis.h>
 #include <grass/raster.h>
-#include <grass/segment.h>
 #include <grass/glocale.h>
 #include "pavl.h"
 #include "rclist.h"
-#include "cache.h"
+#include "tilecache.h"
 
 struct nbr_cnt {
     int id;
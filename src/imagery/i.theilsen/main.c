@@ -17,42 +17,156 @@
 #include <math.h>
 #include <grass/imagery.h>
 #include <grass/glocale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rowblock.h"
 
 /* Separate function for opening maps (see after main function) */
 char *group;
 char *subgroup;
 struct Ref ref;
-DCELL **cell;
 int *cellfd;
 int open_files(void);
 /*-------------------------------------*/
 /*Mann-Kendall test*/
-double mk_test(double *signal, int t);
+double mk_test(double *signal, int t, double *work);
 /*-------------------------------------*/
 
+/* per thread workspace and colour palette ranges */
+struct theilsen_ws {
+    DCELL *signal; /*spectral/temporal signal*/
+    DCELL *slope;  /*Theil-Sen slopes of all pairs*/
+    DCELL *work;   /*Mann-Kendall sorting workspace*/
+    DCELL ts_max;  /*value total max for colour palette */
+    DCELL ts_min;  /*value total min for colour palette */
+    DCELL mk_max;  /*Mann-Kendall total max for colour palette */
+    DCELL mk_min;  /*Mann-Kendall total min for colour palette */
+};
+
+struct theilsen {
+    int nfiles;
+    struct theilsen_ws *ws;
+};
+
+/* k-th smallest of a[0..n-1], partially reorders a */
+static DCELL select_kth(DCELL *a, int n, int k)
+{
+    int lo = 0, hi = n - 1, i, j;
+    DCELL pivot, temp;
+
+    while (lo < hi) {
+        /* median of three as pivot */
+        int mid = lo + (hi - lo) / 2;
+
+        if (a[mid] < a[lo]) {
+            temp = a[mid];
+            a[mid] = a[lo];
+            a[lo] = temp;
+        }
+        if (a[hi] < a[lo]) {
+            temp = a[hi];
+            a[hi] = a[lo];
+            a[lo] = temp;
+        }
+        if (a[hi] < a[mid]) {
+            temp = a[hi];
+            a[hi] = a[mid];
+            a[mid] = temp;
+        }
+        pivot = a[mid];
+
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (a[i] < pivot)
+                i++;
+            while (pivot < a[j])
+                j--;
+            if (i <= j) {
+                temp = a[i];
+                a[i] = a[j];
+                a[j] = temp;
+                i++;
+                j--;
+            }
+        }
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    return a[k];
+}
+
+/* Theil-Sen slope and Mann-Kendall test of the cell idx */
+static void theilsen_cell(void *data, int t_id, DCELL **in, DCELL **out,
+                          size_t idx)
+{
+    const struct theilsen *ts = data;
+    struct theilsen_ws *ws = &ts->ws[t_id];
+    DCELL *signal = ws->signal;
+    DCELL *slope = ws->slope;
+    int nfiles = ts->nfiles;
+    int n, n0, n1, npairs;
+    DCELL median;       /*median slope*/
+    DCELL pvalue = 0.0; /*Mann-Kendall trend test p-value*/
+
+    for (n = 0; n < nfiles; n++)
+        signal[n] = in[n][idx];
+    /* Combinatorics of all in all pairs slopes */
+    /* x-axis is spectral/temporal dim., index n is its value */
+    /* y-axis is from cell[n], pairs with NULL are skipped */
+    npairs = 0;
+    for (n0 = 0; n0 < nfiles; n0++) {
+        if (Rast_is_d_null_value(&signal[n0]))
+            continue;
+        for (n1 = n0 + 1; n1 < nfiles; n1++) {
+            if (!Rast_is_d_null_value(&signal[n1]))
+                slope[npairs++] = (signal[n1] - signal[n0]) / (n1 - n0);
+        }
+    }
+    /* Extract median slope (list halfway), selection instead of sorting */
+    if (npairs > 0) {
+        median = select_kth(slope, npairs, npairs / 2);
+        out[0][idx] = median;
+        /* Prepare Theil-Sen colour palette range from data */
+        if (median < ws->ts_min)
+            ws->ts_min = median;
+        if (median > ws->ts_max)
+            ws->ts_max = median;
+    }
+    else
+        Rast_set_d_null_value(&out[0][idx], 1);
+    /* Mann-Kendall Trend Test */
+    pvalue = mk_test(signal, nfiles, ws->work);
+    if (pvalue < ws->mk_min)
+        ws->mk_min = pvalue;
+    if (pvalue > ws->mk_max)
+        ws->mk_max = pvalue;
+    out[1][idx] = pvalue;
+}
+
 int main(int argc, char *argv[])
 {
-    int nrows, ncols;
-    int row, col;
     struct GModule *module;
-    struct Option *grp, *sgrp, *out0, *out1;
+    struct Option *grp, *sgrp, *out0, *out1, *nprocs_opt;
     /*struct Cell_head window, cellhd;*/
     struct History history; /*metadata */
     struct Colors colors;   /*Color rules */
 
-    int nfiles = 0, count = 0, n = 0, n0 = 0, n1 = 0, n0n1 = 0;
-    DCELL *signal;           /*spectral/temporal signal*/
-    DCELL *sorted;           /*spectral/temporal sorted slope*/
-    DCELL **slope;           /*Theil-Sen slope matrix*/
+    int nfiles = 0, n = 0, t = 0, nprocs;
     DCELL ts_max = -10000.0; /*value total max for colour palette */
     DCELL ts_min = 100000.0; /*value total min for colour palette */
     DCELL mk_max = -10000.0; /*Mann-Kendall total max for colour palette */
     DCELL mk_min = 100000.0; /*Mann-Kendall total min for colour palette */
-    DCELL temp = 0.0;        /*swapping temp value*/
-    DCELL pvalue = 0.0;      /*Mann-Kendall trend test p-value*/
 
     int outfd0, outfd1;
-    DCELL *outrast0, *outrast1;
+    struct theilsen ts;
+    struct rowblock rb;
 
     DCELL val1, val2;
     /************************************/
@@ -79,12 +193,27 @@ int main(int argc, char *argv[])
     out1->description = _("Name of Mann-Kendall test map");
     out1->key = "mannkendall";
 
+    nprocs_opt = G_define_standard_option(G_OPT_M_NPROCS);
+
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
     /*------------------------------------------*/
 
-    nrows = Rast_window_rows();
-    ncols = Rast_window_cols();
+#ifdef _OPENMP
+    nprocs = atoi(nprocs_opt->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), nprocs_opt->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
 
     group = grp->answer;
     subgroup = sgrp->answer;
@@ -93,98 +222,62 @@ int main(int argc, char *argv[])
     outfd0 = Rast_open_new(out0->answer, DCELL_TYPE);
     outfd1 = Rast_open_new(out1->answer, DCELL_TYPE);
 
-    /* Allocate output buffer, use input map data_type */
-    outrast0 = Rast_allocate_d_buf();
-    outrast1 = Rast_allocate_d_buf();
-
     /* Open input files */
     nfiles = open_files();
 
-    /* Allocate spectral pixel memory */
-    signal = (DCELL *)G_malloc(nfiles * sizeof(DCELL));
+    /* Allocate per thread workspace */
+    ts.nfiles = nfiles;
+    ts.ws = G_malloc(nprocs * sizeof(struct theilsen_ws));
+    for (t = 0; t < nprocs; t++) {
+        struct theilsen_ws *ws = &ts.ws[t];
+
+        /* Allocate spectral pixel memory */
+        ws->signal = (DCELL *)G_malloc(nfiles * sizeof(DCELL));
 
-    /* Allocate Theil-Sen Slope Matrix */
-    slope = (DCELL **)G_malloc(nfiles * nfiles * sizeof(DCELL *));
-    for (n = 0; n < nfiles; n++) {
-        slope[n] = (DCELL *)G_malloc(nfiles * sizeof(DCELL));
+        /* Allocate Theil-Sen slopes of all pairs */
+        ws->slope = (DCELL *)G_malloc((size_t)nfiles * (nfiles - 1) / 2 *
+                                      sizeof(DCELL));
+
+        /* Allocate Mann-Kendall sorting workspace */
+        ws->work = (DCELL *)G_malloc(2 * nfiles * sizeof(DCELL));
+
+        ws->ts_max = ts_max;
+        ws->ts_min = ts_min;
+        ws->mk_max = mk_max;
+        ws->mk_min = mk_min;
     }
 
-    /* Allocate 1D Theil-Sen Slope sorting array */
-    sorted = (DCELL *)G_malloc(nfiles * nfiles * sizeof(DCELL));
-
-    /* Process pixels */
-    count = 0;
-    for (row = 0; row < nrows; row++) {
-        G_percent(row, nrows, 2);
-        for (n = 0; n < nfiles; n++)
-            Rast_get_d_row(cellfd[n], cell[n], row);
-        for (col = 0; col < ncols; col++) {
-            count++;
-            for (n = 0; n < nfiles; n++)
-                signal[n] = cell[n][col];
-            /* Combinatorics of all in all pairs slopes */
-            /* x-axis is spectral/temporal dim., index n is its value */
-            /* y-axis is from cell[n] */
-            /* Duplicate n index as matrix axis */
-            n0 = 0;
-            n1 = 0;
-            for (n0 = 0; n0 < n; n0++) {
-                for (n1 = 0; n1 < n; n1++) {
-                    /* Compute outside of diagonal */
-                    if (n0 != n1)
-                        slope[n0][n1] = (signal[n1] - signal[n0]) / (n1 - n0);
-                }
-            }
-            /* Sorting all slopes computed */
-            n0n1 = 0;
-            /* Reduce dimensionality */
-            for (n0 = 0; n0 < n; n0++) {
-                for (n1 = 0; n1 < n; n1++) {
-                    if (n0 != n1) {
-                        sorted[n0n1] = slope[n0][n1];
-                        n0n1++;
-                    }
-                }
-            }
-            /* Actual Sorting, needs to transport max n0n1 length */
-            for (n0 = 0; n0 < n0n1; n0++) {
-                for (n = 1; n < n0n1; n++) {
-                    if (sorted[n - 1] > sorted[n]) {
-                        temp = sorted[n];
-                        sorted[n] = sorted[n - 1];
-                        sorted[n - 1] = temp;
-                    }
-                }
-            }
-            /* Extract median slope (list halfway) */
-            outrast0[col] = sorted[n0n1 / 2];
-            /* Prepare Theil-Sen colour palette range from data */
-            if (sorted[n0n1 / 2] < ts_min)
-                ts_min = sorted[n0n1 / 2];
-            if (sorted[n0n1 / 2] > ts_max)
-                ts_max = sorted[n0n1 / 2];
-            /* Mann-Kendall Trend Test */
-            pvalue = mk_test(signal, nfiles);
-            if (pvalue < mk_min)
-                mk_min = pvalue;
-            if (pvalue > mk_max)
-                mk_max = pvalue;
-            outrast1[col] = pvalue;
-            /*-------------------------*/
-        }
-        Rast_put_d_row(outfd0, outrast0);
-        /* Mann-Kendall Trend Test */
-        /* Not yet implemented     */
-        Rast_put_d_row(outfd1, outrast1);
-        /*-------------------------*/
+    /* Process pixels, nprocs rows at once */
+    rowblock_init(&rb, nfiles, 2, nprocs);
+    for (n = 0; n < nfiles; n++)
+        rowblock_set_input(&rb, n, ref.file[n].name, ref.file[n].mapset,
+                           cellfd[n]);
+    rowblock_set_output(&rb, 0, outfd0);
+    rowblock_set_output(&rb, 1, outfd1);
+    rowblock_run(&rb, theilsen_cell, &ts);
+    rowblock_free(&rb);
+
+    /* Colour palette ranges of all threads */
+    for (t = 0; t < nprocs; t++) {
+        struct theilsen_ws *ws = &ts.ws[t];
+
+        if (ws->ts_min < ts_min)
+            ts_min = ws->ts_min;
+        if (ws->ts_max > ts_max)
+            ts_max = ws->ts_max;
+        if (ws->mk_min < mk_min)
+            mk_min = ws->mk_min;
+        if (ws->mk_max > mk_max)
+            mk_max = ws->mk_max;
+
+        G_free(ws->signal);
+        G_free(ws->slope);
+        G_free(ws->work);
     }
+    G_free(ts.ws);
 
-    for (n = 0; n < nfiles; n++) {
-        G_free(cell[n]);
+    for (n = 0; n < nfiles; n++)
         Rast_close(cellfd[n]);
-    }
-    G_free(outrast0);
-    G_free(outrast1);
     Rast_close(outfd0);
     Rast_close(outfd1);
 
@@ -263,10 +356,8 @@ int open_files(void)
         G_fatal_error(_("Subgroup must have at least 2 raster maps"));
     }
 
-    cell = (DCELL **)G_malloc(ref.nfiles * sizeof(DCELL *));
     cellfd = (int *)G_malloc(ref.nfiles * sizeof(int));
     for (n = 0; n < ref.nfiles; n++) {
-        cell[n] = Rast_allocate_d_buf();
         name = ref.file[n].name;
         mapset = ref.file[n].mapset;
         cellfd[n] = Rast_open_old(name, mapset);
@@ -43,14 +43,78 @@ double normcdf(double x, double mu, double sigma)
     return (y);
 }
 
+/*sort a[0..n-1] ascending with merge sort, work holds n values*/
+/*returns the number of pairs i < j with a[i] > a[j] (inversions)*/
+static long long merge_count(double *a, double *work, int n)
+{
+    long long inv = 0;
+    double *src = a, *dst = work, *tmp;
+    int width, lo, mid, hi, i, j, k;
+
+    for (width = 1; width < n; width *= 2) {
+        for (lo = 0; lo < n; lo += 2 * width) {
+            mid = lo + width < n ? lo + width : n;
+            hi = lo + 2 * width < n ? lo + 2 * width : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi) {
+                /*equal values are taken from the left: ties are no inversions*/
+                if (src[j] < src[i]) {
+                    inv += mid - i;
+                    dst[k++] = src[j++];
+                }
+                else
+                    dst[k++] = src[i++];
+            }
+            while (i < mid)
+                dst[k++] = src[i++];
+            while (j < hi)
+                dst[k++] = src[j++];
+        }
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != a) {
+        for (i = 0; i < n; i++)
+            a[i] = src[i];
+    }
+
+    return inv;
+}
+
 /*Mann-Kendall test input signal and its length (t)*/
-double mk_test(double *signal, int t)
+/*work holds 2 * t values*/
+double mk_test(double *signal, int t, double *work)
 {
     double value = 0.0, z = 0.0;
+    double *a = work, *b = work + t;
+    long long m, nv, npairs, nvpairs, ties, inv, g;
     int i, j;
-    for (i = 1; i < t - 1; i++)
-        for (j = i + 1; j < t; j++)
-            value += sign(signal[j] - signal[i]);
+
+    /*S = sum of sign(signal[j] - signal[i]) for 1 <= i < j < t*/
+    /*counted in O(t log t): ties give 0, inversions -1, all other*/
+    /*valid pairs +1, pairs with a NULL value -1 as with sign()*/
+    nv = 0;
+    for (i = 1; i < t; i++) {
+        if (!isnan(signal[i]))
+            a[nv++] = signal[i];
+    }
+    m = t > 1 ? t - 1 : 0;
+    npairs = m * (m - 1) / 2;
+    nvpairs = nv * (nv - 1) / 2;
+
+    inv = merge_count(a, b, nv);
+    ties = 0;
+    for (i = 0; i < nv; i = j) {
+        for (j = i + 1; j < nv && a[j] == a[i]; j++)
+            ;
+        g = j - i;
+        ties += g * (g - 1) / 2;
+    }
+    value = (double)((nvpairs - inv - ties) - inv - (npairs - nvpairs));
+
     double variance = (t * (t - 1) * (2 * t + 5)) / 18.0;
     double stddev = sqrt(variance);
     if (value > 0)
@@ -0,0 +1,177 @@
+/****************************************************************************
+ *
+ * MODULE:       librowblock
+ *
+ * AUTHOR(S):    Markus Metz
+ *
+ * PURPOSE:      Pipelined reading and writing of row blocks of series of
+ *               raster maps, overlapped with parallel processing of cells
+ *
+ * COPYRIGHT:    (C) 2026 by the GRASS Development Team
+ *
+ *               This program is free software under the GNU General Public
+ *               License (>=v2). Read the file COPYING that comes with GRASS
+ *               for details.
+ *
+ *****************************************************************************/
+
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rowblock.h"
+
+static DCELL **alloc_blocks(int n, size_t size)
+{
+    DCELL **b;
+    int i;
+
+    b = G_malloc(n * sizeof(DCELL *));
+    for (i = 0; i < n; i++)
+        b[i] = G_malloc(size * sizeof(DCELL));
+
+    return b;
+}
+
+static void free_blocks(DCELL **b, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        G_free(b[i]);
+    G_free(b);
+}
+
+void rowblock_init(struct rowblock *rb, int n_in, int n_out, int nblock)
+{
+    size_t size;
+    int i;
+
+    rb->nrows = Rast_window_rows();
+    rb->ncols = Rast_window_cols();
+    rb->nblock = nblock;
+    rb->n_in = n_in;
+    rb->n_out = n_out;
+    rb->in_name = G_calloc(n_in, sizeof(char *));
+    rb->in_mapset = G_calloc(n_in, sizeof(char *));
+    rb->in_fd = G_malloc(n_in * sizeof(int));
+    rb->out_fd = G_malloc(n_out * sizeof(int));
+    for (i = 0; i < n_in; i++)
+        rb->in_fd[i] = -1;
+    for (i = 0; i < n_out; i++)
+        rb->out_fd[i] = -1;
+
+    size = (size_t)nblock * rb->ncols;
+    for (i = 0; i < 2; i++) {
+        rb->in[i] = alloc_blocks(n_in, size);
+        rb->out[i] = alloc_blocks(n_out, size);
+    }
+}
+
+/* fd < 0: the map is opened each time a block is read */
+void rowblock_set_input(struct rowblock *rb, int i, const char *name,
+                        const char *mapset, int fd)
+{
+    rb->in_name[i] = name;
+    rb->in_mapset[i] = mapset;
+    rb->in_fd[i] = fd;
+}
+
+void rowblock_set_output(struct rowblock *rb, int i, int fd)
+{
+    rb->out_fd[i] = fd;
+}
+
+static void read_block(struct rowblock *rb, int r0, int nb, DCELL **in)
+{
+    int i, b, fd;
+
+    for (i = 0; i < rb->n_in; i++) {
+        fd = rb->in_fd[i];
+        if (fd < 0)
+            fd = Rast_open_old(rb->in_name[i], rb->in_mapset[i]);
+        for (b = 0; b < nb; b++)
+            Rast_get_d_row(fd, in[i] + (size_t)b * rb->ncols, r0 + b);
+        if (rb->in_fd[i] < 0)
+            Rast_close(fd);
+    }
+}
+
+static void write_block(struct rowblock *rb, int nb, DCELL **out)
+{
+    int i, b;
+
+    for (b = 0; b < nb; b++) {
+        for (i = 0; i < rb->n_out; i++)
+            Rast_put_d_row(rb->out_fd[i], out[i] + (size_t)b * rb->ncols);
+    }
+}
+
+/* all rows of the current region, cell() is called once for each cell
+ * and must only write to out[i][idx] */
+void rowblock_run(struct rowblock *rb, rowblock_cell_func *cell, void *data)
+{
+    int r0, nb, next_nb, cur;
+
+    if (rb->nrows < 1)
+        return;
+
+    cur = 0;
+    nb = rb->nrows < rb->nblock ? rb->nrows : rb->nblock;
+    read_block(rb, 0, nb, rb->in[cur]);
+
+    for (r0 = 0; r0 < rb->nrows; r0 += rb->nblock) {
+        int prev_nb = r0 > 0 ? rb->nblock : 0;
+        int next_r0 = r0 + rb->nblock;
+        size_t idx, ncells;
+
+        G_percent(r0, rb->nrows, 2);
+
+        nb = rb->nrows - r0 < rb->nblock ? rb->nrows - r0 : rb->nblock;
+        next_nb = rb->nrows - next_r0 < rb->nblock ? rb->nrows - next_r0
+                                                   : rb->nblock;
+        ncells = (size_t)nb * rb->ncols;
+
+#pragma omp parallel private(idx)
+        {
+            int t_id = 0;
+
+#ifdef _OPENMP
+            t_id = omp_get_thread_num();
+#endif
+            /* previous and next block, in the other buffer */
+#pragma omp single nowait
+            {
+                if (prev_nb > 0)
+                    write_block(rb, prev_nb, rb->out[!cur]);
+                if (next_nb > 0)
+                    read_block(rb, next_r0, next_nb, rb->in[!cur]);
+            }
+
+#pragma omp for schedule(dynamic, 64)
+            for (idx = 0; idx < ncells; idx++)
+                cell(data, t_id, rb->in[cur], rb->out[cur], idx);
+        }
+
+        cur = !cur;
+    }
+    write_block(rb, nb, rb->out[!cur]);
+
+    G_percent(1, 1, 2);
+}
+
+void rowblock_free(struct rowblock *rb)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        free_blocks(rb->in[i], rb->n_in);
+        free_blocks(rb->out[i], rb->n_out);
+    }
+    G_free(rb->in_name);
+    G_free(rb->in_mapset);
+    G_free(rb->in_fd);
+    G_free(rb->out_fd);
+}
@@ -0,0 +1,41 @@
+#ifndef GRASS_ROWBLOCK_H
+#define GRASS_ROWBLOCK_H
+
+#include <stddef.h>
+#include <grass/raster.h>
+
+/* pipelined reader and writer for series of raster maps
+ *
+ * rows of all input maps are read in blocks of nblock rows into one of
+ * two buffers. While all threads process the cells of the current
+ * block, one of them writes the previous block of all output maps and
+ * reads the next block of all input maps, then joins the processing.
+ * The raster library is only called by one thread at a time.
+ *
+ * modules using the reader add this directory to EXTRA_INC and link with
+ * -lgrass_rowblock.$(GRASS_LIB_VERSION_NUMBER) */
+
+/* process cell idx of the current block, in[i] and out[i] are the
+ * current block of input map i and of output map i, t_id is the
+ * number of the calling thread */
+typedef void rowblock_cell_func(void *data, int t_id, DCELL **in,
+                                DCELL **out, size_t idx);
+
+struct rowblock {
+    int nrows, ncols, nblock;
+    int n_in, n_out;
+    const char **in_name, **in_mapset;
+    int *in_fd; /* -1: opened only to read a block */
+    int *out_fd;
+    DCELL **in[2];  /* n_in blocks of nblock * ncols cells */
+    DCELL **out[2]; /* n_out blocks of nblock * ncols cells */
+};
+
+void rowblock_init(struct rowblock *rb, int n_in, int n_out, int nblock);
+void rowblock_set_input(struct rowblock *rb, int i, const char *name,
+                        const char *mapset, int fd);
+void rowblock_set_output(struct rowblock *rb, int i, int fd);
+void rowblock_run(struct rowblock *rb, rowblock_cell_func *cell, void *data);
+void rowblock_free(struct rowblock *rb);
+
+#endif
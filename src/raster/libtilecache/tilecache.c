@@ -0,0 +1,460 @@
+/****************************************************************************
+ *
+ * MODULE:       libtilecache
+ *
+ * AUTHOR(S):    Markus Metz
+ *
+ * PURPOSE:      Thread-safe grid cache shared by several modules,
+ *               in memory or with tiles in a temporary file
+ *
+ * COPYRIGHT:    (C) 2026 by the GRASS Development Team
+ *
+ *               This program is free software under the GNU General Public
+ *               License (>=v2). Read the file COPYING that comes with GRASS
+ *               for details.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "tilecache.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* the tiles are distributed over shards, tile t belongs to shard
+ * t % nshards. Each shard has its own lock, its own slots and its own
+ * least recently used replacement, so that threads working on
+ * different tiles rarely wait for each other */
+#define MAX_SHARDS 16
+
+struct cache_slot {
+    int tile;          /* tile in this slot, -1 if empty */
+    int dirty;
+    unsigned long age; /* last access, 0 if empty */
+    char *buf;
+};
+
+struct cache_shard {
+    int nslots;
+    struct cache_slot *slot;
+    unsigned long clock;
+    size_t hits, misses, readahead;
+#ifdef _OPENMP
+    omp_lock_t lock;
+#endif
+};
+
+struct cache_disk {
+    int srows, scols; /* tile dimensions */
+    int spr;          /* tiles per row */
+    int ntiles;
+    size_t tsize;     /* tile size in bytes */
+    int *tile_slot;   /* slot of each tile in its shard, -1 if not loaded */
+    int nshards;
+    struct cache_shard *shard;
+    int readahead;
+    int last_miss;
+    char *fname;
+    int fd;
+#ifdef _OPENMP
+    omp_lock_t io_lock;
+#endif
+};
+
+static void *cache_get_r(struct cache *c, void *p, int row, int col)
+{
+    return memcpy(p, c->r + ((size_t)row * c->cols + col) * c->n, c->n);
+}
+
+static void *cache_put_r(struct cache *c, void *p, int row, int col)
+{
+    return memcpy(c->r + ((size_t)row * c->cols + col) * c->n, p, c->n);
+}
+
+static void lock_shard(struct cache_shard *sh)
+{
+#ifdef _OPENMP
+    omp_set_lock(&sh->lock);
+#endif
+}
+
+static void unlock_shard(struct cache_shard *sh)
+{
+#ifdef _OPENMP
+    omp_unset_lock(&sh->lock);
+#endif
+}
+
+/* tiles not yet written are read as zeros */
+static void read_tile(struct cache_disk *d, int tile, char *buf)
+{
+    ssize_t nread;
+    size_t total = 0;
+
+#ifdef _OPENMP
+    omp_set_lock(&d->io_lock);
+#endif
+    if (lseek(d->fd, (off_t)tile * d->tsize, SEEK_SET) == -1)
+        G_fatal_error(_("Unable to seek in temporary file"));
+
+    while (total < d->tsize) {
+        nread = read(d->fd, buf + total, d->tsize - total);
+        if (nread < 0)
+            G_fatal_error(_("Unable to read from temporary file"));
+        if (nread == 0)
+            break;
+        total += nread;
+    }
+#ifdef _OPENMP
+    omp_unset_lock(&d->io_lock);
+#endif
+
+    if (total < d->tsize)
+        memset(buf + total, 0, d->tsize - total);
+}
+
+static void write_tile(struct cache_disk *d, int tile, char *buf)
+{
+    ssize_t nwritten;
+    size_t total = 0;
+
+#ifdef _OPENMP
+    omp_set_lock(&d->io_lock);
+#endif
+    if (lseek(d->fd, (off_t)tile * d->tsize, SEEK_SET) == -1)
+        G_fatal_error(_("Unable to seek in temporary file"));
+
+    while (total < d->tsize) {
+        nwritten = write(d->fd, buf + total, d->tsize - total);
+        if (nwritten <= 0)
+            G_fatal_error(_("Unable to write to temporary file"));
+        total += nwritten;
+    }
+#ifdef _OPENMP
+    omp_unset_lock(&d->io_lock);
+#endif
+}
+
+/* slot holding the tile, the shard must be locked
+ * a missing tile replaces the least recently used tile of the shard */
+static struct cache_slot *get_slot(struct cache_disk *d,
+                                   struct cache_shard *sh, int tile,
+                                   int prefetch)
+{
+    struct cache_slot *slot;
+    int i, s;
+
+    s = d->tile_slot[tile];
+    if (s >= 0) {
+        slot = &sh->slot[s];
+        if (!prefetch) {
+            slot->age = ++sh->clock;
+            sh->hits++;
+        }
+        return slot;
+    }
+
+    s = 0;
+    for (i = 1; i < sh->nslots; i++) {
+        if (sh->slot[i].age < sh->slot[s].age)
+            s = i;
+    }
+    slot = &sh->slot[s];
+
+    if (slot->tile >= 0) {
+        if (slot->dirty)
+            write_tile(d, slot->tile, slot->buf);
+        d->tile_slot[slot->tile] = -1;
+    }
+
+    read_tile(d, tile, slot->buf);
+    slot->tile = tile;
+    slot->dirty = 0;
+    slot->age = ++sh->clock;
+    d->tile_slot[tile] = s;
+
+    if (prefetch)
+        sh->readahead++;
+    else
+        sh->misses++;
+
+    return slot;
+}
+
+/* after consecutive misses along a row or a column of tiles,
+ * load the next tiles in that direction, unless that would evict
+ * the tiles just loaded */
+static void read_ahead(struct cache_disk *d, int tile)
+{
+    int last, step, t, k;
+    struct cache_shard *sh;
+
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+    last = d->last_miss;
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+    d->last_miss = tile;
+
+    step = tile - last;
+    if (step != 1 && step != d->spr)
+        return;
+
+    for (k = 1; k <= d->readahead; k++) {
+        t = tile + k * step;
+        if (t >= d->ntiles || (step == 1 && t / d->spr != tile / d->spr))
+            break;
+
+        sh = &d->shard[t % d->nshards];
+        if (sh->nslots <= d->readahead)
+            break;
+        lock_shard(sh);
+        get_slot(d, sh, t, 1);
+        unlock_shard(sh);
+    }
+}
+
+static void *cache_get_s(struct cache *c, void *p, int row, int col)
+{
+    struct cache_disk *d = c->d;
+    struct cache_shard *sh;
+    struct cache_slot *slot;
+    int tile;
+    size_t misses;
+
+    tile = (row / d->srows) * d->spr + col / d->scols;
+    sh = &d->shard[tile % d->nshards];
+
+    lock_shard(sh);
+    misses = sh->misses;
+    slot = get_slot(d, sh, tile, 0);
+    memcpy(p,
+           slot->buf +
+               ((size_t)(row % d->srows) * d->scols + col % d->scols) * c->n,
+           c->n);
+    misses = sh->misses - misses;
+    unlock_shard(sh);
+
+    if (misses && d->readahead)
+        read_ahead(d, tile);
+
+    return p;
+}
+
+static void *cache_put_s(struct cache *c, void *p, int row, int col)
+{
+    struct cache_disk *d = c->d;
+    struct cache_shard *sh;
+    struct cache_slot *slot;
+    int tile;
+    size_t misses;
+
+    tile = (row / d->srows) * d->spr + col / d->scols;
+    sh = &d->shard[tile % d->nshards];
+
+    lock_shard(sh);
+    misses = sh->misses;
+    slot = get_slot(d, sh, tile, 0);
+    memcpy(slot->buf +
+               ((size_t)(row % d->srows) * d->scols + col % d->scols) * c->n,
+           p, c->n);
+    slot->dirty = 1;
+    misses = sh->misses - misses;
+    unlock_shard(sh);
+
+    if (misses && d->readahead)
+        read_ahead(d, tile);
+
+    return p;
+}
+
+static void disk_create(struct cache *c, int srows, int scols, int nseg)
+{
+    struct cache_disk *d;
+    int i, k, nthreads;
+
+    d = G_malloc(sizeof(struct cache_disk));
+
+    d->srows = srows;
+    d->scols = scols;
+    d->spr = (c->cols + scols - 1) / scols;
+    d->ntiles = d->spr * ((c->rows + srows - 1) / srows);
+    d->tsize = (size_t)srows * scols * c->n;
+
+    d->tile_slot = G_malloc(d->ntiles * sizeof(int));
+    for (i = 0; i < d->ntiles; i++)
+        d->tile_slot[i] = -1;
+
+    /* shards for concurrent access, at least 4 tiles per shard */
+    nthreads = 1;
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    d->nshards = 1;
+    if (nthreads > 1) {
+        d->nshards = nseg / 4;
+        if (d->nshards > MAX_SHARDS)
+            d->nshards = MAX_SHARDS;
+        if (d->nshards < 1)
+            d->nshards = 1;
+    }
+
+    d->shard = G_malloc(d->nshards * sizeof(struct cache_shard));
+    for (k = 0; k < d->nshards; k++) {
+        struct cache_shard *sh = &d->shard[k];
+
+        sh->nslots = nseg / d->nshards + (k < nseg % d->nshards);
+        sh->slot = G_malloc(sh->nslots * sizeof(struct cache_slot));
+        for (i = 0; i < sh->nslots; i++) {
+            sh->slot[i].tile = -1;
+            sh->slot[i].dirty = 0;
+            sh->slot[i].age = 0;
+            sh->slot[i].buf = G_malloc(d->tsize);
+        }
+        sh->clock = 0;
+        sh->hits = sh->misses = sh->readahead = 0;
+#ifdef _OPENMP
+        omp_init_lock(&sh->lock);
+#endif
+    }
+
+    d->readahead = 2;
+    d->last_miss = -1;
+
+    d->fname = G_tempfile();
+    d->fd = open(d->fname, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600);
+    if (d->fd < 0)
+        G_fatal_error(_("Unable to create temporary file <%s>"), d->fname);
+#ifdef _OPENMP
+    omp_init_lock(&d->io_lock);
+#endif
+
+    c->d = d;
+}
+
+static void disk_destroy(struct cache *c)
+{
+    struct cache_disk *d = c->d;
+    int i, k;
+    size_t hits, misses, readahead;
+
+    cache_get_stats(c, &hits, &misses, &readahead);
+    G_debug(1, "cache: %lu hits, %lu misses, %lu tiles read ahead",
+            (unsigned long)hits, (unsigned long)misses,
+            (unsigned long)readahead);
+
+    for (k = 0; k < d->nshards; k++) {
+        struct cache_shard *sh = &d->shard[k];
+
+        for (i = 0; i < sh->nslots; i++)
+            G_free(sh->slot[i].buf);
+        G_free(sh->slot);
+#ifdef _OPENMP
+        omp_destroy_lock(&sh->lock);
+#endif
+    }
+    G_free(d->shard);
+    G_free(d->tile_slot);
+
+    close(d->fd);
+    unlink(d->fname);
+    G_free(d->fname);
+#ifdef _OPENMP
+    omp_destroy_lock(&d->io_lock);
+#endif
+
+    G_free(d);
+    c->d = NULL;
+}
+
+int cache_create(struct cache *c, int nrows, int ncols, int srows, int scols,
+                 int nbytes, int nseg)
+{
+    int nseg_total;
+
+    c->n = nbytes;
+    c->rows = nrows;
+    c->cols = ncols;
+    c->r = NULL;
+    c->d = NULL;
+
+    nseg_total = ((nrows + srows - 1) / srows) * ((ncols + scols - 1) / scols);
+
+    if (nseg < nseg_total) {
+        G_verbose_message("Using disk cache");
+
+        if (nseg < 1)
+            nseg = 1;
+        disk_create(c, srows, scols, nseg);
+
+        c->get = cache_get_s;
+        c->put = cache_put_s;
+    }
+    else {
+        G_verbose_message("Using memory cache");
+
+        c->r = G_malloc((size_t)c->rows * c->cols * c->n);
+        c->get = cache_get_r;
+        c->put = cache_put_r;
+    }
+
+    return 1;
+}
+
+int cache_destroy(struct cache *c)
+{
+    if (c->r == NULL) {
+        disk_destroy(c);
+    }
+    else {
+        G_free(c->r);
+        c->r = NULL;
+    }
+
+    return 1;
+}
+
+void *cache_get(struct cache *c, void *p, int row, int col)
+{
+    return c->get(c, p, row, col);
+}
+
+void *cache_put(struct cache *c, void *p, int row, int col)
+{
+    return c->put(c, p, row, col);
+}
+
+void cache_set_readahead(struct cache *c, int ntiles)
+{
+    if (c->d)
+        c->d->readahead = ntiles > 0 ? ntiles : 0;
+}
+
+void cache_get_stats(struct cache *c, size_t *hits, size_t *misses,
+                     size_t *readahead)
+{
+    int k;
+
+    *hits = *misses = *readahead = 0;
+
+    if (c->d == NULL)
+        return;
+
+    for (k = 0; k < c->d->nshards; k++) {
+        *hits += c->d->shard[k].hits;
+        *misses += c->d->shard[k].misses;
+        *readahead += c->d->shard[k].readahead;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef GRASS_TILECACHE_H
+#define GRASS_TILECACHE_H
+
+/* grid cache
+ *
+ * all cells are kept in memory if nseg tiles cover the grid, otherwise
+ * tiles are kept in a temporary file and the nseg least recently used
+ * tiles are held in memory.
+ *
+ * cache_get() and cache_put() can be called by several threads at the
+ * same time as long as no two threads access the same cell while one
+ * of them writes it.
+ *
+ * modules using the cache add this directory to EXTRA_INC and link with
+ * -lgrass_tilecache.$(GRASS_LIB_VERSION_NUMBER) */
+
+struct cache_disk;
+
+struct cache {
+    char *r;                 /* memory cache */
+    struct cache_disk *d;    /* disk cache */
+    int n;                   /* data size per cell in bytes */
+    int rows, cols;
+    void *(*get)(struct cache *c, void *p, int row, int col);
+    void *(*put)(struct cache *c, void *p, int row, int col);
+};
+
+int cache_create(struct cache *c, int nrows, int ncols, int srows, int scols,
+                 int nbytes, int nseg);
+int cache_destroy(struct cache *c);
+void *cache_get(struct cache *c, void *p, int row, int col);
+void *cache_put(struct cache *c, void *p, int row, int col);
+
+/* number of tiles to read ahead after consecutive misses along a row of
+ * tiles or along a column of tiles, default 2 */
+void cache_set_readahead(struct cache *c, int ntiles);
+void cache_get_stats(struct cache *c, size_t *hits, size_t *misses,
+                     size_t *readahead);
+
+#endif
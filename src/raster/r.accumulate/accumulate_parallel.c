@@ -0,0 +1,155 @@
+#include <grass/glocale.h>
+#include "global.h"
+
+/* done values while accumulating; cells with no upstream cells start as
+ * READY; cells with n upstream cells start as WAITING + n and are counted down
+ * to WAITING by their upstream cells, so scanning for READY cells never picks
+ * a cell that is being traced down by another thread */
+#define READY   3
+#define WAITING 4
+
+static int nrows, ncols;
+
+static void trace_down(struct cell_map *, struct raster_map *,
+                       struct raster_map *, char **, char, int, int);
+static char is_incomplete(struct cell_map *, int, int);
+
+void accumulate_parallel(struct cell_map *dir_buf,
+                         struct raster_map *weight_buf,
+                         struct raster_map *accum_buf, char **done, char neg,
+                         char zero)
+{
+    int row, col;
+
+    nrows = dir_buf->nrows;
+    ncols = dir_buf->ncols;
+
+    G_message(_("Counting upstream cells..."));
+#pragma omp parallel for schedule(dynamic) private(col)
+    for (row = 0; row < nrows; row++) {
+        for (col = 0; col < ncols; col++) {
+            int i, j, nup = 0;
+
+            if (!dir_buf->c[row][col]) {
+                if (!zero)
+                    set_null(accum_buf, row, col);
+                continue;
+            }
+
+            for (i = -1; i <= 1; i++) {
+                if (row + i < 0 || row + i >= nrows)
+                    continue;
+                for (j = -1; j <= 1; j++) {
+                    if ((i == 0 && j == 0) || col + j < 0 || col + j >= ncols)
+                        continue;
+                    /* same as trace_up() in accumulate_recursive.c */
+                    if (dir_buf->c[row + i][col + j] ==
+                            dir_checks[i + 1][j + 1][0] &&
+                        dir_buf->c[row][col] != dir_checks[i + 1][j + 1][1])
+                        nup++;
+                }
+            }
+            done[row][col] = nup ? WAITING + nup : READY;
+        }
+    }
+
+    G_message(_("Accumulating flows in parallel..."));
+#pragma omp parallel for schedule(dynamic) private(col)
+    for (row = 0; row < nrows; row++)
+        for (col = 0; col < ncols; col++)
+            /* start tracing down from cells with no upstream cells */
+            if (done[row][col] == READY)
+                trace_down(dir_buf, weight_buf, accum_buf, done, neg, row,
+                           col);
+
+    /* cells in flow loops are never reached */
+#pragma omp parallel for schedule(dynamic) private(col)
+    for (row = 0; row < nrows; row++)
+        for (col = 0; col < ncols; col++)
+            if (done[row][col] >= WAITING) {
+                if (zero)
+                    set(accum_buf, row, col, 0);
+                else
+                    set_null(accum_buf, row, col);
+                done[row][col] = 0;
+            }
+}
+
+static void trace_down(struct cell_map *dir_buf, struct raster_map *weight_buf,
+                       struct raster_map *accum_buf, char **done, char neg,
+                       int row, int col)
+{
+    while (1) {
+        int i, j, dir, down_row, down_col, waiting;
+        char incomplete = neg && is_incomplete(dir_buf, row, col);
+        double accum = weight_buf->cells.v ? get(weight_buf, row, col) : 1.0;
+
+        /* all upstream cells are done */
+        for (i = -1; i <= 1; i++) {
+            if (row + i < 0 || row + i >= nrows)
+                continue;
+            for (j = -1; j <= 1; j++) {
+                if ((i == 0 && j == 0) || col + j < 0 || col + j >= ncols)
+                    continue;
+                if (dir_buf->c[row + i][col + j] ==
+                        dir_checks[i + 1][j + 1][0] &&
+                    dir_buf->c[row][col] != dir_checks[i + 1][j + 1][1]) {
+                    double a = get(accum_buf, row + i, col + j);
+
+                    accum += neg && a < 0 ? -a : a;
+                    if (done[row + i][col + j] == 2)
+                        incomplete = neg;
+                }
+            }
+        }
+
+        /* see accumulate_recursive.c for negative accumulation */
+        set(accum_buf, row, col, incomplete ? -accum : accum);
+        done[row][col] = 1 + incomplete;
+
+        /* find the downstream cell */
+        dir = dir_buf->c[row][col];
+        i = dir == NW || dir == N || dir == NE
+                ? -1
+                : (dir == SW || dir == S || dir == SE ? 1 : 0);
+        j = dir == NW || dir == W || dir == SW
+                ? -1
+                : (dir == NE || dir == E || dir == SE ? 1 : 0);
+        down_row = row + i;
+        down_col = col + j;
+
+        /* stop if the downstream cell is outside the computational region,
+         * null, or flows back into the current cell */
+        if ((!i && !j) || down_row < 0 || down_row >= nrows || down_col < 0 ||
+            down_col >= ncols || !dir_buf->c[down_row][down_col] ||
+            dir_buf->c[down_row][down_col] == dir_checks[i + 1][j + 1][0])
+            return;
+
+        /* only the thread that finishes the last upstream cell of the
+         * downstream cell continues */
+#pragma omp flush
+#pragma omp atomic capture
+        waiting = --done[down_row][down_col];
+        if (waiting != WAITING)
+            return;
+#pragma omp flush
+
+        row = down_row;
+        col = down_col;
+    }
+}
+
+static char is_incomplete(struct cell_map *dir_buf, int row, int col)
+{
+    int i, j;
+
+    if (row == 0 || row == nrows - 1 || col == 0 || col == ncols - 1)
+        return 1;
+
+    for (i = -1; i <= 1; i++)
+        for (j = -1; j <= 1; j++)
+            if (!dir_buf->c[row + i][col + j])
+                return 1;
+
+    return 0;
+}
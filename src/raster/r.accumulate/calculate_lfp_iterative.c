@@ -26,6 +26,9 @@ struct headwater_list {
     int nalloc;
 };
 
+/* number of outlets traced concurrently before their paths are written */
+#define OUTLET_BATCH_SIZE 1024
+
 static struct Cell_head window;
 static int nrows, ncols;
 static double diag_length;
@@ -50,9 +53,10 @@ void calculate_lfp_iterative(struct Map_info *Map, struct cell_map *dir_buf,
                              struct raster_map *accum_buf, int *id, char *idcol,
                              struct point_list *outlet_pl)
 {
-    struct line_list ll;
+    struct line_list *lls;
     struct line_cats *Cats;
-    int i, cat;
+    int *outlet_rows, *outlet_cols;
+    int i, batch_start, batch_end, cat;
     dbDriver *driver = NULL;
     struct field_info *Fi = NULL;
     dbString sql;
@@ -69,69 +73,98 @@ void calculate_lfp_iterative(struct Map_info *Map, struct cell_map *dir_buf,
     diag_length = sqrt(pow(window.ew_res, 2.0) + pow(window.ns_res, 2.0));
     cell_area = window.ew_res * window.ns_res;
 
-    init_line_list(&ll);
+    lls = G_malloc(OUTLET_BATCH_SIZE * sizeof *lls);
+    outlet_rows = G_malloc(OUTLET_BATCH_SIZE * sizeof *outlet_rows);
+    outlet_cols = G_malloc(OUTLET_BATCH_SIZE * sizeof *outlet_cols);
 
     Cats = Vect_new_cats_struct();
 
-    /* loop through all outlets and find the longest flow path for each */
+    /* loop through all outlets and find the longest flow path for each;
+     * outlets are traced concurrently in batches because tracing only reads
+     * dir_buf and accum_buf, and their paths are written in order */
     cat = 1;
     G_message(_("Calculating longest flow paths iteratively..."));
-    for (i = 0; i < outlet_pl->n; i++) {
-        int row = (int)Rast_northing_to_row(outlet_pl->y[i], &window);
-        int col = (int)Rast_easting_to_col(outlet_pl->x[i], &window);
-        int j;
+    for (batch_start = 0; batch_start < outlet_pl->n;
+         batch_start += OUTLET_BATCH_SIZE) {
+        batch_end = batch_start + OUTLET_BATCH_SIZE;
+        if (batch_end > outlet_pl->n)
+            batch_end = outlet_pl->n;
+
+        for (i = batch_start; i < batch_end; i++) {
+            int row = (int)Rast_northing_to_row(outlet_pl->y[i], &window);
+            int col = (int)Rast_easting_to_col(outlet_pl->x[i], &window);
+
+            /* if the outlet is outside the computational region, skip */
+            if (row < 0 || row >= nrows || col < 0 || col >= ncols) {
+                G_warning(
+                    _("Skip outlet (%f, %f) outside the current region"),
+                    outlet_pl->x[i], outlet_pl->y[i]);
+                row = -1;
+            }
+            outlet_rows[i - batch_start] = row;
+            outlet_cols[i - batch_start] = col;
+            init_line_list(&lls[i - batch_start]);
+        }
 
-        G_percent(i, outlet_pl->n, 1);
+#pragma omp parallel for schedule(dynamic)
+        for (i = batch_start; i < batch_end; i++)
+            if (outlet_rows[i - batch_start] >= 0)
+                /* trace up flow accumulation */
+                trace_up(dir_buf, accum_buf, outlet_rows[i - batch_start],
+                         outlet_cols[i - batch_start], &lls[i - batch_start]);
 
-        /* if the outlet is outside the computational region, skip */
-        if (row < 0 || row >= nrows || col < 0 || col >= ncols) {
-            G_warning(_("Skip outlet (%f, %f) outside the current region"),
-                      outlet_pl->x[i], outlet_pl->y[i]);
-            continue;
-        }
+        for (i = batch_start; i < batch_end; i++) {
+            struct line_list *ll = &lls[i - batch_start];
+            int j;
 
-        reset_line_list(&ll);
+            G_percent(i, outlet_pl->n, 1);
 
-        /* trace up flow accumulation */
-        trace_up(dir_buf, accum_buf, row, col, &ll);
+            if (outlet_rows[i - batch_start] < 0)
+                continue;
 
-        if (!ll.n) {
-            if (idcol)
-                G_fatal_error(_("Failed to calculate the longest flow path for "
-                                "outlet %s=%d"),
-                              idcol, id[i]);
-            else
-                G_fatal_error(_("Failed to calculate the longest flow path for "
-                                "outlet at (%f, %f)"),
-                              outlet_pl->x[i], outlet_pl->y[i]);
-        }
+            if (!ll->n) {
+                if (idcol)
+                    G_fatal_error(_("Failed to calculate the longest flow "
+                                    "path for outlet %s=%d"),
+                                  idcol, id[i]);
+                else
+                    G_fatal_error(_("Failed to calculate the longest flow "
+                                    "path for outlet at (%f, %f)"),
+                                  outlet_pl->x[i], outlet_pl->y[i]);
+            }
 
-        /* write out longest flow paths */
-        for (j = 0; j < ll.n; j++) {
-            Vect_reset_cats(Cats);
+            /* write out longest flow paths */
+            for (j = 0; j < ll->n; j++) {
+                Vect_reset_cats(Cats);
 
-            Vect_cat_set(Cats, 1, cat);
-            Vect_write_line(Map, GV_LINE, ll.lines[j]->Points, Cats);
+                Vect_cat_set(Cats, 1, cat);
+                Vect_write_line(Map, GV_LINE, ll->lines[j]->Points, Cats);
 
-            if (idcol) {
-                char *buf;
+                if (idcol) {
+                    char *buf;
 
-                G_asprintf(&buf, "insert into %s (%s, %s) values (%d, %d)",
-                           Fi->table, Fi->key, idcol, cat, id[i]);
-                db_set_string(&sql, buf);
+                    G_asprintf(&buf,
+                               "insert into %s (%s, %s) values (%d, %d)",
+                               Fi->table, Fi->key, idcol, cat, id[i]);
+                    db_set_string(&sql, buf);
+
+                    if (db_execute_immediate(driver, &sql) != DB_OK)
+                        G_fatal_error(_("Unable to create table: %s"),
+                                      db_get_string(&sql));
+                    db_free_string(&sql);
+                }
 
-                if (db_execute_immediate(driver, &sql) != DB_OK)
-                    G_fatal_error(_("Unable to create table: %s"),
-                                  db_get_string(&sql));
-                db_free_string(&sql);
+                cat++;
             }
 
-            cat++;
+            free_line_list(ll);
         }
     }
     G_percent(1, 1, 1);
 
-    free_line_list(&ll);
+    G_free(lls);
+    G_free(outlet_rows);
+    G_free(outlet_cols);
 
     Vect_destroy_cats_struct(Cats);
 
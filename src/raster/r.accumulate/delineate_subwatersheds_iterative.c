@@ -16,8 +16,8 @@ struct neighbor_stack {
 static int nrows, ncols;
 
 static void trace_up(struct cell_map *, char **, int, int, int);
-static void find_up(struct cell_map *, char **, int, int, int,
-                    struct neighbor *, int *);
+static void find_up(struct cell_map *, char **, int, int, struct neighbor *,
+                    int *);
 static void init_up_stack(struct neighbor_stack *);
 static void free_up_stack(struct neighbor_stack *);
 static void push_up(struct neighbor_stack *, struct neighbor *);
@@ -29,12 +29,22 @@ void delineate_subwatersheds_iterative(struct cell_map *dir_buf, char **done,
     struct Cell_head window;
     int i, j;
     int subwshed_id;
+    int *outlet_rows, *outlet_cols, *subwshed_ids;
 
     G_get_set_window(&window);
 
     nrows = dir_buf->nrows;
     ncols = dir_buf->ncols;
 
+    outlet_rows = G_malloc(outlet_pl->n * sizeof *outlet_rows);
+    outlet_cols = G_malloc(outlet_pl->n * sizeof *outlet_cols);
+    subwshed_ids = G_malloc(outlet_pl->n * sizeof *subwshed_ids);
+
+    /* while tracing, cells are labeled with -(outlet index + 1), which cannot
+     * be confused with any flow direction, so subwatersheds can be traced
+     * concurrently; each cell flows into only one downstream cell, so once
+     * all outlets are flagged, no two outlets trace up the same cells */
+    subwshed_id = 0;
     G_message(_("Flagging outlets..."));
     for (i = 0; i < outlet_pl->n; i++) {
         int row = (int)Rast_northing_to_row(outlet_pl->y[i], &window);
@@ -46,58 +56,55 @@ void delineate_subwatersheds_iterative(struct cell_map *dir_buf, char **done,
         if (row < 0 || row >= nrows || col < 0 || col >= ncols) {
             G_warning(_("Skip outlet (%f, %f) outside the current region"),
                       outlet_pl->x[i], outlet_pl->y[i]);
+            outlet_rows[i] = -1;
             continue;
         }
 
+        subwshed_id = id ? id[i] : subwshed_id + 1;
+        subwshed_ids[i] = subwshed_id;
+
+        /* if multiple outlets share the same cell, the first one traces up
+         * and the last one labels the outlet cell itself */
+        outlet_rows[i] = done[row][col] ? -1 : row;
+        outlet_cols[i] = col;
+
         done[row][col] = 1;
+        dir_buf->c[row][col] = -(i + 1);
     }
     G_percent(1, 1, 1);
 
     /* loop through all outlets and delineate the subwatershed for each */
-    subwshed_id = 0;
     G_message(_("Delineating subwatersheds iteratively..."));
-    for (i = 0; i < outlet_pl->n; i++) {
-        int row = (int)Rast_northing_to_row(outlet_pl->y[i], &window);
-        int col = (int)Rast_easting_to_col(outlet_pl->x[i], &window);
-
-        G_percent(i, outlet_pl->n, 1);
-
-        /* if the outlet is outside the computational region, skip */
-        if (row < 0 || row >= nrows || col < 0 || col >= ncols) {
-            G_warning(_("Skip outlet (%f, %f) outside the current region"),
-                      outlet_pl->x[i], outlet_pl->y[i]);
-            continue;
-        }
-
-        subwshed_id = id ? id[i] : subwshed_id + 1;
-
-        /* trace up flow directions */
-        trace_up(dir_buf, done, row, col, subwshed_id);
-    }
-    G_percent(1, 1, 1);
+#pragma omp parallel for schedule(dynamic)
+    for (i = 0; i < outlet_pl->n; i++)
+        if (outlet_rows[i] >= 0)
+            /* trace up flow directions */
+            trace_up(dir_buf, done, outlet_rows[i], outlet_cols[i], -(i + 1));
 
     G_message(_("Nullifying cells outside subwatersheds..."));
+#pragma omp parallel for schedule(dynamic) private(j)
     for (i = 0; i < nrows; i++) {
-        G_percent(i, nrows, 1);
         for (j = 0; j < ncols; j++)
             if (!done[i][j])
                 Rast_set_c_null_value(&dir_buf->c[i][j], 1);
+            else
+                dir_buf->c[i][j] = subwshed_ids[-dir_buf->c[i][j] - 1];
     }
-    G_percent(1, 1, 1);
+
+    G_free(outlet_rows);
+    G_free(outlet_cols);
+    G_free(subwshed_ids);
 }
 
 static void trace_up(struct cell_map *dir_buf, char **done, int row, int col,
-                     int id)
+                     int label)
 {
     int nup, i;
     struct neighbor up[8];
     struct neighbor_stack up_stack;
 
-    /* if the current cell is outside the computational region, stop tracing */
-    if (row < 0 || row >= nrows || col < 0 || col >= ncols)
-        return;
-
-    find_up(dir_buf, done, row, col, id, up, &nup);
+    /* the outlet cell is already flagged and labeled */
+    find_up(dir_buf, done, row, col, up, &nup);
 
     /* if no upstream neighbors are found, stop tracing */
     if (!nup)
@@ -113,8 +120,10 @@ static void trace_up(struct cell_map *dir_buf, char **done, int row, int col,
         /* pop one upstream cell */
         struct neighbor cur_up = pop_up(&up_stack);
 
-        /* find its upstream cells */
-        find_up(dir_buf, done, cur_up.row, cur_up.col, id, up, &nup);
+        /* find its upstream cells before labeling it */
+        find_up(dir_buf, done, cur_up.row, cur_up.col, up, &nup);
+        dir_buf->c[cur_up.row][cur_up.col] = label;
+        done[cur_up.row][cur_up.col] = 1;
 
         /* push its upstream cells */
         for (i = nup - 1; i >= 0; i--)
@@ -125,13 +134,10 @@ static void trace_up(struct cell_map *dir_buf, char **done, int row, int col,
 }
 
 static void find_up(struct cell_map *dir_buf, char **done, int row, int col,
-                    int id, struct neighbor *up, int *nup)
+                    struct neighbor *up, int *nup)
 {
     int i, j;
 
-    dir_buf->c[row][col] = id;
-    done[row][col] = 1;
-
     *nup = 0;
     for (i = -1; i <= 1; i++) {
         /* skip edge cells */
@@ -144,8 +150,8 @@ static void find_up(struct cell_map *dir_buf, char **done, int row, int col,
                 continue;
 
             /* if a neighbor cell flows into the current cell, store its row
-             * and col in the up array; no check for flow loop is needed
-             * because dir_buf is being overwritten */
+             * and col in the up array; labeled cells never match a flow
+             * direction and flow loops are stopped by done */
             if (dir_buf->c[row + i][col + j] == dir_checks[i + 1][j + 1][0] &&
                 !done[row + i][col + j]) {
                 up[*nup].row = row + i;
@@ -88,6 +88,10 @@ void add_line(struct line_list *, struct line *);
 void accumulate_iterative(struct cell_map *, struct raster_map *,
                           struct raster_map *, char **, char, char);
 
+/* accumulate_parallel.c */
+void accumulate_parallel(struct cell_map *, struct raster_map *,
+                         struct raster_map *, char **, char, char);
+
 /* accumulate_recursive.c */
 void accumulate_recursive(struct cell_map *, struct raster_map *,
                           struct raster_map *, char **, char, char);
@@ -24,6 +24,9 @@
 #include <grass/vector.h>
 #include <grass/dbmi.h>
 #include <grass/glocale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "global.h"
 
 #define DIR_UNKNOWN 0
@@ -53,6 +56,7 @@ int main(int argc, char *argv[])
         struct Option *outlet_idcol;
         struct Option *idcol;
         struct Option *lfp;
+        struct Option *nprocs;
     } opt;
     struct {
         struct Flag *neg_accum;
@@ -74,6 +78,7 @@ int main(int argc, char *argv[])
     struct cell_map dir_buf;
     struct raster_map accum_buf;
     int nrows, ncols, row, col;
+    int nprocs = 1;
     struct Map_info Map;
     struct point_list outlet_pl;
     int *id;
@@ -201,6 +206,10 @@ int main(int argc, char *argv[])
     opt.lfp->required = NO;
     opt.lfp->description = _("Name for output longest flow path vector map");
 
+#ifdef _OPENMP
+    opt.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+#endif
+
     flag.neg_accum = G_define_flag();
     flag.neg_accum->key = 'n';
     flag.neg_accum->label =
@@ -475,6 +484,20 @@ int main(int argc, char *argv[])
     conf_stream = flag.conf_stream->answer;
     recur = flag.recur->answer;
 
+#ifdef _OPENMP
+    nprocs = atoi(opt.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), opt.nprocs->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#endif
+
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
 
@@ -600,6 +623,9 @@ int main(int argc, char *argv[])
             if (recur)
                 accumulate_recursive(&dir_buf, &weight_buf, &accum_buf, done,
                                      neg_accum, zero_accum);
+            else if (nprocs > 1)
+                accumulate_parallel(&dir_buf, &weight_buf, &accum_buf, done,
+                                    neg_accum, zero_accum);
             else
                 accumulate_iterative(&dir_buf, &weight_buf, &accum_buf, done,
                                      neg_accum, zero_accum);
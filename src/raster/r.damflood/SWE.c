@@ -10,6 +10,9 @@
 #include <grass/dbmi.h>
 #include <grass/linkm.h>
 #include <grass/bitmap.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "SWE.h" /* specifical dependency to the header file */
 
@@ -41,8 +44,9 @@ float velocita_breccia(int i, double h)
 void shallow_water(double **m_h1, double **m_u1, double **m_v1, float **m_z,
                    float **m_DAMBREAK, float **m_m, int **m_lake, double **m_h2,
                    double **m_u2, double **m_v2, int row, int col, int nrows,
-                   int ncols, float timestep, float res_ew, float res_ns,
-                   int method, int num_cell, int num_break, double t)
+                   int ncols, struct wet_box *box, float timestep,
+                   float res_ew, float res_ns, int method, int num_cell,
+                   int num_break, double t)
 {
 
     /*FUNCTION VARIABLES*/
@@ -82,8 +86,13 @@ void shallow_water(double **m_h1, double **m_u1, double **m_v1, float **m_z,
     //                        a tutto il
     // lago
 
-    for (row = 1; row < nrows - 1; row++) {
-        for (col = 1; col < ncols - 1; col++) {
+    // rows are independent except for methods 1 and 2, where the velocities
+    // of the dam breach cells are changed in place
+#pragma omp parallel for schedule(dynamic) if (method == 3) \
+    private(col, h_dx, h_sx, h_up, h_dw, Fdx, Fsx, Gup, Gdw, u_sx, u_dx, \
+            v_up, v_dw, F, G)
+    for (row = box->row1; row <= box->row2; row++) {
+        for (col = box->col1; col <= box->col2; col++) {
             if (m_lake[row][col] == 0 && m_DAMBREAK[row][col] <= 0) {
 
                 //*******************************************/
@@ -390,8 +399,13 @@ void shallow_water(double **m_h1, double **m_u1, double **m_v1, float **m_z,
     // NOTA:
     // u(i,j) e v (i,j) sono le velocita' medie della cella i,j
     /*******************************************************************/
-    for (row = 1; row < nrows - 1; row++) {
-        for (col = 1; col < ncols - 1; col++) {
+#pragma omp parallel for schedule(dynamic) \
+    private(col, h_dx, h_sx, h_up, h_dw, Fdx, Fsx, Gup, Gdw, u_sx, u_dx, \
+            v_dx, v_sx, v_up, v_dw, u_up, u_dw, test, F, G, S, dZ_dx_down, \
+            dZ_dx_up, dZ_dx, dZ_dy_down, dZ_dy_up, dZ_dy, cr_down, cr_up, \
+            Z_piu, Z_meno, u, v, V, R_i)
+    for (row = box->row1; row <= box->row2; row++) {
+        for (col = box->col1; col <= box->col2; col++) {
             if (m_lake[row][col] == 0 && m_h2[row][col] >= hmin) {
 
                 /**********************************************************************************************************************/
@@ -684,6 +698,7 @@ void shallow_water(double **m_h1, double **m_u1, double **m_v1, float **m_z,
 
                 if ((timestep / res_ew *
                      (fabs(m_u2[row][col]) + sqrt(g * m_h2[row][col]))) > 1.0) {
+#pragma omp critical
                     G_warning("At time %f the Courant-Friedrich-Lewy stability "
                               "condition isn't respected",
                               t);
@@ -713,6 +728,7 @@ void shallow_water(double **m_h1, double **m_u1, double **m_v1, float **m_z,
                 }
 
                 if (fabs(m_u2[row][col] >= 1000)) {
+#pragma omp critical
                     G_warning("At the time %f u(%d,%d)=%f", t, row, col,
                               m_u2[row][col]);
                 }
@@ -1001,6 +1017,7 @@ void shallow_water(double **m_h1, double **m_u1, double **m_v1, float **m_z,
                 if ((timestep / res_ns *
                      (abs(abs(m_v2[row][col]) + sqrt(g * m_h2[row][col])))) >
                     1) {
+#pragma omp critical
                     G_warning("At time: %f the Courant-Friedrich-Lewy "
                               "stability condition isn't respected",
                               t);
@@ -1,5 +1,11 @@
 float velocita_breccia(int i, double h);
 
+/* first and last row and column of the cells with water or velocity,
+   cells outside do not change in a time step */
+struct wet_box {
+    int row1, row2, col1, col2;
+};
+
 /*Funzione per risolvere le shallow water equations
 originariamente sviluppata per r.damflood (GRASS command)
 nel caso generico dare una matrice con 2 raster di 0 **m_DAMBREAK & **m_lake
@@ -19,6 +25,7 @@ void shallow_water(
     double **m_h2, double **m_u2,
     double **m_v2, /* water depth and velocities of the i+1 step*/
     int row, int col, int nrows, int ncols, /* matrix size*/
+    struct wet_box *box, /* cells to compute, within 1..nrows-2, 1..ncols-2 */
     float timestep, /* timestep (normally optimized with another function)  */
     float res_ew, float res_ns,  /* grid resolutions*/
     int method,                  /* default = 3, various hypothesis*/
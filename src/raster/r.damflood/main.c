@@ -30,6 +30,9 @@
 #include <grass/dbmi.h>
 #include <grass/linkm.h>
 #include <grass/bitmap.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 /* function here defined */
 #include "SWE.h" /*function that solve the shallow water equations*/
 
@@ -143,6 +146,26 @@ void G_free_vector(double *v)
     return;
 }
 
+/* add the cell row,col to the box */
+static void wet_box_add(struct wet_box *b, int row, int col)
+{
+    b->row1 = min(b->row1, row);
+    b->row2 = max(b->row2, row);
+    b->col1 = min(b->col1, col);
+    b->col2 = max(b->col2, col);
+}
+
+/* cells to compute: the cells of both boxes and their neighbours,
+   without the border of the region */
+static void wet_box_expand(struct wet_box *box, struct wet_box *b1,
+                           struct wet_box *b2, int nrows, int ncols)
+{
+    box->row1 = max(min(b1->row1, b2->row1) - 1, 1);
+    box->row2 = min(max(b1->row2, b2->row2) + 1, nrows - 2);
+    box->col1 = max(min(b1->col1, b2->col1) - 1, 1);
+    box->col2 = min(max(b1->col2, b2->col2) + 1, ncols - 2);
+}
+
 //*********************************************************************************************
 /* main program */
 int main(int argc, char *argv[])
@@ -215,6 +238,11 @@ int main(int argc, char *argv[])
 
     int m = 1, M = 1;
     int i, i_cont;
+    int nprocs, step;
+    /* cells with water or velocity: fixed are the border of the region and
+       the dam breach, wet the others, box the cells to compute */
+    struct wet_box fixed, wet, box;
+    int wet_row1, wet_row2, wet_col1, wet_col2;
     double vel_0 = 0.0, vel_max = 0.0, t;
     /**********************************************************************************/
     // Parameters for the optimization of timestep using the CFL stability
@@ -242,7 +270,8 @@ int main(int argc, char *argv[])
     /* GRASS structure */
     struct GModule *module;
     struct Option *input_ELEV, *input_LAKE, *input_DAMBREAK, *input_MANNING,
-        *input_DELTAT, *input_TSTOP, *input_TIMESTEP, *input_U, *input_V;
+        *input_DELTAT, *input_TSTOP, *input_TIMESTEP, *input_U, *input_V,
+        *input_NPROCS;
     struct {
         struct Option *opt_t;
     } parm;
@@ -434,9 +463,27 @@ int main(int argc, char *argv[])
         _("Name of output wave front time[s] raster map");
     output_WAVEFRONT->guisection = _("Output options");
 
+    input_NPROCS = G_define_standard_option(G_OPT_M_NPROCS);
+
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
+#ifdef _OPENMP
+    nprocs = atoi(input_NPROCS->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), input_NPROCS->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     /***********************************************************************************************************************/
     /* get entered parameters */
     ELEV = input_ELEV->answer;
@@ -880,6 +927,29 @@ int main(int argc, char *argv[])
 
     G_percent(nrows, nrows, 1); /* finish it */
 
+    /* dry cells without velocity stay dry if all their neighbours are dry:
+       only the cells around the wet ones are computed */
+    fixed.row1 = wet.row1 = nrows;
+    fixed.row2 = wet.row2 = -1;
+    fixed.col1 = wet.col1 = ncols;
+    fixed.col2 = wet.col2 = -1;
+    for (row = 0; row < nrows; row++) {
+        for (col = 0; col < ncols; col++) {
+            if (m_DAMBREAK[row][col] > 0)
+                wet_box_add(&fixed, row, col);
+            else if (m_h1[row][col] != 0 || m_u1[row][col] != 0 ||
+                     m_v1[row][col] != 0) {
+                /* the border of the region is never computed */
+                if (row == 0 || row == nrows - 1 || col == 0 ||
+                    col == ncols - 1)
+                    wet_box_add(&fixed, row, col);
+                else
+                    wet_box_add(&wet, row, col);
+            }
+        }
+    }
+    wet_box_expand(&box, &fixed, &wet, nrows, ncols);
+
     G_message("Model running");
 
     /* calculate time step loop */
@@ -900,28 +970,42 @@ int main(int argc, char *argv[])
         // G_message("Function SWE - t=%f, TSTOP=%d",t,TSTOP);
 
         shallow_water(m_h1, m_u1, m_v1, m_z, m_DAMBREAK, m_m, m_lake, m_h2,
-                      m_u2, m_v2, row, col, nrows, ncols, timestep, res_ew,
-                      res_ns, method, num_cell, num_break, t);
+                      m_u2, m_v2, row, col, nrows, ncols, &box, timestep,
+                      res_ew, res_ns, method, num_cell, num_break, t);
 
         //*************************************** overwriting
         //*********************************************
         timestep_ct = 0;
         if (t < TSTOP) {
-            /* open new cicle */
-            for (row = 1; row < nrows - 1; row++) {
-                for (col = 1; col < ncols - 1; col++) {
-                    if ((row == 1 || row == (nrows - 2) || col == 1 ||
-                         col == (ncols - 2)) &&
-                        (m_v2[1][col] > 0 || m_v2[nrows - 2][col] < 0 ||
-                         m_u1[row][1] < 0 || m_u1[row][ncols - 2] > 0)) {
-                        if (reg_lim == 0) {
-                            G_warning("At the time %.3f the computational "
-                                      "region is smaller than inundation",
-                                      t);
-                            reg_lim = 1;
-                        } /* warning  message only a time */
-                    }     /* velocities at the limit of computational region */
+            /* velocities at the limit of computational region, only on the
+               border cells; u1 of column 1 is already overwritten by u2 when
+               the other columns are checked */
+            for (row = 1; row < nrows - 1 && reg_lim == 0; row++) {
+                step = (row == 1 || row == (nrows - 2)) ? 1 : max(ncols - 3, 1);
+                for (col = 1; col < ncols - 1; col += step) {
+                    if (m_v2[1][col] > 0 || m_v2[nrows - 2][col] < 0 ||
+                        (col == 1 ? m_u1[row][1] : m_u2[row][1]) < 0 ||
+                        m_u1[row][ncols - 2] > 0) {
+                        G_warning("At the time %.3f the computational "
+                                  "region is smaller than inundation",
+                                  t);
+                        reg_lim = 1; /* warning  message only a time */
+                        break;
+                    }
+                }
+            }
 
+            /* open new cicle */
+            wet_row1 = nrows;
+            wet_row2 = -1;
+            wet_col1 = ncols;
+            wet_col2 = -1;
+#pragma omp parallel for schedule(dynamic) \
+    private(col, timestep_ct_temp, velocity, i) \
+    reduction(max : timestep_ct, wet_row2, wet_col2) \
+    reduction(min : wet_row1, wet_col1)
+            for (row = box.row1; row <= box.row2; row++) {
+                for (col = box.col1; col <= box.col2; col++) {
                     //********************************************************************
                     // timestep optimization using the CFL stability condition
                     if (m_h2[row][col] >= hmin) {
@@ -1026,8 +1110,21 @@ int main(int argc, char *argv[])
                     }
 
                     m_h1[row][col] = m_h2[row][col];
+
+                    if (m_h1[row][col] != 0 || m_u1[row][col] != 0 ||
+                        m_v1[row][col] != 0) {
+                        wet_row1 = min(wet_row1, row);
+                        wet_row2 = max(wet_row2, row);
+                        wet_col1 = min(wet_col1, col);
+                        wet_col2 = max(wet_col2, col);
+                    }
                 }
             }
+            wet.row1 = wet_row1;
+            wet.row2 = wet_row2;
+            wet.col1 = wet_col1;
+            wet.col2 = wet_col2;
+            wet_box_expand(&box, &fixed, &wet, nrows, ncols);
         }
 
         /*------------------------------   new timestep
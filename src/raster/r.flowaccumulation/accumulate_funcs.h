@@ -159,9 +159,14 @@ void ACCUMULATE(
 
 #pragma omp parallel for schedule(dynamic) private(col)
     for (row = 0; row < nrows; row++) {
+#ifdef USE_WEIGHT
         for (col = 0; col < ncols; col++)
             if (DIR(row, col))
                 UP(row, col) = FIND_UP(row, col);
+#else
+        /* vectorized for a whole row */
+        find_up_row(dir_map, row, &UP(row, 0));
+#endif
     }
 #endif
 
@@ -0,0 +1,529 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "global.h"
+
+#define NO_CELL ((size_t)-1)
+
+/* a cell flowing out of its tile into a cell of another tile */
+struct tile_exit {
+    size_t cell, down;
+    double accum;
+};
+
+/* a cell receiving flow from another tile and the exit cell of its tile it
+ * drains to */
+struct tile_entry {
+    size_t cell, exit;
+};
+
+struct tile_graph {
+    struct tile_exit *exits;
+    struct tile_entry *entries;
+    int nexits, nentries;
+    /* index of the first exit in the array of all exits */
+    size_t offset;
+};
+
+/* per-thread buffers for one tile with its halo */
+struct tile_buffers {
+    unsigned char *dir;
+    void *weight_cells;
+    double *weight, *accum;
+    unsigned char *pending;
+    int *order;
+    size_t *exit;
+    void *accum_cells;
+};
+
+static int nrows, ncols, tile_size, tile_width, ntile_rows, ntile_cols;
+static struct tile_store *dir_store, *weight_store, *accum_store;
+static RASTER_MAP_TYPE weight_type, accum_type;
+static struct tile_graph *graphs;
+static double *totals;
+
+static void alloc_buffers(struct tile_buffers *);
+static void free_buffers(struct tile_buffers *);
+static void load_tile(struct tile_buffers *, int, int);
+static int accumulate_tile(struct tile_buffers *, int, int, int);
+static void collect_graph(struct tile_buffers *, int, int, int);
+static void resolve_graph(void);
+static void store_tile(struct tile_buffers *, int, int, int, int);
+static int find_exit(const struct tile_graph *, size_t);
+static int find_entry(const struct tile_graph *, size_t);
+static struct tile_graph *graph_of(size_t);
+
+static int offsets[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
+                            {0, 1},   {1, -1}, {1, 0},  {1, 1}};
+/* direction pointing from the neighbor at each offset to the center */
+static unsigned char to_center[8] = {SE, S, SW, E, W, NE, N, NW};
+
+#define T(i, j)     ((size_t)(i) * tile_width + (j))
+#define VALID(b, k) ((b)->dir[k] && !isnan((b)->weight[k]))
+
+/* calculates flow accumulation by tiles of tile_size x tile_size cells
+ *
+ * The direction (and weight) tiles have a one-cell halo. First, the flow
+ * accumulation of each tile is calculated in parallel ignoring inflows from
+ * other tiles. Cells flowing across tile boundaries then form a graph
+ * which is small compared to the raster and is resolved sequentially.
+ * Finally, the tiles are accumulated again in parallel with inflows from
+ * the resolved graph and written to accum_tiles. Only the tiles being
+ * processed and the graph are kept in memory. */
+void accumulate_tiled(struct tile_store *dir_tiles,
+                      struct tile_store *weight_tiles,
+                      RASTER_MAP_TYPE weight_map_type,
+                      struct tile_store *accum_tiles,
+                      RASTER_MAP_TYPE accum_map_type, int check_overflow,
+                      int leave_zero)
+{
+    int tile;
+
+    dir_store = dir_tiles;
+    weight_store = weight_tiles;
+    weight_type = weight_map_type;
+    accum_store = accum_tiles;
+    accum_type = accum_map_type;
+    nrows = dir_tiles->nrows;
+    ncols = dir_tiles->ncols;
+    tile_size = dir_tiles->tile_size;
+    tile_width = dir_tiles->tile_width;
+    ntile_rows = dir_tiles->ntile_rows;
+    ntile_cols = dir_tiles->ntile_cols;
+
+    graphs = G_calloc((size_t)ntile_rows * ntile_cols, sizeof *graphs);
+
+    G_message(_("Accumulating flows within tiles..."));
+#pragma omp parallel
+    {
+        struct tile_buffers buffers;
+
+        alloc_buffers(&buffers);
+#pragma omp for schedule(dynamic)
+        for (tile = 0; tile < ntile_rows * ntile_cols; tile++) {
+            int tile_row = tile / ntile_cols, tile_col = tile % ntile_cols;
+            int norder;
+
+            load_tile(&buffers, tile_row, tile_col);
+            norder = accumulate_tile(&buffers, tile_row, tile_col, 0);
+            collect_graph(&buffers, tile_row, tile_col, norder);
+        }
+        free_buffers(&buffers);
+    }
+
+    G_message(_("Resolving flows between tiles..."));
+    resolve_graph();
+
+    G_message(_("Accumulating inflows from other tiles..."));
+#pragma omp parallel
+    {
+        struct tile_buffers buffers;
+
+        alloc_buffers(&buffers);
+#pragma omp for schedule(dynamic)
+        for (tile = 0; tile < ntile_rows * ntile_cols; tile++) {
+            int tile_row = tile / ntile_cols, tile_col = tile % ntile_cols;
+
+            load_tile(&buffers, tile_row, tile_col);
+            accumulate_tile(&buffers, tile_row, tile_col, 1);
+            store_tile(&buffers, tile_row, tile_col, check_overflow,
+                       leave_zero);
+        }
+        free_buffers(&buffers);
+    }
+
+    for (tile = 0; tile < ntile_rows * ntile_cols; tile++) {
+        G_free(graphs[tile].exits);
+        G_free(graphs[tile].entries);
+    }
+    G_free(graphs);
+    G_free(totals);
+}
+
+static void alloc_buffers(struct tile_buffers *b)
+{
+    size_t n = (size_t)tile_width * tile_width;
+
+    b->dir = G_malloc(n);
+    b->weight_cells = weight_store ? G_malloc(weight_store->tile_bytes) : NULL;
+    b->weight = G_malloc(n * sizeof *b->weight);
+    b->accum = G_malloc(n * sizeof *b->accum);
+    b->pending = G_malloc(n);
+    b->order = G_malloc((size_t)tile_size * tile_size * sizeof *b->order);
+    b->exit = G_malloc(n * sizeof *b->exit);
+    b->accum_cells = G_malloc(accum_store->tile_bytes);
+}
+
+static void free_buffers(struct tile_buffers *b)
+{
+    G_free(b->dir);
+    if (b->weight_cells)
+        G_free(b->weight_cells);
+    G_free(b->weight);
+    G_free(b->accum);
+    G_free(b->pending);
+    G_free(b->order);
+    G_free(b->exit);
+    G_free(b->accum_cells);
+}
+
+/* reads directions and weights (NaN for null) of a tile with its halo */
+static void load_tile(struct tile_buffers *b, int tile_row, int tile_col)
+{
+    size_t n = (size_t)tile_width * tile_width, k;
+
+    read_tile(dir_store, tile_row, tile_col, b->dir);
+    if (!weight_store) {
+        for (k = 0; k < n; k++)
+            b->weight[k] = 1;
+        return;
+    }
+
+    read_tile(weight_store, tile_row, tile_col, b->weight_cells);
+    for (k = 0; k < n; k++) {
+        switch (weight_type) {
+        case CELL_TYPE: {
+            CELL *c = (CELL *)b->weight_cells + k;
+
+            b->weight[k] = Rast_is_c_null_value(c) ? NAN : *c;
+            break;
+        }
+        case FCELL_TYPE: {
+            FCELL *f = (FCELL *)b->weight_cells + k;
+
+            b->weight[k] = Rast_is_f_null_value(f) ? NAN : *f;
+            break;
+        }
+        default: {
+            DCELL *d = (DCELL *)b->weight_cells + k;
+
+            b->weight[k] = Rast_is_d_null_value(d) ? NAN : *d;
+            break;
+        }
+        }
+    }
+}
+
+/* returns the tile index of the downstream cell of a tile cell */
+static size_t down_of(const struct tile_buffers *b, size_t k)
+{
+    switch (b->dir[k]) {
+    case NW:
+        return k - tile_width - 1;
+    case N:
+        return k - tile_width;
+    case NE:
+        return k - tile_width + 1;
+    case W:
+        return k - 1;
+    case E:
+        return k + 1;
+    case SW:
+        return k + tile_width - 1;
+    case S:
+        return k + tile_width;
+    default:
+        return k + tile_width + 1;
+    }
+}
+
+static int is_interior(size_t k)
+{
+    int i = k / tile_width, j = k % tile_width;
+
+    return i > 0 && i <= tile_size && j > 0 && j <= tile_size;
+}
+
+static size_t global_cell(int tile_row, int tile_col, size_t k)
+{
+    int row = tile_row * tile_size + k / tile_width - 1;
+    int col = tile_col * tile_size + k % tile_width - 1;
+
+    return INDEX(row, col);
+}
+
+/* calculates flow accumulation within a tile in topological order (cells
+ * which are not reached because of loops are left as NaN); with inflows,
+ * halo cells flowing into the tile add their resolved accumulation; returns
+ * the number of cells in b->order */
+static int accumulate_tile(struct tile_buffers *b, int tile_row,
+                           int tile_col, int inflows)
+{
+    int i, j, n, head = 0, tail = 0;
+    size_t k;
+
+    for (i = 1; i <= tile_size; i++) {
+        for (j = 1; j <= tile_size; j++) {
+            k = T(i, j);
+            b->pending[k] = 0;
+            b->accum[k] = NAN;
+            if (!VALID(b, k))
+                continue;
+            b->accum[k] = b->weight[k];
+            for (n = 0; n < 8; n++) {
+                size_t u = T(i + offsets[n][0], j + offsets[n][1]);
+
+                if (b->dir[u] != to_center[n] || !VALID(b, u))
+                    continue;
+                if (is_interior(u))
+                    b->pending[k]++;
+                else if (inflows) {
+                    size_t cell = global_cell(tile_row, tile_col, u);
+                    const struct tile_graph *g = graph_of(cell);
+
+                    b->accum[k] += totals[g->offset + find_exit(g, cell)];
+                }
+            }
+            if (!b->pending[k])
+                b->order[tail++] = k;
+        }
+    }
+
+    /* the queue of ready cells becomes the topological order */
+    while (head < tail) {
+        size_t d;
+
+        k = b->order[head++];
+        d = down_of(b, k);
+        if (!is_interior(d) || !VALID(b, d))
+            continue;
+        b->accum[d] += b->accum[k];
+        if (!--b->pending[d])
+            b->order[tail++] = d;
+    }
+
+    /* cells in loops were never ready */
+    for (i = 1; i <= tile_size; i++)
+        for (j = 1; j <= tile_size; j++)
+            if (b->pending[T(i, j)])
+                b->accum[T(i, j)] = NAN;
+
+    return tail;
+}
+
+/* records cells flowing out of and into the tile */
+static void collect_graph(struct tile_buffers *b, int tile_row, int tile_col,
+                          int norder)
+{
+    struct tile_graph *g = &graphs[(size_t)tile_row * ntile_cols + tile_col];
+    size_t max_cells = (size_t)tile_size * 4, k;
+    int i, j, n;
+
+    for (i = 1; i <= tile_size; i++)
+        for (j = 1; j <= tile_size; j++)
+            b->exit[T(i, j)] = NO_CELL;
+
+    /* downstream cells come later in the topological order */
+    for (n = norder - 1; n >= 0; n--) {
+        size_t d;
+
+        k = b->order[n];
+        d = down_of(b, k);
+        if (!VALID(b, d))
+            continue;
+        b->exit[k] = is_interior(d) ? b->exit[d]
+                                    : global_cell(tile_row, tile_col, k);
+    }
+
+    g->exits = G_malloc(max_cells * sizeof *g->exits);
+    g->entries = G_malloc(max_cells * sizeof *g->entries);
+    g->nexits = g->nentries = 0;
+
+    /* only boundary cells are visited in row-major order, which keeps both
+     * arrays sorted by cell */
+    for (i = 1; i <= tile_size; i++) {
+        for (j = 1; j <= tile_size; j++) {
+            int entry = 0;
+            size_t d;
+
+            if (i > 1 && i < tile_size && j > 1 && j < tile_size)
+                continue;
+            k = T(i, j);
+            if (!VALID(b, k))
+                continue;
+
+            d = down_of(b, k);
+            if (!is_interior(d) && VALID(b, d)) {
+                struct tile_exit *e = &g->exits[g->nexits++];
+
+                e->cell = global_cell(tile_row, tile_col, k);
+                e->down = global_cell(tile_row, tile_col, d);
+                e->accum = b->accum[k];
+            }
+
+            for (n = 0; n < 8 && !entry; n++) {
+                size_t u = T(i + offsets[n][0], j + offsets[n][1]);
+
+                entry = !is_interior(u) && b->dir[u] == to_center[n] &&
+                        VALID(b, u);
+            }
+            if (entry) {
+                struct tile_entry *e = &g->entries[g->nentries++];
+
+                e->cell = global_cell(tile_row, tile_col, k);
+                e->exit = b->exit[k];
+            }
+        }
+    }
+}
+
+/* calculates total accumulation of all exit cells in topological order of
+ * the graph (exits in loops across tiles are left as NaN) */
+static void resolve_graph(void)
+{
+    int ntiles = ntile_rows * ntile_cols, tile, n;
+    size_t nexits = 0, e, head = 0, tail = 0;
+    size_t *down, *queue;
+    int *indegree;
+
+    for (tile = 0; tile < ntiles; tile++) {
+        graphs[tile].offset = nexits;
+        nexits += graphs[tile].nexits;
+    }
+
+    totals = G_malloc((nexits ? nexits : 1) * sizeof *totals);
+    down = G_malloc((nexits ? nexits : 1) * sizeof *down);
+    indegree = G_calloc(nexits ? nexits : 1, sizeof *indegree);
+    queue = G_malloc((nexits ? nexits : 1) * sizeof *queue);
+
+    /* link each exit to the exit its downstream cell drains to */
+    for (tile = 0; tile < ntiles; tile++) {
+        struct tile_graph *g = &graphs[tile];
+
+        for (n = 0; n < g->nexits; n++) {
+            struct tile_graph *dg = graph_of(g->exits[n].down);
+            int entry = find_entry(dg, g->exits[n].down);
+            size_t exit = dg->entries[entry].exit;
+
+            e = g->offset + n;
+            totals[e] = g->exits[n].accum;
+            down[e] = exit == NO_CELL
+                          ? NO_CELL
+                          : dg->offset + find_exit(dg, exit);
+            if (down[e] != NO_CELL)
+                indegree[down[e]]++;
+        }
+    }
+
+    for (e = 0; e < nexits; e++)
+        if (!indegree[e])
+            queue[tail++] = e;
+
+    while (head < tail) {
+        e = queue[head++];
+        if (down[e] == NO_CELL)
+            continue;
+        totals[down[e]] += totals[e];
+        if (!--indegree[down[e]])
+            queue[tail++] = down[e];
+    }
+
+    for (e = 0; e < nexits; e++)
+        if (indegree[e])
+            totals[e] = NAN;
+
+    G_free(down);
+    G_free(indegree);
+    G_free(queue);
+}
+
+/* converts accumulation to the output type and writes the tile */
+static void store_tile(struct tile_buffers *b, int tile_row, int tile_col,
+                       int check_overflow, int leave_zero)
+{
+    int i, j;
+
+    for (i = 0; i < tile_size; i++) {
+        for (j = 0; j < tile_size; j++) {
+            double accum = b->accum[T(i + 1, j + 1)];
+            size_t k = (size_t)i * tile_size + j;
+            int is_null = isnan(accum);
+
+            if (is_null && leave_zero) {
+                accum = 0;
+                is_null = 0;
+            }
+            if (check_overflow && !is_null &&
+                (accum_type == CELL_TYPE ? accum > INT_MAX
+                                         : (accum_type == FCELL_TYPE
+                                                ? isinf((FCELL)accum)
+                                                : isinf(accum))))
+                G_fatal_error(
+                    accum_type == CELL_TYPE
+                        ? _("Flow accumulation is too large. Try FCELL or "
+                            "DCELL type.")
+                        : (accum_type == FCELL_TYPE
+                               ? _("Flow accumulation is too large. Try "
+                                   "DCELL type.")
+                               : _("Flow accumulation is too large.")));
+            switch (accum_type) {
+            case CELL_TYPE:
+                if (is_null)
+                    Rast_set_c_null_value((CELL *)b->accum_cells + k, 1);
+                else
+                    ((CELL *)b->accum_cells)[k] = (CELL)accum;
+                break;
+            case FCELL_TYPE:
+                if (is_null)
+                    Rast_set_f_null_value((FCELL *)b->accum_cells + k, 1);
+                else
+                    ((FCELL *)b->accum_cells)[k] = accum;
+                break;
+            default:
+                if (is_null)
+                    Rast_set_d_null_value((DCELL *)b->accum_cells + k, 1);
+                else
+                    ((DCELL *)b->accum_cells)[k] = accum;
+                break;
+            }
+        }
+    }
+
+    write_tile(accum_store, tile_row, tile_col, b->accum_cells);
+}
+
+static struct tile_graph *graph_of(size_t cell)
+{
+    int row = cell / ncols, col = cell % ncols;
+
+    return &graphs[(size_t)(row / tile_size) * ntile_cols + col / tile_size];
+}
+
+static int find_exit(const struct tile_graph *g, size_t cell)
+{
+    int lo = 0, hi = g->nexits - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+
+        if (g->exits[mid].cell == cell)
+            return mid;
+        if (g->exits[mid].cell < cell)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    G_fatal_error(_("Inconsistent flows between tiles"));
+    return -1;
+}
+
+static int find_entry(const struct tile_graph *g, size_t cell)
+{
+    int lo = 0, hi = g->nentries - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+
+        if (g->entries[mid].cell == cell)
+            return mid;
+        if (g->entries[mid].cell < cell)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    G_fatal_error(_("Inconsistent flows between tiles"));
+    return -1;
+}
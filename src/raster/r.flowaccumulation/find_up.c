@@ -0,0 +1,171 @@
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+#include "global.h"
+
+typedef int find_up_func(const unsigned char *, const unsigned char *,
+                         const unsigned char *, int, int, unsigned char *);
+
+static void find_up_cells(const unsigned char *, const unsigned char *,
+                          const unsigned char *, int, int, int,
+                          unsigned char *);
+static int find_up_scalar(const unsigned char *, const unsigned char *,
+                          const unsigned char *, int, int, unsigned char *);
+#ifdef HAVE_X86_SIMD
+static int find_up_sse2(const unsigned char *, const unsigned char *,
+                        const unsigned char *, int, int, unsigned char *);
+static int find_up_avx2(const unsigned char *, const unsigned char *,
+                        const unsigned char *, int, int, unsigned char *);
+#endif
+
+static find_up_func *find_up_simd = find_up_scalar;
+
+/* selects the fastest kernel supported by the CPU; call before any threads
+ * use find_up_row() */
+const char *init_find_up(void)
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find_up_simd = find_up_avx2;
+        return "AVX2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        find_up_simd = find_up_sse2;
+        return "SSE2";
+    }
+#endif
+    find_up_simd = find_up_scalar;
+    return NULL;
+}
+
+/* finds upstream cells of all cells in a row; up is set to a bit mask of
+ * neighbor directions flowing into each cell (0 for null cells) just like
+ * FIND_UP() without weights */
+void find_up_row(struct raster_map *dir_map, int row, unsigned char *up)
+{
+    int nrows = dir_map->nrows, ncols = dir_map->ncols, col;
+    const unsigned char *dir = dir_map->cells.uint8 + (size_t)row * ncols;
+    const unsigned char *above = row > 0 ? dir - ncols : NULL;
+    const unsigned char *below = row < nrows - 1 ? dir + ncols : NULL;
+
+    if (!above || !below || ncols < 3) {
+        find_up_cells(above, dir, below, ncols, 0, ncols, up);
+        return;
+    }
+
+    /* vector kernels process interior columns and return where they stopped;
+     * edge columns and the remainder are handled one cell at a time */
+    col = find_up_simd(above, dir, below, ncols, 1, up);
+    find_up_cells(above, dir, below, ncols, 0, 1, up);
+    find_up_cells(above, dir, below, ncols, col, ncols, up);
+}
+
+static void find_up_cells(const unsigned char *above, const unsigned char *dir,
+                          const unsigned char *below, int ncols, int start,
+                          int end, unsigned char *up)
+{
+    int col;
+
+    for (col = start; col < end; col++) {
+        unsigned char mask = 0;
+
+        if (!dir[col]) {
+            up[col] = 0;
+            continue;
+        }
+        if (above) {
+            if (col > 0 && above[col - 1] == SE)
+                mask |= NW;
+            if (above[col] == S)
+                mask |= N;
+            if (col < ncols - 1 && above[col + 1] == SW)
+                mask |= NE;
+        }
+        if (col > 0 && dir[col - 1] == E)
+            mask |= W;
+        if (col < ncols - 1 && dir[col + 1] == W)
+            mask |= E;
+        if (below) {
+            if (col > 0 && below[col - 1] == NE)
+                mask |= SW;
+            if (below[col] == N)
+                mask |= S;
+            if (col < ncols - 1 && below[col + 1] == NW)
+                mask |= SE;
+        }
+        up[col] = mask;
+    }
+}
+
+/* interior columns only; returns the first column not processed */
+static int find_up_scalar(const unsigned char *above, const unsigned char *dir,
+                          const unsigned char *below, int ncols, int start,
+                          unsigned char *up)
+{
+    find_up_cells(above, dir, below, ncols, start, ncols - 1, up);
+
+    return ncols - 1;
+}
+
+#ifdef HAVE_X86_SIMD
+/* each neighbor is compared with the direction pointing to the center cell
+ * for 16 (SSE2) or 32 (AVX2) cells at once and matching neighbors set their
+ * bits in the mask */
+#define FIND_UP_SIMD(vec, bytes, load, store, set1, cmpeq, and, or, zero,     \
+                     andnot)                                                  \
+    int col;                                                                  \
+                                                                              \
+    for (col = start; col + bytes < ncols; col += bytes) {                    \
+        vec mask = zero();                                                    \
+                                                                              \
+        mask = or(mask, and(cmpeq(load((const vec *)(above + col - 1)),       \
+                                  set1(SE)),                                  \
+                            set1(NW)));                                       \
+        mask = or(mask, and(cmpeq(load((const vec *)(above + col)), set1(S)), \
+                            set1(N)));                                        \
+        mask = or(mask, and(cmpeq(load((const vec *)(above + col + 1)),       \
+                                  set1(SW)),                                  \
+                            set1(NE)));                                       \
+        mask = or(mask,                                                       \
+                  and(cmpeq(load((const vec *)(dir + col - 1)), set1(E)),     \
+                      set1(W)));                                              \
+        mask = or(mask,                                                       \
+                  and(cmpeq(load((const vec *)(dir + col + 1)), set1(W)),     \
+                      set1(E)));                                              \
+        mask = or(mask, and(cmpeq(load((const vec *)(below + col - 1)),       \
+                                  set1(NE)),                                  \
+                            set1(SW)));                                       \
+        mask = or(mask, and(cmpeq(load((const vec *)(below + col)), set1(N)), \
+                            set1(S)));                                        \
+        mask = or(mask, and(cmpeq(load((const vec *)(below + col + 1)),       \
+                                  set1(NW)),                                  \
+                            set1(SE)));                                       \
+        /* null cells have no upstream cells */                               \
+        mask = andnot(cmpeq(load((const vec *)(dir + col)), zero()), mask);   \
+        store((vec *)(up + col), mask);                                       \
+    }                                                                         \
+                                                                              \
+    return col
+
+__attribute__((target("sse2"))) static int
+find_up_sse2(const unsigned char *above, const unsigned char *dir,
+             const unsigned char *below, int ncols, int start,
+             unsigned char *up)
+{
+    FIND_UP_SIMD(__m128i, 16, _mm_loadu_si128, _mm_storeu_si128,
+                 _mm_set1_epi8, _mm_cmpeq_epi8, _mm_and_si128,
+                 _mm_or_si128, _mm_setzero_si128, _mm_andnot_si128);
+}
+
+__attribute__((target("avx2"))) static int
+find_up_avx2(const unsigned char *above, const unsigned char *dir,
+             const unsigned char *below, int ncols, int start,
+             unsigned char *up)
+{
+    FIND_UP_SIMD(__m256i, 32, _mm256_loadu_si256, _mm256_storeu_si256,
+                 _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_and_si256,
+                 _mm256_or_si256, _mm256_setzero_si256, _mm256_andnot_si256);
+}
+#endif
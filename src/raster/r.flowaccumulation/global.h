@@ -8,6 +8,7 @@ int gettimeofday(struct timeval *, struct timezone *);
 #else
 #include <sys/time.h>
 #endif
+#include <stdio.h>
 #include <grass/raster.h>
 
 #define E               1
@@ -35,6 +36,15 @@ struct raster_map {
     } cells;
 };
 
+struct tile_store {
+    int nrows, ncols, tile_size, halo;
+    int ntile_rows, ntile_cols, tile_width, band_width, band_row;
+    size_t cell_size, tile_bytes;
+    char *band;
+    void *null_cell;
+    FILE *fp;
+};
+
 /* timeval_diff.c */
 long long timeval_diff(struct timeval *, struct timeval *, struct timeval *);
 
@@ -43,6 +53,23 @@ void accumulate(struct raster_map *, struct raster_map *, struct raster_map *,
                 int, int, int);
 void nullify_zero(struct raster_map *);
 
+/* find_up.c */
+const char *init_find_up(void);
+void find_up_row(struct raster_map *, int, unsigned char *);
+
+/* tile_store.c */
+struct tile_store *create_tile_store(int, int, int, size_t, int, const void *);
+void free_tile_store(struct tile_store *);
+void put_tile_store_row(struct tile_store *, int, const void *);
+void *get_tile_store_row(struct tile_store *, int);
+void read_tile(struct tile_store *, int, int, void *);
+void write_tile(struct tile_store *, int, int, const void *);
+
+/* accumulate_tiled.c */
+void accumulate_tiled(struct tile_store *, struct tile_store *,
+                      RASTER_MAP_TYPE, struct tile_store *, RASTER_MAP_TYPE,
+                      int, int);
+
 /* accumulate_c.c */
 void accumulate_c(struct raster_map *, struct raster_map *);
 void nullify_zero_c(struct raster_map *);
@@ -46,6 +46,7 @@ int main(int argc, char *argv[])
         struct Option *accum;
         struct Option *type;
         struct Option *nprocs;
+        struct Option *tile_size;
     } opt;
     struct {
         struct Flag *check_overflow;
@@ -59,12 +60,14 @@ int main(int argc, char *argv[])
 #ifdef _OPENMP
     int nprocs;
 #endif
-    int check_overflow, use_less_memory, use_zero, null_weight;
+    int check_overflow, use_less_memory, use_zero, null_weight, tile_size;
     int dir_fd, accum_fd;
     unsigned char dir_format;
     struct Range dir_range;
     CELL dir_min, dir_max, *dir_buf;
+    unsigned char *dir_row;
     struct raster_map *dir_map, *weight_map = NULL, *accum_map;
+    struct tile_store *dir_store = NULL, *weight_store = NULL, *accum_store;
     int nrows, ncols, row, col;
     struct History hist;
     struct timeval first_time, start_time, end_time;
@@ -111,6 +114,15 @@ int main(int argc, char *argv[])
     opt.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
 #endif
 
+    opt.tile_size = G_define_option();
+    opt.tile_size->type = TYPE_INTEGER;
+    opt.tile_size->key = "tile_size";
+    opt.tile_size->label =
+        _("Size of square tiles for out-of-core computation (in cells)");
+    opt.tile_size->description =
+        _("Only tiles being processed are kept in memory");
+    opt.tile_size->options = "2-";
+
     flag.check_overflow = G_define_flag();
     flag.check_overflow->key = 'o';
     flag.check_overflow->label = _("Check overflow and exit if it occurs");
@@ -135,6 +147,8 @@ int main(int argc, char *argv[])
     G_option_excludes(opt.weight, flag.check_overflow, flag.use_zero,
                       flag.leave_zero, NULL);
     G_option_exclusive(flag.use_zero, flag.leave_zero, NULL);
+    G_option_excludes(opt.tile_size, flag.use_less_memory, flag.use_zero,
+                      NULL);
 
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
@@ -163,6 +177,16 @@ int main(int argc, char *argv[])
     use_less_memory = flag.use_less_memory->answer;
     use_zero = flag.use_zero->answer ? 1 : 2 * flag.leave_zero->answer;
     null_weight = flag.null_weight->answer;
+    tile_size = opt.tile_size->answer ? atoi(opt.tile_size->answer) : 0;
+
+    if (!use_less_memory && !tile_size) {
+        const char *simd = init_find_up();
+
+        if (simd)
+            G_verbose_message(_("Using %s instructions for finding upstream "
+                                "cells"),
+                              simd);
+    }
 
     /* read direction raster */
     G_message(_("Reading flow direction raster <%s>..."), dir_name);
@@ -227,32 +251,49 @@ int main(int argc, char *argv[])
     dir_map = G_malloc(sizeof *dir_map);
     dir_map->nrows = nrows;
     dir_map->ncols = ncols;
-    dir_map->cells.v = G_calloc((size_t)nrows * ncols, 1);
+    if (tile_size) {
+        unsigned char null_dir = 0;
+
+        /* directions are converted one row at a time and stored in tiles */
+        dir_map->cells.v = NULL;
+        dir_row = G_malloc(ncols);
+        dir_store = create_tile_store(nrows, ncols, tile_size, 1, 1, &null_dir);
+    }
+    else
+        dir_map->cells.v = G_calloc((size_t)nrows * ncols, 1);
     dir_buf = G_malloc(sizeof(CELL) * ncols);
 
     for (row = 0; row < nrows; row++) {
         G_percent(row, nrows, 1);
         Rast_get_c_row(dir_fd, dir_buf, row);
+        if (tile_size)
+            memset(dir_row, 0, ncols);
+        else
+            dir_row = &DIR(row, 0);
         switch (dir_format) {
         case DIR_DEG:
             for (col = 0; col < ncols; col++)
                 if (!Rast_is_c_null_value(&dir_buf[col]))
-                    DIR(row, col) = pow(2, abs(dir_buf[col] / 45.));
+                    dir_row[col] = pow(2, abs(dir_buf[col] / 45.));
             break;
         case DIR_DEG45:
             for (col = 0; col < ncols; col++)
                 if (!Rast_is_c_null_value(&dir_buf[col]))
-                    DIR(row, col) = pow(2, 8 - abs(dir_buf[col]));
+                    dir_row[col] = pow(2, 8 - abs(dir_buf[col]));
             break;
         default:
             for (col = 0; col < ncols; col++)
                 if (!Rast_is_c_null_value(&dir_buf[col]))
-                    DIR(row, col) = abs(dir_buf[col]);
+                    dir_row[col] = abs(dir_buf[col]);
             break;
         }
+        if (tile_size)
+            put_tile_store_row(dir_store, row, dir_row);
     }
     G_percent(1, 1, 1);
     G_free(dir_buf);
+    if (tile_size)
+        G_free(dir_row);
     Rast_close(dir_fd);
 
     gettimeofday(&end_time, NULL);
@@ -273,20 +314,50 @@ int main(int argc, char *argv[])
         weight_map->ncols = ncols;
         weight_map->type = Rast_get_map_type(weight_fd);
         weight_map->cell_size = Rast_cell_size(weight_map->type);
-        weight_map->cells.v =
-            G_calloc((size_t)nrows * ncols, weight_map->cell_size);
-
-        for (row = 0; row < nrows; row++) {
-            G_percent(row, nrows, 1);
-            Rast_get_row(weight_fd,
-                         (char *)weight_map->cells.v +
-                             weight_map->cell_size * ncols * row,
-                         row, weight_map->type);
+
+        if (tile_size) {
+            /* weights are read one row at a time and stored in tiles */
+            void *null_cell = Rast_allocate_buf(weight_map->type);
+            void *weight_row = Rast_allocate_buf(weight_map->type);
+
+            Rast_set_null_value(null_cell, 1, weight_map->type);
+            weight_map->cells.v = NULL;
+            weight_store =
+                create_tile_store(nrows, ncols, tile_size,
+                                  weight_map->cell_size, 1, null_cell);
+
+            for (row = 0; row < nrows; row++) {
+                G_percent(row, nrows, 1);
+                Rast_get_row(weight_fd, weight_row, row, weight_map->type);
+                if (null_weight)
+                    for (col = 0; col < ncols; col++) {
+                        void *cell = (char *)weight_row +
+                                     weight_map->cell_size * col;
+
+                        if (Rast_is_null_value(cell, weight_map->type))
+                            Rast_set_c_value(cell, 0, weight_map->type);
+                    }
+                put_tile_store_row(weight_store, row, weight_row);
+            }
+            G_free(null_cell);
+            G_free(weight_row);
+        }
+        else {
+            weight_map->cells.v =
+                G_calloc((size_t)nrows * ncols, weight_map->cell_size);
+
+            for (row = 0; row < nrows; row++) {
+                G_percent(row, nrows, 1);
+                Rast_get_row(weight_fd,
+                             (char *)weight_map->cells.v +
+                                 weight_map->cell_size * ncols * row,
+                             row, weight_map->type);
+            }
         }
         G_percent(1, 1, 1);
         Rast_close(weight_fd);
 
-        if (null_weight) {
+        if (null_weight && !tile_size) {
 #pragma omp parallel for schedule(dynamic) private(col)
             for (row = 0; row < nrows; row++)
                 for (col = 0; col < ncols; col++)
@@ -340,20 +411,42 @@ int main(int argc, char *argv[])
 
     accum_map->cell_size = Rast_cell_size(accum_map->type);
 
-    if (use_zero)
+    if (tile_size) {
+        void *null_cell = Rast_allocate_buf(accum_map->type);
+
+        /* output tiles are written once, so they need no halo */
+        Rast_set_null_value(null_cell, 1, accum_map->type);
+        accum_store = create_tile_store(nrows, ncols, tile_size,
+                                        accum_map->cell_size, 0, null_cell);
+        G_free(null_cell);
+
+        accumulate_tiled(dir_store, weight_store,
+                         weight_map ? weight_map->type : CELL_TYPE,
+                         accum_store, accum_map->type, check_overflow,
+                         use_zero == 2);
+
+        free_tile_store(dir_store);
+        if (weight_store)
+            free_tile_store(weight_store);
+        accum_map->cells.v = NULL;
+    }
+    else if (use_zero)
         accum_map->cells.v =
             G_calloc((size_t)nrows * ncols, accum_map->cell_size);
     else
         accum_map->cells.v = G_malloc(accum_map->cell_size * nrows * ncols);
 
-    accumulate(dir_map, weight_map, accum_map, check_overflow, use_less_memory,
-               use_zero);
+    if (!tile_size)
+        accumulate(dir_map, weight_map, accum_map, check_overflow,
+                   use_less_memory, use_zero);
 
-    G_free(dir_map->cells.v);
+    if (dir_map->cells.v)
+        G_free(dir_map->cells.v);
     G_free(dir_map);
 
     if (weight_map) {
-        G_free(weight_map->cells.v);
+        if (weight_map->cells.v)
+            G_free(weight_map->cells.v);
         G_free(weight_map);
     }
 
@@ -372,14 +465,18 @@ int main(int argc, char *argv[])
     for (row = 0; row < nrows; row++) {
         G_percent(row, nrows, 1);
         Rast_put_row(accum_fd,
-                     (char *)accum_map->cells.v +
-                         accum_map->cell_size * ncols * row,
+                     tile_size ? get_tile_store_row(accum_store, row)
+                               : (char *)accum_map->cells.v +
+                                     accum_map->cell_size * ncols * row,
                      accum_map->type);
     }
     G_percent(1, 1, 1);
     Rast_close(accum_fd);
 
-    G_free(accum_map->cells.v);
+    if (tile_size)
+        free_tile_store(accum_store);
+    else
+        G_free(accum_map->cells.v);
     G_free(accum_map);
 
     /* write history */
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "global.h"
+
+static void fill_null(struct tile_store *, char *, size_t);
+static void flush_band(struct tile_store *);
+static void load_band(struct tile_store *, int);
+
+/* creates a temporary file for tiles of tile_size x tile_size cells; with
+ * halo, each tile also stores a one-cell ring of its neighbors; null_cell is
+ * used for cells outside the region */
+struct tile_store *create_tile_store(int nrows, int ncols, int tile_size,
+                                     size_t cell_size, int halo,
+                                     const void *null_cell)
+{
+    struct tile_store *store = G_malloc(sizeof *store);
+    char *path;
+
+    store->nrows = nrows;
+    store->ncols = ncols;
+    store->tile_size = tile_size;
+    store->cell_size = cell_size;
+    store->halo = halo ? 1 : 0;
+    store->ntile_rows = (nrows + tile_size - 1) / tile_size;
+    store->ntile_cols = (ncols + tile_size - 1) / tile_size;
+    store->tile_width = tile_size + 2 * store->halo;
+    store->tile_bytes =
+        (size_t)store->tile_width * store->tile_width * cell_size;
+    store->band_width = store->ntile_cols * tile_size + 2 * store->halo;
+    store->band =
+        G_malloc((size_t)store->tile_width * store->band_width * cell_size);
+    store->band_row = -1;
+    store->null_cell = G_malloc(cell_size);
+    memcpy(store->null_cell, null_cell, cell_size);
+
+    path = G_tempfile();
+    if (!(store->fp = fopen(path, "w+b")))
+        G_fatal_error(_("Unable to create temporary file <%s>"), path);
+    /* the file is not needed after closing it */
+    remove(path);
+    G_free(path);
+
+    return store;
+}
+
+void free_tile_store(struct tile_store *store)
+{
+    fclose(store->fp);
+    G_free(store->band);
+    G_free(store->null_cell);
+    G_free(store);
+}
+
+/* puts rows in order from the first to the last row; tiles are written when
+ * their band of rows is complete */
+void put_tile_store_row(struct tile_store *store, int row, const void *buf)
+{
+    int ts = store->tile_size, h = store->halo;
+    size_t row_bytes = (size_t)store->band_width * store->cell_size;
+    char *band = store->band;
+
+    if (row == 0) {
+        store->band_row = 0;
+        fill_null(store, band, (size_t)store->tile_width * store->band_width);
+    }
+    else if (row == (store->band_row + 1) * ts) {
+        /* the first row of the next band is the bottom halo of this band */
+        if (h)
+            memcpy(band + (ts + 1) * row_bytes + store->cell_size, buf,
+                   (size_t)store->ncols * store->cell_size);
+        flush_band(store);
+        store->band_row++;
+        /* the last row of this band is the top halo of the next band */
+        if (h)
+            memcpy(band, band + ts * row_bytes, row_bytes);
+        fill_null(store, band + h * row_bytes,
+                  (size_t)(store->tile_width - h) * store->band_width);
+    }
+
+    memcpy(band + (row - store->band_row * ts + h) * row_bytes +
+               h * store->cell_size,
+           buf, (size_t)store->ncols * store->cell_size);
+
+    if (row == store->nrows - 1) {
+        flush_band(store);
+        store->band_row = -1;
+    }
+}
+
+/* returns a pointer to a row; rows are loaded one band of tiles at a time, so
+ * they should be requested in order */
+void *get_tile_store_row(struct tile_store *store, int row)
+{
+    int band_row = row / store->tile_size;
+
+    if (band_row != store->band_row)
+        load_band(store, band_row);
+
+    return store->band + ((size_t)(row - band_row * store->tile_size +
+                                   store->halo) *
+                              store->band_width +
+                          store->halo) *
+                             store->cell_size;
+}
+
+void read_tile(struct tile_store *store, int tile_row, int tile_col,
+               void *tile)
+{
+    off_t offset =
+        ((off_t)tile_row * store->ntile_cols + tile_col) * store->tile_bytes;
+    size_t n;
+
+#pragma omp critical(tile_store_io)
+    {
+        G_fseek(store->fp, offset, SEEK_SET);
+        n = fread(tile, 1, store->tile_bytes, store->fp);
+    }
+    if (n != store->tile_bytes)
+        G_fatal_error(_("Unable to read temporary file"));
+}
+
+void write_tile(struct tile_store *store, int tile_row, int tile_col,
+                const void *tile)
+{
+    off_t offset =
+        ((off_t)tile_row * store->ntile_cols + tile_col) * store->tile_bytes;
+    size_t n;
+
+#pragma omp critical(tile_store_io)
+    {
+        G_fseek(store->fp, offset, SEEK_SET);
+        n = fwrite(tile, 1, store->tile_bytes, store->fp);
+    }
+    if (n != store->tile_bytes)
+        G_fatal_error(_("Unable to write temporary file"));
+}
+
+static void fill_null(struct tile_store *store, char *p, size_t ncells)
+{
+    size_t i;
+
+    for (i = 0; i < ncells; i++, p += store->cell_size)
+        memcpy(p, store->null_cell, store->cell_size);
+}
+
+static void flush_band(struct tile_store *store)
+{
+    int tw = store->tile_width, tile_col, i;
+    size_t row_bytes = (size_t)store->band_width * store->cell_size;
+    size_t tile_row_bytes = (size_t)tw * store->cell_size;
+    char *tile = G_malloc(store->tile_bytes);
+
+    for (tile_col = 0; tile_col < store->ntile_cols; tile_col++) {
+        for (i = 0; i < tw; i++)
+            memcpy(tile + i * tile_row_bytes,
+                   store->band + i * row_bytes +
+                       (size_t)tile_col * store->tile_size * store->cell_size,
+                   tile_row_bytes);
+        write_tile(store, store->band_row, tile_col, tile);
+    }
+
+    G_free(tile);
+}
+
+static void load_band(struct tile_store *store, int band_row)
+{
+    int tw = store->tile_width, tile_col, i;
+    size_t row_bytes = (size_t)store->band_width * store->cell_size;
+    size_t tile_row_bytes = (size_t)tw * store->cell_size;
+    char *tile = G_malloc(store->tile_bytes);
+
+    for (tile_col = 0; tile_col < store->ntile_cols; tile_col++) {
+        read_tile(store, band_row, tile_col, tile);
+        for (i = 0; i < tw; i++)
+            memcpy(store->band + i * row_bytes +
+                       (size_t)tile_col * store->tile_size * store->cell_size,
+                   tile + i * tile_row_bytes, tile_row_bytes);
+    }
+    store->band_row = band_row;
+
+    G_free(tile);
+}
@@ -17,7 +17,9 @@
 
 #include <grass/gis.h>
 #include <grass/raster.h>
-#include <grass/segment.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "devpressure.h"
 #include "utils.h"
@@ -60,60 +62,71 @@ void update_development_pressure(int row, int col, struct Segments *segments,
             else
                 value = devpressure_info->scaling_factor *
                         exp(-2 * dist / devpressure_info->gamma);
-            Segment_get(&segments->devpressure, (void *)&devpressure_value, i,
+            storage_get(&segments->devpressure, (void *)&devpressure_value, i,
                         j);
             if (Rast_is_null_value(&devpressure_value, FCELL_TYPE))
                 continue;
             devpressure_value += value;
-            Segment_put(&segments->devpressure, (void *)&devpressure_value, i,
+            storage_put(&segments->devpressure, (void *)&devpressure_value, i,
                         j);
         }
     }
 }
 
-/*!
- * \brief Update development pressure for neighborhood of a single cell
- *
- * Uses precomputed matrix to speed up computation.
- *
- * \param row cell row
- * \param col cell column
- * \param segments segments
- * \param devpressure_info Development pressure parameters
- */
-void update_development_pressure_precomputed(
-    int row, int col, struct Segments *segments,
-    struct DevPressure *devpressure_info)
+/* update only rows row1 to row2 (excluded) of the neighborhood */
+static void update_rows_precomputed(int row, int col, int row1, int row2,
+                                    struct Segments *segments,
+                                    struct DevPressure *devpressure_info)
 {
     int i, j, mi, mj;
-    int cols, rows;
+    int cols;
     float value;
     FCELL devpressure_value;
 
     cols = Rast_window_cols();
-    rows = Rast_window_rows();
-    for (i = row - devpressure_info->neighborhood;
-         i <= row + devpressure_info->neighborhood; i++) {
+    if (row1 < row - devpressure_info->neighborhood)
+        row1 = row - devpressure_info->neighborhood;
+    if (row2 > row + devpressure_info->neighborhood + 1)
+        row2 = row + devpressure_info->neighborhood + 1;
+    for (i = row1; i < row2; i++) {
         for (j = col - devpressure_info->neighborhood;
              j <= col + devpressure_info->neighborhood; j++) {
-            if (i < 0 || j < 0 || i >= rows || j >= cols)
+            if (j < 0 || j >= cols)
                 continue;
             mi = devpressure_info->neighborhood - (row - i);
             mj = devpressure_info->neighborhood - (col - j);
             value = devpressure_info->matrix[mi][mj];
             if (value > 0) {
-                Segment_get(&segments->devpressure, (void *)&devpressure_value,
+                storage_get(&segments->devpressure, (void *)&devpressure_value,
                             i, j);
                 if (Rast_is_null_value(&devpressure_value, FCELL_TYPE))
                     continue;
                 devpressure_value += value;
-                Segment_put(&segments->devpressure, (void *)&devpressure_value,
+                storage_put(&segments->devpressure, (void *)&devpressure_value,
                             i, j);
             }
         }
     }
 }
 
+/*!
+ * \brief Update development pressure for neighborhood of a single cell
+ *
+ * Uses precomputed matrix to speed up computation.
+ *
+ * \param row cell row
+ * \param col cell column
+ * \param segments segments
+ * \param devpressure_info Development pressure parameters
+ */
+void update_development_pressure_precomputed(
+    int row, int col, struct Segments *segments,
+    struct DevPressure *devpressure_info)
+{
+    update_rows_precomputed(row, col, 0, Rast_window_rows(), segments,
+                            devpressure_info);
+}
+
 /*!
  * \brief Precompute development pressure matrix to speed up.
  * \param devpressure_info Development pressure parameters and matrix
@@ -148,3 +161,82 @@ void initialize_devpressure_matrix(struct DevPressure *devpressure_info)
         }
     }
 }
+
+/*!
+ * \brief Remember newly developed cells for the update of development
+ * pressure at the end of the step.
+ *
+ * Development pressure is used only to recompute probabilities at the
+ * beginning of a step, so all updates of a step can be done at once.
+ *
+ * \param developed_cells list of cells developed during the step
+ * \param ids ids of newly developed cells
+ * \param n number of newly developed cells
+ */
+void add_developed_cells(struct DevelopedCells *developed_cells, int *ids,
+                         int n)
+{
+    int i;
+
+    if (developed_cells->n + n > developed_cells->max) {
+        developed_cells->max = 1.25 * (developed_cells->n + n) + 1024;
+        developed_cells->ids = (size_t *)G_realloc(
+            developed_cells->ids, developed_cells->max * sizeof(size_t));
+    }
+    for (i = 0; i < n; i++)
+        developed_cells->ids[developed_cells->n++] = ids[i];
+}
+
+/*!
+ * \brief Update development pressure for all cells developed in a step
+ *
+ * Cells are processed in the order they were developed,
+ * which gives the same result as updating after each patch.
+ * When development pressure is kept in memory, blocks of rows
+ * are updated in parallel, each by a single thread, so the order of
+ * updates of each cell is kept.
+ * The list of developed cells is emptied.
+ *
+ * \param developed_cells list of cells developed during the step
+ * \param segments segments
+ * \param devpressure_info Development pressure parameters
+ */
+void update_development_pressure_step(struct DevelopedCells *developed_cells,
+                                      struct Segments *segments,
+                                      struct DevPressure *devpressure_info)
+{
+    size_t i;
+    int row, col, cols, rows;
+    int block, nblocks, block_rows;
+
+    cols = Rast_window_cols();
+    rows = Rast_window_rows();
+    nblocks = 1;
+#ifdef _OPENMP
+    if (segments->devpressure.data)
+        nblocks = 4 * omp_get_max_threads();
+#endif
+    if (nblocks > rows)
+        nblocks = rows;
+    block_rows = (rows + nblocks - 1) / nblocks;
+
+#pragma omp parallel for schedule(dynamic) private(i, row, col) \
+    if (nblocks > 1)
+    for (block = 0; block < nblocks; block++) {
+        int row1 = block * block_rows;
+        int row2 = row1 + block_rows;
+
+        if (row2 > rows)
+            row2 = rows;
+
+        for (i = 0; i < developed_cells->n; i++) {
+            get_xy_from_idx(developed_cells->ids[i], cols, &row, &col);
+            if (row + devpressure_info->neighborhood < row1 ||
+                row - devpressure_info->neighborhood >= row2)
+                continue;
+            update_rows_precomputed(row, col, row1, row2, segments,
+                                    devpressure_info);
+        }
+    }
+    developed_cells->n = 0;
+}
@@ -15,11 +15,23 @@ struct DevPressure {
     enum development_pressure alg;
 };
 
+/* cells developed during one step, in the order of development */
+struct DevelopedCells {
+    size_t *ids;
+    size_t n;
+    size_t max;
+};
+
 void update_development_pressure(int row, int col, struct Segments *segments,
                                  struct DevPressure *devpressure_info);
 void update_development_pressure_precomputed(
     int row, int col, struct Segments *segments,
     struct DevPressure *devpressure_info);
 void initialize_devpressure_matrix(struct DevPressure *devpressure_info);
+void add_developed_cells(struct DevelopedCells *developed_cells, int *ids,
+                         int n);
+void update_development_pressure_step(struct DevelopedCells *developed_cells,
+                                      struct Segments *segments,
+                                      struct DevPressure *devpressure_info);
 
 #endif // FUTURES_DEVPRESSURE_H
@@ -122,37 +122,30 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
         fd_weights = Rast_open_old(inputs.weights, "");
 
     /* Segment open developed */
-    if (Segment_open(&segments->developed, G_tempfile(), rows, cols,
-                     segment_info.rows, segment_info.cols,
-                     Rast_cell_size(CELL_TYPE), segment_info.in_memory) != 1)
+    if (storage_open(&segments->developed, rows, cols,
+                     Rast_cell_size(CELL_TYPE), segment_info) != 1)
         G_fatal_error(_("Cannot create temporary file with segments of a "
                         "raster map of development"));
     /* Segment open subregions */
-    if (Segment_open(&segments->subregions, G_tempfile(), rows, cols,
-                     segment_info.rows, segment_info.cols,
-                     Rast_cell_size(CELL_TYPE), segment_info.in_memory) != 1)
+    if (storage_open(&segments->subregions, rows, cols,
+                     Rast_cell_size(CELL_TYPE), segment_info) != 1)
         G_fatal_error(_("Cannot create temporary file with segments of a "
                         "raster map of subregions"));
     /* Segment open development pressure */
-    if (Segment_open(&segments->devpressure, G_tempfile(), rows, cols,
-                     segment_info.rows, segment_info.cols,
-                     Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
+    if (storage_open(&segments->devpressure, rows, cols,
+                     Rast_cell_size(FCELL_TYPE), segment_info) != 1)
         G_fatal_error(_("Cannot create temporary file with segments of a "
                         "raster map of development pressure"));
     /* Segment open weights */
     if (segments->use_weight)
-        if (Segment_open(&segments->weight, G_tempfile(), rows, cols,
-                         segment_info.rows, segment_info.cols,
-                         Rast_cell_size(FCELL_TYPE),
-                         segment_info.in_memory) != 1)
+        if (storage_open(&segments->weight, rows, cols,
+                         Rast_cell_size(FCELL_TYPE), segment_info) != 1)
             G_fatal_error(_("Cannot create temporary file with segments of a "
                             "raster map of weights"));
     /* Segment open potential_subregions */
     if (segments->use_potential_subregions)
-        if (Segment_open(&segments->potential_subregions, G_tempfile(), rows,
-                         cols, segment_info.rows, segment_info.cols,
-                         Rast_cell_size(CELL_TYPE),
-                         segment_info.in_memory) != 1)
+        if (storage_open(&segments->potential_subregions, rows, cols,
+                         Rast_cell_size(CELL_TYPE), segment_info) != 1)
             G_fatal_error(_("Cannot create temporary file with segments of a "
                             "raster map of weights"));
     developed_row = Rast_allocate_buf(CELL_TYPE);
@@ -246,25 +239,25 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
                 Rast_set_c_null_value(&((CELL *)developed_row)[col], 1);
         }
 
-        Segment_put_row(&segments->developed, developed_row, row);
-        Segment_put_row(&segments->devpressure, devpressure_row, row);
-        Segment_put_row(&segments->subregions, subregions_row, row);
+        storage_put_row(&segments->developed, developed_row, row);
+        storage_put_row(&segments->devpressure, devpressure_row, row);
+        storage_put_row(&segments->subregions, subregions_row, row);
         if (segments->use_weight)
-            Segment_put_row(&segments->weight, weights_row, row);
+            storage_put_row(&segments->weight, weights_row, row);
         if (segments->use_potential_subregions)
-            Segment_put_row(&segments->potential_subregions, pot_subregions_row,
+            storage_put_row(&segments->potential_subregions, pot_subregions_row,
                             row);
     }
     G_percent(row, rows, 5);
 
     /* flush all segments */
-    Segment_flush(&segments->developed);
-    Segment_flush(&segments->subregions);
-    Segment_flush(&segments->devpressure);
+    storage_flush(&segments->developed);
+    storage_flush(&segments->subregions);
+    storage_flush(&segments->devpressure);
     if (segments->use_weight)
-        Segment_flush(&segments->weight);
+        storage_flush(&segments->weight);
     if (segments->use_potential_subregions)
-        Segment_flush(&segments->potential_subregions);
+        storage_flush(&segments->potential_subregions);
 
     /* close raster maps */
     Rast_close(fd_developed);
@@ -321,9 +314,8 @@ void read_predictors(struct RasterInputs inputs, struct Segments *segments,
     aggregated_row = Rast_allocate_buf(FCELL_TYPE);
 
     /* Segment open predictors */
-    if (Segment_open(&segments->aggregated_predictor, G_tempfile(), rows, cols,
-                     segment_info.rows, segment_info.cols,
-                     Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
+    if (storage_open(&segments->aggregated_predictor, rows, cols,
+                     Rast_cell_size(FCELL_TYPE), segment_info) != 1)
         G_fatal_error(_("Cannot create temporary file with segments of "
                         "predictor raster maps"));
 
@@ -334,7 +326,7 @@ void read_predictors(struct RasterInputs inputs, struct Segments *segments,
         }
         for (col = 0; col < cols; col++) {
             ((FCELL *)aggregated_row)[col] = 0;
-            Segment_get(&segments->developed, (void *)&dev_value, row, col);
+            storage_get(&segments->developed, (void *)&dev_value, row, col);
             if (Rast_is_null_value(&dev_value, CELL_TYPE)) {
                 continue;
             }
@@ -344,25 +336,25 @@ void read_predictors(struct RasterInputs inputs, struct Segments *segments,
                 if (Rast_is_null_value(&((FCELL *)predictor_rows[i])[col],
                                        FCELL_TYPE)) {
                     Rast_set_c_null_value(&dev_value, 1);
-                    Segment_put(&segments->developed, (void *)&dev_value, row,
+                    storage_put(&segments->developed, (void *)&dev_value, row,
                                 col);
                     break;
                 }
                 if (segments->use_potential_subregions)
-                    Segment_get(&segments->potential_subregions,
+                    storage_get(&segments->potential_subregions,
                                 (void *)&pot_index, row, col);
                 else
-                    Segment_get(&segments->subregions, (void *)&pot_index, row,
+                    storage_get(&segments->subregions, (void *)&pot_index, row,
                                 col);
                 value = potential->predictors[i][pot_index] *
                         ((FCELL *)predictor_rows[i])[col];
                 ((FCELL *)aggregated_row)[col] += value;
             }
         }
-        Segment_put_row(&segments->aggregated_predictor, aggregated_row, row);
+        storage_put_row(&segments->aggregated_predictor, aggregated_row, row);
     }
-    Segment_flush(&segments->aggregated_predictor);
-    Segment_flush(&segments->developed);
+    storage_flush(&segments->aggregated_predictor);
+    storage_flush(&segments->developed);
     for (i = 0; i < potential->max_predictors; i++) {
         Rast_close(fds_predictors[i]);
         G_free(predictor_rows[i]);
@@ -2,9 +2,9 @@
 #define FUTURES_INPUTS_H
 
 #include <stdbool.h>
-#include <grass/segment.h>
 
 #include "keyvalue.h"
+#include "storage.h"
 
 struct Demand {
     const char *filename;
@@ -39,20 +39,14 @@ struct PatchSizes {
     bool single_column;
 };
 
-struct SegmentMemory {
-    int rows;
-    int cols;
-    int in_memory;
-};
-
 struct Segments {
-    SEGMENT developed;
-    SEGMENT subregions;
-    SEGMENT potential_subregions;
-    SEGMENT devpressure;
-    SEGMENT aggregated_predictor;
-    SEGMENT probability;
-    SEGMENT weight;
+    struct Storage developed;
+    struct Storage subregions;
+    struct Storage potential_subregions;
+    struct Storage devpressure;
+    struct Storage aggregated_predictor;
+    struct Storage probability;
+    struct Storage weight;
     bool use_weight;
     bool use_potential_subregions;
 };
@@ -55,6 +55,9 @@
 #include <grass/raster.h>
 #include <grass/glocale.h>
 #include <grass/segment.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "keyvalue.h"
 #include "inputs.h"
@@ -125,8 +128,13 @@ static int manage_memory(struct SegmentMemory *memory,
 
     if (nseg > nseg_total || input_memory < 0)
         nseg = nseg_total;
-    G_verbose_message(_("Number of segments in memory: %d of %d total"), nseg,
-                      nseg_total);
+    /* when all segments fit into memory, keep the maps in plain arrays */
+    memory->dense = nseg == nseg_total;
+    if (memory->dense)
+        G_verbose_message(_("Keeping raster maps in memory"));
+    else
+        G_verbose_message(_("Number of segments in memory: %d of %d total"),
+                          nseg, nseg_total);
     G_verbose_message(
         _("Estimated minimum memory footprint without using disk cache: %d MB"),
         (int)(estimate / 1.0e6));
@@ -142,7 +150,8 @@ int main(int argc, char **argv)
             *scalingFactor, *gamma, *potentialFile, *numNeighbors,
             *discountFactor, *seedSearch, *patchMean, *patchRange,
             *incentivePower, *potentialWeight, *demandFile, *separator,
-            *patchFile, *numSteps, *output, *outputSeries, *seed, *memory;
+            *patchFile, *numSteps, *output, *outputSeries, *seed, *memory,
+            *nprocs;
 
     } opt;
 
@@ -172,11 +181,13 @@ int main(int argc, char **argv)
     struct PatchSizes patch_sizes;
     struct PatchInfo patch_info;
     struct DevPressure devpressure_info;
+    struct DevelopedCells developed_cells;
     struct Segments segments;
     int *patch_overflow;
     char *name_step;
     bool overgrow;
     size_t undev_estimate;
+    int nprocs;
 
     G_gisinit(argv[0]);
 
@@ -406,6 +417,8 @@ int main(int argc, char **argv)
     opt.memory->required = NO;
     opt.memory->description = _("Memory in GB");
 
+    opt.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+
     // TODO: add mutually exclusive?
     // TODO: add flags or options to control values in series and final rasters
 
@@ -415,6 +428,22 @@ int main(int argc, char **argv)
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
+#ifdef _OPENMP
+    nprocs = atoi(opt.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), opt.nprocs->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     long seed_value;
 
     if (flg.generateSeed->answer) {
@@ -504,9 +533,9 @@ int main(int argc, char **argv)
                        reverse_region_map, potential_region_map);
 
     /* create probability segment*/
-    if (Segment_open(&segments.probability, G_tempfile(), Rast_window_rows(),
-                     Rast_window_cols(), segment_info.rows, segment_info.cols,
-                     Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
+    if (storage_open(&segments.probability, Rast_window_rows(),
+                     Rast_window_cols(), Rast_cell_size(FCELL_TYPE),
+                     segment_info) != 1)
         G_fatal_error(
             _("Cannot create temporary file with segments of a raster map"));
 
@@ -538,6 +567,8 @@ int main(int argc, char **argv)
 
     undev_cells = initialize_undeveloped(region_map->nitems, undev_estimate);
     patch_overflow = G_calloc(region_map->nitems, sizeof(int));
+    developed_cells.ids = NULL;
+    developed_cells.n = developed_cells.max = 0;
     /* here do the modeling */
     overgrow = true;
     G_verbose_message("Starting simulation...");
@@ -551,10 +582,13 @@ int main(int argc, char **argv)
                 "Computing step %d (out of %d), region %d (%d out of %d)",
                 step + 1, num_steps, region_id, region + 1, region_map->nitems);
             compute_step(undev_cells, &demand_info, search_alg, &segments,
-                         &patch_sizes, &patch_info, &devpressure_info,
+                         &patch_sizes, &patch_info, &developed_cells,
                          patch_overflow, step, region, reverse_region_map,
                          overgrow);
         }
+        /* update devpressure for every cell developed in this step */
+        update_development_pressure_step(&developed_cells, &segments,
+                                         &devpressure_info);
         /* export developed for that step */
         if (opt.outputSeries->answer) {
             name_step =
@@ -571,16 +605,16 @@ int main(int argc, char **argv)
                           num_steps, false, false);
 
     /* close segments and free memory */
-    Segment_close(&segments.developed);
-    Segment_close(&segments.subregions);
-    Segment_close(&segments.devpressure);
-    Segment_close(&segments.probability);
-    Segment_close(&segments.aggregated_predictor);
+    storage_close(&segments.developed);
+    storage_close(&segments.subregions);
+    storage_close(&segments.devpressure);
+    storage_close(&segments.probability);
+    storage_close(&segments.aggregated_predictor);
     if (opt.potentialWeight->answer) {
-        Segment_close(&segments.weight);
+        storage_close(&segments.weight);
     }
     if (opt.potentialSubregions->answer)
-        Segment_close(&segments.potential_subregions);
+        storage_close(&segments.potential_subregions);
 
     KeyValueIntInt_free(region_map);
     KeyValueIntInt_free(reverse_region_map);
@@ -613,6 +647,8 @@ int main(int argc, char **argv)
 
     G_free(patch_sizes.patch_sizes);
     G_free(patch_overflow);
+    if (developed_cells.ids)
+        G_free(developed_cells.ids);
 
     return EXIT_SUCCESS;
 }
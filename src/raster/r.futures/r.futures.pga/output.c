@@ -19,7 +19,6 @@
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
-#include <grass/segment.h>
 
 #include "output.h"
 
@@ -65,7 +64,7 @@ char *name_for_step(const char *basename, const int step, const int nsteps)
 
 /*!
  * \brief Write current state of developed areas.
- * \param developed_segment segment of developed cells
+ * \param developed storage of developed cells
  * \param name name for output map
  * \param year_from year to put as timestamp
  * \param year_to if > 0 it is end year of timestamp interval
@@ -74,14 +73,13 @@ char *name_for_step(const char *basename, const int step, const int nsteps)
  * \param developed_as_one Represent all developed areas as 1 instead of number
         representing the step when it was developed
  */
-void output_developed_step(SEGMENT *developed_segment, const char *name,
+void output_developed_step(struct Storage *developed, const char *name,
                            int year_from, int year_to, int nsteps,
                            bool undeveloped_as_null, bool developed_as_one)
 {
     int out_fd;
     int row, col, rows, cols;
     CELL *out_row;
-    CELL developed;
     CELL val1, val2;
     struct Colors colors;
     const char *mapset;
@@ -90,24 +88,22 @@ void output_developed_step(SEGMENT *developed_segment, const char *name,
     rows = Rast_window_rows();
     cols = Rast_window_cols();
 
-    Segment_flush(developed_segment);
+    storage_flush(developed);
     out_fd = Rast_open_new(name, CELL_TYPE);
     out_row = Rast_allocate_c_buf();
 
     for (row = 0; row < rows; row++) {
-        Rast_set_c_null_value(out_row, cols);
+        storage_get_row(developed, out_row, row);
         for (col = 0; col < cols; col++) {
-            Segment_get(developed_segment, (void *)&developed, row, col);
-            if (Rast_is_c_null_value(&developed)) {
+            if (Rast_is_c_null_value(&out_row[col])) {
                 continue;
             }
             /* this handles undeveloped cells */
-            if (undeveloped_as_null && developed == -1)
-                continue;
+            if (undeveloped_as_null && out_row[col] == -1)
+                Rast_set_c_null_value(&out_row[col], 1);
             /* this handles developed cells */
-            if (developed_as_one)
-                developed = 1;
-            out_row[col] = developed;
+            else if (developed_as_one)
+                out_row[col] = 1;
         }
         Rast_put_c_row(out_fd, out_row);
     }
@@ -101,7 +101,7 @@ void add_neighbour(int row, int col, int seed_row, int seed_col, int rows,
     if (row < 0 || row >= rows || col < 0 || col >= cols)
         return;
 
-    Segment_get(&segments->developed, (void *)&value, row, col);
+    storage_get(&segments->developed, (void *)&value, row, col);
     if (Rast_is_null_value(&value, CELL_TYPE))
         return;
     if (value == -1) {
@@ -125,7 +125,7 @@ void add_neighbour(int row, int col, int seed_row, int seed_col, int rows,
             }
         }
         candidate_list->candidates[candidate_list->n].id = idx;
-        Segment_get(&segments->probability, (void *)&prob, row, col);
+        storage_get(&segments->probability, (void *)&prob, row, col);
         candidate_list->candidates[candidate_list->n].potential = prob;
         distance = get_distance(seed_row, seed_col, row, col);
         alpha = get_alpha(patch_info);
@@ -223,7 +223,7 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
     step += 1; /* e.g. first step=0 will be saved as 1 */
 
     /* set seed as developed */
-    Segment_put(&segments->developed, (void *)&step, seed_row, seed_col);
+    storage_put(&segments->developed, (void *)&step, seed_row, seed_col);
     added_ids[0] = get_idx_from_xy(seed_row, seed_col, Rast_window_cols());
 
     /* add surrounding neighbors */
@@ -241,7 +241,7 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
                 added_ids[found] = candidates.candidates[i].id;
                 /* update to developed */
                 get_xy_from_idx(candidates.candidates[i].id, cols, &row, &col);
-                Segment_put(&segments->developed, (void *)&step, row, col);
+                storage_put(&segments->developed, (void *)&step, row, col);
                 /* remove this one from the list by copying down everything
                  * above it */
                 for (j = i + 1; j < candidates.n; j++) {
@@ -260,7 +260,7 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
                 /* sort candidates based on probability */
                 qsort(candidates.candidates, candidates.n,
                       sizeof(struct CandidateNeighbor), sort_neighbours);
-                Segment_get(&segments->subregions, (void *)&test_region, row,
+                storage_get(&segments->subregions, (void *)&test_region, row,
                             col);
                 /* if growing outside of region, account for that, increase
                  * number of cells outside of region */
@@ -297,6 +297,5 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
     if (candidates.max_n > 0)
         G_free(candidates.candidates);
 
-    Segment_flush(&segments->developed);
     return found_in_this_region;
 }
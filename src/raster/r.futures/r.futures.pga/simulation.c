@@ -93,35 +93,26 @@ int get_seed(struct Undeveloped *undev_cells, int region_idx,
     return i;
 }
 
+/* number of rows read at once to recompute probabilities */
+#define PROBABILITY_BLOCK_ROWS 64
+
 /*!
- * \brief Compute development probability for a cell
- * \param[in] segments segments
- * \param[in] values allocated buffer
+ * \brief Compute development probability from cell values
  * \param[in] potential_info potential parameters
- * \param[in] region_index region id
- * \param[in] row row
- * \param[in] col column
+ * \param[in] pot_index potential region index
+ * \param[in] devpressure_val development pressure
+ * \param[in] predictors_val aggregated predictors
+ * \param[in] use_weight whether to apply weight
+ * \param[in] weight weight
  * \return probability
  */
-double get_develop_probability_xy(struct Segments *segments, FCELL *values,
-                                  struct Potential *potential_info,
-                                  int region_index, int row, int col)
+static float develop_probability(struct Potential *potential_info,
+                                 CELL pot_index, FCELL devpressure_val,
+                                 FCELL predictors_val, bool use_weight,
+                                 FCELL weight)
 {
     float probability;
     int transformed_idx = 0;
-    FCELL devpressure_val;
-    FCELL predictors_val;
-    FCELL weight;
-    CELL pot_index;
-
-    Segment_get(&segments->devpressure, (void *)&devpressure_val, row, col);
-    Segment_get(&segments->aggregated_predictor, (void *)&predictors_val, row,
-                col);
-    if (segments->use_potential_subregions)
-        Segment_get(&segments->potential_subregions, (void *)&pot_index, row,
-                    col);
-    else
-        pot_index = region_index;
 
     probability = potential_info->intercept[pot_index];
     probability += potential_info->devpressure[pot_index] * devpressure_val;
@@ -140,8 +131,7 @@ double get_develop_probability_xy(struct Segments *segments, FCELL *values,
     }
 
     /* weights if applicable */
-    if (segments->use_weight) {
-        Segment_get(&segments->weight, (void *)&weight, row, col);
+    if (use_weight) {
         if (weight < 0)
             probability *= 1 - fabs(weight);
         else if (weight > 0)
@@ -150,6 +140,84 @@ double get_develop_probability_xy(struct Segments *segments, FCELL *values,
     return probability;
 }
 
+/*!
+ * \brief Compute development probability for a cell
+ * \param[in] segments segments
+ * \param[in] values allocated buffer
+ * \param[in] potential_info potential parameters
+ * \param[in] region_index region id
+ * \param[in] row row
+ * \param[in] col column
+ * \return probability
+ */
+double get_develop_probability_xy(struct Segments *segments, FCELL *values,
+                                  struct Potential *potential_info,
+                                  int region_index, int row, int col)
+{
+    FCELL devpressure_val;
+    FCELL predictors_val;
+    FCELL weight;
+    CELL pot_index;
+
+    storage_get(&segments->devpressure, (void *)&devpressure_val, row, col);
+    storage_get(&segments->aggregated_predictor, (void *)&predictors_val, row,
+                col);
+    if (segments->use_potential_subregions)
+        storage_get(&segments->potential_subregions, (void *)&pot_index, row,
+                    col);
+    else
+        pot_index = region_index;
+
+    weight = 0;
+    if (segments->use_weight)
+        storage_get(&segments->weight, (void *)&weight, row, col);
+
+    return develop_probability(potential_info, pot_index, devpressure_val,
+                               predictors_val, segments->use_weight, weight);
+}
+
+/* input values of a block of rows */
+struct ProbabilityBlock {
+    int ncells;
+    bool *undeveloped;
+    CELL *developed, *region, *pot_index;
+    FCELL *devpressure, *predictors, *weight;
+    float *probability;
+};
+
+/* reads whole rows, storages need to be flushed */
+static void read_probability_block(struct ProbabilityBlock *block,
+                                   struct Segments *segments, int row1,
+                                   int row2, int cols)
+{
+    int row, i;
+    size_t offset;
+
+    block->ncells = (row2 - row1) * cols;
+    for (row = row1; row < row2; row++) {
+        offset = (size_t)(row - row1) * cols;
+        storage_get_row(&segments->developed, block->developed + offset, row);
+        storage_get_row(&segments->subregions, block->region + offset, row);
+        storage_get_row(&segments->devpressure, block->devpressure + offset,
+                        row);
+        storage_get_row(&segments->aggregated_predictor,
+                        block->predictors + offset, row);
+        if (segments->use_potential_subregions)
+            storage_get_row(&segments->potential_subregions,
+                            block->pot_index + offset, row);
+        if (segments->use_weight)
+            storage_get_row(&segments->weight, block->weight + offset, row);
+    }
+    for (i = 0; i < block->ncells; i++) {
+        /* null is never -1 */
+        block->undeveloped[i] = block->developed[i] == -1;
+        if (!segments->use_potential_subregions)
+            block->pot_index[i] = block->region[i];
+        if (!segments->use_weight)
+            block->weight[i] = 0;
+    }
+}
+
 /*!
  * \brief Recompute development probabilities.
  *
@@ -157,6 +225,9 @@ double get_develop_probability_xy(struct Segments *segments, FCELL *values,
  * probability segment and undev_cells.
  * Also recompute cumulative probability
  *
+ * Input values are read by blocks of whole rows, probabilities of a block
+ * are computed in parallel and then stored in the original order.
+ *
  * \param undeveloped_cells array of undeveloped cells
  * \param segments segments
  * \param potential_info potential parameters
@@ -165,56 +236,92 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
                              struct Segments *segments,
                              struct Potential *potential_info)
 {
-    int row, col, cols, rows;
+    int row, col, cols, rows, row1, row2;
     int id, i, idx, new_size;
     int region_idx;
-    CELL developed;
     CELL region;
-    FCELL *values;
     float probability;
     float sum;
+    struct ProbabilityBlock block;
+    size_t block_size;
 
     cols = Rast_window_cols();
     rows = Rast_window_rows();
-    values = G_malloc(potential_info->max_predictors * sizeof(FCELL *));
+
+    block_size = (size_t)PROBABILITY_BLOCK_ROWS * cols;
+    block.undeveloped = G_malloc(block_size * sizeof(bool));
+    block.developed = G_malloc(block_size * sizeof(CELL));
+    block.region = G_malloc(block_size * sizeof(CELL));
+    block.pot_index = G_malloc(block_size * sizeof(CELL));
+    block.devpressure = G_malloc(block_size * sizeof(FCELL));
+    block.predictors = G_malloc(block_size * sizeof(FCELL));
+    block.weight = G_malloc(block_size * sizeof(FCELL));
+    block.probability = G_malloc(block_size * sizeof(float));
 
     for (region_idx = 0; region_idx < undeveloped_cells->max_subregions;
          region_idx++) {
         undeveloped_cells->num[region_idx] = 0;
     }
-    for (row = 0; row < rows; row++) {
-        for (col = 0; col < cols; col++) {
-            Segment_get(&segments->developed, (void *)&developed, row, col);
-            if (Rast_is_null_value(&developed, CELL_TYPE))
-                continue;
-            if (developed != -1)
+    /* whole rows are read from segment files */
+    storage_flush(&segments->developed);
+    storage_flush(&segments->devpressure);
+    for (row1 = 0; row1 < rows; row1 += PROBABILITY_BLOCK_ROWS) {
+        row2 = row1 + PROBABILITY_BLOCK_ROWS;
+        if (row2 > rows)
+            row2 = rows;
+
+        read_probability_block(&block, segments, row1, row2, cols);
+
+#pragma omp parallel for schedule(static)
+        for (i = 0; i < block.ncells; i++) {
+            if (!block.undeveloped[i])
                 continue;
-            Segment_get(&segments->subregions, (void *)&region, row, col);
-
-            /* realloc if needed */
-            if (undeveloped_cells->num[region] >=
-                undeveloped_cells->max[region]) {
-                new_size = 1.25 * undeveloped_cells->max[region];
-                undeveloped_cells->cells[region] =
-                    (struct UndevelopedCell *)G_realloc(
-                        undeveloped_cells->cells[region],
-                        new_size * sizeof(struct UndevelopedCell));
-                undeveloped_cells->max[region] = new_size;
+            block.probability[i] = develop_probability(
+                potential_info, block.pot_index[i], block.devpressure[i],
+                block.predictors[i], segments->use_weight, block.weight[i]);
+        }
+
+        for (row = row1, i = 0; row < row2; row++) {
+            for (col = 0; col < cols; col++, i++) {
+                if (!block.undeveloped[i])
+                    continue;
+                region = block.region[i];
+
+                /* realloc if needed */
+                if (undeveloped_cells->num[region] >=
+                    undeveloped_cells->max[region]) {
+                    new_size = 1.25 * undeveloped_cells->max[region];
+                    undeveloped_cells->cells[region] =
+                        (struct UndevelopedCell *)G_realloc(
+                            undeveloped_cells->cells[region],
+                            new_size * sizeof(struct UndevelopedCell));
+                    undeveloped_cells->max[region] = new_size;
+                }
+                id = get_idx_from_xy(row, col, cols);
+                idx = undeveloped_cells->num[region];
+                undeveloped_cells->cells[region][idx].id = id;
+                undeveloped_cells->cells[region][idx].tried = 0;
+                /* update undevs and segment */
+                probability = block.probability[i];
+                storage_put(&segments->probability, (void *)&probability, row,
+                            col);
+                undeveloped_cells->cells[region][idx].probability =
+                    probability;
+
+                undeveloped_cells->num[region]++;
             }
-            id = get_idx_from_xy(row, col, cols);
-            idx = undeveloped_cells->num[region];
-            undeveloped_cells->cells[region][idx].id = id;
-            undeveloped_cells->cells[region][idx].tried = 0;
-            /* get probability and update undevs and segment*/
-            probability = get_develop_probability_xy(
-                segments, values, potential_info, region, row, col);
-            Segment_put(&segments->probability, (void *)&probability, row, col);
-            undeveloped_cells->cells[region][idx].probability = probability;
-
-            undeveloped_cells->num[region]++;
         }
     }
-    Segment_flush(&segments->probability);
+    storage_flush(&segments->probability);
+
+    G_free(block.undeveloped);
+    G_free(block.developed);
+    G_free(block.region);
+    G_free(block.pot_index);
+    G_free(block.devpressure);
+    G_free(block.predictors);
+    G_free(block.weight);
+    G_free(block.probability);
 
     i = 0;
     for (region_idx = 0; region_idx < undeveloped_cells->max_subregions;
@@ -252,7 +359,8 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
  * \param segments segments
  * \param patch_sizes list of patch sizes to pick from
  * \param patch_info patch parameters
- * \param devpressure_info development presure parameters
+ * \param developed_cells cells developed during the step, development
+ * pressure is updated at the end of the step
  * \param patch_overflow overflow of cells to next step
  * \param step step number
  * \param region region index
@@ -261,17 +369,16 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
 void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                   enum seed_search search_alg, struct Segments *segments,
                   struct PatchSizes *patch_sizes, struct PatchInfo *patch_info,
-                  struct DevPressure *devpressure_info, int *patch_overflow,
+                  struct DevelopedCells *developed_cells, int *patch_overflow,
                   int step, int region,
                   struct KeyValueIntInt *reverse_region_map, bool overgrow)
 {
-    int i, idx;
+    int idx;
     int region_id;
     int n_to_convert;
     int n_done;
     int found;
     int seed_row, seed_col;
-    int row, col;
     int patch_size;
     int *added_ids;
     bool force_convert_all;
@@ -336,14 +443,14 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
         /* mark as tried */
         undev_cells->cells[region][idx].tried = 1;
         /* see if seed was already developed during this time step */
-        Segment_get(&segments->developed, (void *)&developed, seed_row,
+        storage_get(&segments->developed, (void *)&developed, seed_row,
                     seed_col);
         if (developed != -1) {
             unsuccessful_tries++;
             continue;
         }
         /* get probability */
-        Segment_get(&segments->probability, (void *)&prob, seed_row, seed_col);
+        storage_get(&segments->probability, (void *)&prob, seed_row, seed_col);
         /* challenge probability unless we need to convert all */
         if (force_convert_all || G_drand48() < prob) {
             /* ger random patch size */
@@ -360,13 +467,8 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
             /*output_developed_step(&segments->developed, "debug",
                                   2000, -1, step, false, false);
             */
-            /* update devpressure for every newly developed cell */
-            for (i = 0; i < found; i++) {
-                get_xy_from_idx(added_ids[i], Rast_window_cols(), &row, &col);
-                update_development_pressure_precomputed(row, col, segments,
-                                                        devpressure_info);
-            }
-            Segment_flush(&segments->devpressure);
+            /* devpressure is updated at the end of the step */
+            add_developed_cells(developed_cells, added_ids, found);
             n_done += found;
         }
     }
@@ -5,6 +5,7 @@
 
 #include "inputs.h"
 #include "patch.h"
+#include "devpressure.h"
 
 enum seed_search { RANDOM, PROBABILITY };
 
@@ -20,7 +21,7 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
 void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                   enum seed_search search_alg, struct Segments *segments,
                   struct PatchSizes *patch_sizes, struct PatchInfo *patch_info,
-                  struct DevPressure *devpressure_info, int *patch_overflow,
+                  struct DevelopedCells *developed_cells, int *patch_overflow,
                   int step, int region,
                   struct KeyValueIntInt *reverse_region_map, bool overgrow);
 
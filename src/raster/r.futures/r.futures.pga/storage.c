@@ -0,0 +1,105 @@
+/*!
+   \file storage.c
+
+   \brief Access to raster maps kept in memory or in segment files
+
+   (C) 2016-2019 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <string.h>
+
+#include <grass/gis.h>
+#include <grass/segment.h>
+
+#include "storage.h"
+
+/*!
+ * \brief Open storage for a raster map
+ *
+ * When the whole maps fit into memory, the map is kept in a plain
+ * array, which avoids the overhead of segment access.
+ * Otherwise a segment file is created.
+ *
+ * \param[out] storage storage
+ * \param rows number of rows
+ * \param cols number of columns
+ * \param len size of a cell in bytes
+ * \param info segment parameters
+ * \return 1 on success, return value of Segment_open() otherwise
+ */
+int storage_open(struct Storage *storage, int rows, int cols, int len,
+                 struct SegmentMemory info)
+{
+    storage->cols = cols;
+    storage->len = len;
+    storage->data = NULL;
+    if (info.dense) {
+        storage->data = G_calloc((size_t)rows * cols, len);
+        return 1;
+    }
+    return Segment_open(&storage->segment, G_tempfile(), rows, cols,
+                        info.rows, info.cols, len, info.in_memory);
+}
+
+/*!
+ * \brief Read a whole row
+ *
+ * With segment file, storage must be flushed before.
+ *
+ * \param storage storage
+ * \param[out] buf row buffer
+ * \param row row
+ */
+void storage_get_row(struct Storage *storage, void *buf, int row)
+{
+    if (storage->data)
+        memcpy(buf, storage->data + (size_t)row * storage->cols * storage->len,
+               (size_t)storage->cols * storage->len);
+    else
+        Segment_get_row(&storage->segment, buf, row);
+}
+
+/*!
+ * \brief Write a whole row
+ * \param storage storage
+ * \param buf row buffer
+ * \param row row
+ */
+void storage_put_row(struct Storage *storage, const void *buf, int row)
+{
+    if (storage->data)
+        memcpy(storage->data + (size_t)row * storage->cols * storage->len, buf,
+               (size_t)storage->cols * storage->len);
+    else
+        Segment_put_row(&storage->segment, buf, row);
+}
+
+/*!
+ * \brief Write modified segments to the segment file
+ * \param storage storage
+ */
+void storage_flush(struct Storage *storage)
+{
+    if (!storage->data)
+        Segment_flush(&storage->segment);
+}
+
+/*!
+ * \brief Free memory or close the segment file
+ * \param storage storage
+ */
+void storage_close(struct Storage *storage)
+{
+    if (storage->data) {
+        G_free(storage->data);
+        storage->data = NULL;
+    }
+    else
+        Segment_close(&storage->segment);
+}
@@ -0,0 +1,54 @@
+#ifndef FUTURES_STORAGE_H
+#define FUTURES_STORAGE_H
+
+#include <stdbool.h>
+#include <string.h>
+#include <grass/segment.h>
+
+struct SegmentMemory {
+    int rows;
+    int cols;
+    int in_memory;
+    /* whole maps fit into memory, segment files are not needed */
+    bool dense;
+};
+
+/* raster map kept either in a plain array or in a segment file */
+struct Storage {
+    SEGMENT segment;
+    char *data;
+    int cols;
+    int len;
+};
+
+int storage_open(struct Storage *storage, int rows, int cols, int len,
+                 struct SegmentMemory info);
+void storage_get_row(struct Storage *storage, void *buf, int row);
+void storage_put_row(struct Storage *storage, const void *buf, int row);
+void storage_flush(struct Storage *storage);
+void storage_close(struct Storage *storage);
+
+static inline void storage_get(struct Storage *storage, void *value, int row,
+                               int col)
+{
+    if (storage->data)
+        memcpy(value,
+               storage->data +
+                   ((size_t)row * storage->cols + col) * storage->len,
+               storage->len);
+    else
+        Segment_get(&storage->segment, value, row, col);
+}
+
+static inline void storage_put(struct Storage *storage, const void *value,
+                               int row, int col)
+{
+    if (storage->data)
+        memcpy(storage->data +
+                   ((size_t)row * storage->cols + col) * storage->len,
+               value, storage->len);
+    else
+        Segment_put(&storage->segment, value, row, col);
+}
+
+#endif // FUTURES_STORAGE_H
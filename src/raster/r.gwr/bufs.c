@@ -8,9 +8,12 @@
    the i/o bufs will be rotated by the read operation so that the
    last row read will be in the last i/o buf
 
+   nblock rows are processed at once, after reading nblock rows,
+   the center row of block row i is in buf[bw + i]
+
  */
 
-int allocate_bufs(struct rb *rbuf, int ncols, int bw, int fd)
+int allocate_bufs(struct rb *rbuf, int ncols, int bw, int nblock, int fd)
 {
     int i;
     int ncolsbw;
@@ -20,7 +23,7 @@ int allocate_bufs(struct rb *rbuf, int ncols, int bw, int fd)
     bufsize = ncolsbw * sizeof(DCELL);
 
     rbuf->bw = bw;
-    rbuf->nsize = bw * 2 + 1;
+    rbuf->nsize = bw * 2 + nblock;
     rbuf->fd = fd;
     rbuf->row = 0;
 
@@ -8,7 +8,11 @@
 #include <grass/gis.h>
 #include <grass/glocale.h>
 #include <grass/raster.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "local_proto.h"
+#include "gwr.h"
 
 #ifndef USE_RAND
 
@@ -46,375 +50,485 @@ void init_rand(void)
 
 #endif
 
-/* estimate bandwidth
- * start with a small bandwidth */
-
-int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
-                       DCELL *est, int bw)
+/* cross-validation of candidate bandwidths
+ *
+ * the same sample of cells is used for all bandwidths and the score
+ * of each tested bandwidth is kept, such that a bandwidth is never
+ * tested twice. Several bandwidths are tested with one pass over the
+ * input maps: for each sample cell, the valid neighbours within the
+ * largest bandwidth are collected once, the smaller bandwidths use a
+ * subset of this list */
+
+struct bw_cv {
+    int *inx, ninx, iny;
+    int nrows, ncols;
+    struct gwr_pnt *smp; /* sample cells, ordered by row */
+    int nsmp;
+    int nprocs, nblock;
+    struct gwr_ws **ws;
+    DCELL **cval;
+    DCELL **est;
+    double *ss; /* mean squared error, < 0: not tested, inf: failed */
+};
+
+/* valid neighbours within bw in row-major order, without the center
+ * offsets go to ws->cur_pnts, predictors and y to ws->seg_val */
+static int get_neighbours(struct bw_cv *cv, struct rb *xbuf, struct rb *ybuf,
+                          int rr, int cc, int bw, struct gwr_ws *ws)
 {
-    int i;
-    int r, c;
-    struct rb *xbuf1, *xbuf2, *xbuf3, ybuf1, ybuf2, ybuf3;
-    int prevbw, nextbw, newbw, lastbw, bestbw, bwhi;
-    int bwmin, bwmax;
-    int n1, n2, n3;
-    double f11, f12, f2;
-    double ss1, ss2, ss3, ssmin;
-    double **w1, **w2, **w3;
-    DCELL *ybuf, yval;
-    DCELL est1, est2, est3;
-    int nr, nc, nrt, nct, count, gwrfailed, step, havemin;
-
-    ybuf = Rast_allocate_d_buf();
+    int dr, dc, i, n, isnull;
+    int ninx = cv->ninx;
+    DCELL *val;
 
-    G_message(_("Estimating optimal bandwidth..."));
+    n = 0;
+    for (dr = -bw; dr <= bw; dr++) {
+        for (dc = -bw; dc <= bw; dc++) {
+            if (dr * dr + dc * dc > bw * bw || (dr == 0 && dc == 0))
+                continue;
 
-    /* count non-NULL cells of the dependent variable */
-    nc = 0;
-    for (r = 0; r < nrows; r++) {
+            val = &ws->seg_val[n * (ninx + 1)];
 
-        Rast_get_d_row(iny, ybuf, r);
+            isnull = 0;
+            for (i = 0; i < ninx; i++) {
+                val[i] = xbuf[i].buf[rr + dr][cc + dc];
+                if (Rast_is_d_null_value(&val[i])) {
+                    isnull = 1;
+                    break;
+                }
+            }
+            if (isnull)
+                continue;
 
-        for (c = 0; c < ncols; c++) {
-            yval = ybuf[c];
+            val[ninx] = ybuf->buf[rr + dr][cc + dc];
+            if (Rast_is_d_null_value(&val[ninx]))
+                continue;
 
-            if (!Rast_is_d_null_value(&yval))
-                nc++;
+            ws->cur_pnts[n].r = dr;
+            ws->cur_pnts[n].c = dc;
+            n++;
         }
     }
-    if (nc == 0)
-        G_fatal_error(_("No non-NULL cells in input map"));
 
-    /* number of cells to use for bandwidth estimation */
-    nr = 10000;
-    if (nr > nc)
-        nr = nc;
+    return n;
+}
 
-    if (bw < 2) {
-        G_warning(_("Initial bandwidth must be > 1"));
-        bw = 2;
-    }
+/* leave-one-out estimate for the current sample cell with bandwidth bw
+ * using the first nfound neighbours in ws
+ * same order of summation as gwr() */
+static int cv_estimate(struct bw_cv *cv, struct gwr_ws *ws, int nfound,
+                       DCELL *cval, int bw, double **w, DCELL *est)
+{
+    int n, i, dr, dc, count;
+    int ninx = cv->ninx;
+    double wn;
+    DCELL *val;
+
+    clear_sums(ws);
+
+    count = 0;
+    for (n = 0; n < nfound; n++) {
+        dr = ws->cur_pnts[n].r;
+        dc = ws->cur_pnts[n].c;
+        if (dr < -bw || dr > bw || dc < -bw || dc > bw)
+            continue;
 
-    bwmin = 1;
-    bwmax = sqrt((double)nrows * nrows + (double)ncols * ncols);
+        wn = w[dr + bw][dc + bw];
+        if (wn == 0)
+            continue;
 
-    init_rand();
+        val = &ws->seg_val[n * (ninx + 1)];
+        for (i = 0; i < ninx; i++)
+            ws->xval[i + 1] = val[i];
 
-    xbuf1 = G_malloc(ninx * sizeof(struct rb));
-    xbuf2 = G_malloc(ninx * sizeof(struct rb));
-    xbuf3 = G_malloc(ninx * sizeof(struct rb));
+        add_sums(ws, val[ninx], wn);
+        count++;
+    }
 
-    lastbw = bestbw = bw;
-    ssmin = 1.0 / 0.0;
-    bwhi = 0;
-    step = 2;
-    havemin = 0;
-    while (1) {
+    if (count < ninx + 1)
+        return 0;
 
-        if (bw > bwmax)
-            break;
+    if (!solve_models(ws))
+        return 0;
 
-        if (bwhi < bw)
-            bwhi = bw;
+    for (i = 0; i < ninx; i++)
+        ws->xval[i + 1] = cval[i];
 
-        prevbw = bw - step;
-        nextbw = bw + step;
+    estimate_models(ws, est);
 
-        G_message(_("Testing bandwidth %d"), bw);
+    return count;
+}
 
-        for (i = 0; i < ninx; i++) {
-            allocate_bufs(&(xbuf1[i]), ncols, prevbw, inx[i]);
-            allocate_bufs(&(xbuf2[i]), ncols, bw, inx[i]);
-            allocate_bufs(&(xbuf3[i]), ncols, nextbw, inx[i]);
+/* test all bandwidths in bws that have not yet been tested */
+static void test_bandwidths(struct bw_cv *cv, int *bws, int nbws)
+{
+    int i, k, n, b, r0, nb, s0, s1, bwbuf, ntest, npnts;
+    int test[3];
+    double **w[3], *sqerr[3];
+    struct rb *xbuf, ybuf;
+    int ninx = cv->ninx;
+
+    ntest = 0;
+    bwbuf = 0;
+    for (k = 0; k < nbws; k++) {
+        int dup = 0;
+
+        if (cv->ss[bws[k]] >= 0)
+            continue;
+        for (i = 0; i < ntest; i++) {
+            if (test[i] == bws[k])
+                dup = 1;
         }
-        allocate_bufs(&ybuf1, ncols, prevbw, iny);
-        allocate_bufs(&ybuf2, ncols, bw, iny);
-        allocate_bufs(&ybuf3, ncols, nextbw, iny);
+        if (dup)
+            continue;
 
-        /* initialize the raster buffers with 'bw' rows */
-        for (r = 0; r < prevbw; r++) {
-            for (i = 0; i < ninx; i++)
-                readrast(&(xbuf1[i]), nrows, ncols);
-            readrast(&ybuf1, nrows, ncols);
-        }
-        for (r = 0; r < bw; r++) {
-            for (i = 0; i < ninx; i++)
-                readrast(&(xbuf2[i]), nrows, ncols);
-            readrast(&ybuf2, nrows, ncols);
+        test[ntest] = bws[k];
+        G_message(_("Testing bandwidth %d"), test[ntest]);
+        if (bwbuf < test[ntest])
+            bwbuf = test[ntest];
+
+        w[ntest] = calc_weights(test[ntest]);
+        /* leave one out: the center cell */
+        w[ntest][test[ntest]][test[ntest]] = 0.;
+
+        sqerr[ntest] = G_malloc(cv->nsmp * sizeof(double));
+
+        ntest++;
+    }
+    if (ntest == 0)
+        return;
+
+    /* neighbour list of each thread */
+    npnts = (2 * bwbuf + 1) * (2 * bwbuf + 1);
+    for (i = 0; i < cv->nprocs; i++) {
+        struct gwr_ws *ws = cv->ws[i];
+
+        if (ws->npnts_alloc < npnts) {
+            if (ws->cur_pnts) {
+                G_free(ws->cur_pnts);
+                G_free(ws->seg_val);
+            }
+            ws->npnts_alloc = npnts;
+            ws->cur_pnts = G_malloc(sizeof(struct gwr_pnt) * npnts);
+            ws->seg_val = G_malloc((size_t)npnts * (ninx + 1) * sizeof(DCELL));
         }
-        for (r = 0; r < nextbw; r++) {
+    }
+
+    xbuf = G_malloc(ninx * sizeof(struct rb));
+    for (i = 0; i < ninx; i++)
+        allocate_bufs(&(xbuf[i]), cv->ncols, bwbuf, cv->nblock, cv->inx[i]);
+    allocate_bufs(&ybuf, cv->ncols, bwbuf, cv->nblock, cv->iny);
+
+    /* initialize the raster buffers with 'bw' rows */
+    for (b = 0; b < bwbuf; b++) {
+        for (i = 0; i < ninx; i++)
+            readrast(&(xbuf[i]), cv->nrows, cv->ncols);
+        readrast(&ybuf, cv->nrows, cv->ncols);
+    }
+
+    s1 = 0;
+    for (r0 = 0; r0 < cv->nrows; r0 += cv->nblock) {
+        G_percent(r0, cv->nrows, 4);
+
+        nb = cv->nrows - r0 < cv->nblock ? cv->nrows - r0 : cv->nblock;
+
+        /* always read nblock rows, row r0 + b is in buf[bwbuf + b] */
+        for (b = 0; b < cv->nblock; b++) {
             for (i = 0; i < ninx; i++)
-                readrast(&(xbuf3[i]), nrows, ncols);
-            readrast(&ybuf3, nrows, ncols);
+                readrast(&(xbuf[i]), cv->nrows, cv->ncols);
+            readrast(&ybuf, cv->nrows, cv->ncols);
         }
 
-        w1 = calc_weights(prevbw);
-        w2 = calc_weights(bw);
-        w3 = calc_weights(nextbw);
-        /* leave one out: the center cell */
-        w1[prevbw][prevbw] = 0.;
-        w2[bw][bw] = 0.;
-        w3[nextbw][nextbw] = 0.;
+        /* sample cells in this block */
+        s0 = s1;
+        while (s1 < cv->nsmp && cv->smp[s1].r < r0 + nb)
+            s1++;
 
-        ss1 = ss2 = ss3 = 0;
-        n1 = n2 = n3 = 0;
+#pragma omp parallel for schedule(dynamic) private(i, k)
+        for (n = s0; n < s1; n++) {
+            int t_id = 0;
+            int rr, cc, nfound;
+            struct gwr_ws *ws;
+            DCELL *cval, *est, yval;
 
-        nrt = nr;
-        nct = nc;
-        count = 0;
+#ifdef _OPENMP
+            t_id = omp_get_thread_num();
+#endif
+            ws = cv->ws[t_id];
+            cval = cv->cval[t_id];
+            est = cv->est[t_id];
 
-        for (r = 0; r < nrows; r++) {
-            G_percent(r, nrows, 4);
+            rr = bwbuf + cv->smp[n].r - r0;
+            cc = bwbuf + cv->smp[n].c;
 
-            for (i = 0; i < ninx; i++) {
-                readrast(&(xbuf1[i]), nrows, ncols);
-                readrast(&(xbuf2[i]), nrows, ncols);
-                readrast(&(xbuf3[i]), nrows, ncols);
-            }
-            readrast(&ybuf1, nrows, ncols);
-            readrast(&ybuf2, nrows, ncols);
-            readrast(&ybuf3, nrows, ncols);
-
-            for (c = 0; c < ncols; c++) {
-                yval = ybuf2.buf[bw][c + bw];
-
-                if (Rast_is_d_null_value(&yval))
-                    continue;
-
-                gwrfailed = 0;
-
-                if (make_rand() % nct < nrt) {
-
-                    if (gwr(xbuf1, ninx, &ybuf1, c, prevbw, w1, est, NULL)) {
-                        est1 = est[0];
-                    }
-                    else {
-                        gwrfailed = 1;
-                    }
-                    if (gwr(xbuf2, ninx, &ybuf2, c, bw, w2, est, NULL)) {
-                        est2 = est[0];
-                    }
-                    else {
-                        gwrfailed = 1;
-                    }
-                    if (gwr(xbuf3, ninx, &ybuf3, c, nextbw, w3, est, NULL)) {
-                        est3 = est[0];
-                    }
-                    else {
-                        gwrfailed = 1;
-                    }
-                    if (!gwrfailed) {
-                        ss1 += (est1 - yval) * (est1 - yval);
-                        n1++;
-                        ss2 += (est2 - yval) * (est2 - yval);
-                        n2++;
-                        ss3 += (est3 - yval) * (est3 - yval);
-                        n3++;
-
-                        nrt--;
-                    }
-                    count++;
-                }
-                nct--;
+            nfound = get_neighbours(cv, xbuf, &ybuf, rr, cc, bwbuf, ws);
+
+            for (i = 0; i < ninx; i++)
+                cval[i] = xbuf[i].buf[rr][cc];
+            yval = ybuf.buf[rr][cc];
+
+            for (k = 0; k < ntest; k++) {
+                if (cv_estimate(cv, ws, nfound, cval, test[k], w[k], est))
+                    sqerr[k][n] = (est[0] - yval) * (est[0] - yval);
+                else
+                    sqerr[k][n] = -1;
             }
         }
-        G_percent(nrows, nrows, 4);
+    }
+    G_percent(cv->nrows, cv->nrows, 4);
 
-        for (i = 0; i < ninx; i++) {
-            release_bufs(&(xbuf1[i]));
-            release_bufs(&(xbuf2[i]));
-            release_bufs(&(xbuf3[i]));
-        }
-        release_bufs(&ybuf1);
-        release_bufs(&ybuf2);
-        release_bufs(&ybuf3);
-
-        G_debug(3, "count: %d", count);
-
-        if (n1 < count || n2 < count || n3 < count) {
-            G_debug(1, "increasing bwmin to %d", bw + 1);
-            bwmin = bw + 1;
-            bw += step + 1;
-            ss1 = 3;
-            ss2 = 2;
-            ss3 = 1;
-            n1 = n2 = n3 = 1;
-            continue;
-        }
+    for (i = 0; i < ninx; i++)
+        release_bufs(&(xbuf[i]));
+    release_bufs(&ybuf);
+    G_free(xbuf);
 
-        ss1 /= n1;
-        ss2 /= n2;
-        ss3 /= n3;
+    /* combine in sample order */
+    for (k = 0; k < ntest; k++) {
+        double ss = 0;
 
-        G_debug(1, "ss1: %g", ss1);
-        G_debug(1, "ss2: %g", ss2);
-        G_debug(1, "ss3: %g", ss3);
+        for (n = 0; n < cv->nsmp; n++) {
+            if (sqerr[k][n] < 0) {
+                ss = 1.0 / 0.0;
+                break;
+            }
+            ss += sqerr[k][n];
+        }
+        cv->ss[test[k]] = ss / cv->nsmp;
+
+        G_debug(1, "bw %d: ss %g", test[k], cv->ss[test[k]]);
 
 #if 0
         /* activate for debugging */
-        printf("%d|%g\n", prevbw, ss1);
-        printf("%d|%g\n", bw, ss2);
-        printf("%d|%g\n", nextbw, ss3);
+        printf("%d|%g\n", test[k], cv->ss[test[k]]);
 #endif
 
-        /* first gradient */
-        f11 = ss2 - ss1;
-        /* second gradient */
-        f12 = ss3 - ss2;
-        /* gradient of gradient */
-        f2 = f12 - f11;
-
-        G_free(w1[0]);
-        G_free(w2[0]);
-        G_free(w3[0]);
-        G_free(w1);
-        G_free(w2);
-        G_free(w3);
-
-/* deactivate to get sum of squares for (newbw = bw; newbw > 1; newbw--) */
-#if 1
-        newbw = bw;
-
-        if (ss2 < ss1 && ss2 < ss3) {
-            /* local minimum */
-            havemin = 1;
-
-            if (lastbw > bw)
-                newbw = bw - 2;
-            else
-                newbw = bw + 2;
-
-            if (ss2 < ssmin) {
-                G_debug(1, "New candidate %d", bw);
-            }
-            else if (ss2 > ssmin) {
-                G_debug(1, "Local minimum at %d is larger than %d", bw, bestbw);
-            }
-            else { /* ss2 == ssmin */
-                break;
-            }
-        }
-        else if (ss2 > ss1 && ss2 > ss3) {
-            /* local maximum */
-            G_debug(1, "Detected local maximum at bw %d", bw);
-            if (ss1 < ss3) {
-                newbw = bw - 1;
-                if (newbw == lastbw)
-                    newbw--;
-                if (newbw - step < bwmin) {
-                    newbw = bw + 3;
-                    if (newbw == lastbw)
-                        newbw++;
+        G_free(sqerr[k]);
+        G_free(w[k][0]);
+        G_free(w[k]);
+    }
+}
+
+/* estimate bandwidth
+ * bracket the minimum of the cross-validation score starting with the
+ * given bandwidth, then narrow it down with a golden-section search */
+
+int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
+                       int bw, int nprocs)
+{
+    int i, r, c;
+    struct bw_cv cv;
+    struct gwr_pnt *smp;
+    DCELL **xrow, *yrow;
+    int nr, nc, nrt, nct, isnull;
+    int bwmin, bwmax, step, havemin, bestbw;
+    int x0, x1, x2, bws[3];
+    double ssmin;
+
+    G_message(_("Estimating optimal bandwidth..."));
+
+    xrow = G_malloc(ninx * sizeof(DCELL *));
+    for (i = 0; i < ninx; i++)
+        xrow[i] = Rast_allocate_d_buf();
+    yrow = Rast_allocate_d_buf();
+
+    /* count cells with valid dependent and independent variables */
+    nc = 0;
+    for (r = 0; r < nrows; r++) {
+
+        for (i = 0; i < ninx; i++)
+            Rast_get_d_row(inx[i], xrow[i], r);
+        Rast_get_d_row(iny, yrow, r);
+
+        for (c = 0; c < ncols; c++) {
+            if (Rast_is_d_null_value(&yrow[c]))
+                continue;
+
+            isnull = 0;
+            for (i = 0; i < ninx; i++) {
+                if (Rast_is_d_null_value(&xrow[i][c])) {
+                    isnull = 1;
+                    break;
                 }
             }
-            else {
-                newbw = bw + 1;
-                if (newbw == lastbw)
-                    newbw++;
-            }
+            if (!isnull)
+                nc++;
         }
-        else {
-            /* determine new bandwidth */
-            if (f2 > 0) {
-                /* Newton's method to find the extremum */
-                newbw = bw - (f11 + f12) / (step * f2) + 0.5;
-                if (newbw == bw) {
-                    if (ss1 > ss3) {
-                        /* increase bandwidth */
-                        newbw = bw + 1;
-                    }
-                    else {
-                        newbw = bw - 1;
-                    }
-                }
-                if (newbw - step < bwmin)
-                    newbw = bwmin + step;
-                G_debug(1, "Newton: bw %d, new %d", bw, newbw);
-            }
-            else {
-                if (ss1 < ss3) {
-                    /* decrease bandwidth */
-                    newbw = (bw + bwmin) / 2;
-                    if (newbw - step < bwmin) {
-                        newbw = bwmin + step;
-                        if (newbw == bw)
-                            newbw++;
-                        if (newbw == lastbw)
-                            newbw++;
-                    }
-                }
-                else if (ss1 > ss3) {
-                    /* increase bandwidth */
-                    newbw = bw + bw / 2;
-                }
-                else { /* ss1 == ss3 */
-                    newbw = bw + 1;
-                    if (newbw == lastbw)
-                        newbw++;
+    }
+    if (nc == 0)
+        G_fatal_error(_("No non-NULL cells in input map"));
+
+    /* number of cells to use for bandwidth estimation */
+    nr = 10000;
+    if (nr > nc)
+        nr = nc;
+
+    /* draw the sample once, used for all bandwidths */
+    init_rand();
+
+    smp = G_malloc(nr * sizeof(struct gwr_pnt));
+    nrt = nr;
+    nct = nc;
+    for (r = 0; r < nrows && nrt > 0; r++) {
+
+        for (i = 0; i < ninx; i++)
+            Rast_get_d_row(inx[i], xrow[i], r);
+        Rast_get_d_row(iny, yrow, r);
+
+        for (c = 0; c < ncols; c++) {
+            if (Rast_is_d_null_value(&yrow[c]))
+                continue;
+
+            isnull = 0;
+            for (i = 0; i < ninx; i++) {
+                if (Rast_is_d_null_value(&xrow[i][c])) {
+                    isnull = 1;
+                    break;
                 }
             }
+            if (isnull)
+                continue;
 
-            if (ss1 < ss2 && newbw > bw) {
-                /* moving bw to wrong direction: stop here? */
-                G_debug(1, "f11: %g, f12: %g, f2: %g", f11, f12, f2);
-                if (f11 > 0 && f12 > 0)
-                    newbw = bw - 2;
-                else
-                    newbw = bw + 2;
-            }
-            if (ss3 < ss2 && newbw < bw) {
-                /* moving bw to wrong direction: stop here? */
-                G_debug(1, "f11: %g, f12: %g, f2: %g", f11, f12, f2);
-                if (f11 > 0 && f12 > 0)
-                    newbw = bw - 2;
-                else
-                    newbw = bw + 2;
-            }
-            if (newbw - step < bwmin) {
-                newbw = bwmin + step;
-                if (newbw == bw)
-                    newbw++;
-                if (newbw == lastbw)
-                    newbw++;
+            if (make_rand() % nct < nrt) {
+                smp[nr - nrt].r = r;
+                smp[nr - nrt].c = c;
+                nrt--;
             }
+            nct--;
         }
+    }
 
-        if (ssmin > ss2) {
-            ssmin = ss2;
-            bestbw = bw;
-        }
+    for (i = 0; i < ninx; i++)
+        G_free(xrow[i]);
+    G_free(xrow);
+    G_free(yrow);
 
-        if (newbw - step < bwmin) {
-            newbw = bwhi + step;
-        }
+    if (bw < 2) {
+        G_warning(_("Initial bandwidth must be > 1"));
+        bw = 2;
+    }
 
-        if (newbw == bw)
-            break;
-#else
-        newbw = bw - 1;
-        if (newbw < bwmin)
-            break;
-#endif
+    bwmin = 1;
+    bwmax = sqrt((double)nrows * nrows + (double)ncols * ncols);
+    if (bwmax < 2)
+        bwmax = 2;
+    if (bw > bwmax)
+        bw = bwmax;
 
-        if (newbw < bwmin) {
-            G_debug(1, "Bandwidth is getting too small: %d", newbw);
-            if (bw > bwmin)
-                newbw = bwmin;
-            else
+    cv.inx = inx;
+    cv.ninx = ninx;
+    cv.iny = iny;
+    cv.nrows = nrows;
+    cv.ncols = ncols;
+    cv.smp = smp;
+    cv.nsmp = nr;
+    cv.nprocs = nprocs;
+    cv.nblock = nprocs * 4;
+    cv.ws = G_malloc(nprocs * sizeof(struct gwr_ws *));
+    cv.cval = G_malloc(nprocs * sizeof(DCELL *));
+    cv.est = G_malloc(nprocs * sizeof(DCELL *));
+    for (i = 0; i < nprocs; i++) {
+        cv.ws[i] = create_ws(ninx);
+        cv.cval[i] = G_malloc(ninx * sizeof(DCELL));
+        cv.est[i] = G_malloc((ninx + 1) * sizeof(DCELL));
+    }
+    cv.ss = G_malloc((bwmax + 1) * sizeof(double));
+    for (i = 0; i <= bwmax; i++)
+        cv.ss[i] = -1;
+
+    /* bracket the minimum: ss[x1] <= ss[x0] and ss[x1] < ss[x2]
+     * the regression fails for too small bandwidths (ss = inf)
+     * the bracket grows by the golden ratio */
+    step = bw / 2;
+    x1 = bw;
+    x0 = x1 - step;
+    x2 = x1 + step;
+    if (x2 > bwmax)
+        x2 = bwmax;
+    bws[0] = x0;
+    bws[1] = x1;
+    bws[2] = x2;
+    test_bandwidths(&cv, bws, 3);
+
+    havemin = 0;
+    while (1) {
+        if (x1 < x2 && cv.ss[x2] <= cv.ss[x1]) {
+            /* decreasing: increase bandwidth */
+            if (x2 == bwmax)
+                break;
+            step = (x2 - x1) * 1.618 + 0.5;
+            x0 = x1;
+            x1 = x2;
+            x2 = x1 + step;
+            if (x2 > bwmax)
+                x2 = bwmax;
+            G_debug(1, "increasing bandwidth to %d", x2);
+            test_bandwidths(&cv, &x2, 1);
+        }
+        else if (x0 < x1 && cv.ss[x0] < cv.ss[x1]) {
+            /* increasing: decrease bandwidth, at most by half */
+            if (x0 == bwmin)
                 break;
+            step = (x1 - x0) * 1.618 + 0.5;
+            x2 = x1;
+            x1 = x0;
+            if (step > x1 / 2)
+                step = x1 / 2;
+            x0 = x1 - step;
+            if (x0 < bwmin)
+                x0 = bwmin;
+            G_debug(1, "decreasing bandwidth to %d", x0);
+            test_bandwidths(&cv, &x0, 1);
         }
+        else {
+            havemin = x0 < x1 && x1 < x2;
+            break;
+        }
+    }
 
-        lastbw = bw;
-        bw = newbw;
+    /* golden-section search in [x0, x2], both inner bandwidths are
+     * tested with the same pass */
+    while (x2 - x0 > 3) {
+        int d = (x2 - x0) * 0.381966 + 0.5;
+
+        bws[0] = x0 + d;
+        bws[1] = x2 - d;
+        if (bws[1] <= bws[0])
+            bws[1] = bws[0] + 1;
+        test_bandwidths(&cv, bws, 2);
+
+        if (cv.ss[bws[0]] <= cv.ss[bws[1]] && cv.ss[bws[0]] < 1.0 / 0.0)
+            x2 = bws[1];
+        else
+            x0 = bws[0];
+        G_debug(1, "minimum between %d and %d", x0, x2);
     }
+    step = 0;
+    for (i = x0 + 1; i < x2; i++)
+        bws[step++] = i;
+    test_bandwidths(&cv, bws, step);
 
-    if (bw < bwmin)
-        bw = bwmin;
-    if (bw > bwmax)
-        bw = bwmax;
+    /* best tested bandwidth */
+    bestbw = bw;
+    ssmin = 1.0 / 0.0;
+    for (i = bwmin; i <= bwmax; i++) {
+        if (cv.ss[i] >= 0 && cv.ss[i] < ssmin) {
+            ssmin = cv.ss[i];
+            bestbw = i;
+        }
+    }
 
     if (!havemin)
         G_warning(_("Could not find minimum"));
 
-    return bw;
+    for (i = 0; i < nprocs; i++) {
+        free_ws(cv.ws[i]);
+        G_free(cv.cval[i]);
+        G_free(cv.est[i]);
+    }
+    G_free(cv.ws);
+    G_free(cv.cval);
+    G_free(cv.est);
+    G_free(cv.ss);
+    G_free(smp);
+
+    return bestbw;
 }
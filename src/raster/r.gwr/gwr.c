@@ -83,70 +83,197 @@ int solvemat(struct MATRIX *m, double a[], double B[])
     return 1;
 }
 
-int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, int bw, double **w,
-        DCELL *est, double **B0)
+struct gwr_ws *create_ws(int ninx)
 {
-    int r, c;
-    int i, j, k;
-    int nsize;
-    static DCELL *xval = NULL;
-    DCELL yval;
-    int count, isnull, solved;
-    /* OLS */
-    static double **a = NULL;
-    static double **B = NULL;
-    static struct MATRIX *m_all = NULL;
+    struct gwr_ws *ws;
     struct MATRIX *m;
+    int i, k;
 
-    if (!xval) {
-        xval = G_malloc((ninx + 1) * sizeof(DCELL));
-        xval[0] = 1.;
-    }
+    ws = G_malloc(sizeof(struct gwr_ws));
+    ws->ninx = ninx;
 
-    if (!m_all) {
-        m_all = (struct MATRIX *)G_malloc((ninx + 1) * sizeof(struct MATRIX));
-        a = (double **)G_malloc((ninx + 1) * sizeof(double *));
-        B = (double **)G_malloc((ninx + 1) * sizeof(double *));
+    ws->xval = G_malloc((ninx + 1) * sizeof(DCELL));
+    ws->xval[0] = 1.;
+    ws->seg_val = NULL;
 
-        m = &(m_all[0]);
-        m->n = ninx + 1;
-        m->v = (double **)G_malloc(m->n * sizeof(double));
+    ws->m_all = (struct MATRIX *)G_malloc((ninx + 1) * sizeof(struct MATRIX));
+    ws->a = (double **)G_malloc((ninx + 1) * sizeof(double *));
+    ws->B = (double **)G_malloc((ninx + 1) * sizeof(double *));
+
+    for (k = 0; k <= ninx; k++) {
+        m = &(ws->m_all[k]);
+        m->n = k == 0 ? ninx + 1 : ninx;
+        m->v = (double **)G_malloc(m->n * sizeof(double *));
         m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
         for (i = 1; i < m->n; i++) {
             m->v[i] = m->v[i - 1] + m->n;
         }
+        ws->a[k] = (double *)G_malloc(m->n * sizeof(double));
+        ws->B[k] = (double *)G_malloc(m->n * sizeof(double));
+    }
+
+    ws->cur_pnts = NULL;
+    ws->npnts_alloc = 0;
+
+    return ws;
+}
+
+void free_ws(struct gwr_ws *ws)
+{
+    int k;
+
+    for (k = 0; k <= ws->ninx; k++) {
+        /* rows may have been swapped by solvemat() */
+        struct MATRIX *m = &(ws->m_all[k]);
+        double *v0 = m->v[0];
+        int i;
+
+        for (i = 1; i < m->n; i++) {
+            if (m->v[i] < v0)
+                v0 = m->v[i];
+        }
+        G_free(v0);
+        G_free(m->v);
+        G_free(ws->a[k]);
+        G_free(ws->B[k]);
+    }
+    G_free(ws->m_all);
+    G_free(ws->a);
+    G_free(ws->B);
+    G_free(ws->xval);
+    if (ws->seg_val)
+        G_free(ws->seg_val);
+    if (ws->cur_pnts)
+        G_free(ws->cur_pnts);
+    G_free(ws);
+}
+
+void clear_sums(struct gwr_ws *ws)
+{
+    struct MATRIX *m = &(ws->m_all[0]);
+    int i, j;
+
+    for (i = 0; i < m->n; i++) {
+        for (j = i; j < m->n; j++)
+            M(m, i, j) = 0.0;
+        ws->a[0][i] = 0.0;
+    }
+}
+
+/* add the current observation in ws->xval to the sums of the full model,
+ * the models without predictor k are derived in solve_models() */
+void add_sums(struct gwr_ws *ws, DCELL yval, double w)
+{
+    struct MATRIX *m = &(ws->m_all[0]);
+    DCELL *xval = ws->xval;
+    int i, j;
+
+    for (i = 0; i < m->n; i++) {
+        double val1 = xval[i];
+        double *mrow = m->v[i];
 
-        a[0] = (double *)G_malloc(m->n * sizeof(double));
-        B[0] = (double *)G_malloc(m->n * sizeof(double));
+        for (j = i; j < m->n; j++)
+            mrow[j] += val1 * xval[j] * w;
 
-        for (k = 1; k <= ninx; k++) {
-            m = &(m_all[k]);
-            m->n = ninx;
-            m->v = (double **)G_malloc(m->n * sizeof(double *));
-            m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
-            for (i = 1; i < m->n; i++) {
-                m->v[i] = m->v[i - 1] + m->n;
+        ws->a[0][i] += yval * val1 * w;
+    }
+}
+
+/* returns 1 if all equation systems could be solved */
+int solve_models(struct gwr_ws *ws)
+{
+    int i, j, k, i2, j2, solved;
+    int ninx = ws->ninx;
+    struct MATRIX *m, *m0 = &(ws->m_all[0]);
+
+    /* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
+    for (i = 1; i < m0->n; i++)
+        for (j = 0; j < i; j++)
+            M(m0, i, j) = M(m0, j, i);
+
+    /* linear model without predictor k */
+    for (k = 1; k <= ninx; k++) {
+        m = &(ws->m_all[k]);
+        for (i = 0, i2 = 0; i <= ninx; i++) {
+            if (i == k)
+                continue;
+            for (j = 0, j2 = 0; j <= ninx; j++) {
+                if (j == k)
+                    continue;
+                M(m, i2, j2) = M(m0, i, j);
+                j2++;
             }
-            a[k] = (double *)G_malloc(m->n * sizeof(double));
-            B[k] = (double *)G_malloc(m->n * sizeof(double));
+            ws->a[k][i2] = ws->a[0][i];
+            i2++;
+        }
+    }
+
+    /* estimate coefficients */
+    solved = ninx + 1;
+    for (k = 0; k <= ninx; k++) {
+        m = &(ws->m_all[k]);
+
+        for (i = 0; i < m->n; i++)
+            ws->B[k][i] = 0.0;
+
+        if (!solvemat(m, ws->a[k], ws->B[k])) {
+            G_debug(1, "Solving matrix %d failed", k);
+            solved--;
         }
     }
+    if (solved < ninx + 1) {
+        G_debug(3, "%d of %d equation systems could not be solved",
+                ninx + 1 - solved, ninx + 1);
+        return 0;
+    }
+
+    return 1;
+}
 
+/* estimates for the predictors in ws->xval */
+void estimate_models(struct gwr_ws *ws, DCELL *est)
+{
+    int i, j, k;
+    int ninx = ws->ninx;
+    DCELL *xval = ws->xval;
+
+    est[0] = 0.0;
     for (k = 0; k <= ninx; k++) {
-        m = &(m_all[k]);
-        for (i = 0; i < m->n; i++) {
-            for (j = i; j < m->n; j++)
-                M(m, i, j) = 0.0;
-            a[k][i] = 0.0;
-            B[k][i] = 0.0;
+        est[0] += ws->B[0][k] * xval[k];
+
+        if (k > 0) {
+            est[k] = 0.0;
+
+            /* linear model without predictor k */
+            for (i = 0; i <= ninx; i++) {
+                if (i != k) {
+                    j = k > i ? i : i - 1;
+                    est[k] += ws->B[k][j] * xval[i];
+                }
+            }
         }
     }
+}
+
+/* rr is the row of the current cell in the buffers */
+int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int rr, int cc, int bw,
+        double **w, struct gwr_ws *ws, DCELL *est, double **B0)
+{
+    int r, c, r0;
+    int i;
+    int nsize;
+    DCELL *xval = ws->xval;
+    DCELL yval;
+    int count, isnull;
+
+    clear_sums(ws);
 
     Rast_set_d_null_value(est, ninx + 1);
     if (B0)
         *B0 = NULL;
 
     nsize = bw * 2 + 1;
+    r0 = rr - bw;
 
     /* first pass: collect values */
     count = 0;
@@ -159,7 +286,7 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, int bw, double **w,
 
             isnull = 0;
             for (i = 0; i < ninx; i++) {
-                xval[i + 1] = xbuf[i].buf[r][c + cc];
+                xval[i + 1] = xbuf[i].buf[r0 + r][c + cc];
                 if (Rast_is_d_null_value(&(xval[i + 1]))) {
                     isnull = 1;
                     break;
@@ -168,40 +295,11 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, int bw, double **w,
             if (isnull)
                 continue;
 
-            yval = ybuf->buf[r][c + cc];
+            yval = ybuf->buf[r0 + r][c + cc];
             if (Rast_is_d_null_value(&yval))
                 continue;
 
-            for (i = 0; i <= ninx; i++) {
-                double val1 = xval[i];
-
-                for (j = i; j <= ninx; j++) {
-                    double val2 = xval[j];
-
-                    m = &(m_all[0]);
-                    M(m, i, j) += val1 * val2 * w[r][c];
-
-                    /* linear model without predictor k */
-                    for (k = 1; k <= ninx; k++) {
-                        if (k != i && k != j) {
-                            int i2 = k > i ? i : i - 1;
-                            int j2 = k > j ? j : j - 1;
-
-                            m = &(m_all[k]);
-                            M(m, i2, j2) += val1 * val2 * w[r][c];
-                        }
-                    }
-                }
-
-                a[0][i] += yval * val1 * w[r][c];
-                for (k = 1; k <= ninx; k++) {
-                    if (k != i) {
-                        int i2 = k > i ? i : i - 1;
-
-                        a[k][i2] += yval * val1 * w[r][c];
-                    }
-                }
-            }
+            add_sums(ws, yval, w[r][c]);
             count++;
         }
     }
@@ -212,37 +310,14 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, int bw, double **w,
         return 0;
     }
 
-    /* estimate coefficients */
-    solved = ninx + 1;
-    for (k = 0; k <= ninx; k++) {
-        m = &(m_all[k]);
-
-        /* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
-        for (i = 1; i < m->n; i++)
-            for (j = 0; j < i; j++)
-                M(m, i, j) = M(m, j, i);
-
-        if (!solvemat(m, a[k], B[k])) {
-            /*
-            for (i = 0; i <= ninx; i++) {
-                fprintf(stdout, "b%d=0.0\n", i);
-            }
-            */
-            G_debug(1, "Solving matrix %d failed", k);
-            solved--;
-        }
-    }
-    if (solved < ninx + 1) {
-        G_debug(3, "%d of %d equation systems could not be solved",
-                ninx + 1 - solved, ninx + 1);
+    if (!solve_models(ws))
         return 0;
-    }
 
     /* second pass: calculate estimates */
     isnull = 0;
     for (i = 0; i < ninx; i++) {
 
-        xval[i + 1] = xbuf[i].buf[bw][cc + bw];
+        xval[i + 1] = xbuf[i].buf[rr][cc + bw];
         if (Rast_is_d_null_value(&(xval[i + 1]))) {
             isnull = 1;
             break;
@@ -251,24 +326,9 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, int bw, double **w,
     if (isnull)
         return 0;
 
-    est[0] = 0.0;
-    for (k = 0; k <= ninx; k++) {
-        est[0] += B[0][k] * xval[k];
-
-        if (k > 0) {
-            est[k] = 0.0;
-
-            /* linear model without predictor k */
-            for (i = 0; i <= ninx; i++) {
-                if (i != k) {
-                    j = k > i ? i : i - 1;
-                    est[k] += B[k][j] * xval[i];
-                }
-            }
-        }
-    }
+    estimate_models(ws, est);
     if (B0)
-        *B0 = B[0];
+        *B0 = ws->B[0];
 
     return count;
 }
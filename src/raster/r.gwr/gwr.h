@@ -5,4 +5,25 @@ struct MATRIX {
 
 #define M(m, row, col) (m)->v[(row)][(col)]
 
+struct gwr_pnt {
+    int r, c; /* row, col in target window */
+};
+
+/* work space for one thread:
+ * equation systems of the full model (0) and of the models without
+ * predictor k (1 .. ninx) */
+struct gwr_ws {
+    int ninx;
+    DCELL *xval, *seg_val;
+    double **a, **B;
+    struct MATRIX *m_all;
+    struct gwr_pnt *cur_pnts; /* adaptive bandwidth */
+    int npnts_alloc;
+};
+
 int solvemat(struct MATRIX *m, double a[], double B[]);
+
+void clear_sums(struct gwr_ws *ws);
+void add_sums(struct gwr_ws *ws, DCELL yval, double w);
+int solve_models(struct gwr_ws *ws);
+void estimate_models(struct gwr_ws *ws, DCELL *est);
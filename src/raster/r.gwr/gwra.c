@@ -13,10 +13,6 @@
 /* geographically weighted regression:
  * estimate coefficients for given cell */
 
-struct gwr_pnt {
-    int r, c; /* row, col in target window */
-};
-
 static int cmp_rc(const void *first, const void *second, void *avl_param)
 {
     struct rc *a = (struct rc *)first, *b = (struct rc *)second;
@@ -136,83 +132,51 @@ static int bfs_search(FLAG *null_flag, struct gwr_pnt *cur_pnts, int max_points,
     return found;
 }
 
-int gwra(SEGMENT *in_seg, FLAG *null_flag, int ninx, int rr, int cc, int npnts,
-         DCELL *est, double **B0)
+/* reads the values of the found points */
+static void get_values(struct cache *in_seg, struct gwr_pnt *pnts, int npnts,
+                       DCELL *vals, int nvals)
+{
+    int n;
+
+    for (n = 0; n < npnts; n++)
+        cache_get(in_seg, (void *)&vals[n * nvals], pnts[n].r, pnts[n].c);
+}
+
+int gwra(struct cache *in_seg, FLAG *null_flag, int ninx, int rr, int cc,
+         int npnts, struct gwr_ws *ws, DCELL *est, double **B0)
 {
     int r, c, n, nfound;
-    int i, j, k;
+    int i;
     double bw, maxdist2, dist2, w;
-    static DCELL *xval = NULL, *seg_val = NULL;
+    DCELL *xval = ws->xval, *seg_val;
     DCELL yval;
-    int count, isnull, solved;
-    static int npnts_alloc = 0;
-    static struct gwr_pnt *cur_pnts = NULL;
-    /* OLS */
-    static double **a = NULL;
-    static double **B = NULL;
-    static struct MATRIX *m_all = NULL;
-    struct MATRIX *m;
-
-    if (!xval) {
-        xval = G_malloc((ninx + 1) * sizeof(DCELL));
-        xval[0] = 1.;
-        seg_val = G_malloc((ninx + 1) * sizeof(DCELL));
-    }
-
-    if (!m_all) {
-        m_all = (struct MATRIX *)G_malloc((ninx + 1) * sizeof(struct MATRIX));
-        a = (double **)G_malloc((ninx + 1) * sizeof(double *));
-        B = (double **)G_malloc((ninx + 1) * sizeof(double *));
-
-        m = &(m_all[0]);
-        m->n = ninx + 1;
-        m->v = (double **)G_malloc(m->n * sizeof(double));
-        m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
-        for (i = 1; i < m->n; i++) {
-            m->v[i] = m->v[i - 1] + m->n;
-        }
-
-        a[0] = (double *)G_malloc(m->n * sizeof(double));
-        B[0] = (double *)G_malloc(m->n * sizeof(double));
+    int count, isnull;
 
-        for (k = 1; k <= ninx; k++) {
-            m = &(m_all[k]);
-            m->n = ninx;
-            m->v = (double **)G_malloc(m->n * sizeof(double *));
-            m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
-            for (i = 1; i < m->n; i++) {
-                m->v[i] = m->v[i - 1] + m->n;
-            }
-            a[k] = (double *)G_malloc(m->n * sizeof(double));
-            B[k] = (double *)G_malloc(m->n * sizeof(double));
+    /* point list and values of the points, plus the current cell */
+    if (ws->npnts_alloc < npnts) {
+        if (ws->cur_pnts) {
+            G_free(ws->cur_pnts);
+            G_free(ws->seg_val);
         }
+        ws->npnts_alloc = npnts;
+        ws->cur_pnts = G_malloc(sizeof(struct gwr_pnt) * (npnts + 1));
+        ws->seg_val = G_malloc((npnts + 1) * (ninx + 1) * sizeof(DCELL));
     }
 
-    if (npnts_alloc < npnts) {
-        if (cur_pnts)
-            G_free(cur_pnts);
-        npnts_alloc = npnts;
-        cur_pnts = G_malloc(sizeof(struct gwr_pnt) * npnts_alloc);
-    }
-
-    for (k = 0; k <= ninx; k++) {
-        m = &(m_all[k]);
-        for (i = 0; i < m->n; i++) {
-            for (j = i; j < m->n; j++)
-                M(m, i, j) = 0.0;
-            a[k][i] = 0.0;
-            B[k][i] = 0.0;
-        }
-    }
+    clear_sums(ws);
 
     Rast_set_d_null_value(est, ninx + 1);
     if (B0)
         *B0 = NULL;
 
     /* first pass: collect values */
-    nfound = bfs_search(null_flag, cur_pnts, npnts, rr, cc, &maxdist2);
+    nfound = bfs_search(null_flag, ws->cur_pnts, npnts, rr, cc, &maxdist2);
 
-    qsort(cur_pnts, nfound, sizeof(struct gwr_pnt), cmp_pnts);
+    qsort(ws->cur_pnts, nfound, sizeof(struct gwr_pnt), cmp_pnts);
+
+    ws->cur_pnts[nfound].r = rr;
+    ws->cur_pnts[nfound].c = cc;
+    get_values(in_seg, ws->cur_pnts, nfound + 1, ws->seg_val, ninx + 1);
 
     /* bandwidth */
     bw = sqrt(maxdist2);
@@ -221,10 +185,10 @@ int gwra(SEGMENT *in_seg, FLAG *null_flag, int ninx, int rr, int cc, int npnts,
     count = 0;
     for (n = 0; n < nfound; n++) {
 
-        r = cur_pnts[n].r;
-        c = cur_pnts[n].c;
+        r = ws->cur_pnts[n].r;
+        c = ws->cur_pnts[n].c;
 
-        Segment_get(in_seg, (void *)seg_val, r, c);
+        seg_val = &ws->seg_val[n * (ninx + 1)];
 
         isnull = 0;
         for (i = 0; i < ninx; i++) {
@@ -244,36 +208,7 @@ int gwra(SEGMENT *in_seg, FLAG *null_flag, int ninx, int rr, int cc, int npnts,
         dist2 = (r - rr) * (r - rr) + (c - cc) * (c - cc);
         w = w_fn(dist2, bw);
 
-        for (i = 0; i <= ninx; i++) {
-            double val1 = xval[i];
-
-            for (j = i; j <= ninx; j++) {
-                double val2 = xval[j];
-
-                m = &(m_all[0]);
-                M(m, i, j) += val1 * val2 * w;
-
-                /* linear model without predictor k */
-                for (k = 1; k <= ninx; k++) {
-                    if (k != i && k != j) {
-                        int i2 = k > i ? i : i - 1;
-                        int j2 = k > j ? j : j - 1;
-
-                        m = &(m_all[k]);
-                        M(m, i2, j2) += val1 * val2 * w;
-                    }
-                }
-            }
-
-            a[0][i] += yval * val1 * w;
-            for (k = 1; k <= ninx; k++) {
-                if (k != i) {
-                    int i2 = k > i ? i : i - 1;
-
-                    a[k][i2] += yval * val1 * w;
-                }
-            }
-        }
+        add_sums(ws, yval, w);
         count++;
     }
     if (count < ninx + 1) {
@@ -282,33 +217,11 @@ int gwra(SEGMENT *in_seg, FLAG *null_flag, int ninx, int rr, int cc, int npnts,
         return 0;
     }
 
-    /* estimate coefficients */
-    solved = ninx + 1;
-    for (k = 0; k <= ninx; k++) {
-        m = &(m_all[k]);
-
-        /* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
-        for (i = 1; i < m->n; i++)
-            for (j = 0; j < i; j++)
-                M(m, i, j) = M(m, j, i);
-
-        if (!solvemat(m, a[k], B[k])) {
-            /*
-            for (i = 0; i <= ninx; i++) {
-                fprintf(stdout, "b%d=0.0\n", i);
-            }
-            */
-            solved--;
-        }
-    }
-    if (solved < ninx + 1) {
-        G_debug(3, "%d of %d equation systems could not be solved",
-                ninx + 1 - solved, ninx + 1);
+    if (!solve_models(ws))
         return 0;
-    }
 
     /* third pass: calculate estimates */
-    Segment_get(in_seg, (void *)seg_val, rr, cc);
+    seg_val = &ws->seg_val[nfound * (ninx + 1)];
     isnull = 0;
     for (i = 0; i < ninx; i++) {
 
@@ -321,24 +234,9 @@ int gwra(SEGMENT *in_seg, FLAG *null_flag, int ninx, int rr, int cc, int npnts,
     if (isnull)
         return 0;
 
-    est[0] = 0.0;
-    for (k = 0; k <= ninx; k++) {
-        est[0] += B[0][k] * xval[k];
-
-        if (k > 0) {
-            est[k] = 0.0;
-
-            /* linear model without predictor k */
-            for (i = 0; i <= ninx; i++) {
-                if (i != k) {
-                    j = k > i ? i : i - 1;
-                    est[k] += B[k][j] * xval[i];
-                }
-            }
-        }
-    }
+    estimate_models(ws, est);
     if (B0)
-        *B0 = B[0];
+        *B0 = ws->B[0];
 
     return count;
 }
@@ -1,4 +1,4 @@
-#include <grass/segment.h>
+#include "tilecache.h"
 #include "flag.h"
 #include "bufs.h"
 
@@ -8,11 +8,16 @@ extern double (*w_fn)(double, double);
 
 double **calc_weights(int bw);
 
-int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, int bw, double **w,
-        DCELL *est, double **B0);
+struct gwr_ws;
 
-int gwra(SEGMENT *in_seg, FLAG *yflag, int ninx, int rr, int cc, int npnts,
-         DCELL *est, double **B0);
+struct gwr_ws *create_ws(int ninx);
+void free_ws(struct gwr_ws *ws);
+
+int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int rr, int cc, int bw,
+        double **w, struct gwr_ws *ws, DCELL *est, double **B0);
+
+int gwra(struct cache *in_seg, FLAG *yflag, int ninx, int rr, int cc,
+         int npnts, struct gwr_ws *ws, DCELL *est, double **B0);
 
 int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
-                       DCELL *est, int bw);
+                       int bw, int nprocs);
@@ -24,24 +24,34 @@
 #include <grass/gis.h>
 #include <grass/glocale.h>
 #include <grass/raster.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "local_proto.h"
 
+/* results of one row, the fit statistics are summed up serially in cell
+ * order from the coefficients and estimates of each cell */
+struct gwr_row {
+    DCELL *res, *est, **b; /* output rows */
+    double *Bc, *yest;     /* n_predictors + 1 values per cell */
+    DCELL *y;
+    char *done;            /* 1: coefficients, 2: also residuals */
+};
+
 int main(int argc, char *argv[])
 {
     unsigned int r, c, rows, cols, count;
     int *mapx_fd, mapy_fd, mapres_fd, mapest_fd, mask_fd;
     int i, j, k, n_predictors;
-    double yres;
-    double *B, *Bmin, *Bmax, *Bsum, *Bsumsq, *Bmean, Bstddev;
+    double *Bmin, *Bmax, *Bsum, *Bsumsq, *Bmean, Bstddev;
     int bcount;
-    DCELL *yest;
     double sumY, meanY;
     double SStot, SSerr, SSreg, *SSerr_without;
     double Rsq, Rsqadj, SE, F, t, AIC, AICc, BIC;
-    DCELL *mapx_val, mapy_val, *mapy_buf, *mapres_buf, *mapest_buf;
+    DCELL mapy_val, *mapy_buf, *mapres_buf, *mapest_buf;
     CELL *mask_buf;
     struct rb *xbuf, ybuf;
-    SEGMENT in_seg;
+    struct cache in_seg;
     DCELL **segx_buf, *seg_val;
     int segsize, nseg;
     double mem_mb;
@@ -53,10 +63,14 @@ int main(int argc, char *argv[])
     } *outb, *outbp;
     double **weights;
     int bw, npnts;
+    int nprocs, nblock, r0, nb, b;
+    struct gwr_ws **ws;
+    DCELL **yest_t, **cval_t;
+    struct gwr_row *rowres;
     char *name;
     struct Option *input_mapx, *input_mapy, *mask_opt, *output_res, *output_est,
         *output_b, *output_opt, *kernel_opt, *vf_opt, *bw_opt, *pnts_opt,
-        *mem_opt;
+        *mem_opt, *nprocs_opt;
     struct Flag *shell_style, *estimate;
     struct Cell_head region;
     struct GModule *module;
@@ -148,6 +162,8 @@ int main(int argc, char *argv[])
     mem_opt->answer = "300";
     mem_opt->description = _("Memory in MB for adaptive bandwidth");
 
+    nprocs_opt = G_define_standard_option(G_OPT_M_NPROCS);
+
     shell_style = G_define_flag();
     shell_style->key = 'g';
     shell_style->description = _("Print in shell script style");
@@ -166,6 +182,24 @@ int main(int argc, char *argv[])
         }
     }
 
+#ifdef _OPENMP
+    nprocs = atoi(nprocs_opt->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), nprocs_opt->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+    /* rows processed at once */
+    nblock = nprocs * 4;
+
     G_get_window(&region);
     rows = region.rows;
     cols = region.cols;
@@ -178,8 +212,6 @@ int main(int argc, char *argv[])
     /* allocate memory for x maps */
     mapx_fd = (int *)G_malloc(n_predictors * sizeof(int));
     SSerr_without = (double *)G_malloc(n_predictors * sizeof(double));
-    mapx_val = (DCELL *)G_malloc((n_predictors + 1) * sizeof(DCELL));
-    yest = G_malloc(sizeof(DCELL) * (n_predictors + 1));
 
     bw = atoi(bw_opt->answer);
     if (bw < 2)
@@ -199,7 +231,7 @@ int main(int argc, char *argv[])
     mask_buf = NULL;
     if (mask_opt->answer) {
         mask_fd = Rast_open_old(mask_opt->answer, "");
-        mask_buf = Rast_allocate_c_buf();
+        mask_buf = G_malloc((size_t)nblock * cols * sizeof(CELL));
     }
 
     for (i = 0; i < n_predictors; i++) {
@@ -209,7 +241,7 @@ int main(int argc, char *argv[])
 
     if (estimate->answer) {
         bw = estimate_bandwidth(mapx_fd, n_predictors, mapy_fd, rows, cols,
-                                yest, bw);
+                                bw, nprocs);
         if (shell_style->answer)
             fprintf(stdout, "estimate=%d\n", bw);
         else
@@ -230,9 +262,9 @@ int main(int argc, char *argv[])
 
     if (npnts == 0) {
         for (i = 0; i < n_predictors; i++) {
-            allocate_bufs(&xbuf[i], cols, bw, mapx_fd[i]);
+            allocate_bufs(&xbuf[i], cols, bw, nblock, mapx_fd[i]);
         }
-        allocate_bufs(&ybuf, cols, bw, mapy_fd);
+        allocate_bufs(&ybuf, cols, bw, nblock, mapy_fd);
     }
 
     meanY = sumY = 0.0;
@@ -272,7 +304,7 @@ int main(int argc, char *argv[])
     mapres_buf = NULL;
     if (output_res->answer) {
         mapres_fd = Rast_open_new(output_res->answer, DCELL_TYPE);
-        mapres_buf = Rast_allocate_d_buf();
+        mapres_buf = G_malloc((size_t)nblock * cols * sizeof(DCELL));
     }
 
     /* estimates output */
@@ -280,13 +312,12 @@ int main(int argc, char *argv[])
     mapest_buf = NULL;
     if (output_est->answer) {
         mapest_fd = Rast_open_new(output_est->answer, DCELL_TYPE);
-        mapest_buf = Rast_allocate_d_buf();
+        mapest_buf = G_malloc((size_t)nblock * cols * sizeof(DCELL));
     }
 
     /* gwr for each cell: get estimate */
 
     count = 0;
-    mapx_val[0] = 1.0;
     SStot = SSerr = SSreg = 0.0;
     for (i = 0; i < n_predictors; i++) {
         SSerr_without[i] = 0.0;
@@ -324,7 +355,7 @@ int main(int argc, char *argv[])
 
         nseg = mem_mb * 1024.0 / (64 * 64 * segsize);
 
-        Segment_open(&in_seg, G_tempfile(), rows, cols, 64, 64, segsize, nseg);
+        cache_create(&in_seg, rows, cols, 64, 64, segsize, nseg);
 
         null_flag = flag_create(rows, cols);
 
@@ -352,8 +383,7 @@ int main(int argc, char *argv[])
                 if (!x_null) {
                     seg_val[n_predictors] = mapy_buf[c];
                 }
-                if (Segment_put(&in_seg, (void *)seg_val, r, c) != 1)
-                    G_fatal_error(_("Unable to write to temporary file"));
+                cache_put(&in_seg, (void *)seg_val, r, c);
 
                 if (!x_null && !Rast_is_d_null_value(&mapy_buf[c]))
                     FLAG_SET(null_flag, r, c);
@@ -391,133 +421,225 @@ int main(int argc, char *argv[])
             sprintf(outbp->name, "%s.%d", output_b->answer, i);
 
             outbp->fd = Rast_open_new(outbp->name, DCELL_TYPE);
-            outbp->buf = Rast_allocate_d_buf();
+            outbp->buf = G_malloc((size_t)nblock * cols * sizeof(DCELL));
         }
     }
 
-    G_message(_("Geographically weighted regression..."));
-    for (r = 0; r < rows; r++) {
-        G_percent(r, rows, 2);
+    /* thread-private work space */
+    ws = G_malloc(nprocs * sizeof(struct gwr_ws *));
+    yest_t = G_malloc(nprocs * sizeof(DCELL *));
+    cval_t = G_malloc(nprocs * sizeof(DCELL *));
+    for (i = 0; i < nprocs; i++) {
+        ws[i] = create_ws(n_predictors);
+        yest_t[i] = G_malloc((n_predictors + 1) * sizeof(DCELL));
+        cval_t[i] = G_malloc((n_predictors + 1) * sizeof(DCELL));
+    }
 
-        if (npnts == 0) {
-            for (i = 0; i < n_predictors; i++) {
-                readrast(&(xbuf[i]), rows, cols);
-            }
-            readrast(&ybuf, rows, cols);
+    rowres = G_malloc(nblock * sizeof(struct gwr_row));
+    for (b = 0; b < nblock; b++) {
+        struct gwr_row *rr = &rowres[b];
+
+        rr->res = mapres_buf ? mapres_buf + (size_t)b * cols : NULL;
+        rr->est = mapest_buf ? mapest_buf + (size_t)b * cols : NULL;
+        rr->b = NULL;
+        if (outb) {
+            rr->b = G_malloc((n_predictors + 1) * sizeof(DCELL *));
+            for (i = 0; i <= n_predictors; i++)
+                rr->b[i] = outb[i].buf + (size_t)b * cols;
         }
+        rr->Bc = G_malloc((size_t)cols * (n_predictors + 1) * sizeof(double));
+        rr->yest =
+            G_malloc((size_t)cols * (n_predictors + 1) * sizeof(double));
+        rr->y = G_malloc((size_t)cols * sizeof(DCELL));
+        rr->done = G_malloc(cols);
+    }
 
-        if (mask_buf)
-            Rast_get_c_row(mask_fd, mask_buf, r);
+    G_message(_("Geographically weighted regression..."));
+    for (r0 = 0; r0 < (int)rows; r0 += nblock) {
+        G_percent(r0, rows, 2);
 
-        if (mapres_buf)
-            Rast_set_d_null_value(mapres_buf, cols);
-        if (mapest_buf)
-            Rast_set_d_null_value(mapest_buf, cols);
+        nb = (int)rows - r0 < nblock ? (int)rows - r0 : nblock;
 
-        if (outb) {
-            for (i = 0; i <= n_predictors; i++) {
-                outbp = &outb[i];
-                Rast_set_d_null_value(outbp->buf, cols);
+        /* always read nblock rows, row r0 + b is in buf[bw + b] */
+        if (npnts == 0) {
+            for (b = 0; b < nblock; b++) {
+                for (i = 0; i < n_predictors; i++) {
+                    readrast(&(xbuf[i]), rows, cols);
+                }
+                readrast(&ybuf, rows, cols);
             }
         }
 
-        for (c = 0; c < cols; c++) {
-            int isnull = 0;
+        if (mask_buf) {
+            for (b = 0; b < nb; b++)
+                Rast_get_c_row(mask_fd, mask_buf + (size_t)b * cols, r0 + b);
+        }
 
-            if (mask_buf) {
-                if (Rast_is_c_null_value(&mask_buf[c]) || mask_buf[c] == 0)
-                    continue;
+#pragma omp parallel for schedule(dynamic) private(i, k, c)
+        for (b = 0; b < nb; b++) {
+            struct gwr_row *rr = &rowres[b];
+            CELL *mask_row = mask_buf ? mask_buf + (size_t)b * cols : NULL;
+            int t_id = 0;
+            DCELL *est, yval, res;
+            double *Bc;
+
+#ifdef _OPENMP
+            t_id = omp_get_thread_num();
+#endif
+            est = yest_t[t_id];
+
+            if (rr->res)
+                Rast_set_d_null_value(rr->res, cols);
+            if (rr->est)
+                Rast_set_d_null_value(rr->est, cols);
+            if (rr->b) {
+                for (i = 0; i <= n_predictors; i++)
+                    Rast_set_d_null_value(rr->b[i], cols);
             }
 
-            if (npnts == 0) {
-                for (i = 0; i < n_predictors; i++) {
-                    mapx_val[i + 1] = xbuf[i].buf[bw][c + bw];
-                    if (Rast_is_d_null_value(&(mapx_val[i + 1]))) {
+            memset(rr->done, 0, cols);
+
+            for (c = 0; c < cols; c++) {
+                int isnull = 0;
+
+                if (mask_row) {
+                    if (Rast_is_c_null_value(&mask_row[c]) || mask_row[c] == 0)
+                        continue;
+                }
+
+                if (npnts == 0) {
+                    for (i = 0; i < n_predictors; i++) {
+                        if (Rast_is_d_null_value(
+                                &xbuf[i].buf[bw + b][c + bw])) {
+                            isnull = 1;
+                            break;
+                        }
+                    }
+                    yval = ybuf.buf[bw + b][c + bw];
+                }
+                else {
+                    DCELL *cval = cval_t[t_id];
+
+                    cache_get(&in_seg, (void *)cval, r0 + b, c);
+                    if (Rast_is_d_null_value(&(cval[0]))) {
                         isnull = 1;
-                        break;
                     }
+                    yval = cval[n_predictors];
                 }
-                mapy_val = ybuf.buf[bw][c + bw];
-            }
-            else {
-                Segment_get(&in_seg, (void *)seg_val, r, c);
-                if (Rast_is_d_null_value(&(seg_val[0]))) {
-                    isnull = 1;
+
+                if (isnull)
+                    continue;
+
+                if (npnts == 0) {
+                    if (!gwr(xbuf, n_predictors, &ybuf, bw + b, c, bw, weights,
+                             ws[t_id], est, &Bc)) {
+                        continue;
+                    }
+                }
+                else {
+                    if (!gwra(&in_seg, null_flag, n_predictors, r0 + b, c,
+                              npnts, ws[t_id], est, &Bc)) {
+                        continue;
+                    }
                 }
-                mapy_val = seg_val[n_predictors];
-            }
 
-            if (isnull)
-                continue;
+                /* kept for the coefficient stats */
+                for (i = 0; i <= n_predictors; i++) {
+                    rr->Bc[(size_t)c * (n_predictors + 1) + i] = Bc[i];
 
-            if (npnts == 0) {
-                if (!gwr(xbuf, n_predictors, &ybuf, c, bw, weights, yest, &B)) {
-                    continue;
+                    /* output raster for coefficients */
+                    if (rr->b)
+                        rr->b[i][c] = Bc[i];
                 }
-            }
-            else {
-                if (!gwra(&in_seg, null_flag, n_predictors, r, c, npnts, yest,
-                          &B)) {
+                rr->done[c] = 1;
+
+                /* set estimate */
+                if (rr->est)
+                    rr->est[c] = est[0];
+
+                if (Rast_is_d_null_value(&yval))
                     continue;
-                }
+
+                /* set residual */
+                res = yval - est[0];
+                if (rr->res)
+                    rr->res[c] = res;
+
+                /* kept for the fit stats */
+                for (k = 0; k <= n_predictors; k++)
+                    rr->yest[(size_t)c * (n_predictors + 1) + k] = est[k];
+                rr->y[c] = yval;
+                rr->done[c] = 2;
             }
+        }
+
+        /* write rows and sum up statistics in row order */
+        for (b = 0; b < nb; b++) {
+            struct gwr_row *rr = &rowres[b];
 
-            /* coefficient stats */
-            for (i = 0; i <= n_predictors; i++) {
-                if (Bmin[i] > B[i])
-                    Bmin[i] = B[i];
-                if (Bmax[i] < B[i])
-                    Bmax[i] = B[i];
-                Bsum[i] += B[i];
-                Bsumsq[i] += B[i] * B[i];
-
-                /* output raster for coefficients */
-                if (outb) {
+            if (mapres_buf)
+                Rast_put_d_row(mapres_fd, rr->res);
+            if (mapest_buf)
+                Rast_put_d_row(mapest_fd, rr->est);
+            if (outb) {
+                for (i = 0; i <= n_predictors; i++) {
                     outbp = &outb[i];
-                    outbp->buf[c] = B[i];
+                    Rast_put_d_row(outbp->fd, rr->b[i]);
                 }
             }
-            bcount++;
 
-            /* set estimate */
-            if (mapest_buf)
-                mapest_buf[c] = yest[0];
+            /* same order of summation as a single thread */
+            for (c = 0; c < cols; c++) {
+                double *Bc, *est;
+                DCELL res;
 
-            if (Rast_is_d_null_value(&mapy_val))
-                continue;
+                if (!rr->done[c])
+                    continue;
 
-            /* set residual */
-            yres = mapy_val - yest[0];
-            if (mapres_buf)
-                mapres_buf[c] = yres;
+                /* coefficient stats */
+                Bc = rr->Bc + (size_t)c * (n_predictors + 1);
+                for (i = 0; i <= n_predictors; i++) {
+                    if (Bmin[i] > Bc[i])
+                        Bmin[i] = Bc[i];
+                    if (Bmax[i] < Bc[i])
+                        Bmax[i] = Bc[i];
+                    Bsum[i] += Bc[i];
+                    Bsumsq[i] += Bc[i] * Bc[i];
+                }
+                bcount++;
+
+                if (rr->done[c] < 2)
+                    continue;
 
-            SStot += (mapy_val - meanY) * (mapy_val - meanY);
-            SSreg += (yest[0] - meanY) * (yest[0] - meanY);
-            SSerr += yres * yres;
+                est = rr->yest + (size_t)c * (n_predictors + 1);
+                res = rr->y[c] - est[0];
+                SStot += (rr->y[c] - meanY) * (rr->y[c] - meanY);
+                SSreg += (est[0] - meanY) * (est[0] - meanY);
+                SSerr += res * res;
 
-            for (k = 1; k <= n_predictors; k++) {
+                for (k = 1; k <= n_predictors; k++) {
 
-                /* linear model without predictor k */
-                yres = mapy_val - yest[k];
+                    /* linear model without predictor k */
+                    res = rr->y[c] - est[k];
 
-                /* linear model without predictor k */
-                SSerr_without[k - 1] += yres * yres;
-            }
-            count++;
-        }
-        if (mapres_buf)
-            Rast_put_d_row(mapres_fd, mapres_buf);
-        if (mapest_buf)
-            Rast_put_d_row(mapest_fd, mapest_buf);
-        if (outb) {
-            for (i = 0; i <= n_predictors; i++) {
-                outbp = &outb[i];
-                Rast_put_d_row(outbp->fd, outbp->buf);
+                    /* linear model without predictor k */
+                    SSerr_without[k - 1] += res * res;
+                }
+                count++;
             }
         }
     }
     G_percent(rows, rows, 2);
 
+    for (i = 0; i < nprocs; i++) {
+        free_ws(ws[i]);
+        G_free(yest_t[i]);
+        G_free(cval_t[i]);
+    }
+    G_free(ws);
+    G_free(yest_t);
+    G_free(cval_t);
+
     fprintf(stdout, "n=%d\n", count);
     /* coefficient of determination aka R squared */
     Rsq = 1 - (SSerr / SStot);
@@ -646,7 +768,7 @@ int main(int argc, char *argv[])
         Rast_close(mask_fd);
 
     if (npnts > 0)
-        Segment_close(&in_seg);
+        cache_destroy(&in_seg);
 
     if (mapres_fd > -1) {
         struct History history;
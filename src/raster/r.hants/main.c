@@ -25,20 +25,59 @@
 #include <grass/raster.h>
 #include <grass/glocale.h>
 #include <grass/gmath.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rowblock.h"
 
 struct input {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
 struct output {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
-static int solvemat(double **m, double a[], double B[], int n)
+/* Gauss-Jordan elimination of a matrix, recorded to be applied to
+ * any number of right hand sides */
+struct elimination {
+    int *imark;     /* pivot row of each column */
+    double *factor; /* factor[i * n + i2]: multiple of row i for row i2 */
+    double *diag;   /* diagonal after elimination */
+};
+
+/* factorizations of the normal matrix by pattern of used input values,
+ * direct mapped, one cache per thread */
+struct factor_cache {
+    int size;
+    int nwords;         /* words of a key */
+    unsigned int *keys; /* size * nwords */
+    int *state;         /* 0: empty, 1: solvable, -1: unsolvable */
+    struct elimination *elim;
+};
+
+/* settings and design matrix shared by all threads */
+struct hants {
+    int num_inputs, nr, nf, noutmax;
+    double **mat, **mat_t;
+    double lo, hi, fet, delta;
+    int use_range, rejlo, rejhi, interp_only, do_amp, do_phase;
+    int amp0, phase0;    /* first amplitude and phase output */
+    struct hants_ws *ws; /* one per thread */
+};
+
+/* workspace of one thread */
+struct hants_ws {
+    DCELL *values, *rc;
+    double *za, *zr, **A, **Arow;
+    int *useval;
+    unsigned int *key;
+    struct factor_cache cache;
+};
+
+static int factorize(double **m, struct elimination *e, int n)
 {
     int i, j, i2, j2, imark;
     double factor, temp, *tempp;
@@ -63,29 +102,16 @@ static int solvemat(double **m, double a[], double B[], int n)
         /* co-linear points result in an undefined matrix, and nearly */
         /* co-linear points results in a solution with rounding error */
 
-        if (pivot == 0.0) {
-            G_warning(_("Matrix is unsolvable"));
+        if (pivot == 0.0)
             return 0;
-        }
 
         /* if row with highest pivot is not the current row, switch them */
 
+        e->imark[i] = imark;
         if (imark != i) {
-            /*
-            for (j2 = 0; j2 < n; j2++) {
-                temp = m[imark][j2];
-                m[imark][j2] = m[i][j2];
-                m[i][j2] = temp;
-            }
-            */
-
             tempp = m[imark];
             m[imark] = m[i];
             m[i] = tempp;
-
-            temp = a[imark];
-            a[imark] = a[i];
-            a[i] = temp;
         }
 
         /* compute zeros above and below the pivot, and compute
@@ -94,21 +120,325 @@ static int solvemat(double **m, double a[], double B[], int n)
         for (i2 = 0; i2 < n; i2++) {
             if (i2 != i) {
                 factor = m[i2][j] / pivot;
+                e->factor[i * n + i2] = factor;
                 for (j2 = j; j2 < n; j2++)
                     m[i2][j2] -= factor * m[i][j2];
-                a[i2] -= factor * a[i];
             }
         }
     }
 
+    for (i = 0; i < n; i++)
+        e->diag[i] = m[i][i];
+
+    return 1;
+}
+
+/* same operations on a[] as in the elimination of the matrix,
+ * a[] is modified */
+static void solve_factorized(const struct elimination *e, double a[],
+                             double B[], int n)
+{
+    int i, i2;
+    double temp;
+
+    for (i = 0; i < n; i++) {
+        if (e->imark[i] != i) {
+            temp = a[e->imark[i]];
+            a[e->imark[i]] = a[i];
+            a[i] = temp;
+        }
+        for (i2 = 0; i2 < n; i2++) {
+            if (i2 != i)
+                a[i2] -= e->factor[i * n + i2] * a[i];
+        }
+    }
+
     /* SINCE ALL OTHER VALUES IN THE MATRIX ARE ZERO NOW, CALCULATE THE
        COEFFICIENTS BY DIVIDING THE COLUMN VECTORS BY THE DIAGONAL VALUES. */
 
     for (i = 0; i < n; i++) {
-        B[i] = a[i] / m[i][i];
+        B[i] = a[i] / e->diag[i];
     }
+}
 
-    return 1;
+static void init_cache(struct factor_cache *cache, int size, int nwords,
+                       int n)
+{
+    int i;
+
+    cache->size = size;
+    cache->nwords = nwords;
+    cache->keys = G_calloc((size_t)size * nwords, sizeof(unsigned int));
+    cache->state = G_calloc(size, sizeof(int));
+    cache->elim = G_malloc(size * sizeof(struct elimination));
+    for (i = 0; i < size; i++) {
+        cache->elim[i].imark = G_malloc(n * sizeof(int));
+        cache->elim[i].factor = G_malloc((size_t)n * n * sizeof(double));
+        cache->elim[i].diag = G_malloc(n * sizeof(double));
+    }
+}
+
+static void free_cache(struct factor_cache *cache)
+{
+    int i;
+
+    for (i = 0; i < cache->size; i++) {
+        G_free(cache->elim[i].imark);
+        G_free(cache->elim[i].factor);
+        G_free(cache->elim[i].diag);
+    }
+    G_free(cache->elim);
+    G_free(cache->state);
+    G_free(cache->keys);
+}
+
+/* factorization of mat * diag(useval) * mat' + delta,
+ * NULL if the matrix is unsolvable */
+static const struct elimination *get_factorization(const struct hants *h,
+                                                   struct hants_ws *ws)
+{
+    struct factor_cache *cache = &ws->cache;
+    int i, j, k, nr = h->nr, slot;
+    unsigned int hash, *key;
+    struct elimination *e;
+
+    memset(ws->key, 0, cache->nwords * sizeof(unsigned int));
+    for (j = 0; j < h->num_inputs; j++) {
+        if (ws->useval[j])
+            ws->key[j >> 5] |= 1U << (j & 31);
+    }
+    /* FNV-1a */
+    hash = 2166136261U;
+    for (i = 0; i < cache->nwords; i++) {
+        hash ^= ws->key[i];
+        hash *= 16777619U;
+    }
+    slot = hash % cache->size;
+    key = cache->keys + (size_t)slot * cache->nwords;
+    e = &cache->elim[slot];
+
+    if (cache->state[slot] &&
+        memcmp(key, ws->key, cache->nwords * sizeof(unsigned int)) == 0)
+        return cache->state[slot] > 0 ? e : NULL;
+
+    /* A = mat * diag(p) * mat' */
+
+    /* mat: nr, num_inputs
+     * diag(p): num_inputs, num_inputs
+     * mat_t: num_inputs, nr
+     * A temp: nr, num_inputs
+     * A: nr, nr */
+
+    for (i = 0; i < nr; i++) {
+        for (k = 0; k < nr; k++)
+            ws->A[i][k] = 0;
+        for (j = 0; j < h->num_inputs; j++) {
+            if (ws->useval[j]) {
+                for (k = 0; k < nr; k++)
+                    ws->A[i][k] += h->mat[i][j] * h->mat_t[j][k];
+            }
+        }
+
+        if (i > 0) {
+            ws->A[i][i] += h->delta;
+        }
+    }
+
+    /* rows are swapped in a copy of the row pointers */
+    for (i = 0; i < nr; i++)
+        ws->Arow[i] = ws->A[i];
+
+    memcpy(key, ws->key, cache->nwords * sizeof(unsigned int));
+    cache->state[slot] = factorize(ws->Arow, e, nr) ? 1 : -1;
+
+    return cache->state[slot] > 0 ? e : NULL;
+}
+
+/* harmonic analysis of the cell idx of all input blocks */
+static void hants_cell(void *data, int t_id, DCELL **in, DCELL **out,
+                       size_t idx)
+{
+    const struct hants *h = data;
+    struct hants_ws *ws = &h->ws[t_id];
+    int i, j;
+    int num_inputs = h->num_inputs, nr = h->nr;
+    int null = 0, non_null = 0;
+    int first, last, nout;
+    double maxerrlo, maxerrhi;
+    DCELL *values = ws->values, *rc = ws->rc;
+    double *za = ws->za, *zr = ws->zr;
+    int *useval = ws->useval;
+
+    first = last = -1;
+
+    for (i = 0; i < num_inputs; i++) {
+        DCELL v = in[i][idx];
+
+        useval[i] = 0;
+        if (Rast_is_d_null_value(&v)) {
+            null++;
+        }
+        else if (h->use_range && (v < h->lo || v > h->hi)) {
+            Rast_set_d_null_value(&v, 1);
+            null++;
+        }
+        else {
+            non_null++;
+            useval[i] = 1;
+
+            if (first == -1)
+                first = i;
+            last = i;
+        }
+
+        values[i] = v;
+    }
+    nout = null;
+
+    if (!h->interp_only) {
+        first = 0;
+        last = num_inputs - 1;
+    }
+
+    /* HANTS */
+    if (nout <= h->noutmax) {
+        int n = 0, done = 0;
+
+        while (!done) {
+            const struct elimination *e;
+
+            /* za = mat * y */
+            for (i = 0; i < nr; i++) {
+                za[i] = 0;
+                for (j = 0; j < num_inputs; j++) {
+                    if (useval[j])
+                        za[i] += h->mat[i][j] * values[j];
+                }
+            }
+
+            /* zr = A \ za
+             * solve A * zr = za */
+            e = get_factorization(h, ws);
+            if (!e) {
+#pragma omp critical
+                G_warning(_("Matrix is unsolvable"));
+                done = -1;
+                Rast_set_d_null_value(rc, num_inputs);
+                break;
+            }
+            solve_factorized(e, za, zr, nr);
+            /* G_math_solver_gauss(A, zr, za, nr) is much slower */
+
+            /* rc = mat' * zr */
+            maxerrlo = maxerrhi = 0;
+            for (i = 0; i < num_inputs; i++) {
+                rc[i] = 0;
+                for (j = 0; j < nr; j++) {
+                    rc[i] += h->mat_t[i][j] * zr[j];
+                }
+                if (useval[i]) {
+                    if (maxerrlo < rc[i] - values[i])
+                        maxerrlo = rc[i] - values[i];
+                    if (maxerrhi < values[i] - rc[i])
+                        maxerrhi = values[i] - rc[i];
+                }
+            }
+            if (h->rejlo || h->rejhi) {
+                done = 1;
+                if (h->rejlo && maxerrlo > h->fet)
+                    done = 0;
+                if (h->rejhi && maxerrhi > h->fet)
+                    done = 0;
+
+                if (!done) {
+                    /* filter outliers */
+                    for (i = 0; i < num_inputs; i++) {
+
+                        if (useval[i]) {
+                            if (h->rejlo &&
+                                rc[i] - values[i] > maxerrlo * 0.5) {
+                                useval[i] = 0;
+                                nout++;
+                            }
+                            if (h->rejhi &&
+                                values[i] - rc[i] > maxerrhi * 0.5) {
+                                useval[i] = 0;
+                                nout++;
+                            }
+                        }
+                    }
+                }
+            }
+
+            n++;
+            if (n >= num_inputs)
+                done = 1;
+            if (nout > h->noutmax)
+                done = 1;
+        }
+
+        i = 0;
+        while (i < first) {
+            Rast_set_d_null_value(&out[i][idx], 1);
+            i++;
+        }
+
+        for (i = first; i <= last; i++) {
+            out[i][idx] = rc[i];
+            if (rc[i] < h->lo)
+                out[i][idx] = h->lo;
+            else if (rc[i] > h->hi)
+                out[i][idx] = h->hi;
+        }
+
+        i = last + 1;
+        while (i < num_inputs) {
+            Rast_set_d_null_value(&out[i][idx], 1);
+            i++;
+        }
+
+        if ((h->do_amp || h->do_phase) && done == -1) {
+            for (i = 0; i < h->nf; i++) {
+                if (h->do_amp)
+                    Rast_set_d_null_value(&out[h->amp0 + i][idx], 1);
+                if (h->do_phase)
+                    Rast_set_d_null_value(&out[h->phase0 + i][idx], 1);
+            }
+        }
+        else if (h->do_amp || h->do_phase) {
+            /* amplitude and phase */
+            /* skip constant */
+
+            for (i = 1; i < nr; i += 2) {
+                int ifr = i >> 1;
+
+                if (h->do_amp) {
+                    out[h->amp0 + ifr][idx] =
+                        sqrt(zr[i] * zr[i] + zr[i + 1] * zr[i + 1]);
+                }
+
+                if (h->do_phase) {
+                    double angle = atan2(zr[i + 1], zr[i]) * 180 / M_PI;
+
+                    if (angle < 0)
+                        angle += 360;
+                    out[h->phase0 + ifr][idx] = angle;
+                }
+            }
+        }
+    }
+    else {
+        for (i = 0; i < num_inputs; i++)
+            Rast_set_d_null_value(&out[i][idx], 1);
+        if (h->do_amp || h->do_phase) {
+            for (i = 0; i < h->nf; i++) {
+                if (h->do_amp)
+                    Rast_set_d_null_value(&out[h->amp0 + i][idx], 1);
+                if (h->do_phase)
+                    Rast_set_d_null_value(&out[h->phase0 + i][idx], 1);
+            }
+        }
+    }
 }
 
 int main(int argc, char *argv[])
@@ -116,20 +446,21 @@ int main(int argc, char *argv[])
     struct GModule *module;
     struct {
         struct Option *input, *file, *suffix,
-            *amp,   /* prefix for amplitude output */
-            *phase, /* prefix for phase output */
-            *nf,    /* number of harmonics */
-            *fet,   /* fit error tolerance */
-            *dod,   /* degree of over-determination */
-            *range, /* low/high threshold */
-            *ts,    /* time steps*/
-            *bl,    /* length of base period */
-            *delta; /* threshold for high amplitudes */
+            *amp,    /* prefix for amplitude output */
+            *phase,  /* prefix for phase output */
+            *nf,     /* number of harmonics */
+            *fet,    /* fit error tolerance */
+            *dod,    /* degree of over-determination */
+            *range,  /* low/high threshold */
+            *ts,     /* time steps*/
+            *bl,     /* length of base period */
+            *delta,  /* threshold for high amplitudes */
+            *nprocs; /* number of threads */
     } parm;
     struct {
         struct Flag *lo, *hi, *lazy, *int_only;
     } flag;
-    int i, j, k;
+    int i, j;
     int num_inputs;
     struct input *inputs = NULL;
     int num_outputs;
@@ -138,17 +469,17 @@ int main(int argc, char *argv[])
     struct output *out_phase = NULL;
     char *suffix;
     struct History history;
-    DCELL *values = NULL, *rc = NULL;
-    int nrows, ncols;
-    int row, col;
     double lo, hi, fet, *cs, *sn, *ts, delta;
     int bl;
-    double **mat, **mat_t, **A, *Av, *Azero, *za, *zr, maxerrlo, maxerrhi;
-    int asize;
-    int first, last, interp_only;
-    int dod, nf, nr, nout, noutmax;
-    int rejlo, rejhi, *useval;
+    double **mat, **mat_t;
+    int interp_only;
+    int dod, nf, nr, noutmax;
+    int rejlo, rejhi;
     int do_amp, do_phase;
+    int nprocs, t;
+    struct hants h;
+    struct hants_ws *ws;
+    struct rowblock rb;
 
     G_gisinit(argv[0]);
 
@@ -233,6 +564,8 @@ int main(int argc, char *argv[])
     parm.delta->label = _("Threshold for high amplitudes");
     parm.delta->description = _("Delta should be between 0 and 1");
 
+    parm.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+
     flag.lo = G_define_flag();
     flag.lo->key = 'l';
     flag.lo->description = _("Reject low outliers");
@@ -304,6 +637,22 @@ int main(int argc, char *argv[])
 
     interp_only = flag.int_only->answer;
 
+#ifdef _OPENMP
+    nprocs = atoi(parm.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), parm.nprocs->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     /* process the input maps from the file */
     if (parm.file->answer) {
         FILE *in;
@@ -339,7 +688,6 @@ int main(int argc, char *argv[])
 
             p->name = G_store(name);
             G_verbose_message(_("Reading raster map <%s>..."), p->name);
-            p->buf = Rast_allocate_d_buf();
             if (!flag.lazy->answer)
                 p->fd = Rast_open_old(p->name, "");
         }
@@ -364,7 +712,6 @@ int main(int argc, char *argv[])
 
             p->name = parm.input->answers[i];
             G_verbose_message(_("Reading raster map <%s>..."), p->name);
-            p->buf = Rast_allocate_d_buf();
             if (!flag.lazy->answer)
                 p->fd = Rast_open_old(p->name, "");
         }
@@ -399,7 +746,6 @@ int main(int argc, char *argv[])
         sprintf(output_name, "%s%s", uname, suffix);
 
         out->name = G_store(output_name);
-        out->buf = Rast_allocate_d_buf();
         out->fd = Rast_open_new(output_name, DCELL_TYPE);
     }
 
@@ -434,7 +780,6 @@ int main(int argc, char *argv[])
             sprintf(output_name, "%s.%d", parm.amp->answer, i);
 
             out->name = G_store(output_name);
-            out->buf = Rast_allocate_d_buf();
             out->fd = Rast_open_new(output_name, DCELL_TYPE);
         }
     }
@@ -450,22 +795,14 @@ int main(int argc, char *argv[])
             sprintf(output_name, "%s.%d", parm.phase->answer, i);
 
             out->name = G_store(output_name);
-            out->buf = Rast_allocate_d_buf();
             out->fd = Rast_open_new(output_name, DCELL_TYPE);
         }
     }
 
     /* initialise variables */
-    values = G_malloc(num_inputs * sizeof(DCELL));
-
-    nrows = Rast_window_rows();
-    ncols = Rast_window_cols();
-
     cs = G_alloc_vector(bl);
     sn = G_alloc_vector(bl);
     ts = G_alloc_vector(num_inputs);
-    rc = G_malloc(num_inputs * sizeof(DCELL));
-    useval = G_malloc(num_inputs * sizeof(int));
 
     if (parm.ts->answer) {
         for (i = 0; parm.ts->answers[i]; i++)
@@ -484,16 +821,6 @@ int main(int argc, char *argv[])
 
     mat = G_alloc_matrix(nr, num_inputs);
     mat_t = G_alloc_matrix(num_inputs, nr);
-    A = G_alloc_matrix(nr, nr);
-    Av = *A;
-    Azero = G_alloc_vector(nr * nr);
-    asize = nr * nr * sizeof(double);
-    za = G_alloc_vector(nr);
-    zr = G_alloc_vector(nr);
-    rc = G_alloc_vector(num_inputs);
-
-    for (i = 0; i < nr * nr; i++)
-        Azero[i] = 0;
 
     for (i = 0; i < bl; i++) {
         double ang = 2.0 * M_PI * i / bl;
@@ -527,228 +854,75 @@ int main(int argc, char *argv[])
         }
     }
 
-    /* process the data */
-    G_message(_("Harmonic analysis of %d input maps..."), num_inputs);
-
-    for (row = 0; row < nrows; row++) {
-        G_percent(row, nrows, 4);
-
-        if (flag.lazy->answer) {
-            /* Open the files only on run time */
-            for (i = 0; i < num_inputs; i++) {
-                inputs[i].fd = Rast_open_old(inputs[i].name, "");
-                Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-                Rast_close(inputs[i].fd);
-            }
-        }
-        else {
-            for (i = 0; i < num_inputs; i++)
-                Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-        }
-
-        for (col = 0; col < ncols; col++) {
-            int null = 0, non_null = 0;
-
-            first = last = -1;
-
-            for (i = 0; i < num_inputs; i++) {
-                DCELL v = inputs[i].buf[col];
-
-                useval[i] = 0;
-                if (Rast_is_d_null_value(&v)) {
-                    null++;
-                }
-                else if (parm.range->answer && (v < lo || v > hi)) {
-                    Rast_set_d_null_value(&v, 1);
-                    null++;
-                }
-                else {
-                    non_null++;
-                    useval[i] = 1;
-
-                    if (first == -1)
-                        first = i;
-                    last = i;
-                }
-
-                values[i] = v;
-            }
-            nout = null;
-
-            if (!interp_only) {
-                first = 0;
-                last = num_inputs - 1;
-            }
-
-            /* HANTS */
-            if (nout <= noutmax) {
-                int n = 0, done = 0;
-
-                while (!done) {
-
-                    /* za = mat * y */
-
-                    /* A = mat * diag(p) * mat' */
-
-                    /* mat: nr, num_inputs
-                     * diag(p): num_inputs, num_inputs
-                     * mat_t: num_inputs, nr
-                     * A temp: nr, num_inputs
-                     * A: nr, nr */
-
-                    memcpy(Av, Azero, asize);
-                    for (i = 0; i < nr; i++) {
-                        za[i] = 0;
-                        for (j = 0; j < num_inputs; j++) {
-                            if (useval[j]) {
-                                za[i] += mat[i][j] * values[j];
-
-                                for (k = 0; k < nr; k++)
-                                    A[i][k] += mat[i][j] * mat_t[j][k];
-                            }
-                        }
-
-                        if (i > 0) {
-                            A[i][i] += delta;
-                        }
-                    }
-
-                    /* zr = A \ za
-                     * solve A * zr = za */
-                    if (!solvemat(A, za, zr, nr)) {
-                        done = -1;
-                        Rast_set_d_null_value(rc, num_outputs);
-                        break;
-                    }
-                    /* G_math_solver_gauss(A, zr, za, nr) is much slower */
-
-                    /* rc = mat' * zr */
-                    maxerrlo = maxerrhi = 0;
-                    for (i = 0; i < num_inputs; i++) {
-                        rc[i] = 0;
-                        for (j = 0; j < nr; j++) {
-                            rc[i] += mat_t[i][j] * zr[j];
-                        }
-                        if (useval[i]) {
-                            if (maxerrlo < rc[i] - values[i])
-                                maxerrlo = rc[i] - values[i];
-                            if (maxerrhi < values[i] - rc[i])
-                                maxerrhi = values[i] - rc[i];
-                        }
-                    }
-                    if (rejlo || rejhi) {
-                        done = 1;
-                        if (rejlo && maxerrlo > fet)
-                            done = 0;
-                        if (rejhi && maxerrhi > fet)
-                            done = 0;
-
-                        if (!done) {
-                            /* filter outliers */
-                            for (i = 0; i < num_inputs; i++) {
-
-                                if (useval[i]) {
-                                    if (rejlo &&
-                                        rc[i] - values[i] > maxerrlo * 0.5) {
-                                        useval[i] = 0;
-                                        nout++;
-                                    }
-                                    if (rejhi &&
-                                        values[i] - rc[i] > maxerrhi * 0.5) {
-                                        useval[i] = 0;
-                                        nout++;
-                                    }
-                                }
-                            }
-                        }
-                    }
-
-                    n++;
-                    if (n >= num_inputs)
-                        done = 1;
-                    if (nout > noutmax)
-                        done = 1;
-                }
-
-                i = 0;
-                while (i < first) {
-                    struct output *out = &outputs[i];
-
-                    Rast_set_d_null_value(&out->buf[col], 1);
-                    i++;
-                }
-
-                for (i = first; i <= last; i++) {
-                    struct output *out = &outputs[i];
-
-                    out->buf[col] = rc[i];
-                    if (rc[i] < lo)
-                        out->buf[col] = lo;
-                    else if (rc[i] > hi)
-                        out->buf[col] = hi;
-                }
-
-                i = last + 1;
-                while (i < num_outputs) {
-                    struct output *out = &outputs[i];
-
-                    Rast_set_d_null_value(&out->buf[col], 1);
-                    i++;
-                }
-
-                if (do_amp || do_phase) {
-                    /* amplitude and phase */
-                    /* skip constant */
-
-                    for (i = 1; i < nr; i += 2) {
-                        int ifr = i >> 1;
-
-                        if (do_amp) {
-                            out_amp[ifr].buf[col] =
-                                sqrt(zr[i] * zr[i] + zr[i + 1] * zr[i + 1]);
-                        }
-
-                        if (do_phase) {
-                            double angle = atan2(zr[i + 1], zr[i]) * 180 / M_PI;
-
-                            if (angle < 0)
-                                angle += 360;
-                            out_phase[ifr].buf[col] = angle;
-                        }
-                    }
-                }
-            }
-            else {
-                for (i = 0; i < num_outputs; i++) {
-                    struct output *out = &outputs[i];
+    h.num_inputs = num_inputs;
+    h.nr = nr;
+    h.nf = nf;
+    h.noutmax = noutmax;
+    h.mat = mat;
+    h.mat_t = mat_t;
+    h.lo = lo;
+    h.hi = hi;
+    h.fet = fet;
+    h.delta = delta;
+    h.use_range = parm.range->answer != NULL;
+    h.rejlo = rejlo;
+    h.rejhi = rejhi;
+    h.interp_only = interp_only;
+    h.do_amp = do_amp;
+    h.do_phase = do_phase;
+
+    /* the normal matrix depends only on which input values are used,
+     * its factorization is computed once per pattern and cached */
+    ws = G_malloc(nprocs * sizeof(struct hants_ws));
+    for (t = 0; t < nprocs; t++) {
+        ws[t].values = G_malloc(num_inputs * sizeof(DCELL));
+        ws[t].rc = G_malloc(num_inputs * sizeof(DCELL));
+        ws[t].za = G_alloc_vector(nr);
+        ws[t].zr = G_alloc_vector(nr);
+        ws[t].A = G_alloc_matrix(nr, nr);
+        ws[t].Arow = G_malloc(nr * sizeof(double *));
+        ws[t].useval = G_malloc(num_inputs * sizeof(int));
+        ws[t].key = G_malloc(((num_inputs + 31) / 32) * sizeof(unsigned int));
+        init_cache(&ws[t].cache, 256, (num_inputs + 31) / 32, nr);
+    }
 
-                    Rast_set_d_null_value(&out->buf[col], 1);
-                }
-                if (do_amp || do_phase) {
-                    for (i = 0; i < nf; i++) {
-                        if (do_amp)
-                            Rast_set_d_null_value(&out_amp[i].buf[col], 1);
-                        if (do_phase)
-                            Rast_set_d_null_value(&out_phase[i].buf[col], 1);
-                    }
-                }
-            }
-        }
+    h.ws = ws;
+
+    /* inputs are read and outputs written while the cells of nprocs
+     * rows are processed */
+    h.amp0 = num_outputs;
+    h.phase0 = h.amp0 + (do_amp ? nf : 0);
+    rowblock_init(&rb, num_inputs, h.phase0 + (do_phase ? nf : 0), nprocs);
+    for (i = 0; i < num_inputs; i++)
+        rowblock_set_input(&rb, i, inputs[i].name, "",
+                           flag.lazy->answer ? -1 : inputs[i].fd);
+    for (i = 0; i < num_outputs; i++)
+        rowblock_set_output(&rb, i, outputs[i].fd);
+    for (i = 0; i < nf; i++) {
+        if (do_amp)
+            rowblock_set_output(&rb, h.amp0 + i, out_amp[i].fd);
+        if (do_phase)
+            rowblock_set_output(&rb, h.phase0 + i, out_phase[i].fd);
+    }
 
-        for (i = 0; i < num_outputs; i++)
-            Rast_put_d_row(outputs[i].fd, outputs[i].buf);
+    /* process the data */
+    G_message(_("Harmonic analysis of %d input maps..."), num_inputs);
 
-        if (do_amp || do_phase) {
-            for (i = 0; i < nf; i++) {
-                if (do_amp)
-                    Rast_put_d_row(out_amp[i].fd, out_amp[i].buf);
-                if (do_phase)
-                    Rast_put_d_row(out_phase[i].fd, out_phase[i].buf);
-            }
-        }
+    rowblock_run(&rb, hants_cell, &h);
+    rowblock_free(&rb);
+
+    for (t = 0; t < nprocs; t++) {
+        G_free(ws[t].values);
+        G_free(ws[t].rc);
+        G_free_vector(ws[t].za);
+        G_free_vector(ws[t].zr);
+        G_free_matrix(ws[t].A);
+        G_free(ws[t].Arow);
+        G_free(ws[t].useval);
+        G_free(ws[t].key);
+        free_cache(&ws[t].cache);
     }
-
-    G_percent(row, nrows, 2);
+    G_free(ws);
 
     /* Close input maps */
     if (!flag.lazy->answer) {
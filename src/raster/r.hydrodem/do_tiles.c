@@ -0,0 +1,1279 @@
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "local_proto.h"
+
+/*
+ * Priority-flood by tiles, a parallel replacement of the A* Search in
+ * do_astar.c.
+ *
+ * The A* Search processes cells in the order of their spill elevation (the
+ * lowest level at which water from a cell reaches an edge or a real
+ * depression), then their elevation. Spill elevations are found by tiles:
+ *
+ * 1. each tile is flooded from its own start points and its border cells,
+ *    every cell gets the label of the start point it was reached from and
+ *    the lowest spill elevation between neighbouring labels is recorded
+ * 2. the spill elevations of all labels are solved on the label graph,
+ *    including spills across tile borders, and the spill elevation of each
+ *    cell is written to a segment file
+ *
+ * Connected cells with the same spill elevation form a group. All cells of
+ * lower groups are searched before a group, and the groups of the same
+ * spill elevation do not touch, so the search order is fixed by searching
+ * each group on its own:
+ *
+ * 3. each group is searched like in the A* Search, starting from its cells
+ *    next to a lower group and its start points in the order of their
+ *    index. Groups inside a tile are searched with the tile, groups
+ *    crossing tile borders one after the other through the segment files
+ * 4. a cell drains to the neighbour that would have added it first in the
+ *    A* Search, which depends only on the search order of its neighbours.
+ *    Sink bottoms are found with the same rule as in the A* Search and
+ *    sorted by the search order
+ *
+ * The search order and thus the output do not depend on the tile size or
+ * the number of threads. Groups of the same spill elevation are searched
+ * one after the other and cells next to a lower group are added in the
+ * order of their index, such ties can be broken differently than in the
+ * A* Search.
+ *
+ * Tiles are processed in parallel in memory, only access to the segment
+ * files is serialized.
+ */
+
+#define GET_PARENT(c) ((((GW_LARGE_INT)(c)-2) >> 2) + 1)
+#define GET_CHILD(p)  (((GW_LARGE_INT)(p) << 2) - 2)
+
+#define OCEAN      0  /* label of cells reached from start points */
+#define UNLABELLED -1
+
+/* group ids of cells not yet searched */
+#define UNSEARCHED -1
+#define SHARED     -2 /* group crossing tile borders */
+
+/* cell states in tile buffers */
+#define IN_TILE 1
+#define IN_HALO 2
+#define QUEUED  4
+#define DONE    8
+
+/* what load_tile() reads besides the tile */
+#define LOAD_HALO  1 /* halo and spill elevations */
+#define LOAD_ORDER 2 /* search order */
+
+struct tile {
+    int r0, c0, nr, nc;
+    int n_labels;     /* without OCEAN */
+    int label_base;   /* global id of the first label */
+    int *ring_label;  /* labels of border cells */
+    CELL *ring_ele;   /* elevation = spill elevation in the tile */
+    struct spill *spills;
+    int n_spills;
+    struct point *shared; /* one cell of each group crossing the border */
+    int n_shared;
+    GW_LARGE_INT n_searched;
+};
+
+struct spill {
+    int a, b; /* labels, a < b */
+    CELL w;
+};
+
+struct flood_point {
+    CELL w, ele; /* spill elevation, elevation */
+    GW_LARGE_INT added;
+    GW_LARGE_INT i; /* index in tile buffers or in the region */
+};
+
+/* cells are searched in the order of spill elevation, group, rank */
+struct search_order {
+    GW_LARGE_INT group; /* index of the first cell of the group */
+    GW_LARGE_INT rank;  /* in the search of the group */
+};
+
+struct tile_sink {
+    CELL w;
+    struct search_order o;
+    int r, c;
+};
+
+/* thread-private tile buffers including the halo */
+struct flood {
+    int nr, nc;
+    CELL *ele, *w;
+    struct dir_flag *df;
+    int *label;
+    struct search_order *order;
+    unsigned char *state;
+    int *stack;
+    struct flood_point *heap;
+    GW_LARGE_INT heap_size, added;
+    struct spill *spills;
+    int n_spills, n_alloc_spills;
+    struct tile_sink *sinks;
+    int n_sinks, n_alloc_sinks;
+};
+
+struct label_point {
+    int level, label;
+};
+
+static int nextdr[8] = {1, -1, 0, 0, -1, 1, 1, -1};
+static int nextdc[8] = {0, 0, -1, 1, 1, -1, 1, -1};
+static int asp_r[9] = {0, -1, -1, -1, 0, 1, 1, 1, 0};
+static int asp_c[9] = {0, 1, 0, -1, -1, -1, 0, 1, 1};
+/* sides
+ * |7|1|4|
+ * |2| |3|
+ * |5|0|6|
+ */
+static int nbr_ew[8] = {0, 1, 2, 3, 1, 0, 0, 1};
+static int nbr_ns[8] = {0, 1, 2, 3, 3, 2, 3, 2};
+
+static int ts, n_tile_rows, n_tile_cols;
+static struct tile *tiles;
+static int *level;
+static CSEG spill;
+static SSEG order;
+static double dist_to_nbr[8], ew_res, ns_res;
+
+double get_slope(CELL, CELL, double);
+
+static int ring_index(const struct tile *t, int r, int c)
+{
+    if (r == 0)
+        return c;
+    if (r == t->nr - 1)
+        return t->nc + c;
+    if (c == 0)
+        return 2 * t->nc + r - 1;
+    if (c == t->nc - 1)
+        return 2 * t->nc + t->nr - 2 + r - 1;
+
+    return -1;
+}
+
+static int ring_size(const struct tile *t)
+{
+    if (t->nr == 1)
+        return t->nc;
+
+    return 2 * t->nc + (t->nr - 2) * (t->nc > 1 ? 2 : 1);
+}
+
+static struct tile *tile_of(int r, int c)
+{
+    return &tiles[(r / ts) * n_tile_cols + c / ts];
+}
+
+static int flood_cmp(const struct flood_point *a, const struct flood_point *b)
+{
+    if (a->w != b->w)
+        return a->w < b->w;
+    if (a->ele != b->ele)
+        return a->ele < b->ele;
+
+    return a->added < b->added;
+}
+
+static void flood_add(struct flood_point *heap, GW_LARGE_INT *heap_size,
+                      struct flood_point p)
+{
+    GW_LARGE_INT parent, child;
+
+    child = ++(*heap_size);
+    while (child > 1) {
+        parent = GET_PARENT(child);
+        if (!flood_cmp(&p, &heap[parent]))
+            break;
+        heap[child] = heap[parent];
+        child = parent;
+    }
+    heap[child] = p;
+}
+
+static struct flood_point flood_drop(struct flood_point *heap,
+                                     GW_LARGE_INT *heap_size)
+{
+    GW_LARGE_INT child, childr, parent, i;
+    struct flood_point root_p = heap[1], last_p = heap[*heap_size];
+
+    (*heap_size)--;
+
+    parent = 1;
+    while ((child = GET_CHILD(parent)) <= *heap_size) {
+        childr = child + 1;
+        i = child + 4;
+        while (childr <= *heap_size && childr < i) {
+            if (flood_cmp(&heap[childr], &heap[child]))
+                child = childr;
+            childr++;
+        }
+        if (flood_cmp(&last_p, &heap[child]))
+            break;
+        heap[parent] = heap[child];
+        parent = child;
+    }
+    heap[parent] = last_p;
+
+    return root_p;
+}
+
+/* adds a cell of the tile buffers to the heap */
+static void flood_add_cell(struct flood *f, int i, GW_LARGE_INT added)
+{
+    struct flood_point p;
+
+    p.w = f->w[i];
+    p.ele = f->ele[i];
+    p.added = added;
+    p.i = i;
+    flood_add(f->heap, &f->heap_size, p);
+}
+
+static struct flood *alloc_flood(void)
+{
+    struct flood *f = G_malloc(sizeof(struct flood));
+    size_t n;
+
+    f->nr = f->nc = ts + 2;
+    n = (size_t)f->nr * f->nc;
+    f->ele = G_malloc(n * sizeof(CELL));
+    f->w = G_malloc(n * sizeof(CELL));
+    f->df = G_malloc(n * sizeof(struct dir_flag));
+    f->label = G_malloc(n * sizeof(int));
+    f->order = G_malloc(n * sizeof(struct search_order));
+    f->state = G_malloc(n);
+    f->stack = G_malloc(n * sizeof(int));
+    /* every cell is added at most once */
+    f->heap = G_malloc((n + 1) * sizeof(struct flood_point));
+    f->spills = NULL;
+    f->n_spills = f->n_alloc_spills = 0;
+    f->sinks = NULL;
+    f->n_sinks = f->n_alloc_sinks = 0;
+
+    return f;
+}
+
+static void free_flood(struct flood *f)
+{
+    G_free(f->ele);
+    G_free(f->w);
+    G_free(f->df);
+    G_free(f->label);
+    G_free(f->order);
+    G_free(f->state);
+    G_free(f->stack);
+    G_free(f->heap);
+    G_free(f->spills);
+    G_free(f->sinks);
+    G_free(f);
+}
+
+/* reads a tile and optionally its halo, spill elevations and search order
+ * from the segment files */
+static void load_tile(struct flood *f, const struct tile *t, int what)
+{
+    int r, c, i, gr, gc, own;
+
+    /* buffers are sized for full tiles */
+    memset(f->state, 0, (size_t)f->nr * f->nc);
+
+#pragma omp critical(segment)
+    for (r = -1; r <= t->nr; r++) {
+        for (c = -1; c <= t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            gr = t->r0 + r;
+            gc = t->c0 + c;
+            own = r >= 0 && r < t->nr && c >= 0 && c < t->nc;
+            if (gr < 0 || gr >= nrows || gc < 0 || gc >= ncols ||
+                (!own && !(what & LOAD_HALO)))
+                continue;
+
+            seg_get(&dirflag, (char *)&f->df[i], gr, gc);
+            if (FLAG_GET(f->df[i].flag, NULLFLAG))
+                continue;
+            cseg_get(&ele, &f->ele[i], gr, gc);
+
+            f->state[i] = own ? IN_TILE : IN_HALO;
+            if (what & LOAD_HALO)
+                cseg_get(&spill, &f->w[i], gr, gc);
+            if (what & LOAD_ORDER)
+                seg_get(&order, (char *)&f->order[i], gr, gc);
+        }
+    }
+}
+
+static void add_spill(struct flood *f, int a, int b, CELL w)
+{
+    if (f->n_spills == f->n_alloc_spills) {
+        f->n_alloc_spills += ts * 4;
+        f->spills = G_realloc(f->spills,
+                              f->n_alloc_spills * sizeof(struct spill));
+    }
+    f->spills[f->n_spills].a = a < b ? a : b;
+    f->spills[f->n_spills].b = a < b ? b : a;
+    f->spills[f->n_spills].w = w;
+    f->n_spills++;
+}
+
+static int cmp_spill(const void *a, const void *b)
+{
+    const struct spill *sa = a, *sb = b;
+
+    if (sa->a != sb->a)
+        return sa->a < sb->a ? -1 : 1;
+    if (sa->b != sb->b)
+        return sa->b < sb->b ? -1 : 1;
+    if (sa->w != sb->w)
+        return sa->w < sb->w ? -1 : 1;
+
+    return 0;
+}
+
+/* phase 1: labels and spill elevations between labels of one tile, kept
+ * with the tile if asked for */
+static void flood_labels(struct flood *f, struct tile *t, int keep)
+{
+    int r, c, i, j, ct_dir, k, n;
+
+    f->heap_size = f->added = 0;
+    f->n_spills = 0;
+    t->n_labels = 0;
+
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            f->label[i] = UNLABELLED;
+            if (!(f->state[i] & IN_TILE))
+                continue;
+            /* edge cells and real depressions */
+            if (FLAG_GET(f->df[i].flag, INLISTFLAG))
+                f->label[i] = OCEAN;
+            else if (r > 0 && r < t->nr - 1 && c > 0 && c < t->nc - 1)
+                continue;
+            f->w[i] = f->ele[i];
+            f->state[i] |= QUEUED;
+            flood_add_cell(f, i, f->added++);
+        }
+    }
+
+    while (f->heap_size > 0) {
+        i = flood_drop(f->heap, &f->heap_size).i;
+        f->state[i] |= DONE;
+        /* border cells not reached from another label start a new one */
+        if (f->label[i] == UNLABELLED)
+            f->label[i] = ++t->n_labels;
+
+        for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+            j = i + nextdr[ct_dir] * f->nc + nextdc[ct_dir];
+            if (!(f->state[j] & IN_TILE))
+                continue;
+            if (f->state[j] & DONE) {
+                if (f->label[j] != f->label[i])
+                    add_spill(f, f->label[i], f->label[j],
+                              f->w[i] > f->w[j] ? f->w[i] : f->w[j]);
+            }
+            else if (f->state[j] & QUEUED) {
+                /* border cell at its own elevation */
+                if (f->label[j] == UNLABELLED)
+                    f->label[j] = f->label[i];
+            }
+            else {
+                f->label[j] = f->label[i];
+                f->w[j] = f->w[i] > f->ele[j] ? f->w[i] : f->ele[j];
+                f->state[j] |= QUEUED;
+                flood_add_cell(f, j, f->added++);
+            }
+        }
+    }
+
+    if (!keep)
+        return;
+
+    /* border cells are start points, their spill elevation in the tile is
+     * their elevation */
+    n = ring_size(t);
+    t->ring_label = G_malloc(n * sizeof(int));
+    t->ring_ele = G_malloc(n * sizeof(CELL));
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            if ((k = ring_index(t, r, c)) < 0)
+                continue;
+            i = (r + 1) * f->nc + c + 1;
+            t->ring_label[k] = f->label[i];
+            t->ring_ele[k] = f->ele[i];
+        }
+    }
+
+    /* keep the lowest spill elevation of each pair of labels */
+    qsort(f->spills, f->n_spills, sizeof(struct spill), cmp_spill);
+    for (k = 0, n = 0; k < f->n_spills; k++) {
+        if (n > 0 && f->spills[k].a == f->spills[n - 1].a &&
+            f->spills[k].b == f->spills[n - 1].b)
+            continue;
+        f->spills[n++] = f->spills[k];
+    }
+    t->n_spills = n;
+    t->spills = G_malloc((n ? n : 1) * sizeof(struct spill));
+    for (k = 0; k < n; k++)
+        t->spills[k] = f->spills[k];
+}
+
+static int global_label(const struct tile *t, int label)
+{
+    return label > OCEAN ? t->label_base + label - 1 : label;
+}
+
+static void label_add(struct label_point *heap, int *heap_size, int lvl,
+                      int label)
+{
+    int child = ++(*heap_size), parent;
+
+    while (child > 1) {
+        parent = child / 2;
+        if (heap[parent].level <= lvl)
+            break;
+        heap[child] = heap[parent];
+        child = parent;
+    }
+    heap[child].level = lvl;
+    heap[child].label = label;
+}
+
+static struct label_point label_drop(struct label_point *heap, int *heap_size)
+{
+    struct label_point root_p = heap[1], last_p = heap[(*heap_size)--];
+    int parent = 1, child;
+
+    while ((child = parent * 2) <= *heap_size) {
+        if (child < *heap_size && heap[child + 1].level < heap[child].level)
+            child++;
+        if (last_p.level <= heap[child].level)
+            break;
+        heap[parent] = heap[child];
+        parent = child;
+    }
+    heap[parent] = last_p;
+
+    return root_p;
+}
+
+/* phase 2: spill elevations of all labels */
+static void solve_spills(int n_tiles)
+{
+    int t, k, r, c, ct_dir, n_labels, n_cross, n_alloc_cross;
+    int *first, *nbr, heap_size, *nbr_w;
+    GW_LARGE_INT n_edges, e;
+    struct spill *cross = NULL;
+    struct label_point *heap;
+    char *done;
+
+    G_message(_("Stitch spill elevations of %d tiles..."), n_tiles);
+
+    n_labels = 1;
+    for (t = 0; t < n_tiles; t++) {
+        tiles[t].label_base = n_labels;
+        n_labels += tiles[t].n_labels;
+    }
+    for (t = 0; t < n_tiles; t++) {
+        struct tile *tp = &tiles[t];
+
+        for (k = 0; k < ring_size(tp); k++)
+            tp->ring_label[k] = global_label(tp, tp->ring_label[k]);
+        for (k = 0; k < tp->n_spills; k++) {
+            tp->spills[k].a = global_label(tp, tp->spills[k].a);
+            tp->spills[k].b = global_label(tp, tp->spills[k].b);
+        }
+    }
+
+    /* spills between neighbouring border cells of different tiles */
+    n_cross = n_alloc_cross = 0;
+    for (t = 0; t < n_tiles; t++) {
+        struct tile *tp = &tiles[t];
+
+        for (r = 0; r < tp->nr; r++) {
+            for (c = 0; c < tp->nc; c++) {
+                int la;
+
+                if ((k = ring_index(tp, r, c)) < 0)
+                    continue;
+                if ((la = tp->ring_label[k]) == UNLABELLED)
+                    continue;
+                for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+                    int gr = tp->r0 + r + nextdr[ct_dir];
+                    int gc = tp->c0 + c + nextdc[ct_dir];
+                    struct tile *tn;
+                    int kn, lb;
+
+                    if (gr < 0 || gr >= nrows || gc < 0 || gc >= ncols)
+                        continue;
+                    tn = tile_of(gr, gc);
+                    /* each pair of tiles once */
+                    if (tn <= tp)
+                        continue;
+                    kn = ring_index(tn, gr - tn->r0, gc - tn->c0);
+                    if ((lb = tn->ring_label[kn]) == UNLABELLED || lb == la)
+                        continue;
+                    if (n_cross == n_alloc_cross) {
+                        n_alloc_cross += ts * 4;
+                        cross = G_realloc(cross, n_alloc_cross *
+                                                     sizeof(struct spill));
+                    }
+                    cross[n_cross].a = la;
+                    cross[n_cross].b = lb;
+                    cross[n_cross].w = tp->ring_ele[k] > tn->ring_ele[kn]
+                                           ? tp->ring_ele[k]
+                                           : tn->ring_ele[kn];
+                    n_cross++;
+                }
+            }
+        }
+    }
+
+    /* label graph */
+    first = G_calloc(n_labels + 1, sizeof(int));
+    n_edges = 0;
+    for (t = 0; t <= n_tiles; t++) {
+        struct spill *s = t < n_tiles ? tiles[t].spills : cross;
+        int n = t < n_tiles ? tiles[t].n_spills : n_cross;
+
+        for (k = 0; k < n; k++) {
+            first[s[k].a + 1]++;
+            first[s[k].b + 1]++;
+        }
+        n_edges += 2 * n;
+    }
+    for (k = 0; k < n_labels; k++)
+        first[k + 1] += first[k];
+    nbr = G_malloc((n_edges ? n_edges : 1) * sizeof(int));
+    nbr_w = G_malloc((n_edges ? n_edges : 1) * sizeof(int));
+    for (t = 0; t <= n_tiles; t++) {
+        struct spill *s = t < n_tiles ? tiles[t].spills : cross;
+        int n = t < n_tiles ? tiles[t].n_spills : n_cross;
+
+        for (k = 0; k < n; k++) {
+            e = first[s[k].a]++;
+            nbr[e] = s[k].b;
+            nbr_w[e] = s[k].w;
+            e = first[s[k].b]++;
+            nbr[e] = s[k].a;
+            nbr_w[e] = s[k].w;
+        }
+    }
+    /* first[] was advanced to the start of the next label */
+    for (k = n_labels; k > 0; k--)
+        first[k] = first[k - 1];
+    first[0] = 0;
+
+    for (t = 0; t < n_tiles; t++) {
+        G_free(tiles[t].spills);
+        tiles[t].spills = NULL;
+    }
+    G_free(cross);
+
+    /* lowest level over all paths from OCEAN, the level of a path being its
+     * highest spill elevation */
+    level = G_malloc(n_labels * sizeof(int));
+    done = G_calloc(n_labels, 1);
+    for (k = 0; k < n_labels; k++)
+        level[k] = INT_MAX;
+    level[OCEAN] = INT_MIN;
+    heap = G_malloc((n_edges + 2) * sizeof(struct label_point));
+    heap_size = 0;
+    label_add(heap, &heap_size, level[OCEAN], OCEAN);
+    while (heap_size > 0) {
+        struct label_point p = label_drop(heap, &heap_size);
+
+        if (done[p.label])
+            continue;
+        done[p.label] = 1;
+        for (e = first[p.label]; e < first[p.label + 1]; e++) {
+            int lvl = p.level > nbr_w[e] ? p.level : nbr_w[e];
+
+            if (lvl < level[nbr[e]]) {
+                level[nbr[e]] = lvl;
+                label_add(heap, &heap_size, lvl, nbr[e]);
+            }
+        }
+    }
+
+    G_debug(1, "%d labels, %lld spills between labels", n_labels,
+            (long long int)n_edges / 2);
+
+    G_free(heap);
+    G_free(done);
+    G_free(first);
+    G_free(nbr);
+    G_free(nbr_w);
+}
+
+/* writes the spill elevations of a tile to the segment file */
+static void store_spill(struct flood *f, struct tile *t)
+{
+    int r, c, i, lvl;
+
+    flood_labels(f, t, 0);
+
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            if (!(f->state[i] & IN_TILE))
+                continue;
+            lvl = level[global_label(t, f->label[i])];
+            if (f->label[i] > OCEAN && lvl != INT_MAX && lvl > f->w[i])
+                f->w[i] = lvl;
+        }
+    }
+
+#pragma omp critical(segment)
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            if (f->state[i] & IN_TILE)
+                cseg_put(&spill, &f->w[i], t->r0 + r, t->c0 + c);
+        }
+    }
+}
+
+/* the A* Search does not add a diagonal neighbour that is reached more
+ * steeply from an orthogonal neighbour not yet worked, see do_astar() */
+static int skip_diag(int ct_dir, const double *slope, const CELL *ele_nbr)
+{
+    if (ct_dir < 4 || slope[ct_dir] <= 0)
+        return 0;
+    /* slope to ew nbr > slope to center */
+    if (slope[nbr_ew[ct_dir]] >= 0 &&
+        slope[ct_dir] <
+            get_slope(ele_nbr[nbr_ew[ct_dir]], ele_nbr[ct_dir], ew_res))
+        return 1;
+    /* slope to ns nbr > slope to center */
+    if (slope[nbr_ns[ct_dir]] >= 0 &&
+        slope[ct_dir] <
+            get_slope(ele_nbr[nbr_ns[ct_dir]], ele_nbr[ct_dir], ns_res))
+        return 1;
+
+    return 0;
+}
+
+/* a group starts from its start points and its cells next to a lower
+ * group */
+static int is_entry(const struct flood *f, int i)
+{
+    int ct_dir, j;
+
+    if (FLAG_GET(f->df[i].flag, INLISTFLAG))
+        return 1;
+    for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+        j = i + nextdr[ct_dir] * f->nc + nextdc[ct_dir];
+        if ((f->state[j] & (IN_TILE | IN_HALO)) && f->w[j] < f->w[i])
+            return 1;
+    }
+
+    return 0;
+}
+
+/* A* Search of a group of n cells on the stack, all inside the tile */
+static void search_group(struct flood *f, const struct tile *t, int n)
+{
+    int k, i, j, ct_dir;
+    GW_LARGE_INT rank = 0, n_cells = (GW_LARGE_INT)nrows * ncols;
+    CELL ele_nbr[8];
+    double slope[8];
+    struct flood_point p;
+
+    f->heap_size = f->added = 0;
+    for (k = 0; k < n; k++) {
+        i = f->stack[k];
+        if (is_entry(f, i)) {
+            f->state[i] |= QUEUED;
+            flood_add_cell(f, i,
+                           INDEX(t->r0 + i / f->nc - 1, t->c0 + i % f->nc - 1));
+        }
+    }
+
+    while (f->heap_size > 0) {
+        p = flood_drop(f->heap, &f->heap_size);
+        i = p.i;
+        f->state[i] |= DONE;
+        f->order[i].rank = rank++;
+
+        for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+            j = i + nextdr[ct_dir] * f->nc + nextdc[ct_dir];
+            slope[ct_dir] = -1;
+            ele_nbr[ct_dir] = 0;
+            if (!(f->state[j] & (IN_TILE | IN_HALO)))
+                continue;
+
+            /* lower groups are worked */
+            if (f->w[j] > p.w || (f->w[j] == p.w && !(f->state[j] & DONE))) {
+                ele_nbr[ct_dir] = f->ele[j];
+                slope[ct_dir] =
+                    get_slope(p.ele, ele_nbr[ct_dir], dist_to_nbr[ct_dir]);
+            }
+
+            if (f->w[j] != p.w || (f->state[j] & QUEUED) ||
+                skip_diag(ct_dir, slope, ele_nbr))
+                continue;
+
+            f->state[j] |= QUEUED;
+            flood_add_cell(f, j, n_cells + f->added++);
+        }
+    }
+}
+
+/* phase 3: search order of the groups inside one tile, groups crossing the
+ * tile border are kept for search_shared() */
+static void search_tile(struct flood *f, struct tile *t)
+{
+    int r, c, i, j, k, n, ct_dir, shared;
+    GW_LARGE_INT id;
+
+    t->n_searched = 0;
+    t->n_shared = 0;
+    t->shared = NULL;
+
+    for (i = 0; i < f->nr * f->nc; i++) {
+        f->order[i].group = UNSEARCHED;
+        f->order[i].rank = n_points;
+    }
+
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            if (!(f->state[i] & IN_TILE) || f->order[i].group != UNSEARCHED)
+                continue;
+
+            /* the first cell has the lowest index of the group */
+            id = INDEX(t->r0 + r, t->c0 + c);
+            f->order[i].group = id;
+            f->stack[0] = i;
+            n = 1;
+            shared = 0;
+            for (k = 0; k < n; k++) {
+                for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+                    j = f->stack[k] + nextdr[ct_dir] * f->nc + nextdc[ct_dir];
+                    if (!(f->state[j] & (IN_TILE | IN_HALO)) ||
+                        f->w[j] != f->w[i])
+                        continue;
+                    if (f->state[j] & IN_HALO)
+                        shared = 1;
+                    else if (f->order[j].group == UNSEARCHED) {
+                        f->order[j].group = id;
+                        f->stack[n++] = j;
+                    }
+                }
+            }
+
+            if (shared) {
+                for (k = 0; k < n; k++)
+                    f->order[f->stack[k]].group = SHARED;
+                t->shared = G_realloc(t->shared, (t->n_shared + 1) *
+                                                     sizeof(struct point));
+                t->shared[t->n_shared].r = t->r0 + r;
+                t->shared[t->n_shared].c = t->c0 + c;
+                t->n_shared++;
+            }
+            else {
+                search_group(f, t, n);
+                t->n_searched += n;
+            }
+        }
+    }
+
+#pragma omp critical(segment)
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            if (f->state[i] & IN_TILE)
+                seg_put(&order, (char *)&f->order[i], t->r0 + r, t->c0 + c);
+        }
+    }
+}
+
+/* phase 3: A* Search of a group crossing tile borders through the segment
+ * files, like search_group() */
+static GW_LARGE_INT search_shared(int r, int c)
+{
+    int r_nbr, c_nbr, ct_dir, entry;
+    GW_LARGE_INT k, n, n_alloc, id, rank, added;
+    GW_LARGE_INT heap_size, n_cells = (GW_LARGE_INT)nrows * ncols;
+    CELL w, w_nbr, ele_val, ele_nbr[8];
+    double slope[8];
+    struct point *cells;
+    struct flood_point *heap, p;
+    struct search_order so;
+    struct dir_flag df;
+
+    seg_get(&order, (char *)&so, r, c);
+    if (so.group != SHARED)
+        return 0;
+    cseg_get(&spill, &w, r, c);
+
+    /* collect the group, collected cells are marked as unsearched */
+    n_alloc = 1024;
+    cells = G_malloc(n_alloc * sizeof(struct point));
+    cells[0].r = r;
+    cells[0].c = c;
+    n = 1;
+    id = INDEX(r, c);
+    so.group = UNSEARCHED;
+    seg_put(&order, (char *)&so, r, c);
+    for (k = 0; k < n; k++) {
+        for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+            r_nbr = cells[k].r + nextdr[ct_dir];
+            c_nbr = cells[k].c + nextdc[ct_dir];
+            if (r_nbr < 0 || r_nbr >= nrows || c_nbr < 0 || c_nbr >= ncols)
+                continue;
+            seg_get(&dirflag, (char *)&df, r_nbr, c_nbr);
+            if (FLAG_GET(df.flag, NULLFLAG))
+                continue;
+            cseg_get(&spill, &w_nbr, r_nbr, c_nbr);
+            if (w_nbr != w)
+                continue;
+            seg_get(&order, (char *)&so, r_nbr, c_nbr);
+            if (so.group != SHARED)
+                continue;
+            so.group = UNSEARCHED;
+            seg_put(&order, (char *)&so, r_nbr, c_nbr);
+            if (n == n_alloc) {
+                n_alloc *= 2;
+                cells = G_realloc(cells, n_alloc * sizeof(struct point));
+            }
+            cells[n].r = r_nbr;
+            cells[n].c = c_nbr;
+            if (INDEX(r_nbr, c_nbr) < id)
+                id = INDEX(r_nbr, c_nbr);
+            n++;
+        }
+    }
+
+    /* start points and cells next to a lower group, queued cells are
+     * flagged as in the A* Search */
+    heap = G_malloc((n + 1) * sizeof(struct flood_point));
+    heap_size = 0;
+    for (k = 0; k < n; k++) {
+        r = cells[k].r;
+        c = cells[k].c;
+        so.group = id;
+        so.rank = n_points;
+        seg_put(&order, (char *)&so, r, c);
+
+        seg_get(&dirflag, (char *)&df, r, c);
+        entry = FLAG_GET(df.flag, INLISTFLAG) != 0;
+        for (ct_dir = 0; ct_dir < sides && !entry; ct_dir++) {
+            r_nbr = r + nextdr[ct_dir];
+            c_nbr = c + nextdc[ct_dir];
+            if (r_nbr < 0 || r_nbr >= nrows || c_nbr < 0 || c_nbr >= ncols)
+                continue;
+            seg_get(&dirflag, (char *)&df, r_nbr, c_nbr);
+            if (FLAG_GET(df.flag, NULLFLAG))
+                continue;
+            cseg_get(&spill, &w_nbr, r_nbr, c_nbr);
+            entry = w_nbr < w;
+        }
+        if (!entry)
+            continue;
+
+        seg_get(&dirflag, (char *)&df, r, c);
+        FLAG_SET(df.flag, INLISTFLAG);
+        seg_put(&dirflag, (char *)&df, r, c);
+        p.w = w;
+        cseg_get(&ele, &p.ele, r, c);
+        p.added = p.i = INDEX(r, c);
+        flood_add(heap, &heap_size, p);
+    }
+    G_free(cells);
+
+    rank = added = 0;
+    while (heap_size > 0) {
+        p = flood_drop(heap, &heap_size);
+        r = p.i / ncols;
+        c = p.i % ncols;
+        ele_val = p.ele;
+        so.group = id;
+        so.rank = rank++;
+        seg_put(&order, (char *)&so, r, c);
+
+        for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+            r_nbr = r + nextdr[ct_dir];
+            c_nbr = c + nextdc[ct_dir];
+            slope[ct_dir] = -1;
+            ele_nbr[ct_dir] = 0;
+            if (r_nbr < 0 || r_nbr >= nrows || c_nbr < 0 || c_nbr >= ncols)
+                continue;
+            seg_get(&dirflag, (char *)&df, r_nbr, c_nbr);
+            if (FLAG_GET(df.flag, NULLFLAG))
+                continue;
+            cseg_get(&spill, &w_nbr, r_nbr, c_nbr);
+            if (w_nbr == w)
+                seg_get(&order, (char *)&so, r_nbr, c_nbr);
+
+            /* lower groups are worked */
+            if (w_nbr > w || (w_nbr == w && so.rank == n_points)) {
+                cseg_get(&ele, &ele_nbr[ct_dir], r_nbr, c_nbr);
+                slope[ct_dir] =
+                    get_slope(ele_val, ele_nbr[ct_dir], dist_to_nbr[ct_dir]);
+            }
+
+            if (w_nbr != w || FLAG_GET(df.flag, INLISTFLAG) ||
+                skip_diag(ct_dir, slope, ele_nbr))
+                continue;
+
+            FLAG_SET(df.flag, INLISTFLAG);
+            seg_put(&dirflag, (char *)&df, r_nbr, c_nbr);
+            p.ele = ele_nbr[ct_dir];
+            p.added = n_cells + added++;
+            p.i = INDEX(r_nbr, c_nbr);
+            flood_add(heap, &heap_size, p);
+        }
+    }
+    G_free(heap);
+
+    return rank;
+}
+
+/* whether cell a is searched before cell b */
+static int before(const struct flood *f, int a, int b)
+{
+    if (f->w[a] != f->w[b])
+        return f->w[a] < f->w[b];
+    if (f->order[a].group != f->order[b].group)
+        return f->order[a].group < f->order[b].group;
+
+    return f->order[a].rank < f->order[b].rank;
+}
+
+/* whether the neighbour in direction ct_dir would be added by cell i in the
+ * A* Search, if it is not yet in the list */
+static int adds(const struct flood *f, int i, int ct_dir)
+{
+    int d[3], k, j;
+    CELL ele_nbr[8];
+    double slope[8];
+
+    if (ct_dir < 4)
+        return 1;
+
+    d[0] = nbr_ew[ct_dir];
+    d[1] = nbr_ns[ct_dir];
+    d[2] = ct_dir;
+    for (k = 0; k < 3; k++) {
+        j = i + nextdr[d[k]] * f->nc + nextdc[d[k]];
+        slope[d[k]] = -1;
+        ele_nbr[d[k]] = 0;
+        if ((f->state[j] & (IN_TILE | IN_HALO)) && before(f, i, j)) {
+            ele_nbr[d[k]] = f->ele[j];
+            slope[d[k]] = get_slope(f->ele[i], f->ele[j], dist_to_nbr[d[k]]);
+        }
+    }
+
+    return !skip_diag(ct_dir, slope, ele_nbr);
+}
+
+static void add_sink(struct flood *f, int i, int r, int c)
+{
+    if (f->n_sinks == f->n_alloc_sinks) {
+        f->n_alloc_sinks += 1024;
+        f->sinks = G_realloc(f->sinks,
+                             f->n_alloc_sinks * sizeof(struct tile_sink));
+    }
+    f->sinks[f->n_sinks].w = f->w[i];
+    f->sinks[f->n_sinks].o = f->order[i];
+    f->sinks[f->n_sinks].r = r;
+    f->sinks[f->n_sinks].c = c;
+    f->n_sinks++;
+}
+
+/* phase 4: drainage directions and sink bottom candidates of one tile, a
+ * cell drains to the first neighbour in the search order that adds it, a
+ * real depression to the first neighbour not higher, as in do_astar() */
+static void flood_dirs(struct flood *f, const struct tile *t)
+{
+    int r, c, i, j, ct_dir, best, best_dir, depr;
+    struct dir_flag *df;
+
+    f->n_sinks = 0;
+
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            if (!(f->state[i] & IN_TILE))
+                continue;
+            df = &f->df[i];
+            if (FLAG_GET(df->flag, EDGEFLAG))
+                continue;
+            depr = FLAG_GET(df->flag, DEPRFLAG) && df->dir == 0;
+
+            best = best_dir = -1;
+            for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+                j = i + nextdr[ct_dir] * f->nc + nextdc[ct_dir];
+                if (!(f->state[j] & (IN_TILE | IN_HALO)) || !before(f, j, i))
+                    continue;
+                /* the opposite direction is ct_dir ^ 1 */
+                if (depr ? f->ele[j] > f->ele[i] : !adds(f, j, ct_dir ^ 1))
+                    continue;
+                if (best < 0 || before(f, j, best)) {
+                    best = j;
+                    best_dir = ct_dir;
+                }
+            }
+            if (best < 0)
+                continue;
+
+            df->dir = drain[1 - nextdr[best_dir]][1 - nextdc[best_dir]];
+            if (depr)
+                FLAG_UNSET(df->flag, DEPRFLAG);
+            /* a bottom unless a lower neighbour drains to it, see
+             * is_sink_bottom() */
+            else if (f->ele[best] > f->ele[i])
+                add_sink(f, i, t->r0 + r, t->c0 + c);
+        }
+    }
+
+#pragma omp critical(segment)
+    for (r = 0; r < t->nr; r++) {
+        for (c = 0; c < t->nc; c++) {
+            i = (r + 1) * f->nc + c + 1;
+            if (!(f->state[i] & IN_TILE))
+                continue;
+            FLAG_SET(f->df[i].flag, INLISTFLAG);
+            FLAG_SET(f->df[i].flag, WORKEDFLAG);
+            seg_put(&dirflag, (char *)&f->df[i], t->r0 + r, t->c0 + c);
+        }
+    }
+}
+
+/* a candidate is a sink bottom if no lower neighbour drains to it, as in
+ * the A* Search where the candidate would have added that neighbour */
+static int is_sink_bottom(const struct tile_sink *s)
+{
+    int ct_dir, r_nbr, c_nbr;
+    CELL ele_val, ele_nbr;
+    struct dir_flag df;
+
+    cseg_get(&ele, &ele_val, s->r, s->c);
+    for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+        r_nbr = s->r + nextdr[ct_dir];
+        c_nbr = s->c + nextdc[ct_dir];
+        if (r_nbr < 0 || r_nbr >= nrows || c_nbr < 0 || c_nbr >= ncols)
+            continue;
+        seg_get(&dirflag, (char *)&df, r_nbr, c_nbr);
+        if (FLAG_GET(df.flag, NULLFLAG) || FLAG_GET(df.flag, EDGEFLAG) ||
+            df.dir <= 0)
+            continue;
+        if (r_nbr + asp_r[(int)df.dir] != s->r ||
+            c_nbr + asp_c[(int)df.dir] != s->c)
+            continue;
+        cseg_get(&ele, &ele_nbr, r_nbr, c_nbr);
+        if (ele_nbr < ele_val)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int cmp_sink(const void *a, const void *b)
+{
+    const struct tile_sink *sa = a, *sb = b;
+
+    if (sa->w != sb->w)
+        return sa->w < sb->w ? -1 : 1;
+    if (sa->o.group != sb->o.group)
+        return sa->o.group < sb->o.group ? -1 : 1;
+    if (sa->o.rank != sb->o.rank)
+        return sa->o.rank < sb->o.rank ? -1 : 1;
+
+    return 0;
+}
+
+int do_tiles(int tile_size, int nsegs_in_memory)
+{
+    int t, k, n_tiles, n_done, ct_dir;
+    double dx, dy;
+    struct Cell_head window;
+    struct tile_sink *all_sinks = NULL;
+    GW_LARGE_INT n_all_sinks = 0, n_searched = 0, i, n;
+
+    ts = tile_size;
+    n_tile_rows = (nrows + ts - 1) / ts;
+    n_tile_cols = (ncols + ts - 1) / ts;
+    n_tiles = n_tile_rows * n_tile_cols;
+
+    tiles = G_calloc(n_tiles, sizeof(struct tile));
+    for (t = 0; t < n_tiles; t++) {
+        tiles[t].r0 = (t / n_tile_cols) * ts;
+        tiles[t].c0 = (t % n_tile_cols) * ts;
+        tiles[t].nr = nrows - tiles[t].r0 < ts ? nrows - tiles[t].r0 : ts;
+        tiles[t].nc = ncols - tiles[t].c0 < ts ? ncols - tiles[t].c0 : ts;
+    }
+
+    Rast_get_window(&window);
+    for (ct_dir = 0; ct_dir < sides; ct_dir++) {
+        /* account for rare cases when ns_res != ew_res */
+        dy = abs(nextdr[ct_dir]) * window.ns_res;
+        dx = abs(nextdc[ct_dir]) * window.ew_res;
+        if (ct_dir < 4)
+            dist_to_nbr[ct_dir] = dx + dy;
+        else
+            dist_to_nbr[ct_dir] = sqrt(dx * dx + dy * dy);
+    }
+    ew_res = window.ew_res;
+    ns_res = window.ns_res;
+
+    G_message(_("Priority-flood of %d tiles..."), n_tiles);
+
+    n_done = 0;
+#pragma omp parallel
+    {
+        struct flood *f = alloc_flood();
+
+#pragma omp for schedule(dynamic)
+        for (t = 0; t < n_tiles; t++) {
+            load_tile(f, &tiles[t], 0);
+            flood_labels(f, &tiles[t], 1);
+#pragma omp critical(progress)
+            G_percent(n_done++, n_tiles, 2);
+        }
+
+        free_flood(f);
+    }
+    G_percent(n_tiles, n_tiles, 2);
+
+    solve_spills(n_tiles);
+
+    if (cseg_open(&spill, 64, 64, nsegs_in_memory) != 0)
+        G_fatal_error(_("Could not create cache for spill elevations"));
+    /* as much memory as for spill elevations */
+    if (seg_open(&order, nrows, ncols, 64, 64,
+                 nsegs_in_memory * sizeof(CELL) / sizeof(struct search_order),
+                 sizeof(struct search_order)) != 0)
+        G_fatal_error(_("Could not create cache for the search order"));
+
+    n_done = 0;
+#pragma omp parallel
+    {
+        struct flood *f = alloc_flood();
+
+#pragma omp for schedule(dynamic)
+        for (t = 0; t < n_tiles; t++) {
+            load_tile(f, &tiles[t], 0);
+            store_spill(f, &tiles[t]);
+#pragma omp critical(progress)
+            G_percent(n_done++, n_tiles, 2);
+        }
+
+        free_flood(f);
+    }
+    G_percent(n_tiles, n_tiles, 2);
+
+    G_message(_("A* Search by tiles..."));
+
+    n_done = 0;
+#pragma omp parallel
+    {
+        struct flood *f = alloc_flood();
+
+#pragma omp for schedule(dynamic)
+        for (t = 0; t < n_tiles; t++) {
+            load_tile(f, &tiles[t], LOAD_HALO);
+            search_tile(f, &tiles[t]);
+#pragma omp critical(progress)
+            G_percent(n_done++, n_tiles, 2);
+        }
+
+        free_flood(f);
+    }
+    G_percent(n_tiles, n_tiles, 2);
+
+    /* groups crossing tile borders, in the order of the tiles */
+    for (t = 0; t < n_tiles; t++) {
+        n_searched += tiles[t].n_searched;
+        for (k = 0; k < tiles[t].n_shared; k++)
+            n_searched +=
+                search_shared(tiles[t].shared[k].r, tiles[t].shared[k].c);
+        G_free(tiles[t].shared);
+    }
+
+    G_message(_("Drainage directions by tiles..."));
+
+    n_done = 0;
+#pragma omp parallel
+    {
+        struct flood *f = alloc_flood();
+
+#pragma omp for schedule(dynamic)
+        for (t = 0; t < n_tiles; t++) {
+            load_tile(f, &tiles[t], LOAD_HALO | LOAD_ORDER);
+            flood_dirs(f, &tiles[t]);
+#pragma omp critical(progress)
+            {
+                if (f->n_sinks) {
+                    all_sinks = G_realloc(all_sinks,
+                                          (n_all_sinks + f->n_sinks) *
+                                              sizeof(struct tile_sink));
+                    for (k = 0; k < f->n_sinks; k++)
+                        all_sinks[n_all_sinks + k] = f->sinks[k];
+                    n_all_sinks += f->n_sinks;
+                }
+                G_percent(n_done++, n_tiles, 2);
+            }
+        }
+
+        free_flood(f);
+    }
+    G_percent(n_tiles, n_tiles, 2);
+
+    cseg_close(&spill);
+    seg_close(&order);
+
+    /* sink bottoms in the search order */
+    n = 0;
+    for (i = 0; i < n_all_sinks; i++) {
+        if (is_sink_bottom(&all_sinks[i]))
+            all_sinks[n++] = all_sinks[i];
+    }
+    G_debug(1, "%lld sink bottoms of %lld candidates", (long long int)n,
+            (long long int)n_all_sinks);
+    n_all_sinks = n;
+    qsort(all_sinks, n_all_sinks, sizeof(struct tile_sink), cmp_sink);
+
+    sinks = first_sink = NULL;
+    n_sinks = 0;
+    for (i = 0; i < n_all_sinks; i++) {
+        if (first_sink) {
+            sinks->next =
+                (struct sink_list *)G_malloc(sizeof(struct sink_list));
+            sinks = sinks->next;
+        }
+        else {
+            first_sink =
+                (struct sink_list *)G_malloc(sizeof(struct sink_list));
+            sinks = first_sink;
+        }
+        sinks->next = NULL;
+        sinks->r = all_sinks[i].r;
+        sinks->c = all_sinks[i].c;
+        n_sinks++;
+    }
+    G_free(all_sinks);
+
+    first_cum = n_points - n_searched;
+    if (first_cum)
+        G_warning(_("processed points mismatch of %lld"),
+                  (long long int)first_cum);
+
+    for (t = 0; t < n_tiles; t++) {
+        G_free(tiles[t].ring_label);
+        G_free(tiles[t].ring_ele);
+    }
+    G_free(tiles);
+    G_free(level);
+
+    return 1;
+}
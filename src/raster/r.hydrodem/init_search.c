@@ -2,6 +2,15 @@
 #include <grass/glocale.h>
 #include "local_proto.h"
 
+/* the tiled search finds start points by their flags, only count them */
+static void add_start(int r, int c, CELL ele_value)
+{
+    if (tile_size)
+        heap_size++;
+    else
+        heap_add(r, c, ele_value);
+}
+
 int init_search(int depr_fd)
 {
     int r, c, r_nbr, c_nbr, ct_dir;
@@ -78,7 +87,7 @@ int init_search(int depr_fd)
                 FLAG_SET(df.flag, INLISTFLAG);
                 df.dir = asp_value;
                 seg_put(&dirflag, (char *)&df, r, c);
-                heap_add(r, c, ele_value);
+                add_start(r, c, ele_value);
 
                 if (depr_fd > -1)
                     depr_ptr = G_incr_void_ptr(depr_ptr, depr_size);
@@ -103,7 +112,7 @@ int init_search(int depr_fd)
                         FLAG_SET(df.flag, INLISTFLAG);
                         df.dir = asp_value;
                         seg_put(&dirflag, (char *)&df, r, c);
-                        heap_add(r, c, ele_value);
+                        add_start(r, c, ele_value);
 
                         break;
                     }
@@ -129,7 +138,7 @@ int init_search(int depr_fd)
                     FLAG_SET(df.flag, DEPRFLAG);
                     df.dir = asp_value;
                     seg_put(&dirflag, (char *)&df, r, c);
-                    heap_add(r, c, ele_value);
+                    add_start(r, c, ele_value);
                     n_depr_cells++;
                 }
                 depr_ptr = G_incr_void_ptr(depr_ptr, depr_size);
@@ -64,6 +64,7 @@ extern GW_LARGE_INT first_cum;
 extern char sides;
 extern int c_fac;
 extern int ele_scale;
+extern int tile_size;
 extern struct RB_TREE *draintree;
 
 extern SSEG search_heap;
@@ -86,6 +87,9 @@ int init_search(int);
 int do_astar(void);
 GW_LARGE_INT heap_add(int, int, CELL);
 
+/* do_tiles.c */
+int do_tiles(int, int);
+
 /* hydro_con.c */
 int hydro_con(void);
 int one_cell_extrema(int, int, int);
@@ -18,6 +18,9 @@
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "local_proto.h"
 
 struct snode *stream_node;
@@ -38,6 +41,7 @@ GW_LARGE_INT first_cum;
 char sides;
 int c_fac;
 int ele_scale;
+int tile_size;
 struct RB_TREE *draintree;
 
 SSEG search_heap;
@@ -52,7 +56,7 @@ CSEG stream;
 int main(int argc, char *argv[])
 {
     struct {
-        struct Option *ele, *depr, *memory;
+        struct Option *ele, *depr, *memory, *tile_size, *nprocs;
     } input;
     struct {
         struct Option *ele_hydro;
@@ -61,10 +65,11 @@ int main(int argc, char *argv[])
         struct Flag *do_all;
         struct Flag *force_filling;
         struct Flag *force_carving;
+        struct Flag *segmented;
     } output;
     struct GModule *module;
     int ele_fd, ele_map_type, depr_fd;
-    int memory;
+    int memory, nprocs;
     int seg_cols, seg_rows;
     double seg2kb;
     int num_open_segs, num_open_array_segs, num_seg_total;
@@ -99,6 +104,19 @@ int main(int argc, char *argv[])
     input.memory->answer = "300";
     input.memory->description = _("Maximum memory to be used in MB");
 
+    input.tile_size = G_define_option();
+    input.tile_size->key = "tile_size";
+    input.tile_size->type = TYPE_INTEGER;
+    input.tile_size->required = NO;
+    input.tile_size->answer = "1024";
+    input.tile_size->options = "16-";
+    input.tile_size->label =
+        _("Size of square tiles for the parallel search (in cells)");
+    input.tile_size->description =
+        _("One tile per thread is kept in memory in addition to <memory>");
+
+    input.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+
     output.ele_hydro = G_define_standard_option(G_OPT_R_OUTPUT);
     output.ele_hydro->key = "output";
     output.ele_hydro->description =
@@ -143,6 +161,15 @@ int main(int argc, char *argv[])
         (_("By default a least impact approach is used to modify the DEM."
            "Use this flag to force carving out of sinks."));
 
+    output.segmented = G_define_flag();
+    output.segmented->key = 's';
+    output.segmented->label = (_("Use the segmented A* Search"));
+    output.segmented->description =
+        (_("By default tiles are searched in parallel in memory. "
+           "Use this flag to keep the search heap in a segment file."));
+
+    G_option_excludes(output.segmented, input.tile_size, input.nprocs, NULL);
+
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
@@ -175,6 +202,28 @@ int main(int argc, char *argv[])
     else
         memory = 300;
 
+    if (output.segmented->answer)
+        tile_size = 0;
+    else
+        tile_size = atoi(input.tile_size->answer);
+
+#ifdef _OPENMP
+    nprocs = atoi(input.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), input.nprocs->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    if (tile_size)
+        G_message(n_("Using %d thread for serial computation",
+                     "Using %d threads for parallel computation", nprocs),
+                  nprocs);
+#else
+    nprocs = 1;
+#endif
+
     do_all = output.do_all->answer;
 
     if (!do_all) {
@@ -295,34 +344,46 @@ int main(int argc, char *argv[])
         G_fatal_error(_("No non-NULL cells loaded from input map"));
     }
 
-    /* one-based d-ary search_heap */
-    G_debug(1, "open segments for A* search heap");
-
-    /* allowed memory for search heap in MB */
-    G_debug(1, "heap memory %.2f MB", heap_mem);
-    /* columns per segment */
-    /* larger is faster */
-    seg_cols = seg_rows * seg_rows * seg_rows;
-    num_seg_total = n_points / seg_cols;
-    if (n_points % seg_cols > 0)
-        num_seg_total++;
-    /* no need to have more segments open than exist */
-    num_open_array_segs =
-        (1 << 20) * heap_mem / (seg_cols * sizeof(struct heap_point));
-    if (num_open_array_segs > num_seg_total)
-        num_open_array_segs = num_seg_total;
-    if (num_open_array_segs < 2)
-        num_open_array_segs = 2;
-
-    G_debug(1, "A* search heap open segments %d, total %d", num_open_array_segs,
-            num_seg_total);
-    G_debug(1, "segment size for heap points: %d", seg_cols);
-    /* the search heap will not hold more than 5% of all points at any given
-     * time ? */
-    /* chances are good that the heap will fit into one large segment */
-    if (seg_open(&search_heap, 1, n_points + 1, 1, seg_cols,
-                 num_open_array_segs, sizeof(struct heap_point)) != 0) {
-        G_fatal_error(_("Could not create cache for the A* search heap"));
+    if (tile_size) {
+        /* tile buffers with halo, see do_tiles.c */
+        G_verbose_message(_("Tiles need up to %.2f MB of memory"),
+                          nprocs * (tile_size + 2.) * (tile_size + 2.) *
+                              (2. * sizeof(CELL) + sizeof(struct dir_flag) +
+                               2. * sizeof(int) + 1 +
+                               2. * sizeof(GW_LARGE_INT) +
+                               sizeof(struct heap_point)) /
+                              (1 << 20));
+    }
+    else {
+        /* one-based d-ary search_heap */
+        G_debug(1, "open segments for A* search heap");
+
+        /* allowed memory for search heap in MB */
+        G_debug(1, "heap memory %.2f MB", heap_mem);
+        /* columns per segment */
+        /* larger is faster */
+        seg_cols = seg_rows * seg_rows * seg_rows;
+        num_seg_total = n_points / seg_cols;
+        if (n_points % seg_cols > 0)
+            num_seg_total++;
+        /* no need to have more segments open than exist */
+        num_open_array_segs =
+            (1 << 20) * heap_mem / (seg_cols * sizeof(struct heap_point));
+        if (num_open_array_segs > num_seg_total)
+            num_open_array_segs = num_seg_total;
+        if (num_open_array_segs < 2)
+            num_open_array_segs = 2;
+
+        G_debug(1, "A* search heap open segments %d, total %d",
+                num_open_array_segs, num_seg_total);
+        G_debug(1, "segment size for heap points: %d", seg_cols);
+        /* the search heap will not hold more than 5% of all points at any
+         * given time ? */
+        /* chances are good that the heap will fit into one large segment */
+        if (seg_open(&search_heap, 1, n_points + 1, 1, seg_cols,
+                     num_open_array_segs, sizeof(struct heap_point)) != 0) {
+            G_fatal_error(_("Could not create cache for the A* search heap"));
+        }
     }
 
     /********************/
@@ -334,7 +395,8 @@ int main(int argc, char *argv[])
 
     /* initialize A* search */
     if (init_search(depr_fd) < 0) {
-        seg_close(&search_heap);
+        if (!tile_size)
+            seg_close(&search_heap);
         cseg_close(&ele);
         seg_close(&dirflag);
         G_fatal_error(_("Could not initialize search"));
@@ -345,13 +407,22 @@ int main(int argc, char *argv[])
     }
 
     /* sort elevation and get initial stream direction */
-    if (do_astar() < 0) {
+    if (tile_size) {
+        if (do_tiles(tile_size, num_open_segs * 2) < 0) {
+            cseg_close(&ele);
+            seg_close(&dirflag);
+            G_fatal_error(_("Could not sort elevation map"));
+        }
+    }
+    else {
+        if (do_astar() < 0) {
+            seg_close(&search_heap);
+            cseg_close(&ele);
+            seg_close(&dirflag);
+            G_fatal_error(_("Could not sort elevation map"));
+        }
         seg_close(&search_heap);
-        cseg_close(&ele);
-        seg_close(&dirflag);
-        G_fatal_error(_("Could not sort elevation map"));
     }
-    seg_close(&search_heap);
 
     /* hydrological corrections */
     if (hydro_con() < 0) {
@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+
+############################################################################
+#
+# NAME:      test_r_hydrodem
+#
+# PURPOSE:   Check that the tiled search of r.hydrodem does not depend on
+#            the tile size and the number of threads
+#
+# COPYRIGHT: (C) 2024 by the GRASS Development Team
+#
+#            This program is free software under the GNU General Public
+#            License (>=v2). Read the file COPYING that comes with GRASS
+#            for details.
+#
+#############################################################################
+
+from grass.gunittest.case import TestCase
+from grass.gunittest.main import test
+
+
+class TestTiles(TestCase):
+    elevation = "elevation"
+    single = "test_hydrodem_single"
+    tiled = "test_hydrodem_tiled"
+    tiled_1 = "test_hydrodem_tiled_1"
+
+    @classmethod
+    def setUpClass(cls):
+        """Coarser region, one tile covers it"""
+        cls.use_temp_region()
+        cls.runModule("g.region", raster=cls.elevation, res=30, flags="a")
+        cls.runModule(
+            "r.hydrodem",
+            input=cls.elevation,
+            output=cls.single,
+            tile_size=2000,
+            nprocs=1,
+            overwrite=True,
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.runModule(
+            "g.remove",
+            flags="f",
+            type="raster",
+            name=[cls.single, cls.tiled, cls.tiled_1],
+        )
+        cls.del_temp_region()
+
+    def test_several_tiles(self):
+        """Several tiles give the output of a single tile"""
+        self.assertModule(
+            "r.hydrodem",
+            input=self.elevation,
+            output=self.tiled,
+            tile_size=64,
+            nprocs=2,
+            overwrite=True,
+        )
+        self.assertRastersNoDifference(self.tiled, self.single, precision=0)
+
+    def test_threads(self):
+        """Several tiles give the same output with any number of threads"""
+        self.assertModule(
+            "r.hydrodem",
+            input=self.elevation,
+            output=self.tiled_1,
+            tile_size=50,
+            nprocs=1,
+            overwrite=True,
+        )
+        self.assertModule(
+            "r.hydrodem",
+            input=self.elevation,
+            output=self.tiled,
+            tile_size=50,
+            nprocs=4,
+            overwrite=True,
+        )
+        self.assertRastersNoDifference(self.tiled, self.tiled_1, precision=0)
+        self.assertRastersNoDifference(self.tiled, self.single, precision=0)
+
+
+if __name__ == "__main__":
+    test()
@@ -35,6 +35,7 @@ extern "C" {
 }
 
 #include <map>
+#include <algorithm>
 #include <tuple>
 #include <vector>
 #include <iostream>
@@ -93,15 +94,9 @@ string generate_name(const string &basename, const Date &date)
     return name;
 }
 
-void write_average_area(const std::vector<Img> &infected,
-                        const char *raster_name, double ew_res, double ns_res)
+void write_average_area(double avg, const char *raster_name)
 {
     struct History hist;
-    double avg = 0;
-    for (unsigned i = 0; i < infected.size(); i++) {
-        avg += area_of_infected(infected[i], ew_res, ns_res);
-    }
-    avg /= infected.size();
     string avg_string = "Average infected area: " + std::to_string(avg);
     Rast_read_history(raster_name, "", &hist);
     Rast_set_history(&hist, HIST_KEYWRD, avg_string.c_str());
@@ -207,7 +202,7 @@ struct PoPSOptions {
     struct Option *percent_natural_dispersal;
     struct Option *infected_to_dead_rate, *first_year_to_die;
     struct Option *dead_series;
-    struct Option *seed, *runs, *threads;
+    struct Option *seed, *runs, *threads, *batch_size;
     struct Option *single_series;
     struct Option *average, *average_series;
     struct Option *stddev, *stddev_series;
@@ -219,6 +214,8 @@ struct PoPSOptions {
 struct PoPSFlags {
     struct Flag *mortality;
     struct Flag *generate_seed;
+    struct Flag *cell_random_streams;
+    struct Flag *tabulated_kernels;
 };
 
 int main(int argc, char *argv[])
@@ -685,6 +682,41 @@ int main(int argc, char *argv[])
     opt.threads->options = "1-";
     opt.threads->guisection = _("Randomness");
 
+    opt.batch_size = G_define_option();
+    opt.batch_size->key = "batch_size";
+    opt.batch_size->type = TYPE_INTEGER;
+    opt.batch_size->required = NO;
+    opt.batch_size->label = _("Number of runs computed at the same time");
+    opt.batch_size->description =
+        _("Limits memory used by the runs. Weather is read again for each"
+          " batch. With series outputs, statistics for each output step"
+          " are kept until the last batch. By default, all runs are"
+          " computed at the same time.");
+    opt.batch_size->options = "1-";
+    opt.batch_size->guisection = _("Randomness");
+
+    flg.cell_random_streams = G_define_flag();
+    flg.cell_random_streams->key = 'p';
+    flg.cell_random_streams->label =
+        _("Parallelize computation within each run");
+    flg.cell_random_streams->description =
+        _("Uses a separate random number stream for each cell, so that"
+          " threads can be used within a single run. Results are the same"
+          " for any number of threads, but differ from results obtained"
+          " without this flag.");
+    flg.cell_random_streams->guisection = _("Randomness");
+
+    flg.tabulated_kernels = G_define_flag();
+    flg.tabulated_kernels->key = 't';
+    flg.tabulated_kernels->label =
+        _("Precompute radial dispersal kernels as tables");
+    flg.tabulated_kernels->description =
+        _("Probabilities of dispersal to nearby cells are computed once"
+          " which makes dispersal faster. Results are statistically"
+          " equivalent, but differ from results obtained without this"
+          " flag for the same seed.");
+    flg.tabulated_kernels->guisection = _("Dispersal");
+
     G_option_required(opt.average, opt.average_series, opt.single_series,
                       opt.probability, opt.probability_series,
                       opt.outside_spores, opt.stddev, opt.stddev_series, NULL);
@@ -730,6 +762,11 @@ int main(int argc, char *argv[])
     if (opt.threads->answer)
         threads = std::stoul(opt.threads->answer);
 
+    unsigned batch_size = num_runs;
+    if (opt.batch_size->answer)
+        batch_size = std::min<unsigned>(num_runs,
+                                        std::stoul(opt.batch_size->answer));
+
     // check for file existence
     file_exists_or_fatal_error(opt.moisture_coefficient_file);
     file_exists_or_fatal_error(opt.temperature_coefficient_file);
@@ -755,6 +792,16 @@ int main(int argc, char *argv[])
     config.cols = window.cols;
     config.ew_res = window.ew_res;
     config.ns_res = window.ns_res;
+    // visiting only infected cells gives the same results, but faster
+    config.use_active_cells = true;
+    config.tabulated_kernels = flg.tabulated_kernels->answer;
+    // with cell streams, threads are used within runs, not across runs
+    unsigned run_threads = threads;
+    if (flg.cell_random_streams->answer) {
+        config.cell_random_streams = true;
+        config.threads = threads;
+        run_threads = 1;
+    }
 
     // Seasonality: Do you want the spread to be limited to certain months?
     if (!opt.seasonality->answer || opt.seasonality->answer[0] == '\0')
@@ -966,41 +1013,28 @@ int main(int argc, char *argv[])
         }
     }
 
-    // build the Sporulation object
-    std::vector<Model<Img, DImg, int>> models;
-    std::vector<Img> dispersers;
-    std::vector<Img> sus_species_rasts(num_runs, S_species_rast);
-    std::vector<Img> inf_species_rasts(num_runs, I_species_rast);
-    std::vector<Img> resistant_rasts(num_runs, Img(S_species_rast, 0));
-
-    // We always create at least one exposed for simplicity, but we
-    // could also just leave it empty.
-    std::vector<std::vector<Img>> exposed_vectors(
-        num_runs,
-        std::vector<Img>(config.latency_period_steps + 1,
-                         Img(S_species_rast.rows(), S_species_rast.cols(), 0)));
-
-    // infected cohort for each year (index is cohort age)
-    // age starts with 0 (in year 1), 0 is oldest
-    std::vector<std::vector<Img>> mortality_tracker_vector(
-        num_runs,
-        std::vector<Img>(config.num_mortality_years(), Img(S_species_rast, 0)));
-
-    // we are using only the first dead img for visualization, but for
-    // parallelization we need all allocated anyway
-    std::vector<Img> dead_in_current_year(num_runs, Img(S_species_rast, 0));
+    // Statistics across runs are accumulated as runs progress, so the
+    // rasters of individual runs are needed only for runs in the current
+    // batch. Series statistics are kept per output step until the last
+    // batch reaches the step.
+    typedef EnsembleStatistics<Img, DImg> Statistics;
+    bool series_statistics = opt.average_series->answer ||
+                             opt.stddev_series->answer ||
+                             opt.probability_series->answer;
+    bool final_statistics = opt.average->answer || opt.stddev->answer ||
+                            opt.probability->answer;
+    std::map<unsigned, Statistics> series_stats;
+    std::map<unsigned, double> series_areas;
+    std::unique_ptr<Statistics> final_stats;
+    if (final_statistics)
+        final_stats.reset(
+            new Statistics(I_species_rast.rows(), I_species_rast.cols()));
+    double final_area = 0;
+
     // dead trees accumulated over years
     // TODO: allow only when series as single run
     Img accumulated_dead(Img(S_species_rast, 0));
 
-    models.reserve(num_runs);
-    dispersers.reserve(num_runs);
-    for (unsigned i = 0; i < num_runs; ++i) {
-        Config config_copy = config;
-        config_copy.random_seed = seed_value++;
-        models.emplace_back(config_copy);
-        dispersers.emplace_back(I_species_rast.rows(), I_species_rast.cols());
-    }
     std::vector<std::vector<std::tuple<int, int>>> outside_spores(num_runs);
 
     // spread rate initialization
@@ -1017,176 +1051,226 @@ int main(int argc, char *argv[])
     std::vector<unsigned> unresolved_steps;
     unresolved_steps.reserve(config.scheduler().get_num_steps());
 
-    // main simulation loop
+    // kernel tables depend only on the kernel settings, so all runs share them
+    auto natural_table = create_natural_tabulated_kernel(config);
+    auto anthro_table = create_anthro_tabulated_kernel(config);
+    if (config.tabulated_kernels) {
+        if (!natural_table &&
+            TabulatedDispersalKernel::supports_kernel(
+                kernel_type_from_string(config.natural_kernel_type)))
+            G_warning(_("Natural dispersal kernel is too large to be"
+                        " precomputed, using it without a table"));
+        if (!anthro_table && config.use_anthropogenic_kernel &&
+            TabulatedDispersalKernel::supports_kernel(
+                kernel_type_from_string(config.anthro_kernel_type)))
+            G_warning(_("Anthropogenic dispersal kernel is too large to be"
+                        " precomputed, using it without a table"));
+    }
+
     unsigned current_index = 0;
-    for (; current_index < config.scheduler().get_num_steps();
-         ++current_index) {
-        unresolved_steps.push_back(current_index);
-
-        // if all the hosts are infected, then exit
-        if (all_infected(S_species_rast)) {
-            G_warning("In step %d all suspectible hosts are infected, ending "
-                      "simulation.",
-                      current_index);
-            break;
+    for (unsigned batch_start = 0; batch_start < num_runs;
+         batch_start += batch_size) {
+        unsigned batch_runs = std::min(batch_size, num_runs - batch_start);
+        bool first_batch = batch_start == 0;
+        bool last_batch = batch_start + batch_runs == num_runs;
+
+        // build the Sporulation object
+        std::vector<Model<Img, DImg, int>> models;
+        std::vector<Img> dispersers;
+        std::vector<Img> sus_species_rasts(batch_runs, S_species_rast);
+        std::vector<Img> inf_species_rasts(batch_runs, I_species_rast);
+        std::vector<Img> resistant_rasts(batch_runs, Img(S_species_rast, 0));
+
+        // We always create at least one exposed for simplicity, but we
+        // could also just leave it empty.
+        std::vector<std::vector<Img>> exposed_vectors(
+            batch_runs, std::vector<Img>(config.latency_period_steps + 1,
+                                         Img(S_species_rast.rows(),
+                                             S_species_rast.cols(), 0)));
+
+        // infected cohort for each year (index is cohort age)
+        // age starts with 0 (in year 1), 0 is oldest
+        std::vector<std::vector<Img>> mortality_tracker_vector(
+            batch_runs, std::vector<Img>(config.num_mortality_years(),
+                                         Img(S_species_rast, 0)));
+
+        // we are using only the first dead img for visualization, but for
+        // parallelization we need all allocated anyway
+        std::vector<Img> dead_in_current_year(batch_runs,
+                                              Img(S_species_rast, 0));
+
+        models.reserve(batch_runs);
+        dispersers.reserve(batch_runs);
+        for (unsigned i = 0; i < batch_runs; ++i) {
+            Config config_copy = config;
+            // each run has the same seed regardless of the batch size
+            config_copy.random_seed = seed_value + batch_start + i;
+            models.emplace_back(config_copy, natural_table, anthro_table);
+            dispersers.emplace_back(I_species_rast.rows(),
+                                    I_species_rast.cols());
         }
 
-        // check whether the spore occurs in the month
-        // At the end of the year, run simulation for all unresolved
-        // steps in one chunk.
-        if (config.output_schedule()[current_index] ||
-            current_index == config.scheduler().get_num_steps() - 1) {
-            unsigned step_in_chunk = 0;
-            // get weather for all the steps in chunk
-            for (auto step : unresolved_steps) {
-                if (moisture_temperature) {
-                    DImg moisture(
-                        raster_from_grass_float(moisture_names[step]));
-                    DImg temperature(
-                        raster_from_grass_float(temperature_names[step]));
-                    weather_coefficients[step_in_chunk] =
-                        moisture * temperature;
-                }
-                else if (weather)
-                    weather_coefficients[step_in_chunk] =
-                        raster_from_grass_float(weather_names[step]);
-                ++step_in_chunk;
+        // main simulation loop
+        unresolved_steps.clear();
+        current_index = 0;
+        for (; current_index < config.scheduler().get_num_steps();
+             ++current_index) {
+            unresolved_steps.push_back(current_index);
+
+            // if all the hosts are infected, then exit
+            if (all_infected(S_species_rast)) {
+                if (first_batch)
+                    G_warning("In step %d all suspectible hosts are infected,"
+                              " ending simulation.",
+                              current_index);
+                break;
             }
 
-// stochastic simulation runs
-#pragma omp parallel for num_threads(threads)
-            for (unsigned run = 0; run < num_runs; run++) {
-                // actual runs of the simulation for each step
-                int weather_step = 0;
+            // check whether the spore occurs in the month
+            // At the end of the year, run simulation for all unresolved
+            // steps in one chunk.
+            if (config.output_schedule()[current_index] ||
+                current_index == config.scheduler().get_num_steps() - 1) {
+                unsigned step_in_chunk = 0;
+                // get weather for all the steps in chunk
                 for (auto step : unresolved_steps) {
-                    dead_in_current_year[run].zero();
-                    models[run].run_step(
-                        step, inf_species_rasts[run], sus_species_rasts[run],
-                        lvtree_rast, dispersers[run], exposed_vectors[run],
-                        mortality_tracker_vector[run],
-                        dead_in_current_year[run], actual_temperatures,
-                        weather_coefficients[weather_step], treatments,
-                        resistant_rasts[run], outside_spores[run],
-                        spread_rates[run], quarantine, empty, movements);
-                    ++weather_step;
+                    if (moisture_temperature) {
+                        DImg moisture(
+                            raster_from_grass_float(moisture_names[step]));
+                        DImg temperature(
+                            raster_from_grass_float(temperature_names[step]));
+                        weather_coefficients[step_in_chunk] =
+                            moisture * temperature;
+                    }
+                    else if (weather)
+                        weather_coefficients[step_in_chunk] =
+                            raster_from_grass_float(weather_names[step]);
+                    ++step_in_chunk;
                 }
-            }
 
-            unresolved_steps.clear();
-            if (config.output_schedule()[current_index]) {
-                // output
-                Step interval = config.scheduler().get_step(current_index);
-                if (opt.single_series->answer) {
-                    string name = generate_name(opt.single_series->answer,
-                                                interval.end_date());
-                    raster_to_grass(inf_species_rasts[0], name,
-                                    "Occurrence from a single stochastic run",
-                                    interval.end_date());
+// stochastic simulation runs
+#pragma omp parallel for num_threads(run_threads)
+                for (unsigned run = 0; run < batch_runs; run++) {
+                    // actual runs of the simulation for each step
+                    int weather_step = 0;
+                    for (auto step : unresolved_steps) {
+                        dead_in_current_year[run].zero();
+                        models[run].run_step(
+                            step, inf_species_rasts[run],
+                            sus_species_rasts[run], lvtree_rast,
+                            dispersers[run], exposed_vectors[run],
+                            mortality_tracker_vector[run],
+                            dead_in_current_year[run], actual_temperatures,
+                            weather_coefficients[weather_step], treatments,
+                            resistant_rasts[run],
+                            outside_spores[batch_start + run],
+                            spread_rates[batch_start + run], quarantine,
+                            empty, movements);
+                        ++weather_step;
+                    }
                 }
-                if ((opt.average_series->answer) || opt.stddev_series->answer) {
-                    // aggregate in the series
-                    DImg average_raster(I_species_rast.rows(),
-                                        I_species_rast.cols(), 0);
-                    average_raster.zero();
-                    for (unsigned i = 0; i < num_runs; i++)
-                        average_raster += inf_species_rasts[i];
-                    average_raster /= num_runs;
-                    if (opt.average_series->answer) {
-                        // write result
-                        // date is always end of the year, even for seasonal
-                        // spread
-                        string name = generate_name(opt.average_series->answer,
+
+                unresolved_steps.clear();
+                if (config.output_schedule()[current_index]) {
+                    // output
+                    Step interval = config.scheduler().get_step(current_index);
+                    if (opt.single_series->answer && first_batch) {
+                        string name = generate_name(opt.single_series->answer,
                                                     interval.end_date());
                         raster_to_grass(
-                            average_raster, name,
-                            "Average occurrence from all stochastic runs",
+                            inf_species_rasts[0], name,
+                            "Occurrence from a single stochastic run",
                             interval.end_date());
-                        write_average_area(inf_species_rasts, name.c_str(),
-                                           window.ew_res, window.ns_res);
                     }
-                    if (opt.stddev_series->answer) {
-                        DImg stddev(I_species_rast.rows(),
-                                    I_species_rast.cols(), 0);
-                        for (unsigned i = 0; i < num_runs; i++) {
-                            auto tmp = inf_species_rasts[i] - average_raster;
-                            stddev += tmp * tmp;
+                    if (series_statistics) {
+                        // aggregate in the series
+                        auto &stats =
+                            series_stats
+                                .emplace(current_index,
+                                         Statistics(I_species_rast.rows(),
+                                                    I_species_rast.cols()))
+                                .first->second;
+                        double &area = series_areas[current_index];
+                        for (unsigned i = 0; i < batch_runs; i++) {
+                            stats.add(inf_species_rasts[i]);
+                            area += area_of_infected(inf_species_rasts[i],
+                                                     window.ew_res,
+                                                     window.ns_res);
                         }
-                        stddev /= num_runs;
-                        stddev.for_each([](Float &a) { a = std::sqrt(a); });
-                        string name = generate_name(opt.stddev_series->answer,
-                                                    interval.end_date());
-                        string title = "Standard deviation of average"
-                                       " occurrence from all stochastic runs";
-                        raster_to_grass(stddev, name, title,
-                                        interval.end_date());
                     }
-                }
-                if (opt.probability_series->answer) {
-                    DImg probability(I_species_rast.rows(),
-                                     I_species_rast.cols(), 0);
-                    for (unsigned i = 0; i < num_runs; i++) {
-                        Img tmp = inf_species_rasts[i];
-                        tmp.for_each([](Integer &a) { a = bool(a); });
-                        probability += tmp;
+                    if (series_statistics && last_batch) {
+                        const auto &stats = series_stats.at(current_index);
+                        if (opt.average_series->answer) {
+                            // write result
+                            // date is always end of the year, even for
+                            // seasonal spread
+                            string name =
+                                generate_name(opt.average_series->answer,
+                                              interval.end_date());
+                            raster_to_grass(
+                                stats.mean(), name,
+                                "Average occurrence from all stochastic runs",
+                                interval.end_date());
+                            write_average_area(series_areas[current_index] /
+                                                   num_runs,
+                                               name.c_str());
+                        }
+                        if (opt.stddev_series->answer) {
+                            string name =
+                                generate_name(opt.stddev_series->answer,
+                                              interval.end_date());
+                            string title =
+                                "Standard deviation of average"
+                                " occurrence from all stochastic runs";
+                            raster_to_grass(stats.stddev(), name, title,
+                                            interval.end_date());
+                        }
+                        if (opt.probability_series->answer) {
+                            string name =
+                                generate_name(opt.probability_series->answer,
+                                              interval.end_date());
+                            string title = "Probability of occurrence";
+                            raster_to_grass(stats.probability(), name, title,
+                                            interval.end_date());
+                        }
+                        series_stats.erase(current_index);
                     }
-                    probability *= 100; // prob from 0 to 100
-                    probability /= num_runs;
-                    string name = generate_name(opt.probability_series->answer,
-                                                interval.end_date());
-                    string title = "Probability of occurrence";
-                    raster_to_grass(probability, name, title,
-                                    interval.end_date());
-                }
-                if (config.use_mortality && opt.dead_series->answer) {
-                    accumulated_dead += dead_in_current_year[0];
-                    if (opt.dead_series->answer) {
-                        string name = generate_name(opt.dead_series->answer,
-                                                    interval.end_date());
-                        raster_to_grass(accumulated_dead, name,
-                                        "Number of dead hosts to date",
-                                        interval.end_date());
+                    if (config.use_mortality && opt.dead_series->answer &&
+                        first_batch) {
+                        accumulated_dead += dead_in_current_year[0];
+                        if (opt.dead_series->answer) {
+                            string name = generate_name(
+                                opt.dead_series->answer, interval.end_date());
+                            raster_to_grass(accumulated_dead, name,
+                                            "Number of dead hosts to date",
+                                            interval.end_date());
+                        }
                     }
                 }
             }
         }
-    }
-    Step interval = config.scheduler().get_step(--current_index);
-    if (opt.average->answer || opt.stddev->answer) {
-        // aggregate
-        DImg average_raster(I_species_rast.rows(), I_species_rast.cols(), 0);
-        for (unsigned i = 0; i < num_runs; i++)
-            average_raster += inf_species_rasts[i];
-        average_raster /= num_runs;
-        if (opt.average->answer) {
-            // write final result
-            raster_to_grass(average_raster, opt.average->answer,
-                            "Average occurrence from all stochastic runs",
-                            interval.end_date());
-            write_average_area(inf_species_rasts, opt.average->answer,
-                               window.ew_res, window.ns_res);
-        }
-        if (opt.stddev->answer) {
-            DImg stddev(average_raster.rows(), average_raster.cols(), 0);
-            for (unsigned i = 0; i < num_runs; i++) {
-                auto tmp = inf_species_rasts[i] - average_raster;
-                stddev += tmp * tmp;
+        if (final_statistics) {
+            for (unsigned i = 0; i < batch_runs; i++) {
+                final_stats->add(inf_species_rasts[i]);
+                final_area += area_of_infected(
+                    inf_species_rasts[i], window.ew_res, window.ns_res);
             }
-            stddev /= num_runs;
-            stddev.for_each([](Float &a) { a = std::sqrt(a); });
-            raster_to_grass(stddev, opt.stddev->answer, opt.stddev->description,
-                            interval.end_date());
         }
     }
+    Step interval = config.scheduler().get_step(--current_index);
+    if (opt.average->answer) {
+        // write final result
+        raster_to_grass(final_stats->mean(), opt.average->answer,
+                        "Average occurrence from all stochastic runs",
+                        interval.end_date());
+        write_average_area(final_area / num_runs, opt.average->answer);
+    }
+    if (opt.stddev->answer) {
+        raster_to_grass(final_stats->stddev(), opt.stddev->answer,
+                        opt.stddev->description, interval.end_date());
+    }
     if (opt.probability->answer) {
-        DImg probability(I_species_rast.rows(), I_species_rast.cols(), 0);
-        for (unsigned i = 0; i < num_runs; i++) {
-            Img tmp = inf_species_rasts[i];
-            tmp.for_each([](Integer &a) { a = bool(a); });
-            probability += tmp;
-        }
-        probability *= 100; // prob from 0 to 100
-        probability /= num_runs;
-        raster_to_grass(probability, opt.probability->answer,
+        raster_to_grass(final_stats->probability(), opt.probability->answer,
                         "Probability of occurrence", interval.end_date());
     }
     if (opt.outside_spores->answer) {
@@ -0,0 +1,534 @@
+/*
+ * Benchmarks for the PoPS core library.
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times the main parts of the model on synthetic rasters and reports
+ * throughput in cells per second and dispersers per second.
+ *
+ * Usage:
+ *
+ *     benchmark_pops [--rows=N] [--cols=N] [--benchmark_min_time=SECONDS]
+ *                    [--benchmark_filter=TEXT] [--threads=N] [--seed=N]
+ *
+ * Only benchmarks with TEXT in their name are executed. Each benchmark
+ * is repeated until its measured time reaches the minimum time.
+ * The output format follows the one of Google Benchmark, so the results
+ * can be compared in the same way.
+ */
+
+#include <pops/model.hpp>
+#include <pops/raster.hpp>
+#include <pops/radial_kernel.hpp>
+#include <pops/uniform_kernel.hpp>
+#include <pops/neighbor_kernel.hpp>
+#include <pops/deterministic_kernel.hpp>
+#include <pops/tabulated_kernel.hpp>
+#include <pops/quarantine.hpp>
+#include <pops/spread_rate.hpp>
+#include <pops/statistics.hpp>
+#include <pops/treatments.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace pops;
+
+typedef Raster<int> IntegerRaster;
+typedef Raster<double> FloatRaster;
+
+/** Accumulates time of the measured parts of one benchmark */
+class Timer {
+public:
+    void start() { start_ = std::chrono::steady_clock::now(); }
+
+    void stop()
+    {
+        elapsed_ += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count();
+    }
+
+    double elapsed() const { return elapsed_; }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    double elapsed_{0};
+};
+
+/** Amount of work done in one iteration of a benchmark */
+struct Counters {
+    double cells{0};
+    double dispersers{0};
+};
+
+/** One iteration of a benchmark
+ *
+ * The function calls Timer::start() and Timer::stop() around the part
+ * which should be measured, so that preparation of the data for the
+ * iteration (e.g. restoring the initial state) is not included.
+ */
+typedef std::function<Counters(Timer &)> BenchmarkFunction;
+
+struct Benchmark {
+    std::string name;
+    BenchmarkFunction function;
+};
+
+struct Settings {
+    int rows{1000};
+    int cols{1000};
+    double min_time{0.5};
+    std::string filter;
+    unsigned threads{1};
+    unsigned seed{42};
+    double ew_res{30};
+    double ns_res{30};
+};
+
+/** Synthetic host and infection data with the initial state */
+struct Landscape {
+    IntegerRaster susceptible;
+    IntegerRaster infected;
+    IntegerRaster total_hosts;
+    FloatRaster weather_coefficient;
+
+    /** Infection is in a block in the middle (a tenth of the cells) */
+    Landscape(const Settings &settings)
+        : susceptible(settings.rows, settings.cols, 0),
+          infected(settings.rows, settings.cols, 0),
+          total_hosts(settings.rows, settings.cols, 0),
+          weather_coefficient(settings.rows, settings.cols, 0)
+    {
+        std::default_random_engine generator(settings.seed);
+        std::uniform_int_distribution<int> hosts(0, 100);
+        std::uniform_real_distribution<double> weather(0.5, 1);
+        int row_start = settings.rows * 0.34;
+        int row_end = settings.rows * 0.66;
+        int col_start = settings.cols * 0.34;
+        int col_end = settings.cols * 0.66;
+        for (int i = 0; i < settings.rows; i++) {
+            for (int j = 0; j < settings.cols; j++) {
+                int total = hosts(generator);
+                int sick = 0;
+                if (i >= row_start && i < row_end && j >= col_start &&
+                    j < col_end)
+                    sick = total / 10;
+                total_hosts(i, j) = total;
+                infected(i, j) = sick;
+                susceptible(i, j) = total - sick;
+                weather_coefficient(i, j) = weather(generator);
+            }
+        }
+    }
+};
+
+Config create_config(const Settings &settings, const std::string &model_type,
+                     const std::string &kernel)
+{
+    Config config;
+    config.random_seed = settings.seed;
+    config.rows = settings.rows;
+    config.cols = settings.cols;
+    config.ew_res = settings.ew_res;
+    config.ns_res = settings.ns_res;
+    config.model_type = model_type;
+    config.latency_period_steps = model_type == "SEI" ? 2 : 0;
+    config.weather = true;
+    config.reproductive_rate = 1;
+    config.natural_kernel_type = kernel;
+    config.natural_scale = 20;
+    config.natural_direction = "none";
+    config.natural_kappa = 0;
+    config.use_anthropogenic_kernel = false;
+    config.anthro_kernel_type = "none";
+    config.anthro_direction = "none";
+    config.use_lethal_temperature = false;
+    config.use_quarantine = false;
+    config.use_spreadrates = true;
+    config.spreadrate_frequency = "year";
+    config.spreadrate_frequency_n = 1;
+    config.set_date_start(2020, 1, 1);
+    config.set_date_end(2020, 12, 31);
+    config.set_step_unit(StepUnit::Month);
+    config.set_step_num_units(1);
+    config.create_schedules();
+    return config;
+}
+
+/** Model::run_step() for the first step of the simulation
+ *
+ * Each iteration starts from the initial state, so all iterations do
+ * the same amount of work.
+ */
+Benchmark model_benchmark(const Settings &settings, const std::string &name,
+                          Config config)
+{
+    auto landscape = std::make_shared<Landscape>(settings);
+    return {"model_run_step/" + name, [settings, landscape,
+                                       config](Timer &timer) {
+                Landscape state = *landscape;
+                IntegerRaster dispersers(settings.rows, settings.cols, 0);
+                std::vector<IntegerRaster> exposed(
+                    config.latency_period_steps + 1,
+                    IntegerRaster(settings.rows, settings.cols, 0));
+                std::vector<IntegerRaster> mortality_tracker(
+                    1, IntegerRaster(settings.rows, settings.cols, 0));
+                IntegerRaster died(settings.rows, settings.cols, 0);
+                IntegerRaster resistant(settings.rows, settings.cols, 0);
+                IntegerRaster empty;
+                std::vector<FloatRaster> temperatures;
+                std::vector<std::tuple<int, int>> outside_dispersers;
+                std::vector<std::vector<int>> movements;
+                Treatments<IntegerRaster, FloatRaster> treatments(
+                    config.scheduler());
+                SpreadRate<IntegerRaster> spread_rate(
+                    state.infected, config.ew_res, config.ns_res,
+                    get_number_of_scheduled_actions(
+                        config.spread_rate_schedule()));
+                QuarantineEscape<IntegerRaster> quarantine(
+                    empty, config.ew_res, config.ns_res, 0);
+                Model<IntegerRaster, FloatRaster, int> model(config);
+
+                timer.start();
+                model.run_step(0, state.infected, state.susceptible,
+                               state.total_hosts, dispersers, exposed,
+                               mortality_tracker, died, temperatures,
+                               state.weather_coefficient, treatments,
+                               resistant, outside_dispersers, spread_rate,
+                               quarantine, empty, movements);
+                timer.stop();
+
+                Counters counters;
+                counters.cells = double(settings.rows) * settings.cols;
+                counters.dispersers = sum_of_infected(dispersers);
+                return counters;
+            }};
+}
+
+/** Generates random source cells for dispersers */
+std::vector<std::tuple<int, int>> kernel_sources(const Settings &settings,
+                                                 int num_sources)
+{
+    std::default_random_engine generator(settings.seed);
+    std::uniform_int_distribution<int> rows(0, settings.rows - 1);
+    std::uniform_int_distribution<int> cols(0, settings.cols - 1);
+    std::vector<std::tuple<int, int>> sources;
+    for (int i = 0; i < num_sources; i++)
+        sources.emplace_back(rows(generator), cols(generator));
+    return sources;
+}
+
+/** Placement of dispersers by a kernel
+ *
+ * The *Kernel* is created for each iteration using *create* to include
+ * the creation cost (which is part of Model::run_step()).
+ */
+template <typename Kernel>
+Benchmark kernel_benchmark(const Settings &settings, const std::string &name,
+                           std::function<Kernel()> create,
+                           int num_sources = 1000, int per_source = 100)
+{
+    auto sources = kernel_sources(settings, num_sources);
+    return {"kernel/" + name, [settings, sources, create,
+                               per_source](Timer &timer) {
+                std::default_random_engine generator(settings.seed);
+                long checksum = 0;
+                timer.start();
+                Kernel kernel = create();
+                for (const auto &source : sources) {
+                    for (int k = 0; k < per_source; k++) {
+                        int row;
+                        int col;
+                        std::tie(row, col) =
+                            kernel(generator, std::get<0>(source),
+                                   std::get<1>(source));
+                        checksum += row + col;
+                    }
+                }
+                timer.stop();
+                // use the result, so the loop is not optimized out
+                if (checksum == 42)
+                    std::cerr << "";
+                Counters counters;
+                counters.dispersers = double(sources.size()) * per_source;
+                return counters;
+            }};
+}
+
+std::vector<Benchmark> kernel_benchmarks(const Settings &settings)
+{
+    double ew_res = settings.ew_res;
+    double ns_res = settings.ns_res;
+    int rows = settings.rows;
+    int cols = settings.cols;
+    typedef RadialDispersalKernel<IntegerRaster> Radial;
+    std::vector<Benchmark> benchmarks;
+    benchmarks.push_back(kernel_benchmark<Radial>(settings, "cauchy", [=]() {
+        return Radial(ew_res, ns_res, DispersalKernelType::Cauchy, 20);
+    }));
+    benchmarks.push_back(
+        kernel_benchmark<Radial>(settings, "exponential", [=]() {
+            return Radial(ew_res, ns_res, DispersalKernelType::Exponential,
+                          20);
+        }));
+    benchmarks.push_back(
+        kernel_benchmark<Radial>(settings, "cauchy_direction", [=]() {
+            return Radial(ew_res, ns_res, DispersalKernelType::Cauchy, 20,
+                          Direction::NE, 2);
+        }));
+    typedef TabulatedDispersalKernel Tabulated;
+    benchmarks.push_back(
+        kernel_benchmark<Tabulated>(settings, "cauchy_tabulated", [=]() {
+            return Tabulated(ew_res, ns_res, DispersalKernelType::Cauchy, 20);
+        }));
+    benchmarks.push_back(
+        kernel_benchmark<Tabulated>(settings, "exponential_tabulated", [=]() {
+            return Tabulated(ew_res, ns_res, DispersalKernelType::Exponential,
+                             20);
+        }));
+    benchmarks.push_back(kernel_benchmark<UniformDispersalKernel>(
+        settings, "uniform",
+        [=]() { return UniformDispersalKernel(rows - 1, cols - 1); }));
+    benchmarks.push_back(kernel_benchmark<DeterministicNeighborDispersalKernel>(
+        settings, "deterministic_neighbor",
+        [=]() { return DeterministicNeighborDispersalKernel(Direction::E); }));
+    // the deterministic kernel scans its whole window for each disperser
+    int num_sources = 100;
+    int per_source = 10;
+    auto dispersers = std::make_shared<IntegerRaster>(rows, cols, 0);
+    for (const auto &source : kernel_sources(settings, num_sources))
+        (*dispersers)(std::get<0>(source), std::get<1>(source)) = per_source;
+    typedef DeterministicDispersalKernel<IntegerRaster> Deterministic;
+    benchmarks.push_back(kernel_benchmark<Deterministic>(
+        settings, "deterministic_cauchy",
+        [=]() {
+            return Deterministic(DispersalKernelType::Cauchy, *dispersers,
+                                 0.99, ew_res, ns_res, 20);
+        },
+        num_sources, per_source));
+    return benchmarks;
+}
+
+Benchmark quarantine_benchmark(const Settings &settings)
+{
+    auto landscape = std::make_shared<Landscape>(settings);
+    // one quarantine area which contains all the infected cells
+    auto areas =
+        std::make_shared<IntegerRaster>(settings.rows, settings.cols, 0);
+    for (int i = 0; i < settings.rows; i++)
+        for (int j = 0; j < settings.cols; j++)
+            (*areas)(i, j) = 1;
+    auto quarantine = std::make_shared<QuarantineEscape<IntegerRaster>>(
+        *areas, settings.ew_res, settings.ns_res, 1);
+    return {"quarantine_escape", [settings, landscape, areas,
+                                  quarantine](Timer &timer) {
+                timer.start();
+                quarantine->infection_escape_quarantine(landscape->infected,
+                                                        *areas, 0);
+                timer.stop();
+                Counters counters;
+                counters.cells = double(settings.rows) * settings.cols;
+                return counters;
+            }};
+}
+
+Benchmark spread_rate_benchmark(const Settings &settings)
+{
+    auto landscape = std::make_shared<Landscape>(settings);
+    auto spread_rate = std::make_shared<SpreadRate<IntegerRaster>>(
+        landscape->infected, settings.ew_res, settings.ns_res, 1);
+    return {"spread_rate", [settings, landscape, spread_rate](Timer &timer) {
+                timer.start();
+                spread_rate->compute_step_spread_rate(landscape->infected, 0);
+                timer.stop();
+                Counters counters;
+                counters.cells = double(settings.rows) * settings.cols;
+                return counters;
+            }};
+}
+
+Benchmark treatments_benchmark(const Settings &settings,
+                               const std::string &name, int num_days,
+                               TreatmentApplication application)
+{
+    auto landscape = std::make_shared<Landscape>(settings);
+    Config config = create_config(settings, "SI", "cauchy");
+    // treat every other row with 80 % efficacy
+    FloatRaster map(settings.rows, settings.cols, 0);
+    for (int i = 0; i < settings.rows; i += 2)
+        for (int j = 0; j < settings.cols; j++)
+            map(i, j) = 0.8;
+    auto treatments =
+        std::make_shared<Treatments<IntegerRaster, FloatRaster>>(
+            config.scheduler());
+    treatments->add_treatment(map, config.date_start(), num_days,
+                              application);
+    return {"treatments/" + name, [settings, landscape,
+                                   treatments](Timer &timer) {
+                Landscape state = *landscape;
+                std::vector<IntegerRaster> exposed;
+                IntegerRaster resistant(settings.rows, settings.cols, 0);
+                timer.start();
+                treatments->manage(0, state.infected, exposed,
+                                   state.susceptible, resistant);
+                timer.stop();
+                Counters counters;
+                counters.cells = double(settings.rows) * settings.cols;
+                return counters;
+            }};
+}
+
+std::vector<Benchmark> all_benchmarks(const Settings &settings)
+{
+    std::vector<Benchmark> benchmarks;
+    benchmarks.push_back(model_benchmark(
+        settings, "SI", create_config(settings, "SI", "cauchy")));
+    benchmarks.push_back(model_benchmark(
+        settings, "SEI", create_config(settings, "SEI", "cauchy")));
+    Config config = create_config(settings, "SI", "exponential");
+    benchmarks.push_back(model_benchmark(settings, "SI_exponential", config));
+    config = create_config(settings, "SI", "cauchy");
+    config.use_active_cells = true;
+    benchmarks.push_back(model_benchmark(settings, "SI_active_cells", config));
+    config = create_config(settings, "SI", "cauchy");
+    config.tabulated_kernels = true;
+    benchmarks.push_back(model_benchmark(settings, "SI_tabulated", config));
+    config = create_config(settings, "SI", "cauchy");
+    config.cell_random_streams = true;
+    config.threads = settings.threads;
+    benchmarks.push_back(
+        model_benchmark(settings,
+                        "SI_cell_streams/threads:" +
+                            std::to_string(settings.threads),
+                        config));
+    for (auto &benchmark : kernel_benchmarks(settings))
+        benchmarks.push_back(benchmark);
+    benchmarks.push_back(quarantine_benchmark(settings));
+    benchmarks.push_back(spread_rate_benchmark(settings));
+    benchmarks.push_back(treatments_benchmark(
+        settings, "simple_ratio", 0, TreatmentApplication::Ratio));
+    benchmarks.push_back(treatments_benchmark(
+        settings, "pesticide_all_infected", 30,
+        TreatmentApplication::AllInfectedInCell));
+    return benchmarks;
+}
+
+/** Formats a rate in the Google Benchmark style (e.g. 1.5M/s) */
+std::string format_rate(double rate)
+{
+    const char *suffixes[] = {"", "k", "M", "G", "T"};
+    int i = 0;
+    while (rate >= 1000 && i < 4) {
+        rate /= 1000;
+        i++;
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.4g%s/s", rate, suffixes[i]);
+    return buffer;
+}
+
+void run_benchmark(const Benchmark &benchmark, const Settings &settings)
+{
+    // warm-up (not measured)
+    Timer warm_up;
+    benchmark.function(warm_up);
+
+    Timer timer;
+    Counters total;
+    long iterations = 0;
+    while (timer.elapsed() < settings.min_time || !iterations) {
+        Counters counters = benchmark.function(timer);
+        total.cells += counters.cells;
+        total.dispersers += counters.dispersers;
+        ++iterations;
+    }
+    double time_per_iteration = timer.elapsed() / iterations;
+    std::printf("%-42s %12.3f ms %10ld", benchmark.name.c_str(),
+                1000 * time_per_iteration, iterations);
+    if (total.cells)
+        std::printf(" cells=%s",
+                    format_rate(total.cells / timer.elapsed()).c_str());
+    if (total.dispersers)
+        std::printf(" dispersers=%s",
+                    format_rate(total.dispersers / timer.elapsed()).c_str());
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+/** Returns value of a --name=value argument or nullptr if not matching */
+const char *argument_value(const std::string &argument, const char *name)
+{
+    std::string prefix = std::string("--") + name + "=";
+    if (argument.compare(0, prefix.size(), prefix) == 0)
+        return argument.c_str() + prefix.size();
+    return nullptr;
+}
+
+int main(int argc, char *argv[])
+{
+    Settings settings;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        const char *value;
+        if ((value = argument_value(argument, "rows")))
+            settings.rows = std::atoi(value);
+        else if ((value = argument_value(argument, "cols")))
+            settings.cols = std::atoi(value);
+        else if ((value = argument_value(argument, "benchmark_min_time")))
+            settings.min_time = std::atof(value);
+        else if ((value = argument_value(argument, "benchmark_filter")))
+            settings.filter = value;
+        else if ((value = argument_value(argument, "threads")))
+            settings.threads = std::atoi(value);
+        else if ((value = argument_value(argument, "seed")))
+            settings.seed = std::atoi(value);
+        else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--rows=N] [--cols=N] [--benchmark_min_time=S]"
+                         " [--benchmark_filter=TEXT] [--threads=N]"
+                         " [--seed=N]\n";
+            return 1;
+        }
+    }
+    if (settings.rows < 1 || settings.cols < 1 || !settings.threads) {
+        std::cerr << "Rows, cols, and threads must be positive\n";
+        return 1;
+    }
+
+    std::printf("Raster size: %d x %d cells\n", settings.rows, settings.cols);
+    std::printf("%-42s %15s %10s %s\n", "Benchmark", "Time", "Iterations",
+                "UserCounters...");
+    std::printf("%s\n", std::string(90, '-').c_str());
+    for (const auto &benchmark : all_benchmarks(settings)) {
+        if (benchmark.name.find(settings.filter) == std::string::npos)
+            continue;
+        run_benchmark(benchmark, settings);
+    }
+    return 0;
+}
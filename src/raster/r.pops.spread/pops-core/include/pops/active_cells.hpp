@@ -0,0 +1,154 @@
+/*
+ * PoPS model - tracking of active (infected or exposed) cells
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#ifndef POPS_ACTIVE_CELLS_HPP
+#define POPS_ACTIVE_CELLS_HPP
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace pops {
+
+/*! Set of cells which need to be visited by the simulation.
+ *
+ * Early in an invasion, only a small fraction of the cells is infected
+ * or exposed, so visiting only these cells is much cheaper than going
+ * over the whole raster. The set is conservative: once a cell is added,
+ * it stays in the set even if it is not infected anymore (e.g. after
+ * treatment). Cells outside of the set are guaranteed to have no
+ * infected or exposed hosts as long as all additions of infected or
+ * exposed hosts are reported using add().
+ *
+ * The cells are visited in row-major order, i.e., in the same order
+ * as when iterating over the whole raster, so using the set does not
+ * change the sequence of random numbers drawn by the simulation.
+ *
+ * Memory use is one bit per raster cell plus one index per active cell.
+ */
+template <typename RasterIndex = int>
+class ActiveCells {
+private:
+    RasterIndex rows_;
+    RasterIndex cols_;
+    // fast membership test (one bit per cell)
+    std::vector<bool> flags_;
+    // linear (row-major) indices of active cells
+    std::vector<std::size_t> cells_;
+    bool sorted_{true};
+
+public:
+    ActiveCells(RasterIndex rows, RasterIndex cols)
+        : rows_(rows), cols_(cols),
+          flags_(static_cast<std::size_t>(rows) * cols, false)
+    {
+    }
+
+    RasterIndex rows() const { return rows_; }
+
+    RasterIndex cols() const { return cols_; }
+
+    /** Number of active cells */
+    std::size_t size() const { return cells_.size(); }
+
+    bool is_empty() const { return cells_.empty(); }
+
+    bool contains(RasterIndex row, RasterIndex col) const
+    {
+        return flags_[index(row, col)];
+    }
+
+    /** Adds a cell to the set (no-op if the cell is already active) */
+    void add(RasterIndex row, RasterIndex col)
+    {
+        std::size_t i = index(row, col);
+        if (flags_[i])
+            return;
+        flags_[i] = true;
+        if (!cells_.empty() && i < cells_.back())
+            sorted_ = false;
+        cells_.push_back(i);
+    }
+
+    /** Adds all cells which have a non-zero value in a raster */
+    template <typename Raster>
+    void add_nonzero(const Raster &raster)
+    {
+        for (RasterIndex i = 0; i < rows_; i++) {
+            for (RasterIndex j = 0; j < cols_; j++) {
+                if (raster(i, j) != 0)
+                    add(i, j);
+            }
+        }
+    }
+
+    /** Removes all cells from the set */
+    void clear()
+    {
+        for (auto i : cells_)
+            flags_[i] = false;
+        cells_.clear();
+        sorted_ = true;
+    }
+
+    /** Calls *function* with row and column of each active cell
+     *
+     * The cells are visited in row-major order. The function can add
+     * new cells to the set, but these are not visited in the current
+     * call.
+     */
+    template <typename Function>
+    void for_each(Function function)
+    {
+        sort();
+        // new cells can be appended by the function, so no iterators
+        std::size_t size = cells_.size();
+        for (std::size_t k = 0; k < size; k++) {
+            function(row(k), col(k));
+        }
+    }
+
+    /** Puts the cells into row-major order
+     *
+     * Needed before using row() and col() to access cells by position.
+     */
+    void sort()
+    {
+        if (!sorted_) {
+            std::sort(cells_.begin(), cells_.end());
+            sorted_ = true;
+        }
+    }
+
+    /** Row of the cell at given position in the set */
+    RasterIndex row(std::size_t position) const
+    {
+        return cells_[position] / cols_;
+    }
+
+    /** Column of the cell at given position in the set */
+    RasterIndex col(std::size_t position) const
+    {
+        return cells_[position] % cols_;
+    }
+
+private:
+    std::size_t index(RasterIndex row, RasterIndex col) const
+    {
+        return static_cast<std::size_t>(row) * cols_ + col;
+    }
+};
+
+} // namespace pops
+
+#endif // POPS_ACTIVE_CELLS_HPP
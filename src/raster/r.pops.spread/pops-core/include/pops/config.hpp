@@ -44,7 +44,14 @@ public:
     bool establishment_stochasticity{true};
     bool movement_stochasticity{true};
     bool deterministic{false};
+    // Precompute radial kernels (not used with deterministic)
+    bool tabulated_kernels{false};
     double establishment_probability{0};
+    // Visit only infected and exposed cells
+    bool use_active_cells{false};
+    // Random number stream for each cell (allows threads within a run)
+    bool cell_random_streams{false};
+    unsigned threads{1};
     // Temperature
     bool use_lethal_temperature{false};
     double lethal_temperature{-273.15}; // 0 K
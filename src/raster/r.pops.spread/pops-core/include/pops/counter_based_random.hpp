@@ -0,0 +1,129 @@
+/*
+ * PoPS model - counter-based random number generator
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#ifndef POPS_COUNTER_BASED_RANDOM_HPP
+#define POPS_COUNTER_BASED_RANDOM_HPP
+
+#include <array>
+#include <cstdint>
+
+namespace pops {
+
+/*! Philox4x32-10 counter-based random number engine
+ *
+ * The engine computes random numbers as a function of a key and
+ * a counter (Salmon et al. 2011, Parallel random numbers: as easy as
+ * 1, 2, 3). Unlike with the standard sequential engines, any position
+ * in any stream can be obtained directly without generating the
+ * previous numbers. This makes it possible to give each cell its own
+ * independent stream which gives the same numbers regardless of the
+ * order in which the cells are processed and regardless of the number
+ * of threads.
+ *
+ * The 64-bit key selects the sequence (typically a seed combined with
+ * a step or call number) and the 64-bit stream number selects
+ * a stream within the sequence (typically a cell index). Each stream
+ * has 2^64 blocks of four 32-bit numbers.
+ *
+ * The class fulfills the requirements of UniformRandomBitGenerator,
+ * so it can be used with the standard distributions and kernels in
+ * the same way as `std::default_random_engine`.
+ */
+class Philox4x32Engine {
+public:
+    typedef std::uint32_t result_type;
+    typedef std::array<std::uint32_t, 4> Counter;
+    typedef std::array<std::uint32_t, 2> Key;
+
+    Philox4x32Engine(std::uint64_t key = 0, std::uint64_t stream = 0)
+        : key_{{static_cast<std::uint32_t>(key),
+                static_cast<std::uint32_t>(key >> 32)}},
+          counter_{{0, 0, static_cast<std::uint32_t>(stream),
+                    static_cast<std::uint32_t>(stream >> 32)}},
+          buffer_{{0, 0, 0, 0}}, index_(4)
+    {
+    }
+
+    static constexpr result_type min() { return 0; }
+
+    static constexpr result_type max() { return 0xFFFFFFFF; }
+
+    result_type operator()()
+    {
+        if (index_ == 4) {
+            buffer_ = philox4x32(counter_, key_);
+            // 64-bit block number in the two low words
+            if (++counter_[0] == 0)
+                ++counter_[1];
+            index_ = 0;
+        }
+        return buffer_[index_++];
+    }
+
+    /** Skips *count* numbers */
+    void discard(unsigned long long count)
+    {
+        while (count && index_ != 4) {
+            ++index_;
+            --count;
+        }
+        std::uint64_t block =
+            (static_cast<std::uint64_t>(counter_[1]) << 32) | counter_[0];
+        block += count / 4;
+        counter_[0] = static_cast<std::uint32_t>(block);
+        counter_[1] = static_cast<std::uint32_t>(block >> 32);
+        for (count %= 4; count; --count)
+            (*this)();
+    }
+
+    /** Computes one block of the Philox4x32-10 function */
+    static Counter philox4x32(Counter counter, Key key)
+    {
+        for (int round = 0; round < 10; ++round) {
+            if (round)
+                bump_key(key);
+            counter = single_round(counter, key);
+        }
+        return counter;
+    }
+
+private:
+    Key key_;
+    Counter counter_;
+    Counter buffer_;
+    unsigned index_;
+
+    static Counter single_round(const Counter &counter, const Key &key)
+    {
+        std::uint64_t product0 =
+            static_cast<std::uint64_t>(0xD2511F53) * counter[0];
+        std::uint64_t product1 =
+            static_cast<std::uint64_t>(0xCD9E8D57) * counter[2];
+        std::uint32_t hi0 = static_cast<std::uint32_t>(product0 >> 32);
+        std::uint32_t lo0 = static_cast<std::uint32_t>(product0);
+        std::uint32_t hi1 = static_cast<std::uint32_t>(product1 >> 32);
+        std::uint32_t lo1 = static_cast<std::uint32_t>(product1);
+        return {{hi1 ^ counter[1] ^ key[0], lo1, hi0 ^ counter[3] ^ key[1],
+                 lo0}};
+    }
+
+    static void bump_key(Key &key)
+    {
+        key[0] += 0x9E3779B9;
+        key[1] += 0xBB67AE85;
+    }
+};
+
+} // namespace pops
+
+#endif // POPS_COUNTER_BASED_RANDOM_HPP
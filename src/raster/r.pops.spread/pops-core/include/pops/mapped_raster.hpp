@@ -0,0 +1,384 @@
+/*
+ * PoPS model - raster stored in memory-mapped tiles
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#ifndef POPS_MAPPED_RASTER_HPP
+#define POPS_MAPPED_RASTER_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <initializer_list>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define POPS_HAVE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace pops {
+
+/*! Directory for files backing the mapped rasters
+ *
+ * When empty (the default), the memory is mapped anonymously, i.e., it is
+ * backed by swap. When set to a directory, a temporary file is created
+ * (and immediately unlinked) in the directory for each raster, so the
+ * operating system can page the data out to the file when the memory is
+ * needed elsewhere. This allows working with more data than fits into
+ * memory.
+ *
+ * Change by assigning to the returned reference. Applies to rasters
+ * created afterwards.
+ */
+inline std::string &mapped_raster_directory()
+{
+    static std::string directory;
+    return directory;
+}
+
+/*! Zero-initialized block of memory mapped from a file or anonymously
+ *
+ * Falls back to an ordinary allocation on platforms without mmap.
+ */
+class MappedMemory {
+public:
+    MappedMemory() = default;
+
+    MappedMemory(std::size_t size, const std::string &directory) : size_(size)
+    {
+        if (!size_)
+            return;
+#ifdef POPS_HAVE_MMAP
+        int fd = -1;
+        int flags = MAP_PRIVATE | MAP_ANON;
+        if (!directory.empty()) {
+            std::string name = directory + "/pops_raster_XXXXXX";
+            std::vector<char> path(name.begin(), name.end());
+            path.push_back('\0');
+            fd = mkstemp(path.data());
+            if (fd < 0)
+                throw std::runtime_error(
+                    "MappedMemory: Cannot create file in " + directory);
+            // the file exists only as long as it is mapped
+            unlink(path.data());
+            if (ftruncate(fd, size_) != 0) {
+                close(fd);
+                throw std::runtime_error(
+                    "MappedMemory: Cannot resize file in " + directory);
+            }
+            flags = MAP_SHARED;
+        }
+        void *data =
+            mmap(nullptr, size_, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (fd >= 0)
+            close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("MappedMemory: Cannot map memory");
+        data_ = static_cast<char *>(data);
+#else
+        (void)directory; // files are not supported on this platform
+        data_ = new char[size_]();
+#endif
+    }
+
+    MappedMemory(const MappedMemory &) = delete;
+    MappedMemory &operator=(const MappedMemory &) = delete;
+
+    MappedMemory(MappedMemory &&other) : data_(other.data_), size_(other.size_)
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    MappedMemory &operator=(MappedMemory &&other)
+    {
+        if (this != &other) {
+            release();
+            data_ = other.data_;
+            size_ = other.size_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    ~MappedMemory() { release(); }
+
+    char *data() noexcept { return data_; }
+
+    const char *data() const noexcept { return data_; }
+
+    std::size_t size() const noexcept { return size_; }
+
+private:
+    char *data_{nullptr};
+    std::size_t size_{0};
+
+    void release()
+    {
+        if (!data_)
+            return;
+#ifdef POPS_HAVE_MMAP
+        munmap(data_, size_);
+#else
+        delete[] data_;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+};
+
+/*! Raster stored in square tiles in memory-mapped storage
+ *
+ * The class provides the subset of the Raster interface used by the
+ * Simulation and Model classes (and the classes they use), so it can be
+ * used as IntegerRaster (or FloatRaster) without any changes in them.
+ *
+ * The values are stored in tiles of 64 by 64 cells, so cells close to
+ * each other in both directions are close in memory. The storage is
+ * mapped using mmap (see mapped_raster_directory() for details), so the
+ * operating system can keep in memory only the tiles which are used.
+ *
+ * Unlike Raster, the Number type can be a narrow type such as
+ * `std::uint16_t` to reduce memory use when the values (e.g. number of
+ * hosts) are known to fit. There is no overflow checking.
+ *
+ * Direct access to the underlying array is not provided because the
+ * values are not stored in row-major order. Use operator() or
+ * conversion from and to Raster instead.
+ */
+template <typename Number, typename Index = int>
+class MappedRaster {
+public:
+    typedef Number NumberType;
+    typedef Index IndexType;
+
+    /*! Tile size is 2^tile_bits cells */
+    static const int tile_bits = 6;
+    static const int tile_size = 1 << tile_bits;
+
+    MappedRaster() : MappedRaster(0, 0) {}
+
+    MappedRaster(Index rows, Index cols)
+        : rows_(rows), cols_(cols),
+          tile_cols_((cols + tile_size - 1) / tile_size),
+          tile_rows_((rows + tile_size - 1) / tile_size),
+          memory_(static_cast<std::size_t>(tile_rows_) * tile_cols_ *
+                      tile_size * tile_size * sizeof(Number),
+                  mapped_raster_directory()),
+          data_(reinterpret_cast<Number *>(memory_.data()))
+    {
+        static_assert(std::is_trivially_copyable<Number>::value,
+                      "MappedRaster requires trivially copyable values");
+    }
+
+    MappedRaster(Index rows, Index cols, Number value)
+        : MappedRaster(rows, cols)
+    {
+        fill(value);
+    }
+
+    /*! Initialize size using another raster, but use given value */
+    MappedRaster(const MappedRaster &other, Number value)
+        : MappedRaster(other.rows_, other.cols_, value)
+    {
+    }
+
+    MappedRaster(const MappedRaster &other)
+        : MappedRaster(other.rows_, other.cols_)
+    {
+        std::copy(other.data_, other.data_ + size(), data_);
+    }
+
+    MappedRaster(MappedRaster &&other)
+        : rows_(other.rows_), cols_(other.cols_),
+          tile_cols_(other.tile_cols_), tile_rows_(other.tile_rows_),
+          memory_(std::move(other.memory_)), data_(other.data_)
+    {
+        other.reset();
+    }
+
+    /*! Copy values from another raster type (e.g. Raster) */
+    template <typename OtherRaster,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<OtherRaster>::type,
+                  MappedRaster>::value>::type>
+    explicit MappedRaster(const OtherRaster &other)
+        : MappedRaster(other.rows(), other.cols())
+    {
+        for (Index i = 0; i < rows_; i++)
+            for (Index j = 0; j < cols_; j++)
+                (*this)(i, j) = other(i, j);
+    }
+
+    MappedRaster(std::initializer_list<std::initializer_list<Number>> l)
+        : MappedRaster(l.size(), l.begin()->size())
+    {
+        Index i = 0;
+        for (const auto &subl : l) {
+            Index j = 0;
+            for (const auto &value : subl) {
+                (*this)(i, j) = value;
+                ++j;
+            }
+            ++i;
+        }
+    }
+
+    MappedRaster &operator=(const MappedRaster &other)
+    {
+        if (this != &other) {
+            MappedRaster copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    MappedRaster &operator=(MappedRaster &&other)
+    {
+        if (this != &other) {
+            rows_ = other.rows_;
+            cols_ = other.cols_;
+            tile_cols_ = other.tile_cols_;
+            tile_rows_ = other.tile_rows_;
+            memory_ = std::move(other.memory_);
+            data_ = other.data_;
+            other.reset();
+        }
+        return *this;
+    }
+
+    Index cols() const { return cols_; }
+
+    Index rows() const { return rows_; }
+
+    const Number &operator()(Index row, Index col) const
+    {
+        return data_[index(row, col)];
+    }
+
+    Number &operator()(Index row, Index col) { return data_[index(row, col)]; }
+
+    /*! Fills all cells (including tile padding) with a value */
+    void fill(Number value) { std::fill(data_, data_ + size(), value); }
+
+    void zero() { fill(0); }
+
+    /*! Applies an operation to each cell (in tile order) */
+    template <class UnaryOperation>
+    void for_each(UnaryOperation op)
+    {
+        for (Index i = 0; i < rows_; i++)
+            for (Index j = 0; j < cols_; j++)
+                op((*this)(i, j));
+    }
+
+    MappedRaster &operator+=(const MappedRaster &other)
+    {
+        check_size(other);
+        // padding is updated too, but never read
+        for (std::size_t i = 0; i < size(); i++)
+            data_[i] += other.data_[i];
+        return *this;
+    }
+
+    MappedRaster &operator-=(const MappedRaster &other)
+    {
+        check_size(other);
+        for (std::size_t i = 0; i < size(); i++)
+            data_[i] -= other.data_[i];
+        return *this;
+    }
+
+    template <typename OtherNumber>
+    typename std::enable_if<std::is_arithmetic<OtherNumber>::value,
+                            MappedRaster &>::type
+    operator*=(OtherNumber value)
+    {
+        for (std::size_t i = 0; i < size(); i++)
+            data_[i] *= value;
+        return *this;
+    }
+
+    bool operator==(const MappedRaster &other) const
+    {
+        if (rows_ != other.rows_ || cols_ != other.cols_)
+            return false;
+        for (Index i = 0; i < rows_; i++)
+            for (Index j = 0; j < cols_; j++)
+                if ((*this)(i, j) != other(i, j))
+                    return false;
+        return true;
+    }
+
+    bool operator!=(const MappedRaster &other) const
+    {
+        return !(*this == other);
+    }
+
+    /*! Copies the values to a raster in row-major order (e.g. Raster) */
+    template <typename OtherRaster>
+    OtherRaster to_raster() const
+    {
+        OtherRaster out(rows_, cols_);
+        for (Index i = 0; i < rows_; i++)
+            for (Index j = 0; j < cols_; j++)
+                out(i, j) = (*this)(i, j);
+        return out;
+    }
+
+private:
+    Index rows_;
+    Index cols_;
+    Index tile_cols_;
+    Index tile_rows_;
+    MappedMemory memory_;
+    Number *data_;
+
+    std::size_t size() const
+    {
+        return static_cast<std::size_t>(tile_rows_) * tile_cols_ * tile_size *
+               tile_size;
+    }
+
+    std::size_t index(Index row, Index col) const
+    {
+        std::size_t tile = static_cast<std::size_t>(row >> tile_bits) *
+                               tile_cols_ +
+                           (col >> tile_bits);
+        return (tile << (2 * tile_bits)) +
+               ((row & (tile_size - 1)) << tile_bits) +
+               (col & (tile_size - 1));
+    }
+
+    /*! Leaves a moved-from raster empty */
+    void reset()
+    {
+        rows_ = cols_ = tile_cols_ = tile_rows_ = 0;
+        data_ = nullptr;
+    }
+
+    void check_size(const MappedRaster &other) const
+    {
+        if (rows_ != other.rows_ || cols_ != other.cols_)
+            throw std::invalid_argument(
+                "MappedRaster: The number of rows or columns does not match");
+    }
+};
+
+} // namespace pops
+
+#endif // POPS_MAPPED_RASTER_HPP
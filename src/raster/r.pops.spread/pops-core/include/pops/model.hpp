@@ -33,9 +33,63 @@
 #include "quarantine.hpp"
 
 #include <vector>
+#include <memory>
 
 namespace pops {
 
+/*! Creates a tabulated kernel if it can be used with the given settings
+ *
+ * Returns nullptr if the kernel is not radial, if the deterministic
+ * kernel should be used, or if the table would be too large for the
+ * given scale and resolution. The radial kernel is used instead in
+ * these cases.
+ */
+inline std::shared_ptr<const TabulatedDispersalKernel>
+create_tabulated_kernel(const Config &config, DispersalKernelType kernel,
+                        double scale, const std::string &direction,
+                        double kappa)
+{
+    if (!config.tabulated_kernels || config.deterministic ||
+        !TabulatedDispersalKernel::supports_kernel(kernel))
+        return nullptr;
+    if (TabulatedDispersalKernel::window_cells(
+            config.ew_res, config.ns_res, kernel, scale,
+            config.dispersal_percentage) >
+        TabulatedDispersalKernel::max_window_cells)
+        return nullptr;
+    return std::make_shared<const TabulatedDispersalKernel>(
+        config.ew_res, config.ns_res, kernel, scale,
+        direction_from_string(direction), kappa, config.dispersal_percentage);
+}
+
+/*! Creates the tabulated natural kernel for the given settings
+ *
+ * \see create_tabulated_kernel()
+ */
+inline std::shared_ptr<const TabulatedDispersalKernel>
+create_natural_tabulated_kernel(const Config &config)
+{
+    return create_tabulated_kernel(
+        config, kernel_type_from_string(config.natural_kernel_type),
+        config.natural_scale, config.natural_direction, config.natural_kappa);
+}
+
+/*! Creates the tabulated anthropogenic kernel for the given settings
+ *
+ * Returns nullptr if the anthropogenic kernel is not used.
+ *
+ * \see create_tabulated_kernel()
+ */
+inline std::shared_ptr<const TabulatedDispersalKernel>
+create_anthro_tabulated_kernel(const Config &config)
+{
+    if (!config.use_anthropogenic_kernel)
+        return nullptr;
+    return create_tabulated_kernel(
+        config, kernel_type_from_string(config.anthro_kernel_type),
+        config.anthro_scale, config.anthro_direction, config.anthro_kappa);
+}
+
 template <typename IntegerRaster, typename FloatRaster, typename RasterIndex>
 class Model {
 private:
@@ -45,11 +99,30 @@ private:
     UniformDispersalKernel uniform_kernel;
     DeterministicNeighborDispersalKernel natural_neighbor_kernel;
     DeterministicNeighborDispersalKernel anthro_neighbor_kernel;
+    std::shared_ptr<const TabulatedDispersalKernel> natural_tabulated_kernel;
+    std::shared_ptr<const TabulatedDispersalKernel> anthro_tabulated_kernel;
     Simulation<IntegerRaster, FloatRaster, RasterIndex> simulation_;
     unsigned last_index{0};
 
 public:
     Model(const Config &config)
+        : Model(config, create_natural_tabulated_kernel(config),
+                create_anthro_tabulated_kernel(config))
+    {
+    }
+
+    /*! Creates the model with already created tabulated kernels
+     *
+     * Tabulated kernels depend only on the kernel settings, so models
+     * which differ only in other settings, e.g., in the random seed,
+     * can share them. The kernels are created by
+     * create_natural_tabulated_kernel() and
+     * create_anthro_tabulated_kernel(). If a kernel is nullptr, the
+     * radial kernel is used.
+     */
+    Model(const Config &config,
+          std::shared_ptr<const TabulatedDispersalKernel> natural_table,
+          std::shared_ptr<const TabulatedDispersalKernel> anthro_table)
         : config_(config),
           natural_kernel(kernel_type_from_string(config.natural_kernel_type)),
           anthro_kernel(kernel_type_from_string(config.anthro_kernel_type)),
@@ -58,12 +131,16 @@ public:
               direction_from_string(config.natural_direction)),
           anthro_neighbor_kernel(
               direction_from_string(config.anthro_direction)),
+          natural_tabulated_kernel(natural_table),
+          anthro_tabulated_kernel(anthro_table),
           simulation_(
               config.random_seed, config.rows, config.cols,
               model_type_from_string(config.model_type),
               config.latency_period_steps, config.generate_stochasticity,
               config.establishment_stochasticity, config.movement_stochasticity)
     {
+        simulation_.set_cell_random_streams(config.cell_random_streams);
+        simulation_.set_threads(config.threads);
     }
 
     /**
@@ -84,6 +161,12 @@ public:
      * dispersers, but only the number of dispersers generated (and subsequently
      * used) in this step. There are no dispersers in between simulation steps.
      *
+     * If Config::use_active_cells is true, the cells with infected or exposed
+     * hosts or with hosts in mortality tracker in the first call of this
+     * function become the initial active cells (see
+     * Simulation::activate_cells()). In that case, *dispersers* is not
+     * modified outside of the active cells.
+     *
      * @param step Step number in the simulation.
      * @param[in,out] infected Infected hosts
      * @param[in,out] susceptible Susceptible hosts
@@ -141,14 +224,22 @@ public:
             config_.dispersal_percentage);
         SwitchDispersalKernel<IntegerRaster> natural_selectable_kernel(
             natural_kernel, natural_radial_kernel, uniform_kernel,
-            natural_neighbor_kernel);
+            natural_neighbor_kernel, natural_tabulated_kernel);
         SwitchDispersalKernel<IntegerRaster> anthro_selectable_kernel(
             anthro_kernel, anthro_radial_kernel, uniform_kernel,
-            anthro_neighbor_kernel);
+            anthro_neighbor_kernel, anthro_tabulated_kernel);
         DispersalKernel<IntegerRaster> dispersal_kernel(
             natural_selectable_kernel, anthro_selectable_kernel,
             config_.use_anthropogenic_kernel,
             config_.percent_natural_dispersal);
+        // initial infected and exposed hosts define the active cells
+        if (config_.use_active_cells && !simulation_.uses_active_cells()) {
+            simulation_.activate_cells(infected);
+            for (const auto &raster : exposed)
+                simulation_.activate_cells(raster);
+            for (const auto &raster : mortality_tracker)
+                simulation_.activate_cells(raster);
+        }
         int mortality_simulation_year =
             simulation_step_to_action_step(config_.mortality_schedule(), step);
         // removal of dispersers due to lethal tempearture
@@ -24,9 +24,12 @@
 #include <vector>
 #include <random>
 #include <string>
+#include <cstdint>
 #include <stdexcept>
 
 #include "utils.hpp"
+#include "active_cells.hpp"
+#include "counter_based_random.hpp"
 
 namespace pops {
 
@@ -105,6 +108,20 @@ inline ModelType model_type_from_string(const char *text)
  * types are using. However, at the same time, comparison with signed
  * type are perfomed and a signed type might be required in the future.
  * A default is provided, but it can be changed in the future.
+ *
+ * By default, all cells of the rasters are visited in each step.
+ * After a call to activate_cells(), only the cells which are (or were)
+ * infected or exposed are visited, so the cost of a step is
+ * proportional to the infested area rather than to the size of the
+ * whole area. The results are the same in both cases.
+ *
+ * By default, one random number generator is used sequentially for all
+ * cells. After a call to set_cell_random_streams(), each cell obtains
+ * its own counter-based random number stream in generate() and
+ * disperse(), so these can run in parallel (see set_threads()) and the
+ * results depend only on the seed, not on the number of threads.
+ * The results differ from the results obtained with the sequential
+ * generator.
  */
 template <typename IntegerRaster, typename FloatRaster,
           typename RasterIndex = int>
@@ -118,6 +135,204 @@ private:
     ModelType model_type_;
     unsigned latency_period_;
     std::default_random_engine generator_;
+    unsigned random_seed_;
+    bool use_active_cells_{false};
+    ActiveCells<RasterIndex> active_cells_{0, 0};
+    bool cell_random_streams_{false};
+    unsigned threads_{1};
+    // number of calls using the cell streams (part of the stream key)
+    std::uint32_t stream_call_{0};
+
+    /** Disperser with its destination and random number for establishment
+     */
+    struct DispersalEvent
+    {
+        int row;
+        int col;
+        double establishment_tester;
+    };
+
+    /** Calls *function* with row and column of each cell to visit
+     *
+     * Visits either all cells or only active cells (if enabled).
+     * In both cases, the cells are visited in row-major order.
+     */
+    template <typename Function>
+    void for_each_cell(Function function)
+    {
+        if (use_active_cells_) {
+            active_cells_.for_each(function);
+            return;
+        }
+        for (RasterIndex i = 0; i < rows_; i++) {
+            for (RasterIndex j = 0; j < cols_; j++) {
+                function(i, j);
+            }
+        }
+    }
+
+    /** Calls *function* with row and column of each cell to visit in
+     * parallel
+     *
+     * Like for_each_cell(), but the function is called concurrently from
+     * multiple threads, so it can modify only the given cell.
+     */
+    template <typename Function>
+    void for_each_cell_in_parallel(Function function)
+    {
+        if (use_active_cells_) {
+            active_cells_.sort();
+            std::ptrdiff_t size = active_cells_.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads_) schedule(dynamic, 64)
+#endif
+            for (std::ptrdiff_t k = 0; k < size; k++) {
+                function(active_cells_.row(k), active_cells_.col(k));
+            }
+            return;
+        }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads_) schedule(dynamic)
+#endif
+        for (RasterIndex i = 0; i < rows_; i++) {
+            for (RasterIndex j = 0; j < cols_; j++) {
+                function(i, j);
+            }
+        }
+    }
+
+    /** Creates a random number stream for a cell
+     *
+     * Each call of a function using the streams uses different key,
+     * so the same cell obtains a different stream each time.
+     */
+    Philox4x32Engine cell_random_stream(std::uint32_t call, RasterIndex row,
+                                        RasterIndex col) const
+    {
+        std::uint64_t key =
+            (static_cast<std::uint64_t>(call) << 32) | random_seed_;
+        std::uint64_t cell = static_cast<std::uint64_t>(row) * cols_ + col;
+        return Philox4x32Engine(key, cell);
+    }
+
+    /** Establishes a disperser in a cell
+     *
+     * The disperser dispersed from cell *i*, *j* establishes in
+     * cell *row*, *col* if the *establishment_tester* is lower than the
+     * probability of establishment.
+     */
+    void establish(RasterIndex i, RasterIndex j, int row, int col,
+                   double establishment_tester, IntegerRaster &susceptible,
+                   IntegerRaster &exposed_or_infected,
+                   IntegerRaster &mortality_tracker,
+                   const IntegerRaster &total_populations, bool weather,
+                   const FloatRaster &weather_coefficient)
+    {
+        double probability_of_establishment =
+            (double)(susceptible(row, col)) / total_populations(row, col);
+        if (weather)
+            probability_of_establishment *= weather_coefficient(i, j);
+        if (establishment_tester < probability_of_establishment) {
+            exposed_or_infected(row, col) += 1;
+            susceptible(row, col) -= 1;
+            add_active_cell(row, col);
+            if (model_type_ == ModelType::SusceptibleInfected) {
+                mortality_tracker(row, col) += 1;
+            }
+            else if (model_type_ == ModelType::SusceptibleExposedInfected) {
+                // no-op
+            }
+            else {
+                throw std::runtime_error("Unknown ModelType value in "
+                                         "Simulation::disperse()");
+            }
+        }
+    }
+
+    /** Disperse using cell random streams (see disperse())
+     *
+     * First, destinations and random numbers for establishment are
+     * generated for all dispersers in parallel. Each thread uses its own
+     * copy of the dispersal kernel. Then, the dispersers are established
+     * in the same order as in disperse() using the pre-generated numbers.
+     * The establishment depends on the state of susceptible hosts left by
+     * the previous dispersers, so this part is sequential, but it does
+     * not involve the (expensive) kernel.
+     */
+    template <typename DispersalKernel>
+    void disperse_with_cell_streams(
+        const IntegerRaster &dispersers, IntegerRaster &susceptible,
+        IntegerRaster &exposed_or_infected, IntegerRaster &mortality_tracker,
+        const IntegerRaster &total_populations,
+        std::vector<std::tuple<int, int>> &outside_dispersers, bool weather,
+        const FloatRaster &weather_coefficient,
+        const DispersalKernel &dispersal_kernel,
+        double establishment_probability)
+    {
+        std::vector<std::tuple<RasterIndex, RasterIndex>> sources;
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (dispersers(i, j) > 0)
+                sources.emplace_back(i, j);
+        });
+        std::vector<std::vector<DispersalEvent>> events(sources.size());
+        std::uint32_t call = stream_call_++;
+        std::ptrdiff_t num_sources = sources.size();
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads_)
+#endif
+        {
+            DispersalKernel kernel(dispersal_kernel);
+            std::uniform_real_distribution<double> distribution_uniform(0.0,
+                                                                        1.0);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+            for (std::ptrdiff_t s = 0; s < num_sources; s++) {
+                RasterIndex i;
+                RasterIndex j;
+                std::tie(i, j) = sources[s];
+                auto generator = cell_random_stream(call, i, j);
+                auto &cell_events = events[s];
+                cell_events.resize(dispersers(i, j));
+                for (auto &event : cell_events) {
+                    std::tie(event.row, event.col) = kernel(generator, i, j);
+                    event.establishment_tester =
+                        distribution_uniform(generator);
+                }
+            }
+        }
+        for (std::size_t s = 0; s < sources.size(); s++) {
+            RasterIndex i;
+            RasterIndex j;
+            std::tie(i, j) = sources[s];
+            for (const auto &event : events[s]) {
+                int row = event.row;
+                int col = event.col;
+                if (row < 0 || row >= rows_ || col < 0 || col >= cols_) {
+                    outside_dispersers.emplace_back(std::make_tuple(row, col));
+                    continue;
+                }
+                if (susceptible(row, col) > 0) {
+                    double establishment_tester = 1 - establishment_probability;
+                    if (establishment_stochasticity_)
+                        establishment_tester = event.establishment_tester;
+                    establish(i, j, row, col, establishment_tester,
+                              susceptible, exposed_or_infected,
+                              mortality_tracker, total_populations, weather,
+                              weather_coefficient);
+                }
+            }
+            // release memory as soon as possible
+            std::vector<DispersalEvent>().swap(events[s]);
+        }
+    }
+
+    /** Marks cell as active if active cells are used */
+    void add_active_cell(RasterIndex row, RasterIndex col)
+    {
+        if (use_active_cells_)
+            active_cells_.add(row, col);
+    }
 
 public:
     /** Creates simulation object and seeds the internal random number
@@ -151,26 +366,85 @@ public:
           dispersers_stochasticity_(dispersers_stochasticity),
           establishment_stochasticity_(establishment_stochasticity),
           movement_stochasticity_(movement_stochasticity),
-          model_type_(model_type), latency_period_(latency_period)
+          model_type_(model_type), latency_period_(latency_period),
+          random_seed_(random_seed)
     {
         generator_.seed(random_seed);
     }
 
     Simulation() = delete;
 
+    /** Visit only active cells and add cells from a raster to them
+     *
+     * Cells with non-zero value in the *raster* are added to the active
+     * cells. The first call switches the simulation to the active cell
+     * mode. Typically, this is called once before the simulation with
+     * the initial infected raster and, if applicable, with the exposed
+     * and mortality tracker rasters.
+     *
+     * Afterwards, the simulation keeps the active cells up to date
+     * as new hosts are infected or exposed in disperse() or moved in
+     * movement(). If infected or exposed hosts are added to the rasters
+     * outside of this class, the new cells need to be added using
+     * this function, too. Removal of hosts (e.g. by treatments) does
+     * not need to be reported.
+     *
+     * In the active cell mode, generate() does not modify *dispersers*
+     * outside of the active cells and disperse() ignores *dispersers*
+     * outside of the active cells.
+     */
+    void activate_cells(const IntegerRaster &raster)
+    {
+        if (!use_active_cells_) {
+            active_cells_ = ActiveCells<RasterIndex>(rows_, cols_);
+            use_active_cells_ = true;
+        }
+        active_cells_.add_nonzero(raster);
+    }
+
+    /** True if only active cells are visited */
+    bool uses_active_cells() const { return use_active_cells_; }
+
+    /** Cells visited in the active cell mode */
+    const ActiveCells<RasterIndex> &active_cells() const
+    {
+        return active_cells_;
+    }
+
+    /** Use a separate random number stream for each cell
+     *
+     * When enabled, generate() and disperse() use a counter-based random
+     * number stream for each cell derived from the seed, the cell
+     * position, and the number of previous calls. This allows generate()
+     * and disperse() to use multiple threads while the results stay the
+     * same for any number of threads.
+     *
+     * Other functions, i.e., movement(), still use the sequential
+     * generator.
+     */
+    void set_cell_random_streams(bool value) { cell_random_streams_ = value; }
+
+    /** True if each cell has its own random number stream */
+    bool cell_random_streams() const { return cell_random_streams_; }
+
+    /** Set number of threads used by generate() and disperse()
+     *
+     * The threads are used only with cell random streams enabled and
+     * only if compiled with OpenMP.
+     */
+    void set_threads(unsigned threads) { threads_ = threads ? threads : 1; }
+
     void remove(IntegerRaster &infected, IntegerRaster &susceptible,
                 const FloatRaster &temperature, double lethal_temperature)
     {
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                if (temperature(i, j) < lethal_temperature) {
-                    // move infested/infected host back to susceptible pool
-                    susceptible(i, j) += infected(i, j);
-                    // remove all infestation/infection in the infected class
-                    infected(i, j) = 0;
-                }
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (temperature(i, j) < lethal_temperature) {
+                // move infested/infected host back to susceptible pool
+                susceptible(i, j) += infected(i, j);
+                // remove all infestation/infection in the infected class
+                infected(i, j) = 0;
             }
-        }
+        });
     }
 
     void mortality(IntegerRaster &infected, double mortality_rate,
@@ -182,26 +456,24 @@ public:
             int mortality_current_year = 0;
             int max_year_index = current_year - first_mortality_year;
 
-            for (int i = 0; i < rows_; i++) {
-                for (int j = 0; j < cols_; j++) {
-                    for (int year_index = 0; year_index <= max_year_index;
-                         year_index++) {
-                        int mortality_in_year_index = 0;
-                        if (mortality_tracker_vector[year_index](i, j) > 0) {
-                            mortality_in_year_index =
-                                mortality_rate *
-                                mortality_tracker_vector[year_index](i, j);
-                            mortality_tracker_vector[year_index](i, j) -=
-                                mortality_in_year_index;
-                            mortality(i, j) += mortality_in_year_index;
-                            mortality_current_year += mortality_in_year_index;
-                            if (infected(i, j) > 0) {
-                                infected(i, j) -= mortality_in_year_index;
-                            }
+            for_each_cell([&](RasterIndex i, RasterIndex j) {
+                for (int year_index = 0; year_index <= max_year_index;
+                     year_index++) {
+                    int mortality_in_year_index = 0;
+                    if (mortality_tracker_vector[year_index](i, j) > 0) {
+                        mortality_in_year_index =
+                            mortality_rate *
+                            mortality_tracker_vector[year_index](i, j);
+                        mortality_tracker_vector[year_index](i, j) -=
+                            mortality_in_year_index;
+                        mortality(i, j) += mortality_in_year_index;
+                        mortality_current_year += mortality_in_year_index;
+                        if (infected(i, j) > 0) {
+                            infected(i, j) -= mortality_in_year_index;
                         }
                     }
                 }
-            }
+            });
         }
     }
 
@@ -295,6 +567,8 @@ public:
             susceptible(row_from, col_from) -= susceptible_moved;
             total_hosts(row_from, col_from) -= total_hosts_moved;
             infected(row_to, col_to) += infected_moved;
+            if (infected_moved > 0)
+                add_active_cell(row_to, col_to);
             susceptible(row_to, col_to) += susceptible_moved;
             total_hosts(row_to, col_to) += total_hosts_moved;
         }
@@ -314,29 +588,52 @@ public:
                   bool weather, const FloatRaster &weather_coefficient,
                   double reproductive_rate)
     {
-        double lambda = reproductive_rate;
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                if (infected(i, j) > 0) {
-                    if (weather)
-                        lambda = reproductive_rate * weather_coefficient(i, j);
-                    int dispersers_from_cell = 0;
-                    if (dispersers_stochasticity_) {
-                        std::poisson_distribution<int> distribution(lambda);
-                        for (int k = 0; k < infected(i, j); k++) {
-                            dispersers_from_cell += distribution(generator_);
-                        }
+        if (cell_random_streams_) {
+            std::uint32_t call = stream_call_++;
+            for_each_cell_in_parallel([&](RasterIndex i, RasterIndex j) {
+                if (infected(i, j) <= 0) {
+                    dispersers(i, j) = 0;
+                    return;
+                }
+                double lambda = reproductive_rate;
+                if (weather)
+                    lambda *= weather_coefficient(i, j);
+                int dispersers_from_cell = 0;
+                if (dispersers_stochasticity_) {
+                    auto generator = cell_random_stream(call, i, j);
+                    std::poisson_distribution<int> distribution(lambda);
+                    for (int k = 0; k < infected(i, j); k++) {
+                        dispersers_from_cell += distribution(generator);
                     }
-                    else {
-                        dispersers_from_cell = lambda * infected(i, j);
+                }
+                else {
+                    dispersers_from_cell = lambda * infected(i, j);
+                }
+                dispersers(i, j) = dispersers_from_cell;
+            });
+            return;
+        }
+        double lambda = reproductive_rate;
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (infected(i, j) > 0) {
+                if (weather)
+                    lambda = reproductive_rate * weather_coefficient(i, j);
+                int dispersers_from_cell = 0;
+                if (dispersers_stochasticity_) {
+                    std::poisson_distribution<int> distribution(lambda);
+                    for (int k = 0; k < infected(i, j); k++) {
+                        dispersers_from_cell += distribution(generator_);
                     }
-                    dispersers(i, j) = dispersers_from_cell;
                 }
                 else {
-                    dispersers(i, j) = 0;
+                    dispersers_from_cell = lambda * infected(i, j);
                 }
+                dispersers(i, j) = dispersers_from_cell;
             }
-        }
+            else {
+                dispersers(i, j) = 0;
+            }
+        });
     }
 
     /** Creates dispersal locations for the dispersing individuals
@@ -393,61 +690,40 @@ public:
                   DispersalKernel &dispersal_kernel,
                   double establishment_probability = 0.5)
     {
+        if (cell_random_streams_) {
+            this->disperse_with_cell_streams(
+                dispersers, susceptible, exposed_or_infected,
+                mortality_tracker, total_populations, outside_dispersers,
+                weather, weather_coefficient, dispersal_kernel,
+                establishment_probability);
+            return;
+        }
         std::uniform_real_distribution<double> distribution_uniform(0.0, 1.0);
         int row;
         int col;
 
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                if (dispersers(i, j) > 0) {
-                    for (int k = 0; k < dispersers(i, j); k++) {
-                        std::tie(row, col) = dispersal_kernel(generator_, i, j);
-
-                        if (row < 0 || row >= rows_ || col < 0 ||
-                            col >= cols_) {
-                            // export dispersers dispersed outside of modeled
-                            // area
-                            outside_dispersers.emplace_back(
-                                std::make_tuple(row, col));
-                            continue;
-                        }
-                        if (susceptible(row, col) > 0) {
-                            double probability_of_establishment =
-                                (double)(susceptible(row, col)) /
-                                total_populations(row, col);
-                            double establishment_tester =
-                                1 - establishment_probability;
-                            if (establishment_stochasticity_)
-                                establishment_tester =
-                                    distribution_uniform(generator_);
-
-                            if (weather)
-                                probability_of_establishment *=
-                                    weather_coefficient(i, j);
-                            if (establishment_tester <
-                                probability_of_establishment) {
-                                exposed_or_infected(row, col) += 1;
-                                susceptible(row, col) -= 1;
-                                if (model_type_ ==
-                                    ModelType::SusceptibleInfected) {
-                                    mortality_tracker(row, col) += 1;
-                                }
-                                else if (model_type_ ==
-                                         ModelType::
-                                             SusceptibleExposedInfected) {
-                                    // no-op
-                                }
-                                else {
-                                    throw std::runtime_error(
-                                        "Unknown ModelType value in "
-                                        "Simulation::disperse()");
-                                }
-                            }
-                        }
-                    }
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (dispersers(i, j) <= 0)
+                return;
+            for (int k = 0; k < dispersers(i, j); k++) {
+                std::tie(row, col) = dispersal_kernel(generator_, i, j);
+
+                if (row < 0 || row >= rows_ || col < 0 || col >= cols_) {
+                    // export dispersers dispersed outside of modeled area
+                    outside_dispersers.emplace_back(std::make_tuple(row, col));
+                    continue;
+                }
+                if (susceptible(row, col) > 0) {
+                    double establishment_tester = 1 - establishment_probability;
+                    if (establishment_stochasticity_)
+                        establishment_tester = distribution_uniform(generator_);
+                    establish(i, j, row, col, establishment_tester,
+                              susceptible, exposed_or_infected,
+                              mortality_tracker, total_populations, weather,
+                              weather_coefficient);
                 }
             }
-        }
+        });
     }
 
     /** Infect exposed hosts (E to I transition in the SEI model)
@@ -499,12 +775,22 @@ public:
             if (step >= latency_period_) {
                 // Oldest item needs to be in the front
                 auto &oldest = exposed.front();
-                // Move hosts to infected raster
-                infected += oldest;
-                mortality_tracker += oldest;
-                // Reset the raster
-                // (hosts moved from the raster)
-                oldest.fill(0);
+                if (use_active_cells_) {
+                    // Exposed hosts are only in the active cells.
+                    for_each_cell([&](RasterIndex i, RasterIndex j) {
+                        infected(i, j) += oldest(i, j);
+                        mortality_tracker(i, j) += oldest(i, j);
+                        oldest(i, j) = 0;
+                    });
+                }
+                else {
+                    // Move hosts to infected raster
+                    infected += oldest;
+                    mortality_tracker += oldest;
+                    // Reset the raster
+                    // (hosts moved from the raster)
+                    oldest.fill(0);
+                }
             }
             // Age the items and the used one to the back
             // elements go one position to the left
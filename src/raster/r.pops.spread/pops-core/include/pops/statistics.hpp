@@ -16,6 +16,9 @@
 #ifndef POPS_STATISTICS_HPP
 #define POPS_STATISTICS_HPP
 
+#include <cmath>
+#include <stdexcept>
+
 namespace pops {
 
 /**
@@ -51,5 +54,89 @@ double area_of_infected(const IntegerRaster &infected, double ew_res,
     return cells * ew_res * ns_res;
 }
 
+/**
+ * Per-cell statistics of an ensemble of stochastic runs computed
+ * without keeping the rasters from individual runs.
+ *
+ * Each run is added using add() as soon as its result is available.
+ * Mean and variance are updated using the Welford's algorithm,
+ * probability of occurrence is computed from the number of runs
+ * with a non-zero value in the cell. Memory use is two floating point
+ * rasters and one integer raster regardless of the number of runs.
+ * The results depend on the order in which the runs are added only
+ * through rounding errors.
+ */
+template <typename IntegerRaster, typename FloatRaster>
+class EnsembleStatistics {
+public:
+    EnsembleStatistics(int rows, int cols)
+        : mean_(rows, cols, 0), m2_(rows, cols, 0), occurrences_(rows, cols, 0)
+    {
+    }
+
+    /** Adds values from one run */
+    void add(const IntegerRaster &values)
+    {
+        if (values.rows() != mean_.rows() || values.cols() != mean_.cols())
+            throw std::invalid_argument(
+                "EnsembleStatistics: Raster size does not match");
+        ++count_;
+        for (int i = 0; i < mean_.rows(); i++) {
+            for (int j = 0; j < mean_.cols(); j++) {
+                double value = values(i, j);
+                double delta = value - mean_(i, j);
+                mean_(i, j) += delta / count_;
+                m2_(i, j) += delta * (value - mean_(i, j));
+                if (value > 0)
+                    occurrences_(i, j) += 1;
+            }
+        }
+    }
+
+    /** Number of runs added so far */
+    unsigned count() const { return count_; }
+
+    /** Mean value of each cell over all runs */
+    const FloatRaster &mean() const { return mean_; }
+
+    /** Population variance of each cell over all runs */
+    FloatRaster variance() const
+    {
+        FloatRaster variance = m2_;
+        if (count_)
+            variance /= count_;
+        return variance;
+    }
+
+    /** Population standard deviation of each cell over all runs */
+    FloatRaster stddev() const
+    {
+        FloatRaster stddev = variance();
+        stddev.for_each([](typename FloatRaster::NumberType &value) {
+            value = std::sqrt(value);
+        });
+        return stddev;
+    }
+
+    /** Percentage of runs with a non-zero value in each cell (0-100) */
+    FloatRaster probability() const
+    {
+        FloatRaster probability(mean_.rows(), mean_.cols(), 0);
+        if (!count_)
+            return probability;
+        for (int i = 0; i < mean_.rows(); i++)
+            for (int j = 0; j < mean_.cols(); j++)
+                probability(i, j) = 100. * occurrences_(i, j) / count_;
+        return probability;
+    }
+
+private:
+    FloatRaster mean_;
+    // sum of squared differences from the mean
+    FloatRaster m2_;
+    IntegerRaster occurrences_;
+    unsigned count_{0};
+};
+
 } // namespace pops
 #endif // POPS_STATISTICS_HPP
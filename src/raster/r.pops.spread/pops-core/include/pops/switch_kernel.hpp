@@ -17,10 +17,13 @@
 #define POPS_SWITCH_KERNEL_HPP
 
 #include "radial_kernel.hpp"
+#include "tabulated_kernel.hpp"
 #include "uniform_kernel.hpp"
 #include "neighbor_kernel.hpp"
 #include "kernel_types.hpp"
 
+#include <memory>
+
 namespace pops {
 
 /*! Dispersal kernel providing all the radial kernels.
@@ -31,6 +34,10 @@ namespace pops {
  * To add new kernel, add new member, constructor parameter,
  * its call in the function call operator, and extend the
  * supports_kernel() function.
+ *
+ * If *tabulated_kernel* is provided, it is used instead of the radial
+ * kernel. The tabulated kernel is shared (not copied) by all copies of
+ * this object, so it can be created once and reused in every step.
  */
 template <typename IntegerRaster>
 class SwitchDispersalKernel {
@@ -39,6 +46,7 @@ protected:
     RadialDispersalKernel<IntegerRaster> radial_kernel_;
     UniformDispersalKernel uniform_kernel_;
     DeterministicNeighborDispersalKernel deterministic_neighbor_kernel_;
+    std::shared_ptr<const TabulatedDispersalKernel> tabulated_kernel_;
 
 public:
     SwitchDispersalKernel(
@@ -47,12 +55,15 @@ public:
         const UniformDispersalKernel &uniform_kernel,
         const DeterministicNeighborDispersalKernel
             &deterministic_neighbor_kernel =
-                DeterministicNeighborDispersalKernel(Direction::None))
+                DeterministicNeighborDispersalKernel(Direction::None),
+        std::shared_ptr<const TabulatedDispersalKernel> tabulated_kernel =
+            nullptr)
         : dispersal_kernel_type_(dispersal_kernel_type),
           // Here we initialize all kernels,
           // although we won't use all of them.
           radial_kernel_(radial_kernel), uniform_kernel_(uniform_kernel),
-          deterministic_neighbor_kernel_(deterministic_neighbor_kernel)
+          deterministic_neighbor_kernel_(deterministic_neighbor_kernel),
+          tabulated_kernel_(tabulated_kernel)
     {
     }
 
@@ -69,6 +80,9 @@ public:
                  DispersalKernelType::DeterministicNeighbor) {
             return deterministic_neighbor_kernel_(generator, row, col);
         }
+        else if (tabulated_kernel_) {
+            return (*tabulated_kernel_)(generator, row, col);
+        }
         else {
             return radial_kernel_(generator, row, col);
         }
@@ -0,0 +1,440 @@
+/*
+ * PoPS model - tabulated radial dispersal kernel
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#ifndef POPS_TABULATED_KERNEL_HPP
+#define POPS_TABULATED_KERNEL_HPP
+
+#include "radial_kernel.hpp"
+#include "kernel_types.hpp"
+
+#include <cmath>
+#include <tuple>
+#include <vector>
+#include <random>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace pops {
+
+/*! Alias table for sampling from a discrete distribution in constant time
+ *
+ * Built using the Vose's variant of the Walker's alias method.
+ * The weights don't need to be normalized.
+ */
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    explicit AliasTable(const std::vector<double> &weights)
+        : probability_(weights.size()), alias_(weights.size())
+    {
+        std::size_t size = weights.size();
+        if (!size)
+            throw std::invalid_argument("AliasTable: No weights provided");
+        double sum = 0;
+        for (auto weight : weights)
+            sum += weight;
+        if (!(sum > 0))
+            throw std::invalid_argument("AliasTable: Sum of weights is zero");
+        std::vector<double> scaled(size);
+        std::vector<std::size_t> small;
+        std::vector<std::size_t> large;
+        for (std::size_t i = 0; i < size; i++) {
+            scaled[i] = weights[i] * size / sum;
+            if (scaled[i] < 1)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            std::size_t less = small.back();
+            small.pop_back();
+            std::size_t more = large.back();
+            large.pop_back();
+            probability_[less] = scaled[less];
+            alias_[less] = more;
+            scaled[more] = (scaled[more] + scaled[less]) - 1;
+            if (scaled[more] < 1)
+                small.push_back(more);
+            else
+                large.push_back(more);
+        }
+        // leftovers are (up to rounding errors) exactly one
+        for (auto i : large) {
+            probability_[i] = 1;
+            alias_[i] = i;
+        }
+        for (auto i : small) {
+            probability_[i] = 1;
+            alias_[i] = i;
+        }
+    }
+
+    std::size_t size() const { return probability_.size(); }
+
+    /*! Returns index of a randomly selected item
+     *
+     * Uses one uniform random number for both selection of the column
+     * and the choice between the item and its alias.
+     */
+    template <typename Generator>
+    std::size_t operator()(Generator &generator) const
+    {
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        double value = distribution(generator) * probability_.size();
+        std::size_t index = static_cast<std::size_t>(value);
+        // guard against rounding up to size
+        if (index >= probability_.size())
+            index = probability_.size() - 1;
+        double fraction = value - index;
+        return fraction < probability_[index] ? index : alias_[index];
+    }
+
+private:
+    std::vector<double> probability_;
+    std::vector<std::size_t> alias_;
+};
+
+/*! Radial dispersal kernel with precomputed probabilities of cell offsets
+ *
+ * The kernel represents the same distribution of the dispersal
+ * distance and direction as RadialDispersalKernel, but the
+ * probabilities of moving to each cell in a window around the source
+ * cell are computed once when the object is created. Each disperser
+ * is then placed using an alias table, i.e., in constant time and
+ * without evaluation of trigonometric functions.
+ *
+ * The window covers distances up to the quantile of the distance
+ * distribution given by *dispersal_percentage*. The remaining
+ * dispersers (the tail of the distribution) are placed by sampling
+ * the distance from the tail and the direction from the von Mises
+ * distribution, so the tail is not truncated.
+ *
+ * The probability of each cell is the integral of the kernel density
+ * over the cell. Near the source, the distance distribution is
+ * integrated exactly along rays in many directions, further away the
+ * density is integrated numerically, so all cells of the window get
+ * their probability regardless of the distance.
+ * The sequence of random numbers is different from RadialDispersalKernel,
+ * so the results for a given seed are different.
+ *
+ * The function call operator is const and the object can be shared
+ * between threads and simulation steps. Memory use is proportional to
+ * the number of cells in the window which is limited by
+ * max_window_cells.
+ */
+class TabulatedDispersalKernel {
+public:
+    TabulatedDispersalKernel(double ew_res, double ns_res,
+                             DispersalKernelType dispersal_kernel,
+                             double distance_scale,
+                             Direction dispersal_direction = Direction::None,
+                             double dispersal_direction_kappa = 0,
+                             double dispersal_percentage = 0.99)
+        : east_west_resolution(ew_res), north_south_resolution(ns_res),
+          dispersal_kernel_type_(dispersal_kernel), scale_(distance_scale),
+          mu_(static_cast<int>(dispersal_direction) * PI / 180),
+          kappa_(dispersal_direction == Direction::None
+                     ? 0
+                     : dispersal_direction_kappa)
+    {
+        if (!supports_kernel(dispersal_kernel_type_))
+            throw std::invalid_argument(
+                "TabulatedDispersalKernel: Unsupported dispersal kernel type");
+        if (!(dispersal_percentage > 0 && dispersal_percentage < 1))
+            throw std::invalid_argument(
+                "TabulatedDispersalKernel: dispersal_percentage must be"
+                " between 0 and 1");
+        if (window_cells(ew_res, ns_res, dispersal_kernel, distance_scale,
+                         dispersal_percentage) > max_window_cells)
+            throw std::invalid_argument(
+                "TabulatedDispersalKernel: Window is too large for the given"
+                " scale and resolution");
+        max_distance_ = quantile(dispersal_percentage);
+        tail_start_ = cdf(max_distance_);
+        row_radius_ = std::ceil(max_distance_ / north_south_resolution);
+        col_radius_ = std::ceil(max_distance_ / east_west_resolution);
+        width_ = 2 * col_radius_ + 1;
+        int height = 2 * row_radius_ + 1;
+        // the last item is the tail beyond the window
+        std::vector<double> weights(std::size_t(width_) * height + 1, 0);
+
+        // direction samples for the cells near the source
+        std::vector<double> sin_angles(num_angles);
+        std::vector<double> cos_angles(num_angles);
+        std::vector<double> angle_weights(num_angles);
+        double angle_sum = 0;
+        for (int m = 0; m < num_angles; m++) {
+            double theta = (m + 0.5) * 2 * PI / num_angles;
+            sin_angles[m] = std::sin(theta);
+            cos_angles[m] = std::cos(theta);
+            angle_weights[m] = direction_weight(cos_angles[m], sin_angles[m]);
+            angle_sum += angle_weights[m];
+        }
+        for (auto &weight : angle_weights)
+            weight /= angle_sum;
+        // normalizes direction_weight() to a density
+        direction_density_ = num_angles / (2 * PI * angle_sum);
+
+        double max_res = std::max(east_west_resolution, north_south_resolution);
+        double cell_area = east_west_resolution * north_south_resolution;
+        // offsets of Gauss-Legendre points from the cell center
+        double gauss_x = east_west_resolution / (2 * std::sqrt(3.));
+        double gauss_y = north_south_resolution / (2 * std::sqrt(3.));
+        for (int row = -row_radius_; row <= row_radius_; row++) {
+            // north and east are positive
+            double y = -row * north_south_resolution;
+            double near_y =
+                std::max(0., std::abs(row) - 0.5) * north_south_resolution;
+            for (int col = -col_radius_; col <= col_radius_; col++) {
+                double x = col * east_west_resolution;
+                double near_x =
+                    std::max(0., std::abs(col) - 0.5) * east_west_resolution;
+                double near_distance = std::hypot(near_x, near_y);
+                if (near_distance >= max_distance_)
+                    continue;
+                double probability = 0;
+                if (near_distance < near_cells * max_res) {
+                    for (int m = 0; m < num_angles; m++) {
+                        // part of the ray crossing the cell
+                        double start = 0;
+                        double end = max_distance_;
+                        if (!clip_ray(x - east_west_resolution / 2,
+                                      x + east_west_resolution / 2,
+                                      sin_angles[m], start, end) ||
+                            !clip_ray(y - north_south_resolution / 2,
+                                      y + north_south_resolution / 2,
+                                      cos_angles[m], start, end))
+                            continue;
+                        probability +=
+                            angle_weights[m] * (cdf(end) - cdf(start));
+                    }
+                }
+                else if (near_distance < gauss_cells * max_res) {
+                    probability = (density(x - gauss_x, y - gauss_y) +
+                                   density(x + gauss_x, y - gauss_y) +
+                                   density(x - gauss_x, y + gauss_y) +
+                                   density(x + gauss_x, y + gauss_y)) *
+                                  cell_area / 4;
+                }
+                else {
+                    probability = density(x, y) * cell_area;
+                }
+                weights[index(row, col)] = probability;
+            }
+        }
+        weights.back() = 1 - tail_start_;
+        probabilities_.resize(weights.size());
+        double sum = 0;
+        for (auto weight : weights)
+            sum += weight;
+        for (std::size_t i = 0; i < weights.size(); i++)
+            probabilities_[i] = weights[i] / sum;
+        alias_table_ = AliasTable(weights);
+    }
+
+    /*! \copydoc RadialDispersalKernel::operator()()
+     */
+    template <typename Generator>
+    std::tuple<int, int> operator()(Generator &generator, int row,
+                                    int col) const
+    {
+        std::size_t item = alias_table_(generator);
+        if (item + 1 < probabilities_.size()) {
+            row += int(item / width_) - row_radius_;
+            col += int(item % width_) - col_radius_;
+            return std::make_tuple(row, col);
+        }
+        // tail of the distribution (outside of the window)
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        double distance =
+            quantile(tail_start_ + distribution(generator) * (1 - tail_start_));
+        von_mises_distribution von_mises(mu_, kappa_);
+        double theta = von_mises(generator);
+        // limit the distance to what fits into the integer type
+        const double limit = 1e9;
+        double row_movement =
+            distance * std::cos(theta) / north_south_resolution;
+        double col_movement = distance * std::sin(theta) / east_west_resolution;
+        row_movement = std::min(limit, std::max(-limit, row_movement));
+        col_movement = std::min(limit, std::max(-limit, col_movement));
+        row -= std::round(row_movement);
+        col += std::round(col_movement);
+        return std::make_tuple(row, col);
+    }
+
+    /*! Probability of moving by the given number of rows and columns
+     *
+     * Zero is returned for offsets outside of the window.
+     */
+    double probability(int row_offset, int col_offset) const
+    {
+        if (std::abs(row_offset) > row_radius_ ||
+            std::abs(col_offset) > col_radius_)
+            return 0;
+        return probabilities_[index(row_offset, col_offset)];
+    }
+
+    /*! Probability of moving outside of the window */
+    double tail_probability() const { return probabilities_.back(); }
+
+    /*! Maximum number of rows a disperser can move within the window */
+    int row_radius() const { return row_radius_; }
+
+    /*! Maximum number of columns a disperser can move within the window */
+    int col_radius() const { return col_radius_; }
+
+    /*! \copydoc RadialDispersalKernel::supports_kernel()
+     */
+    static bool supports_kernel(const DispersalKernelType type)
+    {
+        return type == DispersalKernelType::Cauchy ||
+               type == DispersalKernelType::Exponential;
+    }
+
+    /*! Number of cells in the window of a kernel with the given parameters
+     *
+     * Allows to check the size against max_window_cells before the kernel
+     * is created.
+     */
+    static double window_cells(double ew_res, double ns_res,
+                               DispersalKernelType dispersal_kernel,
+                               double distance_scale,
+                               double dispersal_percentage = 0.99)
+    {
+        double distance = distance_quantile(dispersal_kernel, distance_scale,
+                                            dispersal_percentage);
+        return (2 * std::ceil(distance / ew_res) + 1) *
+               (2 * std::ceil(distance / ns_res) + 1);
+    }
+
+    /*! Maximum number of cells in the window (limits memory use) */
+    static constexpr double max_window_cells = 16e6;
+
+private:
+    double east_west_resolution;
+    double north_south_resolution;
+    DispersalKernelType dispersal_kernel_type_;
+    double scale_;
+    double mu_;
+    double kappa_;
+    double max_distance_;
+    double tail_start_;
+    int row_radius_;
+    int col_radius_;
+    int width_;
+    std::vector<double> probabilities_;
+    AliasTable alias_table_;
+
+    /*! Number of directions integrated for the cells near the source */
+    static const int num_angles = 8192;
+    /*! Cells closer than this number of cell sizes are near the source */
+    static constexpr double near_cells = 8;
+    /*! Cells closer than this number of cell sizes use four points */
+    static constexpr double gauss_cells = 32;
+
+    double direction_density_{0};
+
+    /*! Von Mises density of the direction up to a constant
+     *
+     * The direction is given by its cosine (north) and sine (east)
+     * components and the density is shifted for numerical stability.
+     */
+    double direction_weight(double north, double east) const
+    {
+        if (kappa_ <= 1.e-06)
+            return 1;
+        return std::exp(
+            kappa_ * (north * std::cos(mu_) + east * std::sin(mu_) - 1));
+    }
+
+    /*! Kernel density at the given position relative to the source
+     *
+     * Zero beyond the window distance.
+     */
+    double density(double east, double north) const
+    {
+        double distance = std::sqrt(east * east + north * north);
+        if (distance >= max_distance_)
+            return 0;
+        double distance_density;
+        if (dispersal_kernel_type_ == DispersalKernelType::Cauchy) {
+            double ratio = distance / scale_;
+            distance_density = 2 / (PI * scale_ * (1 + ratio * ratio));
+        }
+        else
+            distance_density = std::exp(-distance / scale_) / scale_;
+        return distance_density * direction_density_ *
+               direction_weight(north / distance, east / distance) / distance;
+    }
+
+    /*! Limits the part of a ray to a slab between two coordinates
+     *
+     * The ray starts at the source and *direction* is its component
+     * across the slab. Returns false if the ray misses the slab.
+     */
+    static bool clip_ray(double low, double high, double direction,
+                         double &start, double &end)
+    {
+        if (direction == 0)
+            return low <= 0 && high >= 0;
+        double first = low / direction;
+        double second = high / direction;
+        if (first > second)
+            std::swap(first, second);
+        start = std::max(start, first);
+        end = std::min(end, second);
+        return start < end;
+    }
+
+    std::size_t index(int row_offset, int col_offset) const
+    {
+        return std::size_t(row_offset + row_radius_) * width_ + col_offset +
+               col_radius_;
+    }
+
+    /*! Cumulative distribution function of the distance */
+    double cdf(double distance) const
+    {
+        return distance_cdf(dispersal_kernel_type_, scale_, distance);
+    }
+
+    /*! Quantile function (inverse of cdf()) of the distance */
+    double quantile(double probability) const
+    {
+        return distance_quantile(dispersal_kernel_type_, scale_, probability);
+    }
+
+    static double distance_cdf(DispersalKernelType type, double scale,
+                               double distance)
+    {
+        if (type == DispersalKernelType::Cauchy)
+            // absolute value of Cauchy (half-Cauchy)
+            return 2 / PI * std::atan(distance / scale);
+        return 1 - std::exp(-distance / scale);
+    }
+
+    static double distance_quantile(DispersalKernelType type, double scale,
+                                    double probability)
+    {
+        if (type == DispersalKernelType::Cauchy)
+            return scale * std::tan(probability * PI / 2);
+        return -scale * std::log(1 - probability);
+    }
+};
+
+} // namespace pops
+
+#endif // POPS_TABULATED_KERNEL_HPP
@@ -0,0 +1,129 @@
+#ifdef POPS_TEST
+
+/*
+ * Tests for the PoPS counter-based random number engine.
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pops/counter_based_random.hpp>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace pops;
+using std::cout;
+
+typedef Philox4x32Engine::Counter Counter;
+typedef Philox4x32Engine::Key Key;
+
+int test_known_answer(const Counter &counter, const Key &key,
+                      const Counter &expected)
+{
+    auto result = Philox4x32Engine::philox4x32(counter, key);
+    if (result != expected) {
+        cout << "Philox4x32-10 known answer test failed: " << std::hex
+             << result[0] << " " << result[1] << " " << result[2] << " "
+             << result[3] << std::dec << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int test_discard()
+{
+    Philox4x32Engine a(42, 7);
+    Philox4x32Engine b(42, 7);
+    for (int i = 0; i < 13; i++)
+        a();
+    b.discard(13);
+    if (a() != b()) {
+        cout << "Discard does not match generated numbers\n";
+        return 1;
+    }
+    a();
+    a();
+    b.discard(2);
+    if (a() != b()) {
+        cout << "Discard within a block does not match generated numbers\n";
+        return 1;
+    }
+    return 0;
+}
+
+int test_streams_differ()
+{
+    Philox4x32Engine a(42, 0);
+    Philox4x32Engine b(42, 1);
+    Philox4x32Engine c(43, 0);
+    auto first = a();
+    if (first == b() || first == c()) {
+        cout << "Different streams or keys give the same numbers\n";
+        return 1;
+    }
+    return 0;
+}
+
+int test_with_distribution()
+{
+    Philox4x32Engine generator(1, 2);
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    double sum = 0;
+    int count = 10000;
+    for (int i = 0; i < count; i++) {
+        double value = distribution(generator);
+        if (value < 0 || value >= 1) {
+            cout << "Uniform distribution value out of range: " << value
+                 << "\n";
+            return 1;
+        }
+        sum += value;
+    }
+    double mean = sum / count;
+    if (mean < 0.48 || mean > 0.52) {
+        cout << "Uniform distribution mean is off: " << mean << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int ret = 0;
+
+    // known answers from the Random123 library
+    ret += test_known_answer({{0, 0, 0, 0}}, {{0, 0}},
+                             {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c,
+                               0x9b00dbd8}});
+    ret += test_known_answer(
+        {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}},
+        {{0xffffffff, 0xffffffff}},
+        {{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}});
+    ret += test_known_answer(
+        {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}},
+        {{0xa4093822, 0x299f31d0}},
+        {{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}});
+    ret += test_discard();
+    ret += test_streams_differ();
+    ret += test_with_distribution();
+
+    return ret;
+}
+
+#endif // POPS_TEST
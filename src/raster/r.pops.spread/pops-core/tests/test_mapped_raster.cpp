@@ -0,0 +1,234 @@
+#ifdef POPS_TEST
+
+/*
+ * Tests for the PoPS mapped raster.
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pops/raster.hpp>
+#include <pops/mapped_raster.hpp>
+#include <pops/radial_kernel.hpp>
+#include <pops/simulation.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace pops;
+using std::cout;
+
+template <typename Number>
+int test_values_across_tiles()
+{
+    // larger than one tile and not a multiple of the tile size
+    int rows = 100;
+    int cols = 150;
+    MappedRaster<Number> raster(rows, cols, 3);
+    int ret = 0;
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            raster(i, j) += (i * cols + j) % 1000;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            if (raster(i, j) != Number(3 + (i * cols + j) % 1000)) {
+                cout << "Mapped raster: wrong value at " << i << ", " << j
+                     << ": " << raster(i, j) << "\n";
+                return ret + 1;
+            }
+        }
+    }
+    auto copy = raster;
+    copy += raster;
+    if (copy(99, 149) != 2 * raster(99, 149)) {
+        cout << "Mapped raster: += gives " << copy(99, 149) << "\n";
+        ret++;
+    }
+    copy -= raster;
+    if (copy != raster) {
+        cout << "Mapped raster: copy and -= does not give the original\n";
+        ret++;
+    }
+    copy.zero();
+    if (copy == raster || copy(50, 70) != 0) {
+        cout << "Mapped raster: zero() did not reset values\n";
+        ret++;
+    }
+    return ret;
+}
+
+int test_conversion_from_and_to_raster()
+{
+    Raster<int> raster = {{1, 2, 3}, {4, 5, 6}, {7, 8, 9}};
+    MappedRaster<std::uint16_t> mapped(raster);
+    MappedRaster<std::uint16_t> expected = {{1, 2, 3}, {4, 5, 6}, {7, 8, 9}};
+    int ret = 0;
+    if (mapped != expected) {
+        cout << "Mapped raster: conversion from Raster failed\n";
+        ret++;
+    }
+    if (mapped.to_raster<Raster<int>>() != raster) {
+        cout << "Mapped raster: conversion to Raster failed\n";
+        ret++;
+    }
+    return ret;
+}
+
+int test_move()
+{
+    MappedRaster<int> raster(70, 80, 5);
+    raster(69, 79) = 7;
+    MappedRaster<int> moved(std::move(raster));
+    int ret = 0;
+    if (moved(69, 79) != 7 || moved.rows() != 70 || moved.cols() != 80) {
+        cout << "Mapped raster: move construction lost values\n";
+        ret++;
+    }
+    if (raster.rows() != 0 || raster.cols() != 0) {
+        cout << "Mapped raster: moved-from raster is not empty\n";
+        ret++;
+    }
+    MappedRaster<int> assigned(3, 3, 1);
+    assigned = std::move(moved);
+    if (assigned(69, 79) != 7 || assigned(0, 0) != 5) {
+        cout << "Mapped raster: move assignment lost values\n";
+        ret++;
+    }
+    if (moved.rows() != 0 || moved.cols() != 0) {
+        cout << "Mapped raster: moved-from raster is not empty\n";
+        ret++;
+    }
+    // moved-from rasters can be assigned again
+    moved = MappedRaster<int>(2, 2, 4);
+    if (moved(1, 1) != 4) {
+        cout << "Mapped raster: assignment to moved-from raster failed\n";
+        ret++;
+    }
+    return ret;
+}
+
+int test_file_backed()
+{
+    std::string original = mapped_raster_directory();
+    mapped_raster_directory() = "/tmp";
+    int ret = 0;
+    {
+        MappedRaster<int> raster(70, 70, 5);
+        raster(69, 69) = 7;
+        MappedRaster<int> copy(raster);
+        if (copy(69, 69) != 7 || copy(0, 0) != 5) {
+            cout << "Mapped raster: file-backed copy has wrong values\n";
+            ret++;
+        }
+    }
+    mapped_raster_directory() = "/nonexistent/directory";
+    try {
+        MappedRaster<int> raster(10, 10);
+        cout << "Mapped raster: no exception for nonexistent directory\n";
+        ret++;
+    }
+    catch (const std::runtime_error &) {
+    }
+    mapped_raster_directory() = original;
+    return ret;
+}
+
+// Raster(rows, cols, value) sets only the first cell, so fill explicitly
+template <typename AnyRaster>
+AnyRaster filled(int rows, int cols, typename AnyRaster::NumberType value)
+{
+    AnyRaster raster(rows, cols, 0);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            raster(i, j) = value;
+    return raster;
+}
+
+template <typename IntegerRaster, typename FloatRaster>
+IntegerRaster run_simulation(const std::string &model_type)
+{
+    int rows = 70;
+    int cols = 70;
+    auto susceptible = filled<IntegerRaster>(rows, cols, 40);
+    IntegerRaster infected(rows, cols, 0);
+    infected(20, 30) = 5;
+    infected(65, 66) = 3;
+    susceptible(20, 30) -= 5;
+    susceptible(65, 66) -= 3;
+    auto total_hosts = filled<IntegerRaster>(rows, cols, 40);
+    auto weather_coefficient = filled<FloatRaster>(rows, cols, 0.8);
+    unsigned latency_period = 2;
+    std::vector<IntegerRaster> exposed(latency_period + 1,
+                                       IntegerRaster(rows, cols, 0));
+    std::vector<IntegerRaster> mortality_tracker(3,
+                                                 IntegerRaster(rows, cols, 0));
+    IntegerRaster died(rows, cols, 0);
+    IntegerRaster dispersers(rows, cols, 0);
+    std::vector<std::tuple<int, int>> outside_dispersers;
+
+    Simulation<IntegerRaster, FloatRaster> simulation(
+        42, rows, cols, model_type_from_string(model_type), latency_period);
+    RadialDispersalKernel<IntegerRaster> kernel(
+        30, 30, DispersalKernelType::Cauchy, 20);
+    for (unsigned step = 0; step < 6; ++step) {
+        int year = step / 2;
+        simulation.generate(dispersers, infected, true, weather_coefficient,
+                            3);
+        simulation.disperse_and_infect(
+            step, dispersers, susceptible, exposed, infected,
+            mortality_tracker[year], total_hosts, outside_dispersers, true,
+            weather_coefficient, kernel);
+        simulation.mortality(infected, 0.5, year, 0, died, mortality_tracker);
+    }
+    return infected;
+}
+
+int test_simulation_same_as_raster(const std::string &model_type)
+{
+    auto reference = run_simulation<Raster<int>, Raster<double>>(model_type);
+    auto mapped =
+        run_simulation<MappedRaster<std::uint16_t>, MappedRaster<double>>(
+            model_type);
+    if (MappedRaster<std::uint16_t>(reference) != mapped) {
+        cout << "Mapped raster: simulation (" << model_type
+             << ") gives different results than with Raster\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int ret = 0;
+
+    ret += test_values_across_tiles<int>();
+    ret += test_values_across_tiles<std::uint16_t>();
+    ret += test_values_across_tiles<double>();
+    ret += test_conversion_from_and_to_raster();
+    ret += test_move();
+    ret += test_file_backed();
+    ret += test_simulation_same_as_raster("SI");
+    ret += test_simulation_same_as_raster("SEI");
+
+    return ret;
+}
+
+#endif // POPS_TEST
@@ -27,6 +27,7 @@
 #include <pops/radial_kernel.hpp>
 #include <pops/neighbor_kernel.hpp>
 #include <pops/simulation.hpp>
+#include <pops/statistics.hpp>
 
 #include <map>
 #include <iostream>
@@ -486,6 +487,166 @@ int test_calling_all_functions()
     return 0;
 }
 
+int test_active_cells_same_as_all_cells(const std::string &model_type)
+{
+    int rows = 8;
+    int cols = 8;
+    Raster<int> susceptible(rows, cols, 0);
+    susceptible += 50;
+    Raster<int> infected(rows, cols, 0);
+    infected(2, 3) = 4;
+    infected(5, 6) = 2;
+    susceptible -= infected;
+    Raster<int> total_hosts = susceptible + infected;
+    Raster<double> weather_coefficient(rows, cols, 0);
+    weather_coefficient += 0.8;
+    unsigned latency_period = 2;
+    std::vector<Raster<int>> exposed(latency_period + 1,
+                                     Raster<int>(rows, cols, 0));
+    std::vector<Raster<int>> mortality_tracker(3, Raster<int>(rows, cols, 0));
+    Raster<int> died(rows, cols, 0);
+    Raster<int> dispersers(rows, cols, 0);
+    std::vector<std::tuple<int, int>> outside_dispersers;
+
+    auto susceptible_a = susceptible;
+    auto infected_a = infected;
+    auto exposed_a = exposed;
+    auto mortality_tracker_a = mortality_tracker;
+    auto died_a = died;
+    auto dispersers_a = dispersers;
+    auto outside_dispersers_a = outside_dispersers;
+
+    Simulation<Raster<int>, Raster<double>> simulation(
+        42, rows, cols, model_type_from_string(model_type), latency_period);
+    Simulation<Raster<int>, Raster<double>> simulation_a(
+        42, rows, cols, model_type_from_string(model_type), latency_period);
+    simulation_a.activate_cells(infected_a);
+
+    RadialDispersalKernel<Raster<int>> kernel(30, 30,
+                                              DispersalKernelType::Cauchy, 20);
+    int ret = 0;
+    for (unsigned step = 0; step < 6; ++step) {
+        int year = step / 2;
+        simulation.generate(dispersers, infected, true, weather_coefficient,
+                            3);
+        simulation.disperse_and_infect(
+            step, dispersers, susceptible, exposed, infected,
+            mortality_tracker[year], total_hosts, outside_dispersers, true,
+            weather_coefficient, kernel);
+        simulation.mortality(infected, 0.5, year, 0, died, mortality_tracker);
+        simulation_a.generate(dispersers_a, infected_a, true,
+                              weather_coefficient, 3);
+        simulation_a.disperse_and_infect(
+            step, dispersers_a, susceptible_a, exposed_a, infected_a,
+            mortality_tracker_a[year], total_hosts, outside_dispersers_a, true,
+            weather_coefficient, kernel);
+        simulation_a.mortality(infected_a, 0.5, year, 0, died_a,
+                               mortality_tracker_a);
+        if (infected_a != infected || susceptible_a != susceptible ||
+            died_a != died) {
+            cout << "Active cells (" << model_type << ") step " << step
+                 << ": infected (active, all):\n"
+                 << infected_a << "  !=\n"
+                 << infected << "\n";
+            ret += 1;
+        }
+        if (outside_dispersers_a.size() != outside_dispersers.size()) {
+            cout << "Active cells (" << model_type << ") step " << step
+                 << ": outside dispersers differ\n";
+            ret += 1;
+        }
+    }
+    if (sum_of_infected(infected) <= 6) {
+        cout << "Active cells (" << model_type << "): no spread happened\n";
+        ret += 1;
+    }
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            if (infected(i, j) > 0 &&
+                !simulation_a.active_cells().contains(i, j)) {
+                cout << "Active cells (" << model_type << "): infected cell "
+                     << i << ", " << j << " is not active\n";
+                ret += 1;
+            }
+        }
+    }
+    return ret;
+}
+
+int test_cell_random_streams_with_threads(const std::string &model_type,
+                                          bool active_cells)
+{
+    int rows = 9;
+    int cols = 9;
+    Raster<int> susceptible(rows, cols, 0);
+    susceptible += 40;
+    Raster<int> infected(rows, cols, 0);
+    infected(1, 1) = 5;
+    infected(4, 6) = 3;
+    infected(7, 2) = 1;
+    susceptible -= infected;
+    Raster<int> total_hosts = susceptible + infected;
+    Raster<double> weather_coefficient(rows, cols, 0);
+    weather_coefficient += 0.9;
+    unsigned latency_period = 1;
+    std::vector<Raster<int>> exposed(latency_period + 1,
+                                     Raster<int>(rows, cols, 0));
+    Raster<int> mortality_tracker(rows, cols, 0);
+    Raster<int> dispersers(rows, cols, 0);
+    std::vector<std::tuple<int, int>> outside_dispersers;
+
+    auto susceptible_p = susceptible;
+    auto infected_p = infected;
+    auto exposed_p = exposed;
+    auto mortality_tracker_p = mortality_tracker;
+    auto dispersers_p = dispersers;
+    auto outside_dispersers_p = outside_dispersers;
+
+    Simulation<Raster<int>, Raster<double>> simulation(
+        42, rows, cols, model_type_from_string(model_type), latency_period);
+    Simulation<Raster<int>, Raster<double>> simulation_p(
+        42, rows, cols, model_type_from_string(model_type), latency_period);
+    simulation.set_cell_random_streams(true);
+    simulation_p.set_cell_random_streams(true);
+    simulation_p.set_threads(4);
+    if (active_cells) {
+        simulation.activate_cells(infected);
+        simulation_p.activate_cells(infected_p);
+    }
+
+    RadialDispersalKernel<Raster<int>> kernel(
+        30, 30, DispersalKernelType::Exponential, 25, Direction::NE, 2);
+    int ret = 0;
+    for (unsigned step = 0; step < 5; ++step) {
+        simulation.generate(dispersers, infected, true, weather_coefficient,
+                            2.5);
+        simulation.disperse_and_infect(
+            step, dispersers, susceptible, exposed, infected,
+            mortality_tracker, total_hosts, outside_dispersers, true,
+            weather_coefficient, kernel);
+        simulation_p.generate(dispersers_p, infected_p, true,
+                              weather_coefficient, 2.5);
+        simulation_p.disperse_and_infect(
+            step, dispersers_p, susceptible_p, exposed_p, infected_p,
+            mortality_tracker_p, total_hosts, outside_dispersers_p, true,
+            weather_coefficient, kernel);
+        if (infected_p != infected || susceptible_p != susceptible ||
+            outside_dispersers_p != outside_dispersers) {
+            cout << "Cell random streams (" << model_type << ") step " << step
+                 << ": infected (4 threads, 1 thread):\n"
+                 << infected_p << "  !=\n"
+                 << infected << "\n";
+            ret += 1;
+        }
+    }
+    if (sum_of_infected(infected) <= 9) {
+        cout << "Cell random streams (" << model_type
+             << "): no spread happened\n";
+        ret += 1;
+    }
+    return ret;
+}
+
 int main()
 {
     int ret = 0;
@@ -499,6 +660,11 @@ int main()
     ret += test_with_reduced_stochasticity();
     ret += test_with_sei();
     ret += test_SI_versus_SEI0();
+    ret += test_active_cells_same_as_all_cells("SI");
+    ret += test_active_cells_same_as_all_cells("SEI");
+    ret += test_cell_random_streams_with_threads("SI", false);
+    ret += test_cell_random_streams_with_threads("SEI", false);
+    ret += test_cell_random_streams_with_threads("SI", true);
 
     return ret;
 }
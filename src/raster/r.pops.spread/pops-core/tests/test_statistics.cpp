@@ -26,6 +26,10 @@
 #include <pops/raster.hpp>
 #include <pops/statistics.hpp>
 
+#include <cmath>
+#include <iostream>
+#include <vector>
+
 using namespace pops;
 
 int test_sum()
@@ -66,12 +70,71 @@ int test_area()
     return err;
 }
 
+int test_ensemble_statistics()
+{
+    int err = 0;
+    std::vector<Raster<int>> runs = {
+        {{0, 2, 4}, {1, 0, 0}, {3, 3, 0}},
+        {{0, 4, 0}, {1, 0, 7}, {3, 1, 0}},
+        {{0, 6, 2}, {1, 2, 0}, {3, 8, 0}},
+        {{0, 0, 1}, {1, 0, 0}, {3, 2, 0}}};
+    EnsembleStatistics<Raster<int>, Raster<double>> statistics(3, 3);
+    for (const auto &run : runs)
+        statistics.add(run);
+
+    Raster<double> mean(3, 3, 0);
+    for (const auto &run : runs)
+        mean += run;
+    mean /= runs.size();
+    Raster<double> variance(3, 3, 0);
+    for (const auto &run : runs) {
+        auto tmp = run - mean;
+        variance += tmp * tmp;
+    }
+    variance /= runs.size();
+    Raster<double> probability = {
+        {0, 75, 75}, {100, 25, 25}, {100, 100, 0}};
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (std::abs(statistics.mean()(i, j) - mean(i, j)) > 1e-12) {
+                std::cout << "ensemble mean fails at " << i << ", " << j
+                          << std::endl;
+                err++;
+            }
+            if (std::abs(statistics.variance()(i, j) - variance(i, j)) >
+                1e-12) {
+                std::cout << "ensemble variance fails at " << i << ", " << j
+                          << std::endl;
+                err++;
+            }
+            if (std::abs(statistics.stddev()(i, j) -
+                         std::sqrt(variance(i, j))) > 1e-12) {
+                std::cout << "ensemble stddev fails at " << i << ", " << j
+                          << std::endl;
+                err++;
+            }
+            if (statistics.probability()(i, j) != probability(i, j)) {
+                std::cout << "ensemble probability fails at " << i << ", "
+                          << j << std::endl;
+                err++;
+            }
+        }
+    }
+    if (statistics.count() != runs.size()) {
+        std::cout << "ensemble count fails" << std::endl;
+        err++;
+    }
+    return err;
+}
+
 int main()
 {
     int num_errors = 0;
 
     num_errors += test_sum();
     num_errors += test_area();
+    num_errors += test_ensemble_statistics();
     std::cout << "Statistics number of errors: " << num_errors << std::endl;
     return num_errors;
 }
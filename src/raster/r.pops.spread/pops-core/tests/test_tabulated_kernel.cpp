@@ -0,0 +1,226 @@
+#ifdef POPS_TEST
+
+/*
+ * Tests for the PoPS tabulated dispersal kernel.
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pops/raster.hpp>
+#include <pops/model.hpp>
+#include <pops/radial_kernel.hpp>
+#include <pops/tabulated_kernel.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace pops;
+using std::cout;
+
+int test_alias_table()
+{
+    std::vector<double> weights = {1, 0, 3, 6};
+    AliasTable table(weights);
+    std::default_random_engine generator(42);
+    std::vector<int> counts(weights.size(), 0);
+    int num_samples = 100000;
+    for (int i = 0; i < num_samples; i++)
+        counts[table(generator)]++;
+    int ret = 0;
+    for (unsigned i = 0; i < weights.size(); i++) {
+        double expected = weights[i] / 10;
+        double actual = double(counts[i]) / num_samples;
+        if (std::abs(expected - actual) > 0.01) {
+            cout << "Alias table item " << i << ": frequency " << actual
+                 << " instead of " << expected << "\n";
+            ret++;
+        }
+    }
+    return ret;
+}
+
+int test_probabilities_sum_to_one(DispersalKernelType type)
+{
+    TabulatedDispersalKernel kernel(30, 30, type, 20);
+    double sum = kernel.tail_probability();
+    for (int i = -kernel.row_radius(); i <= kernel.row_radius(); i++)
+        for (int j = -kernel.col_radius(); j <= kernel.col_radius(); j++)
+            sum += kernel.probability(i, j);
+    if (std::abs(sum - 1) > 1e-9) {
+        cout << "Tabulated kernel probabilities sum to " << sum << "\n";
+        return 1;
+    }
+    if (std::abs(kernel.tail_probability() - 0.01) > 1e-6) {
+        cout << "Tabulated kernel tail probability is "
+             << kernel.tail_probability() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int test_symmetry_and_direction()
+{
+    int ret = 0;
+    TabulatedDispersalKernel kernel(10, 10, DispersalKernelType::Exponential,
+                                    30);
+    double north = kernel.probability(-2, 0);
+    double south = kernel.probability(2, 0);
+    double east = kernel.probability(0, 2);
+    double west = kernel.probability(0, -2);
+    if (std::abs(north - south) > 1e-4 || std::abs(east - west) > 1e-4 ||
+        std::abs(north - east) > 1e-4) {
+        cout << "Tabulated kernel without direction is not symmetric: "
+             << north << " " << south << " " << east << " " << west << "\n";
+        ret++;
+    }
+    TabulatedDispersalKernel directed(
+        10, 10, DispersalKernelType::Exponential, 30, Direction::N, 2);
+    if (!(directed.probability(-2, 0) > 2 * directed.probability(2, 0))) {
+        cout << "Tabulated kernel with north direction does not prefer north: "
+             << directed.probability(-2, 0) << " <= "
+             << directed.probability(2, 0) << "\n";
+        ret++;
+    }
+    return ret;
+}
+
+int test_matches_radial_kernel(DispersalKernelType type, Direction direction,
+                               double kappa)
+{
+    double res = 10;
+    double scale = 15;
+    RadialDispersalKernel<Raster<int>> radial(res, res, type, scale,
+                                              direction, kappa);
+    TabulatedDispersalKernel tabulated(res, res, type, scale, direction,
+                                       kappa);
+    std::default_random_engine generator(42);
+    std::map<std::pair<int, int>, int> radial_counts;
+    std::map<std::pair<int, int>, int> tabulated_counts;
+    int num_samples = 200000;
+    int row;
+    int col;
+    for (int i = 0; i < num_samples; i++) {
+        std::tie(row, col) = radial(generator, 0, 0);
+        radial_counts[std::make_pair(row, col)]++;
+        std::tie(row, col) = tabulated(generator, 0, 0);
+        tabulated_counts[std::make_pair(row, col)]++;
+    }
+    int ret = 0;
+    for (int i = -3; i <= 3; i++) {
+        for (int j = -3; j <= 3; j++) {
+            auto key = std::make_pair(i, j);
+            double expected = double(radial_counts[key]) / num_samples;
+            double actual = double(tabulated_counts[key]) / num_samples;
+            double table = tabulated.probability(i, j);
+            if (std::abs(expected - actual) > 0.005 ||
+                std::abs(expected - table) > 0.005) {
+                cout << "Tabulated kernel differs from radial kernel at " << i
+                     << ", " << j << ": " << actual << " (table " << table
+                     << ") instead of " << expected << "\n";
+                ret++;
+            }
+        }
+    }
+    return ret;
+}
+
+int test_far_cells_match_density()
+{
+    // window radius of 319 cells
+    double scale = 5;
+    TabulatedDispersalKernel kernel(1, 1, DispersalKernelType::Cauchy, scale);
+    int ret = 0;
+    for (int distance : {10, 50, 229, 250, 300}) {
+        double density = 2 / (PI * scale * (1 + std::pow(distance / scale, 2)))
+                         / (2 * PI * distance);
+        double sum = kernel.tail_probability();
+        for (int i = -kernel.row_radius(); i <= kernel.row_radius(); i++)
+            for (int j = -kernel.col_radius(); j <= kernel.col_radius(); j++)
+                sum += kernel.probability(i, j);
+        // probabilities are normalized by their sum
+        double expected = density / sum;
+        for (auto offset : {std::make_pair(-distance, 0),
+                            std::make_pair(0, distance),
+                            std::make_pair(distance, 0)}) {
+            double actual = kernel.probability(offset.first, offset.second);
+            if (std::abs(actual - expected) > 0.01 * expected) {
+                cout << "Tabulated kernel probability at " << offset.first
+                     << ", " << offset.second << " is " << actual
+                     << " instead of " << expected << "\n";
+                ret++;
+            }
+        }
+    }
+    return ret;
+}
+
+int test_large_window_uses_radial_kernel()
+{
+    Config config;
+    config.ew_res = 1;
+    config.ns_res = 1;
+    config.tabulated_kernels = true;
+    config.natural_kernel_type = "cauchy";
+    config.natural_scale = 200;
+    config.natural_direction = "none";
+    config.use_anthropogenic_kernel = false;
+    if (!(TabulatedDispersalKernel::window_cells(
+              1, 1, DispersalKernelType::Cauchy, 200) >
+          TabulatedDispersalKernel::max_window_cells)) {
+        cout << "Tabulated kernel window for scale 200 is not too large\n";
+        return 1;
+    }
+    if (create_natural_tabulated_kernel(config)) {
+        cout << "Tabulated kernel created for a too large window\n";
+        return 1;
+    }
+    config.natural_scale = 2;
+    if (!create_natural_tabulated_kernel(config)) {
+        cout << "Tabulated kernel not created for a small window\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int ret = 0;
+
+    ret += test_alias_table();
+    ret += test_probabilities_sum_to_one(DispersalKernelType::Cauchy);
+    ret += test_probabilities_sum_to_one(DispersalKernelType::Exponential);
+    ret += test_symmetry_and_direction();
+    ret += test_matches_radial_kernel(DispersalKernelType::Cauchy,
+                                      Direction::None, 0);
+    ret += test_matches_radial_kernel(DispersalKernelType::Exponential,
+                                      Direction::None, 0);
+    ret += test_matches_radial_kernel(DispersalKernelType::Cauchy,
+                                      Direction::SE, 2);
+    ret += test_matches_radial_kernel(DispersalKernelType::Exponential,
+                                      Direction::W, 1);
+    ret += test_far_cells_match_density();
+    ret += test_large_window_uses_radial_kernel();
+
+    return ret;
+}
+
+#endif // POPS_TEST
@@ -27,6 +27,10 @@
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rowblock.h"
 
 /* TODO: use more stable two pass algorithm */
 
@@ -96,16 +100,21 @@ struct menu {
 struct input {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
 struct output {
     const char *name;
     int fd;
-    DCELL *buf;
     int method;
 };
 
+/* settings shared by all threads */
+struct regression {
+    int num_inputs, num_outputs;
+    struct output *outputs;
+    int nulls;
+};
+
 static char *build_method_list(void)
 {
     char *buf = G_malloc(1024);
@@ -138,11 +147,70 @@ static int find_method(const char *method_name)
     return -1;
 }
 
+/* regression of the cell idx of all input blocks, x series are followed
+ * by y series */
+static void regression_cell(void *data, int t_id, DCELL **in, DCELL **out,
+                            size_t idx)
+{
+    const struct regression *r = data;
+    struct reg_stats rs;
+    int i, null = 0;
+
+    (void)t_id;
+
+    rs.sumX = rs.sumY = rs.sumsqX = rs.sumsqY = rs.sumXY = 0.0;
+    rs.meanX = rs.meanY = 0.0;
+    rs.count = 0;
+
+    for (i = 0; i < r->num_inputs; i++) {
+        DCELL x = in[i][idx];
+        DCELL y = in[r->num_inputs + i][idx];
+
+        if (Rast_is_d_null_value(&x) || Rast_is_d_null_value(&y))
+            null = 1;
+        else {
+            rs.sumX += x;
+            rs.sumY += y;
+            rs.sumsqX += x * x;
+            rs.sumsqY += y * y;
+            rs.sumXY += x * y;
+            rs.count++;
+        }
+    }
+    if (rs.count > 1) {
+        DCELL tmp1 = rs.count * rs.sumXY - rs.sumX * rs.sumY;
+        DCELL tmp2 = rs.count * rs.sumsqX - rs.sumX * rs.sumX;
+
+        /* slope */
+        rs.B = tmp1 / tmp2;
+        /* correlation coefficient */
+        rs.R =
+            tmp1 / sqrt((tmp2) * (rs.count * rs.sumsqY - rs.sumY * rs.sumY));
+        /* coefficient of determination aka R squared */
+        rs.R2 = rs.R * rs.R;
+
+        rs.meanX = rs.sumX / rs.count;
+
+        rs.meanY = rs.sumY / rs.count;
+    }
+    else {
+        rs.R = rs.R2 = rs.B = 0;
+    }
+
+    for (i = 0; i < r->num_outputs; i++) {
+        if (rs.count < 2 || (null && r->nulls))
+            Rast_set_d_null_value(&out[i][idx], 1);
+        else {
+            reg(&out[i][idx], rs, r->outputs[i].method);
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     struct GModule *module;
     struct {
-        struct Option *xinput, *yinput, *output, *method;
+        struct Option *xinput, *yinput, *output, *method, *nprocs;
     } parm;
     struct {
         struct Flag *nulls;
@@ -152,10 +220,10 @@ int main(int argc, char *argv[])
     struct input *xinputs, *yinputs;
     int num_outputs;
     struct output *outputs;
-    struct reg_stats rs;
     struct History history;
-    int nrows, ncols;
-    int row, col;
+    int nprocs;
+    struct regression r;
+    struct rowblock rb;
 
     G_gisinit(argv[0]);
 
@@ -190,9 +258,27 @@ int main(int argc, char *argv[])
     flag.nulls->key = 'n';
     flag.nulls->description = _("Propagate NULLs");
 
+    parm.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
+#ifdef _OPENMP
+    nprocs = atoi(parm.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), parm.nprocs->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     /* process the input maps */
     for (i = 0; parm.xinput->answers[i]; i++)
         ;
@@ -222,12 +308,10 @@ int main(int argc, char *argv[])
         px->name = parm.xinput->answers[i];
         G_message(_("Reading raster map <%s>..."), px->name);
         px->fd = Rast_open_old(px->name, "");
-        px->buf = Rast_allocate_d_buf();
 
         py->name = parm.yinput->answers[i];
         G_message(_("Reading raster map <%s>..."), py->name);
         py->fd = Rast_open_old(py->name, "");
-        py->buf = Rast_allocate_d_buf();
     }
 
     /* process the output maps */
@@ -251,84 +335,31 @@ int main(int argc, char *argv[])
 
         out->name = output_name;
         out->method = menu[method].method;
-        out->buf = Rast_allocate_d_buf();
         out->fd = Rast_open_new(output_name, DCELL_TYPE);
     }
 
     /* initialise variables */
-
-    nrows = Rast_window_rows();
-    ncols = Rast_window_cols();
+    r.num_inputs = num_inputs;
+    r.num_outputs = num_outputs;
+    r.outputs = outputs;
+    r.nulls = flag.nulls->answer;
+
+    /* inputs are read and outputs written while the cells of nprocs
+     * rows are processed */
+    rowblock_init(&rb, 2 * num_inputs, num_outputs, nprocs);
+    for (i = 0; i < num_inputs; i++) {
+        rowblock_set_input(&rb, i, xinputs[i].name, "", xinputs[i].fd);
+        rowblock_set_input(&rb, num_inputs + i, yinputs[i].name, "",
+                           yinputs[i].fd);
+    }
+    for (i = 0; i < num_outputs; i++)
+        rowblock_set_output(&rb, i, outputs[i].fd);
 
     /* process the data */
     G_verbose_message(_("Percent complete..."));
 
-    for (row = 0; row < nrows; row++) {
-        G_percent(row, nrows, 2);
-
-        for (i = 0; i < num_inputs; i++) {
-            Rast_get_d_row(xinputs[i].fd, xinputs[i].buf, row);
-            Rast_get_d_row(yinputs[i].fd, yinputs[i].buf, row);
-        }
-
-        for (col = 0; col < ncols; col++) {
-            int null = 0;
-
-            rs.sumX = rs.sumY = rs.sumsqX = rs.sumsqY = rs.sumXY = 0.0;
-            rs.meanX = rs.meanY = 0.0;
-            rs.count = 0;
-
-            for (i = 0; i < num_inputs; i++) {
-                DCELL x = xinputs[i].buf[col];
-                DCELL y = yinputs[i].buf[col];
-
-                if (Rast_is_d_null_value(&x) || Rast_is_d_null_value(&y))
-                    null = 1;
-                else {
-                    rs.sumX += x;
-                    rs.sumY += y;
-                    rs.sumsqX += x * x;
-                    rs.sumsqY += y * y;
-                    rs.sumXY += x * y;
-                    rs.count++;
-                }
-            }
-            if (rs.count > 1) {
-                DCELL tmp1 = rs.count * rs.sumXY - rs.sumX * rs.sumY;
-                DCELL tmp2 = rs.count * rs.sumsqX - rs.sumX * rs.sumX;
-
-                /* slope */
-                rs.B = tmp1 / tmp2;
-                /* correlation coefficient */
-                rs.R = tmp1 / sqrt((tmp2) *
-                                   (rs.count * rs.sumsqY - rs.sumY * rs.sumY));
-                /* coefficient of determination aka R squared */
-                rs.R2 = rs.R * rs.R;
-
-                rs.meanX = rs.sumX / rs.count;
-
-                rs.meanY = rs.sumY / rs.count;
-            }
-            else {
-                rs.R = rs.R2 = rs.B = 0;
-            }
-
-            for (i = 0; i < num_outputs; i++) {
-                struct output *out = &outputs[i];
-
-                if (rs.count < 2 || (null && flag.nulls->answer))
-                    Rast_set_d_null_value(&out->buf[col], 1);
-                else {
-                    reg(&out->buf[col], rs, out->method);
-                }
-            }
-        }
-
-        for (i = 0; i < num_outputs; i++)
-            Rast_put_d_row(outputs[i].fd, outputs[i].buf);
-    }
-
-    G_percent(row, nrows, 2);
+    rowblock_run(&rb, regression_cell, &r);
+    rowblock_free(&rb);
 
     /* close maps */
     for (i = 0; i < num_outputs; i++) {
@@ -19,9 +19,11 @@
 #include <string.h>
 #include <math.h>
 #include <grass/raster.h>
-#include <grass/segment.h>
 #include <grass/glocale.h>
-#include "cache.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "tilecache.h"
 #include "tps.h"
 
 int main(int argc, char *argv[])
@@ -36,7 +38,7 @@ int main(int argc, char *argv[])
     struct GModule *module;
     struct Option *in_opt, *ivar_opt, *ovar_opt, *out_opt, *minpnts_opt,
         *maxpnts_opt, *radius_opt, *reg_opt, *ov_opt, *lm_opt, *ep_opt,
-        *mask_opt, *mem_opt;
+        *mask_opt, *mem_opt, *nprocs_opt;
     struct Flag *c_flag;
     struct Cell_head cellhd, src, dst;
 
@@ -51,6 +53,7 @@ int main(int argc, char *argv[])
     int insize, varsize;
     double segsize;
     int segs_mb, nsegs, nsegs_total;
+    int nprocs;
 
     /*----------------------------------------------------------------*/
     /* Options declarations */
@@ -163,6 +166,8 @@ int main(int argc, char *argv[])
     mem_opt->answer = "300";
     mem_opt->description = _("Memory in MB");
 
+    nprocs_opt = G_define_standard_option(G_OPT_M_NPROCS);
+
     c_flag = G_define_flag();
     c_flag->key = 'c';
     c_flag->description =
@@ -179,6 +184,22 @@ int main(int argc, char *argv[])
 
     outname = out_opt->answer;
 
+#ifdef _OPENMP
+    nprocs = atoi(nprocs_opt->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), nprocs_opt->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     n_ivars = 0;
     if (ivar_opt->answer) {
         while (ivar_opt->answers[n_ivars])
@@ -435,7 +456,7 @@ int main(int argc, char *argv[])
     if (radius) {
         if (tps_window(&in_seg, &var_seg, n_vars, &out_seg, out_fd,
                        mask_opt->answer, &src, &dst, n_points, regularization,
-                       overlap, radius, lm_thresh) != 1) {
+                       overlap, radius, lm_thresh, nprocs) != 1) {
             G_fatal_error(_("TPS interpolation failed"));
         }
     }
@@ -443,7 +464,7 @@ int main(int argc, char *argv[])
         if (tps_nn(&in_seg, &var_seg, n_vars, &out_seg, out_fd,
                    mask_opt->answer, &src, &dst, n_points, min_points,
                    max_points, regularization, overlap, c_flag->answer,
-                   lm_thresh, ep_thresh) != 1) {
+                   lm_thresh, ep_thresh, nprocs) != 1) {
             G_fatal_error(_("TPS interpolation failed"));
         }
     }
@@ -4,13 +4,15 @@
 #include <math.h>
 #include <grass/gis.h>
 #include <grass/raster.h>
-#include <grass/segment.h>
 #include <grass/glocale.h>
-#include "cache.h"
+#include "tilecache.h"
 #include "tps.h"
 #include "flag.h"
 #include "rclist.h"
 #include "pavlrc.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 static int solvemat(double **m, double a[], double B[], int n)
 {
@@ -556,26 +558,550 @@ static double lm_rsqr(struct cache *in_seg, int n_vars, struct Cell_head *src,
     return R2;
 }
 
+/* local solutions
+ *
+ * output cells are visited, points are selected and local TPS are
+ * solved in the original order, because the cells to skip depend on
+ * the interpolation windows of previous cells. The interpolation
+ * windows, which take most of the time, are evaluated for a batch of
+ * local solutions in parallel, and the results are added to the output
+ * in the original order. The output does not depend on the number of
+ * threads. */
+
+/* last local solution, reused if the next output cell selects the same
+ * points */
+struct tps_last {
+    int pfound;     /* < 0: no solution */
+    int palloc;
+    double *sr, *sc; /* source row, col of the points */
+    double *pr, *pc; /* north, east of the points */
+    int n_vars_i;   /* covariables used by B */
+    int solved_tps_lm, solved_tps;
+    double *B;
+    double *Bpnts;  /* TPS without covariables */
+    int use_Bpnts;  /* Bpnts is solved and used to avoid extrapolation */
+    double *vmin, *vmax;
+};
+
+/* evaluation of one local solution */
+struct tps_task {
+    int irow1, irow2, icol1, icol2;
+    int pfound;
+    int n_vars_i;
+    double *pr, *pc;
+    double *B;
+    double *Bpnts;
+    double *vmin, *vmax;
+    double *res, *w; /* result and weight per window cell, w < 0: no value */
+};
+
+struct tps_batch {
+    int n_vars;
+    int nprocs;
+    int ntasks, maxtasks;
+    size_t ncells, maxcells;
+    struct tps_task *task;
+    int *item_task, *item_row;
+    DCELL **varbuf; /* thread-private */
+    struct cache *var_seg, *out_seg;
+    FLAG *mask_flag;
+    struct Cell_head *dst;
+    double wmin, wmax;
+    unsigned int cnt_efac;
+};
+
+static void last_init(struct tps_last *l, int n_vars)
+{
+    l->pfound = -1;
+    l->palloc = 0;
+    l->use_Bpnts = 0;
+    l->sr = l->sc = l->pr = l->pc = NULL;
+    l->B = l->Bpnts = NULL;
+    l->vmin = l->vmax = NULL;
+    if (n_vars) {
+        l->vmin = G_malloc(n_vars * sizeof(double));
+        l->vmax = G_malloc(n_vars * sizeof(double));
+    }
+}
+
+static void last_free(struct tps_last *l)
+{
+    if (l->palloc) {
+        G_free(l->sr);
+        G_free(l->sc);
+        G_free(l->pr);
+        G_free(l->pc);
+        G_free(l->B);
+        G_free(l->Bpnts);
+    }
+    if (l->vmin) {
+        G_free(l->vmin);
+        G_free(l->vmax);
+    }
+}
+
+/* remember the source row, col of the points before load_tps_pnts() */
+static void last_set_pnts(struct tps_last *l, struct tps_pnt *pnts, int n,
+                          int n_vars)
+{
+    int i;
+
+    if (l->palloc < n) {
+        last_free(l);
+        last_init(l, n_vars);
+        l->palloc = n;
+        l->sr = G_malloc(n * sizeof(double));
+        l->sc = G_malloc(n * sizeof(double));
+        l->pr = G_malloc(n * sizeof(double));
+        l->pc = G_malloc(n * sizeof(double));
+        l->B = G_malloc((n + 1 + n_vars) * sizeof(double));
+        l->Bpnts = G_malloc((n + 1) * sizeof(double));
+    }
+    l->pfound = -1;
+    for (i = 0; i < n; i++) {
+        l->sr[i] = pnts[i].r;
+        l->sc[i] = pnts[i].c;
+    }
+}
+
+static int last_is_same(struct tps_last *l, struct tps_pnt *pnts, int n)
+{
+    int i;
+
+    if (l->pfound != n)
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (l->sr[i] != pnts[i].r || l->sc[i] != pnts[i].c)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* keep the solution, pnts are in north, east */
+static void last_set_solution(struct tps_last *l, struct tps_pnt *pnts,
+                              int n, int n_vars, int n_vars_i,
+                              int solved_tps_lm, int solved_tps, double *B,
+                              double *Bpnts, double *vmin, double *vmax)
+{
+    int i;
+
+    l->pfound = n;
+    for (i = 0; i < n; i++) {
+        l->pr[i] = pnts[i].r;
+        l->pc[i] = pnts[i].c;
+    }
+    l->n_vars_i = n_vars_i;
+    l->solved_tps_lm = solved_tps_lm;
+    l->solved_tps = solved_tps;
+    memcpy(l->B, B, (n + 1 + n_vars_i) * sizeof(double));
+    l->use_Bpnts = 0;
+    if (Bpnts) {
+        memcpy(l->Bpnts, Bpnts, (n + 1) * sizeof(double));
+        l->use_Bpnts = 1;
+    }
+    if (vmin) {
+        memcpy(l->vmin, vmin, n_vars * sizeof(double));
+        memcpy(l->vmax, vmax, n_vars * sizeof(double));
+    }
+}
+
+/* reuse the last solution, pnts are converted to north, east */
+static void last_get_pnts(struct tps_last *l, struct tps_pnt *pnts)
+{
+    int i;
+
+    for (i = 0; i < l->pfound; i++) {
+        pnts[i].r = l->pr[i];
+        pnts[i].c = l->pc[i];
+    }
+}
+
+static void batch_init(struct tps_batch *bt, int n_vars, int nprocs,
+                       struct cache *var_seg, struct cache *out_seg,
+                       FLAG *mask_flag, struct Cell_head *dst)
+{
+    int i;
+
+    bt->n_vars = n_vars;
+    bt->nprocs = nprocs;
+    bt->ntasks = 0;
+    bt->maxtasks = 64 * nprocs;
+    bt->ncells = 0;
+    bt->maxcells = 1 << 20;
+    bt->task = G_malloc(bt->maxtasks * sizeof(struct tps_task));
+    bt->item_task = NULL;
+    bt->item_row = NULL;
+    bt->varbuf = G_malloc(nprocs * sizeof(DCELL *));
+    for (i = 0; i < nprocs; i++)
+        bt->varbuf[i] = n_vars ? G_malloc(n_vars * sizeof(DCELL)) : NULL;
+    bt->var_seg = var_seg;
+    bt->out_seg = out_seg;
+    bt->mask_flag = mask_flag;
+    bt->dst = dst;
+    bt->wmin = 10;
+    bt->wmax = 0;
+    bt->cnt_efac = 0;
+}
+
+static void batch_free(struct tps_batch *bt)
+{
+    int i;
+
+    for (i = 0; i < bt->nprocs; i++) {
+        if (bt->varbuf[i])
+            G_free(bt->varbuf[i]);
+    }
+    G_free(bt->varbuf);
+    G_free(bt->task);
+    if (bt->item_task) {
+        G_free(bt->item_task);
+        G_free(bt->item_row);
+    }
+}
+
+static void task_free(struct tps_task *t)
+{
+    G_free(t->pr);
+    G_free(t->pc);
+    G_free(t->B);
+    if (t->Bpnts)
+        G_free(t->Bpnts);
+    if (t->vmin) {
+        G_free(t->vmin);
+        G_free(t->vmax);
+    }
+    if (t->res) {
+        G_free(t->res);
+        G_free(t->w);
+    }
+}
+
+/* weight of an output cell in the interpolation window */
+static double window_weight(struct tps_task *t, int irow, int icol)
+{
+    double dx, dy, dist2;
+
+    dx = fabs(2.0 * icol - (t->icol2 + t->icol1)) / (t->icol2 - t->icol1 + 1);
+    dy = fabs(2.0 * irow - (t->irow2 + t->irow1)) / (t->irow2 - t->irow1 + 1);
+
+    dist2 = (dx * dx + dy * dy);
+
+    return exp(-dist2 * 4.0);
+}
+
+/* the weights of the interpolation window decide which output cells
+ * are skipped: set them now, optionally keep them in w */
+static void set_wmax(struct tps_batch *bt, struct tps_task *t, double *w)
+{
+    int irow, icol;
+    double weight;
+    struct tps_out tps_out;
+
+    for (irow = t->irow1; irow <= t->irow2; irow++) {
+        for (icol = t->icol1; icol <= t->icol2; icol++) {
+            if ((FLAG_GET(bt->mask_flag, irow, icol))) {
+                if (w)
+                    *w++ = -1;
+                continue;
+            }
+
+            weight = window_weight(t, irow, icol);
+            if (w)
+                *w++ = weight;
+
+            cache_get(bt->out_seg, (void *)&tps_out, irow, icol);
+            if (tps_out.wmax < weight) {
+                tps_out.wmax = weight;
+                cache_put(bt->out_seg, (void *)&tps_out, irow, icol);
+            }
+        }
+    }
+}
+
+/* interpolate one row of the window of a local solution, w holds the
+ * weights from set_wmax() if have_w is set
+ * returns the number of cells where extrapolation was avoided */
+static int eval_row(struct tps_batch *bt, struct tps_task *t, int irow,
+                    DCELL *varbuf, double *res, double *w, int have_w)
+{
+    int i, j, icol, n_vars_ic, cnt_efac;
+    double *Bc;
+    double dx, dy, dist, dist2, result;
+    double i_n, i_e;
+
+    i_n = bt->dst->north - (irow + 0.5) * bt->dst->ns_res;
+
+    cnt_efac = 0;
+    for (icol = t->icol1; icol <= t->icol2; icol++, res++, w++) {
+        if (have_w) {
+            if (*w < 0)
+                continue;
+        }
+        else if ((FLAG_GET(bt->mask_flag, irow, icol))) {
+            *w = -1;
+            continue;
+        }
+
+        n_vars_ic = t->n_vars_i;
+        Bc = t->B;
+
+        if (t->n_vars_i) {
+
+            cache_get(bt->var_seg, (void *)varbuf, irow, icol);
+            if (Rast_is_d_null_value(varbuf)) {
+                *w = -1;
+                continue;
+            }
+
+            if (t->Bpnts) {
+                for (i = 0; i < t->n_vars_i; i++) {
+                    if (varbuf[i] < t->vmin[i] || varbuf[i] > t->vmax[i]) {
+                        n_vars_ic = 0;
+                        Bc = t->Bpnts;
+                        cnt_efac++;
+                        break;
+                    }
+                }
+            }
+        }
+
+        i_e = bt->dst->west + (icol + 0.5) * bt->dst->ew_res;
+
+        result = Bc[0];
+        if (n_vars_ic) {
+            for (j = 0; j < n_vars_ic; j++) {
+                result += varbuf[j] * Bc[j + 1];
+            }
+        }
+
+        for (i = 0; i < t->pfound; i++) {
+            dx = t->pc[i] - i_e;
+            dy = t->pr[i] - i_n;
+
+            dist2 = dx * dx + dy * dy;
+            dist = 0;
+            if (dist2 > 0) {
+                dist = dist2 * log(dist2) * 0.5;
+                result += Bc[1 + n_vars_ic + i] * dist;
+            }
+        }
+
+        *res = result;
+        if (!have_w)
+            *w = window_weight(t, irow, icol);
+    }
+
+    return cnt_efac;
+}
+
+/* add one row of results to the output */
+static void add_row(struct tps_batch *bt, struct tps_task *t, int irow,
+                    double *res, double *w)
+{
+    int icol;
+    struct tps_out tps_out;
+
+    for (icol = t->icol1; icol <= t->icol2; icol++, res++, w++) {
+        if (*w < 0)
+            continue;
+
+        /* wmax is already set by set_wmax() */
+        cache_get(bt->out_seg, (void *)&tps_out, irow, icol);
+
+        tps_out.val += *res * *w;
+        tps_out.wsum += *w;
+        cache_put(bt->out_seg, (void *)&tps_out, irow, icol);
+    }
+}
+
+static void row_stats(double *w, int n, double *wmin, double *wmax)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (w[i] < 0)
+            continue;
+        if (*wmin > w[i])
+            *wmin = w[i];
+        if (*wmax < w[i])
+            *wmax = w[i];
+    }
+}
+
+/* evaluate the windows of all local solutions in parallel,
+ * add them to the output in the original order */
+static void batch_run(struct tps_batch *bt)
+{
+    int k, n, nitems, irow;
+    unsigned int cnt_efac;
+
+    if (bt->ntasks == 0)
+        return;
+
+    nitems = 0;
+    for (k = 0; k < bt->ntasks; k++)
+        nitems += bt->task[k].irow2 - bt->task[k].irow1 + 1;
+
+    bt->item_task = G_realloc(bt->item_task, nitems * sizeof(int));
+    bt->item_row = G_realloc(bt->item_row, nitems * sizeof(int));
+    nitems = 0;
+    for (k = 0; k < bt->ntasks; k++) {
+        for (irow = bt->task[k].irow1; irow <= bt->task[k].irow2; irow++) {
+            bt->item_task[nitems] = k;
+            bt->item_row[nitems] = irow;
+            nitems++;
+        }
+    }
+
+    cnt_efac = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+ : cnt_efac)
+    for (n = 0; n < nitems; n++) {
+        struct tps_task *t = &bt->task[bt->item_task[n]];
+        int t_id = 0;
+        size_t offset;
+
+#ifdef _OPENMP
+        t_id = omp_get_thread_num();
+#endif
+        offset = (size_t)(bt->item_row[n] - t->irow1) *
+                 (t->icol2 - t->icol1 + 1);
+        cnt_efac += eval_row(bt, t, bt->item_row[n], bt->varbuf[t_id],
+                             t->res + offset, t->w + offset, 1);
+    }
+    bt->cnt_efac += cnt_efac;
+
+    for (k = 0; k < bt->ntasks; k++) {
+        struct tps_task *t = &bt->task[k];
+        int wcols = t->icol2 - t->icol1 + 1;
+
+        for (irow = t->irow1; irow <= t->irow2; irow++) {
+            size_t offset = (size_t)(irow - t->irow1) * wcols;
+
+            row_stats(t->w + offset, wcols, &bt->wmin, &bt->wmax);
+            add_row(bt, t, irow, t->res + offset, t->w + offset);
+        }
+        task_free(t);
+    }
+    bt->ntasks = 0;
+    bt->ncells = 0;
+}
+
+/* a window too large for a batch, e.g. with only one equation for all
+ * points, is evaluated and added row by row in parallel */
+static void run_large_task(struct tps_batch *bt, struct tps_task *t)
+{
+    int irow, wcols;
+    unsigned int cnt_efac;
+    double wmin, wmax;
+
+    wcols = t->icol2 - t->icol1 + 1;
+    cnt_efac = 0;
+    wmin = bt->wmin;
+    wmax = bt->wmax;
+
+#pragma omp parallel private(irow) reduction(+ : cnt_efac) \
+    reduction(min : wmin) reduction(max : wmax)
+    {
+        int t_id = 0;
+        double *res, *w;
+
+#ifdef _OPENMP
+        t_id = omp_get_thread_num();
+#endif
+        res = G_malloc(wcols * sizeof(double));
+        w = G_malloc(wcols * sizeof(double));
+
+#pragma omp for schedule(dynamic)
+        for (irow = t->irow1; irow <= t->irow2; irow++) {
+            cnt_efac += eval_row(bt, t, irow, bt->varbuf[t_id], res, w, 0);
+            row_stats(w, wcols, &wmin, &wmax);
+            add_row(bt, t, irow, res, w);
+        }
+
+        G_free(res);
+        G_free(w);
+    }
+    bt->cnt_efac += cnt_efac;
+    bt->wmin = wmin;
+    bt->wmax = wmax;
+}
+
+/* set the weights of the window and queue the last local solution */
+static void batch_add(struct tps_batch *bt, struct tps_last *l, int irow1,
+                      int irow2, int icol1, int icol2)
+{
+    struct tps_task *t, tl;
+    size_t ncells;
+    int n = l->pfound;
+
+    ncells = (size_t)(irow2 - irow1 + 1) * (icol2 - icol1 + 1);
+
+    t = ncells > bt->maxcells ? &tl : &bt->task[bt->ntasks];
+
+    t->irow1 = irow1;
+    t->irow2 = irow2;
+    t->icol1 = icol1;
+    t->icol2 = icol2;
+    t->pfound = n;
+    t->n_vars_i = l->n_vars_i;
+    t->pr = G_malloc(n * sizeof(double));
+    t->pc = G_malloc(n * sizeof(double));
+    memcpy(t->pr, l->pr, n * sizeof(double));
+    memcpy(t->pc, l->pc, n * sizeof(double));
+    t->B = G_malloc((n + 1 + l->n_vars_i) * sizeof(double));
+    memcpy(t->B, l->B, (n + 1 + l->n_vars_i) * sizeof(double));
+    t->Bpnts = NULL;
+    t->vmin = t->vmax = NULL;
+    if (l->n_vars_i && l->use_Bpnts) {
+        t->Bpnts = G_malloc((n + 1) * sizeof(double));
+        memcpy(t->Bpnts, l->Bpnts, (n + 1) * sizeof(double));
+        t->vmin = G_malloc(bt->n_vars * sizeof(double));
+        t->vmax = G_malloc(bt->n_vars * sizeof(double));
+        memcpy(t->vmin, l->vmin, bt->n_vars * sizeof(double));
+        memcpy(t->vmax, l->vmax, bt->n_vars * sizeof(double));
+    }
+    t->res = t->w = NULL;
+
+    if (t == &tl) {
+        batch_run(bt);
+        set_wmax(bt, t, NULL);
+        run_large_task(bt, t);
+        task_free(t);
+
+        return;
+    }
+
+    t->res = G_malloc(ncells * sizeof(double));
+    t->w = G_malloc(ncells * sizeof(double));
+    set_wmax(bt, t, t->w);
+    bt->ntasks++;
+    bt->ncells += ncells;
+
+    if (bt->ntasks == bt->maxtasks || bt->ncells > bt->maxcells)
+        batch_run(bt);
+}
+
 int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
            struct cache *out_seg, int out_fd, char *mask_name,
            struct Cell_head *src, struct Cell_head *dst, off_t n_points,
            int min_points, int max_points, double regularization,
-           double overlap, int clustered, double lm_thresh, double efac)
+           double overlap, int clustered, double lm_thresh, double efac,
+           int nprocs)
 {
     int ridx, cidx, row, col, nrows, ncols, src_row, src_col;
     double **m, *a, *B;
     double **mfull, *afull, *Bfull;
     double **mpnts, *apnts, *Bpnts;
     double **mvars, *avars, *Bvars;
-    double *Bc;
-    int i, j;
+    int i;
     int kdalloc, palloc, n_cur_points;
     struct tps_pnt *cur_pnts;
-    double dx, dy, dist, dist2, mfactor;
+    double mfactor;
     DCELL *dval, result, *outbuf, *varbuf;
     CELL *maskbuf;
     int solved, solved_tps_lm, solved_tps, solved_lm;
-    int n_vars_i, n_vars_ic;
+    int n_vars_i;
     double rsqr;
     int kdfound, bfsfound, pfound;
     double distmax, mindist;
@@ -584,13 +1110,13 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     FLAG *mask_flag, *pnt_flag;
     struct tps_out tps_out;
     double *pvar;
-    double weight, dxi, dyi;
-    double wmin, wmax;
+    double weight;
     int rmin, rmax, cmin, cmax, rminp, rmaxp, cminp, cmaxp;
-    int irow, irow1, irow2, icol, icol1, icol2;
-    unsigned int cnt_wa, cnt_tps_lm, cnt_tps, cnt_efac;
-    double i_n, i_e;
+    int irow1, irow2, icol1, icol2;
+    unsigned int cnt_wa, cnt_tps_lm, cnt_tps, cnt_reuse;
     double *vmin, *vmax;
+    struct tps_last last;
+    struct tps_batch batch;
 
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
@@ -617,8 +1143,6 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     apnts = NULL;
     Bpnts = NULL;
 
-    Bc = NULL;
-
     vmin = NULL;
     vmax = NULL;
     if (n_vars) {
@@ -715,12 +1239,13 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     G_message(_("Nearest neighbor TPS interpolation with %ld points..."),
               n_points);
 
-    wmin = 10;
-    wmax = 0;
     cnt_wa = 0;
     cnt_tps_lm = 0;
     cnt_tps = 0;
-    cnt_efac = 0;
+    cnt_reuse = 0;
+
+    last_init(&last, n_vars);
+    batch_init(&batch, n_vars, nprocs, var_seg, out_seg, mask_flag, dst);
 
     if (overlap > 1.0)
         overlap = 1.0;
@@ -924,76 +1449,102 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 
                 qsort(cur_pnts, pfound, sizeof(struct tps_pnt), cmp_pnts);
 
-                load_tps_pnts(in_seg, dval, n_vars, cur_pnts, pfound, src, dst,
-                              regularization, m, a, mvars, avars, mpnts, apnts,
-                              vmin, vmax);
-
-                /* solve */
-                /* it can happen that a simple linear model with the
-                 * given covariables can be solved but TPS with
-                 * covariables can not be solved
-                 */
-                solved_tps_lm = solved_tps = 0;
-                n_vars_i = n_vars;
-                m = mfull;
-                a = afull;
-                B = Bfull;
-                if (n_vars) {
-
-                    solved_tps_lm = solvemat(m, a, B, pfound + 1 + n_vars);
+                if (last_is_same(&last, cur_pnts, pfound)) {
+                    /* same points as for the last solution */
+                    last_get_pnts(&last, cur_pnts);
+                    n_vars_i = last.n_vars_i;
+                    solved_tps_lm = last.solved_tps_lm;
+                    solved_tps = last.solved_tps;
+                    cnt_reuse++;
+                }
+                else {
+                    last_set_pnts(&last, cur_pnts, pfound, n_vars);
+
+                    load_tps_pnts(in_seg, dval, n_vars, cur_pnts, pfound, src,
+                                  dst, regularization, m, a, mvars, avars,
+                                  mpnts, apnts, vmin, vmax);
+
+                    /* solve */
+                    /* it can happen that a simple linear model with the
+                     * given covariables can be solved but TPS with
+                     * covariables can not be solved
+                     */
+                    solved_tps_lm = solved_tps = 0;
+                    n_vars_i = n_vars;
+                    m = mfull;
+                    a = afull;
+                    B = Bfull;
+                    if (n_vars) {
 
-                    if (solved_tps_lm && lm_thresh > 0) {
+                        solved_tps_lm = solvemat(m, a, B, pfound + 1 + n_vars);
 
-                        solved_lm = solvemat(mvars, avars, Bvars, 1 + n_vars);
-                        if (!solved_lm) {
-                            G_debug(1,
-                                    "LM with covariables not working at row "
-                                    "%d, col %d",
-                                    row, col);
+                        if (solved_tps_lm && lm_thresh > 0) {
 
-                            solved_tps_lm = 0;
-                        }
-                        else {
-                            rsqr = lm_rsqr(in_seg, n_vars, src, cur_pnts,
-                                           pfound, B);
+                            solved_lm =
+                                solvemat(mvars, avars, Bvars, 1 + n_vars);
+                            if (!solved_lm) {
+                                G_debug(1,
+                                        "LM with covariables not working at "
+                                        "row %d, col %d",
+                                        row, col);
 
-                            if (rsqr < lm_thresh) {
                                 solved_tps_lm = 0;
                             }
                             else {
-                                for (i = 1; i <= n_vars; i++) {
-                                    if (fabs(B[i]) > fabs(5 * Bvars[i])) {
-                                        G_debug(
-                                            1, "LM B%d is %g but TPS B%d is %g",
-                                            i, Bvars[i], i, B[i]);
-                                        solved_tps_lm = 0;
+                                rsqr = lm_rsqr(in_seg, n_vars, src, cur_pnts,
+                                               pfound, B);
+
+                                if (rsqr < lm_thresh) {
+                                    solved_tps_lm = 0;
+                                }
+                                else {
+                                    for (i = 1; i <= n_vars; i++) {
+                                        if (fabs(B[i]) > fabs(5 * Bvars[i])) {
+                                            G_debug(1,
+                                                    "LM B%d is %g but TPS B%d "
+                                                    "is %g",
+                                                    i, Bvars[i], i, B[i]);
+                                            solved_tps_lm = 0;
+                                        }
                                     }
                                 }
                             }
                         }
-                    }
 
-                    if (efac) {
-                        for (i = 0; i < n_vars; i++) {
-                            double diff;
+                        if (efac) {
+                            for (i = 0; i < n_vars; i++) {
+                                double diff;
 
-                            diff = efac * (vmax[i] - vmin[i]);
-                            vmin[i] -= diff;
-                            vmax[i] += diff;
+                                diff = efac * (vmax[i] - vmin[i]);
+                                vmin[i] -= diff;
+                                vmax[i] += diff;
+                            }
                         }
-                    }
 
-                    if (!solved_tps_lm) {
-                        n_vars_i = 0;
-                        m = mpnts;
-                        a = apnts;
-                        B = Bpnts;
+                        if (!solved_tps_lm) {
+                            n_vars_i = 0;
+                            m = mpnts;
+                            a = apnts;
+                            B = Bpnts;
 
+                            solved_tps = solvemat(m, a, B, pfound + 1);
+                        }
+                    }
+                    else {
                         solved_tps = solvemat(m, a, B, pfound + 1);
                     }
-                }
-                else {
-                    solved_tps = solvemat(m, a, B, pfound + 1);
+
+                    /* solve TPS without covariables now to avoid
+                     * extrapolation in the interpolation window */
+                    if (efac && solved_tps_lm)
+                        solved_tps = solvemat(mpnts, apnts, Bpnts, pfound + 1);
+
+                    last_set_solution(&last, cur_pnts, pfound, n_vars,
+                                      n_vars_i, solved_tps_lm, solved_tps, B,
+                                      (efac && solved_tps_lm && solved_tps)
+                                          ? Bpnts
+                                          : NULL,
+                                      vmin, vmax);
                 }
 
                 solved = (solved_tps_lm | solved_tps);
@@ -1021,7 +1572,10 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
                     result = interp_wa(in_seg, dval, cur_pnts, pfound, row, col,
                                        src, dst, distmax, &weight);
 
-                    cache_get(out_seg, (void *)&tps_out, irow, icol);
+                    /* keep the order of additions */
+                    batch_run(&batch);
+
+                    cache_get(out_seg, (void *)&tps_out, row, col);
 
                     /* weight according to distance to nearest point */
                     if (tps_out.wmax < weight)
@@ -1115,98 +1669,16 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
                 icol2 = ncols - 1;
             }
 
-            dxi = icol2 - icol1 + 1;
-            dyi = irow2 - irow1 + 1;
-
-            for (irow = irow1; irow <= irow2; irow++) {
-                if (pfound == n_points)
-                    G_percent(irow - irow1, irow2 - irow1, 1);
-
-                i_n = dst->north - (irow + 0.5) * dst->ns_res;
-
-                for (icol = icol1; icol <= icol2; icol++) {
-                    if ((FLAG_GET(mask_flag, irow, icol))) {
-                        continue;
-                    }
-
-                    n_vars_ic = n_vars_i;
-                    Bc = B;
-
-                    if (n_vars_i) {
-
-                        cache_get(var_seg, (void *)varbuf, irow, icol);
-                        if (Rast_is_d_null_value(varbuf)) {
-                            continue;
-                        }
-
-                        if (efac) {
-                            for (i = 0; i < n_vars_i; i++) {
-                                if (varbuf[i] < vmin[i] ||
-                                    varbuf[i] > vmax[i]) {
-                                    if (!solved_tps)
-                                        solved_tps = solvemat(
-                                            mpnts, apnts, Bpnts, pfound + 1);
-                                    if (solved_tps) {
-                                        n_vars_ic = 0;
-                                        Bc = Bpnts;
-                                        cnt_efac++;
-                                    }
-                                    break;
-                                }
-                            }
-                        }
-                    }
-
-                    i_e = dst->west + (icol + 0.5) * dst->ew_res;
-
-                    cache_get(out_seg, (void *)&tps_out, irow, icol);
-
-                    result = Bc[0];
-                    if (n_vars_ic) {
-                        for (j = 0; j < n_vars_ic; j++) {
-                            result += varbuf[j] * Bc[j + 1];
-                        }
-                    }
-
-                    for (i = 0; i < pfound; i++) {
-                        dx = cur_pnts[i].c - i_e;
-                        dy = cur_pnts[i].r - i_n;
-
-                        dist2 = dx * dx + dy * dy;
-                        dist = 0;
-                        if (dist2 > 0) {
-                            dist = dist2 * log(dist2) * 0.5;
-                            result += Bc[1 + n_vars_ic + i] * dist;
-                        }
-                    }
-
-                    dx = fabs(2.0 * icol - (icol2 + icol1)) / dxi;
-                    dy = fabs(2.0 * irow - (irow2 + irow1)) / dyi;
-
-                    dist2 = (dx * dx + dy * dy);
-
-                    weight = exp(-dist2 * 4.0);
-
-                    if (wmin > weight)
-                        wmin = weight;
-                    if (wmax < weight)
-                        wmax = weight;
-
-                    if (tps_out.wmax < weight)
-                        tps_out.wmax = weight;
-
-                    tps_out.val += result * weight;
-                    tps_out.wsum += weight;
-                    cache_put(out_seg, (void *)&tps_out, irow, icol);
-                }
-            }
+            batch_add(&batch, &last, irow1, irow2, icol1, icol2);
         }
     }
+    batch_run(&batch);
     G_percent(1, 1, 1);
 
-    G_debug(1, "min weight: %g", wmin);
-    G_debug(1, "max weight: %g", wmax);
+    G_debug(1, "min weight: %g", batch.wmin);
+    G_debug(1, "max weight: %g", batch.wmax);
     G_debug(1, "Weighted average count: %u", cnt_wa);
+    G_debug(1, "Reused TPS solutions: %u", cnt_reuse);
 
     if (n_vars > 0 && cnt_tps) {
         double perc_no_vars;
@@ -1220,12 +1692,14 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
             _("Percentage of TPS interpolations without covariables: %.2f"),
             perc_no_vars);
     }
-    if (cnt_efac) {
+    if (batch.cnt_efac) {
         G_verbose_message(
             _("Number of TPS interpolations avoiding extrapolation: %u"),
-            cnt_efac);
+            batch.cnt_efac);
     }
 
+    batch_free(&batch);
+    last_free(&last);
     flag_destroy(pnt_flag);
 
     outbuf = Rast_allocate_d_buf();
@@ -1262,15 +1736,15 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
                struct cache *out_seg, int out_fd, char *mask_name,
                struct Cell_head *src, struct Cell_head *dst, off_t n_points,
                double regularization, double overlap, int radius,
-               double lm_thresh)
+               double lm_thresh, int nprocs)
 {
     int ridx, cidx, row, col, nrows, ncols, src_row, src_col;
     double **m, *a, *B;
     double **mvars, *avars, *Bvars;
-    int i, j;
+    int i;
     int palloc;
     struct tps_pnt *cur_pnts;
-    double dx, dy, dist, dist2, mfactor;
+    double mfactor;
     DCELL *dval, result, *outbuf, *varbuf;
     CELL *maskbuf;
     int solved, solved_tps_lm, solved_tps, solved_lm, n_vars_i;
@@ -1281,13 +1755,13 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
     FLAG *mask_flag, *pnt_flag;
     struct tps_out tps_out;
     double *pvar;
-    double weight, dxi, dyi;
-    double wmin, wmax;
+    double weight;
     int rmin, rmax, cmin, cmax, rminp, rmaxp, cminp, cmaxp;
-    int irow, irow1, irow2, icol, icol1, icol2;
+    int irow1, irow2, icol1, icol2;
     int wsize;
-    unsigned int wacnt;
-    double i_n, i_e;
+    unsigned int wacnt, cnt_reuse;
+    struct tps_last last;
+    struct tps_batch batch;
 
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
@@ -1392,9 +1866,11 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
     G_message(_("Moving window TPS interpolation with %ld points..."),
               n_points);
 
-    wmin = 10;
-    wmax = 0;
     wacnt = 0;
+    cnt_reuse = 0;
+
+    last_init(&last, n_vars);
+    batch_init(&batch, n_vars, nprocs, var_seg, out_seg, mask_flag, dst);
 
     if (overlap > 1.0)
         overlap = 1.0;
@@ -1450,66 +1926,85 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
             /* sort points */
             qsort(cur_pnts, pfound, sizeof(struct tps_pnt), cmp_pnts);
 
-            load_tps_pnts(in_seg, dval, n_vars, cur_pnts, pfound, src, dst,
-                          regularization, m, a, mvars, avars, NULL, NULL, NULL,
-                          NULL);
+            if (last_is_same(&last, cur_pnts, pfound)) {
+                /* same points as for the last solution */
+                last_get_pnts(&last, cur_pnts);
+                n_vars_i = last.n_vars_i;
+                solved = (last.solved_tps_lm | last.solved_tps);
+                cnt_reuse++;
+            }
+            else {
+                last_set_pnts(&last, cur_pnts, pfound, n_vars);
 
-            n_vars_i = n_vars;
-            if (pfound > 2) {
-                /* solve */
-                solved_tps_lm = solved_tps = 0;
+                load_tps_pnts(in_seg, dval, n_vars, cur_pnts, pfound, src,
+                              dst, regularization, m, a, mvars, avars, NULL,
+                              NULL, NULL, NULL);
+
+                n_vars_i = n_vars;
+                if (pfound > 2) {
+                    /* solve */
+                    solved_tps_lm = solved_tps = 0;
 
-                if (n_vars) {
+                    if (n_vars) {
 
-                    solved_tps_lm = solvemat(m, a, B, pfound + 1 + n_vars);
+                        solved_tps_lm = solvemat(m, a, B, pfound + 1 + n_vars);
 
-                    if (solved_tps_lm && lm_thresh > 0) {
+                        if (solved_tps_lm && lm_thresh > 0) {
 
-                        solved_lm = solvemat(mvars, avars, Bvars, 1 + n_vars);
-                        if (!solved_lm) {
-                            G_debug(1,
-                                    "LM with covariables not working at row "
-                                    "%d, col %d",
-                                    row, col);
+                            solved_lm =
+                                solvemat(mvars, avars, Bvars, 1 + n_vars);
+                            if (!solved_lm) {
+                                G_debug(1,
+                                        "LM with covariables not working at "
+                                        "row %d, col %d",
+                                        row, col);
 
-                            solved_tps_lm = 0;
-                        }
-                        else {
-                            rsqr = lm_rsqr(in_seg, n_vars, src, cur_pnts,
-                                           pfound, B);
-
-                            if (rsqr < lm_thresh) {
-                                for (i = 1; i <= n_vars; i++) {
-                                    if (fabs(B[i]) > fabs(5 * Bvars[i])) {
-                                        G_debug(
-                                            0, "LM B%d is %g but TPS B%d is %g",
-                                            i, Bvars[i], i, B[i]);
-                                        solved_tps_lm = 0;
+                                solved_tps_lm = 0;
+                            }
+                            else {
+                                rsqr = lm_rsqr(in_seg, n_vars, src, cur_pnts,
+                                               pfound, B);
+
+                                if (rsqr < lm_thresh) {
+                                    for (i = 1; i <= n_vars; i++) {
+                                        if (fabs(B[i]) > fabs(5 * Bvars[i])) {
+                                            G_debug(0,
+                                                    "LM B%d is %g but TPS B%d "
+                                                    "is %g",
+                                                    i, Bvars[i], i, B[i]);
+                                            solved_tps_lm = 0;
+                                        }
                                     }
                                 }
                             }
                         }
+
+                        if (!solved_tps_lm) {
+                            n_vars_i = 0;
+                            for (i = 0; i < pfound; i++) {
+                                cur_pnts[i].r =
+                                    (int)((src->north - cur_pnts[i].r) /
+                                          src->ns_res);
+                                cur_pnts[i].c =
+                                    (int)((cur_pnts[i].c - src->west) /
+                                          src->ew_res);
+                            }
+                            load_tps_pnts(in_seg, dval, 0, cur_pnts, pfound,
+                                          src, dst, regularization, m, a, NULL,
+                                          NULL, NULL, NULL, NULL, NULL);
+                        }
                     }
 
                     if (!solved_tps_lm) {
-                        n_vars_i = 0;
-                        for (i = 0; i < pfound; i++) {
-                            cur_pnts[i].r = (int)((src->north - cur_pnts[i].r) /
-                                                  src->ns_res);
-                            cur_pnts[i].c = (int)((cur_pnts[i].c - src->west) /
-                                                  src->ew_res);
-                        }
-                        load_tps_pnts(in_seg, dval, 0, cur_pnts, pfound, src,
-                                      dst, regularization, m, a, NULL, NULL,
-                                      NULL, NULL, NULL, NULL);
+                        solved_tps = solvemat(m, a, B, pfound + 1);
                     }
-                }
 
-                if (!solved_tps_lm) {
-                    solved_tps = solvemat(m, a, B, pfound + 1);
+                    solved = (solved_tps_lm | solved_tps);
                 }
 
-                solved = (solved_tps_lm | solved_tps);
+                last_set_solution(&last, cur_pnts, pfound, n_vars, n_vars_i,
+                                  solved ? solved_tps_lm : 0,
+                                  solved ? solved_tps : 0, B, NULL, NULL, NULL);
             }
 
             if (!solved) {
@@ -1521,6 +2016,11 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
                     result = interp_wa(in_seg, dval, cur_pnts, pfound, row, col,
                                        src, dst, distmax, &weight);
 
+                    /* keep the order of additions */
+                    batch_run(&batch);
+
+                    cache_get(out_seg, (void *)&tps_out, row, col);
+
                     /* weight according to distance to nearest point */
                     if (tps_out.wmax < weight)
                         tps_out.wmax = weight;
@@ -1587,80 +2087,19 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
             if (icol2 > ncols - 1)
                 icol2 = ncols - 1;
 
-            dxi = icol2 - icol1 + 1;
-            dyi = irow2 - irow1 + 1;
-
-            for (irow = irow1; irow <= irow2; irow++) {
-
-                i_n = dst->north - (irow + 0.5) * dst->ns_res;
-
-                for (icol = icol1; icol <= icol2; icol++) {
-                    if ((FLAG_GET(mask_flag, irow, icol))) {
-                        continue;
-                    }
-
-                    if (n_vars_i) {
-
-                        cache_get(var_seg, (void *)varbuf, irow, icol);
-                        if (Rast_is_d_null_value(varbuf)) {
-                            continue;
-                        }
-                    }
-
-                    i_e = dst->west + (icol + 0.5) * dst->ew_res;
-
-                    cache_get(out_seg, (void *)&tps_out, irow, icol);
-
-                    j = 0;
-
-                    result = B[0];
-                    if (n_vars_i) {
-                        for (j = 0; j < n_vars; j++) {
-                            result += varbuf[j] * B[j + 1];
-                        }
-                    }
-
-                    for (i = 0; i < pfound; i++) {
-
-                        dx = cur_pnts[i].c - i_e;
-                        dy = cur_pnts[i].r - i_n;
-
-                        dist2 = dx * dx + dy * dy;
-                        dist = 0;
-                        if (dist2 > 0) {
-                            dist = dist2 * log(dist2) * 0.5;
-                            result += B[1 + n_vars + i] * dist;
-                        }
-                    }
-
-                    dx = fabs(2.0 * icol - (icol2 + icol1)) / dxi;
-                    dy = fabs(2.0 * irow - (irow2 + irow1)) / dyi;
-
-                    dist2 = (dx * dx + dy * dy);
-
-                    weight = exp(-dist2 * 4.0);
-
-                    if (wmin > weight)
-                        wmin = weight;
-                    if (wmax < weight)
-                        wmax = weight;
-
-                    if (tps_out.wmax < weight)
-                        tps_out.wmax = weight;
-
-                    tps_out.val += result * weight;
-                    tps_out.wsum += weight;
-                    cache_put(out_seg, (void *)&tps_out, irow, icol);
-                }
-            }
+            batch_add(&batch, &last, irow1, irow2, icol1, icol2);
         }
     }
+    batch_run(&batch);
     G_percent(1, 1, 1);
 
-    G_debug(1, "wmin: %g", wmin);
-    G_debug(1, "wmax: %g", wmax);
+    G_debug(1, "wmin: %g", batch.wmin);
+    G_debug(1, "wmax: %g", batch.wmax);
     G_debug(1, "wacnt: %u", wacnt);
+    G_debug(1, "Reused TPS solutions: %u", cnt_reuse);
 
+    batch_free(&batch);
+    last_free(&last);
     flag_destroy(pnt_flag);
 
     outbuf = Rast_allocate_d_buf();
@@ -14,10 +14,11 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
            struct cache *out_seg, int out_fd, char *mask_name,
            struct Cell_head *src, struct Cell_head *dst, off_t n_points,
            int min_points, int max_points, double regularization,
-           double overlap, int do_bfs, double lm_thresh, double ep_thresh);
+           double overlap, int do_bfs, double lm_thresh, double ep_thresh,
+           int nprocs);
 
 int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
                struct cache *out_seg, int out_fd, char *mask_name,
                struct Cell_head *src, struct Cell_head *dst, off_t n_points,
                double regularization, double overlap, int radius,
-               double lm_thresh);
+               double lm_thresh, int nprocs);
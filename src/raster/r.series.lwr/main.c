@@ -23,17 +23,70 @@
 #include <grass/raster.h>
 #include <grass/glocale.h>
 #include <grass/gmath.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rowblock.h"
 
 struct input {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
 struct output {
     const char *name;
     int fd;
-    DCELL *buf;
+};
+
+#define MAX_TERMS 4
+
+/* Gauss-Jordan elimination of a matrix, recorded to be applied to
+ * any number of right hand sides */
+struct elimination {
+    int imark[MAX_TERMS];                 /* pivot row of each column */
+    double factor[MAX_TERMS * MAX_TERMS]; /* multiple of row i for row i2 */
+    double diag[MAX_TERMS];               /* diagonal after elimination */
+};
+
+#define FIT_NULL    0
+#define FIT_POLY    1
+#define FIT_AVERAGE 2
+
+/* fit of one output time step for a given pattern of null values */
+struct fit {
+    int type;
+    int in_lo, in_hi;
+    double max_ts;
+    struct elimination elim;
+};
+
+/* fits of all output time steps by pattern of null values,
+ * direct mapped, one cache per thread */
+struct fit_cache {
+    int size;
+    int nwords;         /* words of a key */
+    unsigned int *keys; /* size * nwords */
+    int *state;         /* 0: empty, 1: valid */
+    struct fit **fits;  /* size * num_inputs */
+};
+
+/* settings shared by all threads */
+struct lwr {
+    int num_inputs, order, min_points;
+    double *ts, maxgap;
+    double (*weight_func)(double, double, double);
+    double lo, hi, fet, delta;
+    int use_range, rejlo, rejhi, interp_only;
+    struct lwr_ws *ws; /* one per thread */
+};
+
+/* workspace of one thread */
+struct lwr_ws {
+    DCELL *values, *values2, *resultn;
+    int *isnull;
+    unsigned int *key;
+    double **m, *a, *a2, *B;
+    struct fit_cache cache;
 };
 
 static double uniform(double ref, double x, double max)
@@ -117,7 +170,7 @@ static double cosine(double ref, double x, double max)
     return (cos(M_PI_2 * dist));
 }
 
-static int solvemat(double **m, double a[], double B[], int n)
+static int factorize(double **m, struct elimination *e, int n)
 {
     int i, j, i2, j2, imark;
     double factor, temp, *tempp;
@@ -149,22 +202,11 @@ static int solvemat(double **m, double a[], double B[], int n)
 
         /* if row with highest pivot is not the current row, switch them */
 
+        e->imark[i] = imark;
         if (imark != i) {
-            /*
-            for (j2 = 0; j2 < n; j2++) {
-                temp = m[imark][j2];
-                m[imark][j2] = m[i][j2];
-                m[i][j2] = temp;
-            }
-            */
-
             tempp = m[imark];
             m[imark] = m[i];
             m[i] = tempp;
-
-            temp = a[imark];
-            a[imark] = a[i];
-            a[i] = temp;
         }
 
         /* compute zeros above and below the pivot, and compute
@@ -173,21 +215,45 @@ static int solvemat(double **m, double a[], double B[], int n)
         for (i2 = 0; i2 < n; i2++) {
             if (i2 != i) {
                 factor = m[i2][j] / pivot;
+                e->factor[i * n + i2] = factor;
                 for (j2 = j; j2 < n; j2++)
                     m[i2][j2] -= factor * m[i][j2];
-                a[i2] -= factor * a[i];
             }
         }
     }
 
+    for (i = 0; i < n; i++)
+        e->diag[i] = m[i][i];
+
+    return 1;
+}
+
+/* same operations on a[] as in the elimination of the matrix,
+ * a[] is modified */
+static void solve_factorized(const struct elimination *e, double a[],
+                             double B[], int n)
+{
+    int i, i2;
+    double temp;
+
+    for (i = 0; i < n; i++) {
+        if (e->imark[i] != i) {
+            temp = a[e->imark[i]];
+            a[e->imark[i]] = a[i];
+            a[i] = temp;
+        }
+        for (i2 = 0; i2 < n; i2++) {
+            if (i2 != i)
+                a[i2] -= e->factor[i * n + i2] * a[i];
+        }
+    }
+
     /* SINCE ALL OTHER VALUES IN THE MATRIX ARE ZERO NOW, CALCULATE THE
        COEFFICIENTS BY DIVIDING THE COLUMN VECTORS BY THE DIAGONAL VALUES. */
 
     for (i = 0; i < n; i++) {
-        B[i] = a[i] / m[i][i];
+        B[i] = a[i] / e->diag[i];
     }
-
-    return 1;
 }
 
 static double term(int term, double x)
@@ -206,6 +272,377 @@ static double term(int term, double x)
     return 0.0;
 }
 
+static void init_cache(struct fit_cache *cache, int size, int nwords,
+                       int num_inputs)
+{
+    int i;
+
+    cache->size = size;
+    cache->nwords = nwords;
+    cache->keys = G_calloc((size_t)size * nwords, sizeof(unsigned int));
+    cache->state = G_calloc(size, sizeof(int));
+    cache->fits = G_malloc(size * sizeof(struct fit *));
+    for (i = 0; i < size; i++)
+        cache->fits[i] = G_malloc(num_inputs * sizeof(struct fit));
+}
+
+static void free_cache(struct fit_cache *cache)
+{
+    int i;
+
+    for (i = 0; i < cache->size; i++)
+        G_free(cache->fits[i]);
+    G_free(cache->fits);
+    G_free(cache->state);
+    G_free(cache->keys);
+}
+
+/* window, weights and factorized matrix of the fits for outputs first
+ * to last, these depend only on the pattern of null values */
+static void build_fits(const struct lwr *l, struct lwr_ws *ws, int first,
+                       int last, struct fit *fits)
+{
+    int i, j, k, n;
+    int num_inputs = l->num_inputs, order = l->order;
+    int in_lo, in_hi, n_points, this_margin;
+    double *ts = l->ts, **m = ws->m, *mrow[MAX_TERMS];
+    double thisgap, prev_ts, next_ts, weight;
+    double max_ts, tsdiff1, tsdiff2;
+    int *isnull = ws->isnull;
+
+    thisgap = 0;
+    prev_ts = next_ts = ts[0] - (ts[1] - ts[0]);
+
+    for (i = first; i <= last; i++) {
+        struct fit *f = &fits[i];
+
+        f->type = FIT_NULL;
+
+        if (isnull[i]) {
+            if (next_ts < ts[i]) {
+                if (i > 0)
+                    prev_ts = ts[i] - (ts[i] - ts[i - 1]) / 2.0;
+                else
+                    prev_ts = ts[i] - (ts[i + 1] - ts[i]) / 2.0;
+
+                j = i;
+                while (j < num_inputs - 1 && isnull[j + 1])
+                    j++;
+
+                if (j < num_inputs - 1)
+                    next_ts = ts[j] + (ts[j + 1] - ts[j]) / 2.0;
+                else
+                    next_ts = ts[j] + (ts[j] - ts[j - 1]) / 2.0;
+
+                thisgap = next_ts - prev_ts;
+            }
+            if (thisgap > l->maxgap)
+                continue;
+        }
+
+        /* margin around i */
+        n_points = 0;
+        in_lo = in_hi = i;
+        this_margin = 0;
+        if (!isnull[i])
+            n_points++;
+        for (j = 1; j < num_inputs; j++) {
+            if (i - j >= 0) {
+                if (!isnull[i - j]) {
+                    n_points++;
+                    in_lo = i - j;
+                }
+            }
+            if (i + j < num_inputs) {
+                if (!isnull[i + j]) {
+                    n_points++;
+                    in_hi = i + j;
+                }
+            }
+            if (n_points >= l->min_points) {
+                this_margin = j;
+                break;
+            }
+        }
+        if (l->interp_only && isnull[i] && (in_lo == i || in_hi == i))
+            continue;
+
+        tsdiff1 = ts[i] - ts[in_lo];
+        tsdiff2 = ts[in_hi] - ts[i];
+
+        max_ts = tsdiff1;
+        if (max_ts < tsdiff2)
+            max_ts = tsdiff2;
+
+        max_ts *= (1.0 + 1.0 / this_margin);
+
+        f->in_lo = in_lo;
+        f->in_hi = in_hi;
+        f->max_ts = max_ts;
+
+        /* initialize matrix */
+        for (j = 0; j <= order; j++) {
+            m[j][j] = 0;
+            for (k = 0; k < j; k++) {
+                m[j][k] = m[k][j] = 0;
+            }
+        }
+
+        /* load points */
+        for (n = in_lo; n <= in_hi; n++) {
+            if (isnull[n])
+                continue;
+
+            weight = l->weight_func(ts[i], ts[n], max_ts);
+            for (j = 0; j <= order; j++) {
+                double val1 = term(j, ts[n]);
+
+                for (k = j; k <= order; k++) {
+                    double val2 = term(k, ts[n]);
+
+                    m[j][k] += val1 * val2 * weight;
+                }
+            }
+        }
+
+        /* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
+        for (j = 1; j <= order; j++) {
+            for (k = 0; k < j; k++) {
+                m[j][k] = m[k][j];
+            }
+            m[j][j] *= (1 + l->delta);
+        }
+
+        /* rows are swapped in a copy of the row pointers */
+        for (j = 0; j <= order; j++)
+            mrow[j] = m[j];
+        if (factorize(mrow, &f->elim, order + 1))
+            f->type = FIT_POLY;
+        else
+            f->type = FIT_AVERAGE;
+    }
+}
+
+/* fits for the current pattern of null values */
+static const struct fit *get_fits(const struct lwr *l, struct lwr_ws *ws,
+                                  int first, int last)
+{
+    struct fit_cache *cache = &ws->cache;
+    int i, slot;
+    unsigned int hash, *key;
+
+    memset(ws->key, 0, cache->nwords * sizeof(unsigned int));
+    for (i = 0; i < l->num_inputs; i++) {
+        if (ws->isnull[i])
+            ws->key[i >> 5] |= 1U << (i & 31);
+    }
+    /* FNV-1a */
+    hash = 2166136261U;
+    for (i = 0; i < cache->nwords; i++) {
+        hash ^= ws->key[i];
+        hash *= 16777619U;
+    }
+    slot = hash % cache->size;
+    key = cache->keys + (size_t)slot * cache->nwords;
+
+    if (!cache->state[slot] ||
+        memcmp(key, ws->key, cache->nwords * sizeof(unsigned int)) != 0) {
+        build_fits(l, ws, first, last, cache->fits[slot]);
+        memcpy(key, ws->key, cache->nwords * sizeof(unsigned int));
+        cache->state[slot] = 1;
+    }
+
+    return cache->fits[slot];
+}
+
+/* local weighted regression of the cell idx of all input blocks */
+static void lwr_cell(void *data, int t_id, DCELL **in, DCELL **out,
+                     size_t idx)
+{
+    const struct lwr *l = data;
+    struct lwr_ws *ws = &l->ws[t_id];
+    int i, j, n;
+    int num_inputs = l->num_inputs, order = l->order;
+    int first, last, n_nulls;
+    double *ts = l->ts, *a = ws->a, *a2 = ws->a2, *B = ws->B;
+    double maxerrlo, maxerrhi, weight;
+    DCELL *values = ws->values, *values2 = ws->values2;
+    DCELL *resultn = ws->resultn;
+    int *isnull = ws->isnull;
+    const struct fit *fits;
+
+    first = last = -1;
+    n_nulls = 0;
+    for (i = 0; i < num_inputs; i++) {
+        DCELL v = in[i][idx];
+
+        isnull[i] = 0;
+        if (Rast_is_d_null_value(&v)) {
+            isnull[i] = 1;
+            n_nulls++;
+        }
+        else if (l->use_range && (v < l->lo || v > l->hi)) {
+            Rast_set_d_null_value(&v, 1);
+            isnull[i] = 1;
+            n_nulls++;
+        }
+        else {
+            if (first == -1)
+                first = i;
+            last = i;
+        }
+        values[i] = v;
+    }
+    if (!l->interp_only) {
+        first = 0;
+        last = num_inputs - 1;
+    }
+    else {
+        for (i = 0; i < first; i++)
+            Rast_set_d_null_value(&out[i][idx], 1);
+        for (i = last + 1; i < num_inputs; i++)
+            Rast_set_d_null_value(&out[i][idx], 1);
+    }
+
+    /* LWR */
+    if (num_inputs - n_nulls < l->min_points) {
+        for (i = 0; i < num_inputs; i++)
+            Rast_set_d_null_value(&out[i][idx], 1);
+        return;
+    }
+
+    fits = get_fits(l, ws, first, last);
+
+    for (i = first; i <= last; i++) {
+        const struct fit *f = &fits[i];
+        DCELL result;
+
+        if (f->type == FIT_NULL) {
+            Rast_set_d_null_value(&out[i][idx], 1);
+            continue;
+        }
+
+        if (f->type == FIT_POLY) {
+            for (j = 0; j <= order; j++)
+                a[j] = 0;
+
+            /* load points */
+            for (n = f->in_lo; n <= f->in_hi; n++) {
+                if (isnull[n])
+                    continue;
+
+                weight = l->weight_func(ts[i], ts[n], f->max_ts);
+                for (j = 0; j <= order; j++) {
+                    double val1 = term(j, ts[n]);
+
+                    a[j] += values[n] * val1 * weight;
+                }
+            }
+
+            solve_factorized(&f->elim, a, B, order + 1);
+
+            /* get estimate */
+            result = 0.0;
+            for (j = 0; j <= order; j++) {
+                result += B[j] * term(j, ts[i]);
+            }
+
+            if (l->rejlo || l->rejhi) {
+                int done = 0;
+
+                for (n = f->in_lo; n <= f->in_hi; n++) {
+                    if (isnull[n])
+                        continue;
+
+                    values2[n] = values[n];
+                }
+
+                while (!done) {
+                    done = 1;
+
+                    maxerrlo = maxerrhi = 0;
+                    for (n = f->in_lo; n <= f->in_hi; n++) {
+                        if (isnull[n])
+                            continue;
+
+                        resultn[n] = 0.0;
+                        for (j = 0; j <= order; j++) {
+                            resultn[n] += B[j] * term(j, ts[n]);
+                        }
+                        if (maxerrlo < resultn[n] - values2[n])
+                            maxerrlo = resultn[n] - values2[n];
+                        if (maxerrhi < values2[n] - resultn[n])
+                            maxerrhi = values2[n] - resultn[n];
+                    }
+
+                    if (l->rejlo && maxerrlo > l->fet)
+                        done = 0;
+                    if (l->rejhi && maxerrhi > l->fet)
+                        done = 0;
+
+                    if (!done) {
+                        for (j = 0; j <= order; j++)
+                            a2[j] = 0;
+
+                        /* replace outliers */
+                        for (n = f->in_lo; n <= f->in_hi; n++) {
+                            if (isnull[n])
+                                continue;
+
+                            weight = l->weight_func(ts[i], ts[n], f->max_ts);
+                            if (l->rejlo &&
+                                resultn[n] - values2[n] > maxerrlo * 0.5) {
+                                values2[n] = (resultn[n] + values2[n]) * 0.5;
+                            }
+                            if (l->rejhi &&
+                                values2[n] - resultn[n] > maxerrhi * 0.5) {
+                                values2[n] = (values2[n] + resultn[n]) * 0.5;
+                            }
+                            for (j = 0; j <= order; j++) {
+                                double val1 = term(j, ts[n]);
+
+                                a2[j] += values2[n] * val1 * weight;
+                            }
+                        }
+
+                        /* same matrix, same factorization */
+                        solve_factorized(&f->elim, a2, B, order + 1);
+
+                        /* update estimate */
+                        result = 0.0;
+                        for (j = 0; j <= order; j++) {
+                            result += B[j] * term(j, ts[i]);
+                        }
+                    }
+                }
+            }
+        }
+        else {
+            double wsum = 0.0;
+
+#pragma omp critical
+            G_warning(_("Points are (nearly) co-linear, using "
+                        "weighted average"));
+
+            result = 0.0;
+            for (n = f->in_lo; n <= f->in_hi; n++) {
+                if (isnull[n])
+                    continue;
+
+                weight = l->weight_func(ts[i], ts[n], f->max_ts);
+                result += values[n] * weight;
+                wsum += weight;
+            }
+            result /= wsum;
+        }
+        if (result < l->lo)
+            result = l->lo;
+        if (result > l->hi)
+            result = l->hi;
+        out[i][idx] = result;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     struct GModule *module;
@@ -215,39 +652,36 @@ int main(int argc, char *argv[])
             *fet,                                     /* fit error tolerance */
             *ts,                                      /* time steps */
             *maxgap,                                  /* maximum gap size */
-            *dod,   /* degree of over-determination */
-            *range, /* range of valid values */
-            *delta; /* threshold for high amplitudes */
+            *dod,    /* degree of over-determination */
+            *range,  /* range of valid values */
+            *delta,  /* threshold for high amplitudes */
+            *nprocs; /* number of threads */
     } parm;
     struct {
         struct Flag *lo, *hi, *lazy, *int_only;
     } flag;
-    int i, j, k, n;
-    int num_inputs, in_lo, in_hi;
+    int i;
+    int num_inputs;
     struct input *inputs = NULL;
     int num_outputs;
     struct output *outputs = NULL;
     char *suffix;
     struct History history;
     struct Colors colors;
-    DCELL *values = NULL, *values2 = NULL;
-    int nrows, ncols;
-    int row, col;
     int order;
-    double fet, maxerrlo, maxerrhi, lo, hi;
-    DCELL *resultn;
+    double fet, lo, hi;
     int msize;
-    double **m, **m2, *a, *a2, *B;
-    double *ts, maxgap, thisgap, prev_ts, next_ts, weight;
+    double *ts, maxgap;
     double (*weight_func)(double, double, double);
     int dod;
-    int *isnull, n_nulls;
-    int min_points, n_points;
-    int first, last, interp_only;
-    int this_margin;
-    double max_ts, tsdiff1, tsdiff2;
+    int min_points;
+    int interp_only;
     double delta;
     int rejlo, rejhi;
+    int nprocs, t;
+    struct lwr l;
+    struct lwr_ws *ws;
+    struct rowblock rb;
 
     G_gisinit(argv[0]);
 
@@ -333,6 +767,8 @@ int main(int argc, char *argv[])
     parm.delta->label = _("Threshold for high amplitudes");
     parm.delta->description = _("Delta should be between 0 and 1");
 
+    parm.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+
     flag.lo = G_define_flag();
     flag.lo->key = 'l';
     flag.lo->description = _("Reject low outliers");
@@ -414,6 +850,22 @@ int main(int argc, char *argv[])
 
     interp_only = flag.int_only->answer;
 
+#ifdef _OPENMP
+    nprocs = atoi(parm.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), parm.nprocs->key);
+
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     /* process the input maps from the file */
     if (parm.file->answer) {
         FILE *in;
@@ -449,7 +901,6 @@ int main(int argc, char *argv[])
 
             p->name = G_store(name);
             G_verbose_message(_("Reading raster map <%s>..."), p->name);
-            p->buf = Rast_allocate_d_buf();
             if (!flag.lazy->answer)
                 p->fd = Rast_open_old(p->name, "");
         }
@@ -474,7 +925,6 @@ int main(int argc, char *argv[])
 
             p->name = parm.input->answers[i];
             G_verbose_message(_("Reading raster map <%s>..."), p->name);
-            p->buf = Rast_allocate_d_buf();
             if (!flag.lazy->answer)
                 p->fd = Rast_open_old(p->name, "");
         }
@@ -528,7 +978,6 @@ int main(int argc, char *argv[])
         sprintf(output_name, "%s%s", uname, suffix);
 
         out->name = G_store(output_name);
-        out->buf = Rast_allocate_d_buf();
         out->fd = Rast_open_new(output_name, DCELL_TYPE);
     }
 
@@ -540,319 +989,71 @@ int main(int argc, char *argv[])
                         "degree of over-determination %d."),
                       min_points, order, dod);
 
-    /* initialise variables */
-    values = G_malloc(num_inputs * sizeof(DCELL));
-    values2 = G_malloc(num_inputs * sizeof(DCELL));
-    resultn = G_malloc(num_inputs * sizeof(DCELL));
+    l.num_inputs = num_inputs;
+    l.order = order;
+    l.min_points = min_points;
+    l.ts = ts;
+    l.maxgap = maxgap;
+    l.weight_func = weight_func;
+    l.lo = lo;
+    l.hi = hi;
+    l.fet = fet;
+    l.delta = delta;
+    l.use_range = parm.range->answer != NULL;
+    l.rejlo = rejlo;
+    l.rejhi = rejhi;
+    l.interp_only = interp_only;
 
-    nrows = Rast_window_rows();
-    ncols = Rast_window_cols();
+    /* initialise variables */
+    msize = 1 + order;
 
-    isnull = G_malloc(num_inputs * sizeof(int));
+    /* windows, weights and factorized matrices depend only on the
+     * pattern of null values, they are computed once per pattern
+     * and cached */
+    ws = G_malloc(nprocs * sizeof(struct lwr_ws));
+    for (t = 0; t < nprocs; t++) {
+        ws[t].values = G_malloc(num_inputs * sizeof(DCELL));
+        ws[t].values2 = G_malloc(num_inputs * sizeof(DCELL));
+        ws[t].resultn = G_malloc(num_inputs * sizeof(DCELL));
+        ws[t].isnull = G_malloc(num_inputs * sizeof(int));
+        ws[t].key = G_malloc(((num_inputs + 31) / 32) * sizeof(unsigned int));
+        ws[t].m = G_alloc_matrix(msize, msize);
+        ws[t].a = G_alloc_vector(msize);
+        ws[t].a2 = G_alloc_vector(msize);
+        ws[t].B = G_alloc_vector(msize);
+        init_cache(&ws[t].cache, 64, (num_inputs + 31) / 32, num_inputs);
+    }
 
-    msize = 1 + order;
-    m = G_alloc_matrix(msize, msize);
-    m2 = G_alloc_matrix(msize, msize);
-    a = G_alloc_vector(msize);
-    a2 = G_alloc_vector(msize);
-    B = G_alloc_vector(msize);
+    l.ws = ws;
 
-    /* calculate weights for different margins */
+    /* inputs are read and outputs written while the cells of nprocs
+     * rows are processed */
+    rowblock_init(&rb, num_inputs, num_outputs, nprocs);
+    for (i = 0; i < num_inputs; i++)
+        rowblock_set_input(&rb, i, inputs[i].name, "",
+                           flag.lazy->answer ? -1 : inputs[i].fd);
+    for (i = 0; i < num_outputs; i++)
+        rowblock_set_output(&rb, i, outputs[i].fd);
 
     /* process the data */
     G_message(_("Local weighted regression of %d input maps..."), num_inputs);
 
-    for (row = 0; row < nrows; row++) {
-        G_percent(row, nrows, 4);
-
-        if (flag.lazy->answer) {
-            /* Open the files only on run time */
-            for (i = 0; i < num_inputs; i++) {
-                inputs[i].fd = Rast_open_old(inputs[i].name, "");
-                Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-                Rast_close(inputs[i].fd);
-            }
-        }
-        else {
-            for (i = 0; i < num_inputs; i++)
-                Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-        }
-
-        for (col = 0; col < ncols; col++) {
-
-            first = last = -1;
-            n_nulls = 0;
-            for (i = 0; i < num_inputs; i++) {
-                DCELL v = inputs[i].buf[col];
-
-                isnull[i] = 0;
-                if (Rast_is_d_null_value(&v)) {
-                    isnull[i] = 1;
-                    n_nulls++;
-                }
-                else if (parm.range->answer && (v < lo || v > hi)) {
-                    Rast_set_d_null_value(&v, 1);
-                    isnull[i] = 1;
-                    n_nulls++;
-                }
-                else {
-                    if (first == -1)
-                        first = i;
-                    last = i;
-                }
-                values[i] = v;
-            }
-            if (!interp_only) {
-                first = 0;
-                last = num_inputs - 1;
-            }
-            else {
-                for (i = 0; i < first; i++)
-                    Rast_set_d_null_value(&outputs[i].buf[col], 1);
-                for (i = last + 1; i < num_inputs; i++)
-                    Rast_set_d_null_value(&outputs[i].buf[col], 1);
-            }
-
-            /* LWR */
-            if (num_inputs - n_nulls >= min_points) {
-
-                thisgap = 0;
-                prev_ts = next_ts = ts[0] - (ts[1] - ts[0]);
-
-                for (i = first; i <= last; i++) {
-                    DCELL result;
-
-                    if (isnull[i]) {
-                        if (next_ts < ts[i]) {
-                            if (i > 0)
-                                prev_ts = ts[i] - (ts[i] - ts[i - 1]) / 2.0;
-                            else
-                                prev_ts = ts[i] - (ts[i + 1] - ts[i]) / 2.0;
-
-                            j = i;
-                            while (j < num_inputs - 1 && isnull[j + 1])
-                                j++;
-
-                            if (j < num_inputs - 1)
-                                next_ts = ts[j] + (ts[j + 1] - ts[j]) / 2.0;
-                            else
-                                next_ts = ts[j] + (ts[j] - ts[j - 1]) / 2.0;
-
-                            thisgap = next_ts - prev_ts;
-                        }
-                        if (thisgap > maxgap) {
-                            Rast_set_d_null_value(&outputs[i].buf[col], 1);
-                            continue;
-                        }
-                    }
-
-                    /* margin around i */
-                    n_points = 0;
-                    in_lo = in_hi = i;
-                    this_margin = 0;
-                    if (!isnull[i])
-                        n_points++;
-                    for (j = 1; j < num_inputs; j++) {
-                        if (i - j >= 0) {
-                            if (!isnull[i - j]) {
-                                n_points++;
-                                in_lo = i - j;
-                            }
-                        }
-                        if (i + j < num_inputs) {
-                            if (!isnull[i + j]) {
-                                n_points++;
-                                in_hi = i + j;
-                            }
-                        }
-                        if (n_points >= min_points) {
-                            this_margin = j;
-                            break;
-                        }
-                    }
-                    if (interp_only && isnull[i] &&
-                        (in_lo == i || in_hi == i)) {
-
-                        Rast_set_d_null_value(&outputs[i].buf[col], 1);
-                        continue;
-                    }
-
-                    tsdiff1 = ts[i] - ts[in_lo];
-                    tsdiff2 = ts[in_hi] - ts[i];
-
-                    max_ts = tsdiff1;
-                    if (max_ts < tsdiff2)
-                        max_ts = tsdiff2;
-
-                    max_ts *= (1.0 + 1.0 / this_margin);
-
-                    /* initialize matrix and vectors */
-                    for (j = 0; j <= order; j++) {
-                        a[j] = 0;
-                        B[j] = 0;
-                        m[j][j] = 0;
-                        for (k = 0; k < j; k++) {
-                            m[j][k] = m[k][j] = 0;
-                        }
-                    }
-
-                    /* load points */
-                    for (n = in_lo; n <= in_hi; n++) {
-                        if (isnull[n])
-                            continue;
-
-                        weight = weight_func(ts[i], ts[n], max_ts);
-                        for (j = 0; j <= order; j++) {
-                            double val1 = term(j, ts[n]);
-
-                            for (k = j; k <= order; k++) {
-                                double val2 = term(k, ts[n]);
-
-                                m[j][k] += val1 * val2 * weight;
-                            }
-                            a[j] += values[n] * val1 * weight;
-                        }
-                    }
-
-                    /* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
-                    m2[0][0] = m[0][0];
-                    a2[0] = a[0];
-                    for (j = 1; j <= order; j++) {
-                        for (k = 0; k < j; k++) {
-                            m[j][k] = m[k][j];
-                            m2[j][k] = m2[k][j] = m[k][j];
-                        }
-                        m[j][j] *= (1 + delta);
-                        m2[j][j] = m[j][j];
-                        a2[j] = a[j];
-                    }
-
-                    if (solvemat(m2, a2, B, order + 1) != 0) {
-                        /* get estimate */
-                        result = 0.0;
-                        for (j = 0; j <= order; j++) {
-                            result += B[j] * term(j, ts[i]);
-                        }
-
-                        if (rejlo || rejhi) {
-                            int done = 0;
-
-                            for (n = in_lo; n <= in_hi; n++) {
-                                if (isnull[n])
-                                    continue;
-
-                                values2[n] = values[n];
-                            }
-
-                            while (!done) {
-                                done = 1;
-
-                                maxerrlo = maxerrhi = 0;
-                                for (n = in_lo; n <= in_hi; n++) {
-                                    if (isnull[n])
-                                        continue;
-
-                                    resultn[n] = 0.0;
-                                    for (j = 0; j <= order; j++) {
-                                        resultn[n] += B[j] * term(j, ts[n]);
-                                    }
-                                    if (maxerrlo < resultn[n] - values2[n])
-                                        maxerrlo = resultn[n] - values2[n];
-                                    if (maxerrhi < values2[n] - resultn[n])
-                                        maxerrhi = values2[n] - resultn[n];
-                                }
-
-                                if (rejlo && maxerrlo > fet)
-                                    done = 0;
-                                if (rejhi && maxerrhi > fet)
-                                    done = 0;
-
-                                if (!done) {
-
-                                    a2[0] = 0;
-                                    m2[0][0] = m[0][0];
-                                    for (j = 1; j <= order; j++) {
-                                        for (k = 0; k < j; k++) {
-                                            m2[j][k] = m2[k][j] = m[k][j];
-                                        }
-                                        m2[j][j] = m[j][j];
-                                        a2[j] = 0;
-                                    }
-
-                                    /* replace outliers */
-                                    for (n = in_lo; n <= in_hi; n++) {
-                                        if (isnull[n])
-                                            continue;
-
-                                        weight =
-                                            weight_func(ts[i], ts[n], max_ts);
-                                        if (rejlo && resultn[n] - values2[n] >
-                                                         maxerrlo * 0.5) {
-                                            values2[n] =
-                                                (resultn[n] + values2[n]) * 0.5;
-                                        }
-                                        if (rejhi && values2[n] - resultn[n] >
-                                                         maxerrhi * 0.5) {
-                                            values2[n] =
-                                                (values2[n] + resultn[n]) * 0.5;
-                                        }
-                                        for (j = 0; j <= order; j++) {
-                                            double val1 = term(j, ts[n]);
-
-                                            a2[j] += values2[n] * val1 * weight;
-                                        }
-                                    }
-                                    done = 1;
-                                    if (solvemat(m2, a2, B, order + 1) != 0) {
-                                        /* update estimate */
-                                        result = 0.0;
-                                        for (j = 0; j <= order; j++) {
-                                            result += B[j] * term(j, ts[i]);
-                                        }
-                                        done = 0;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    else {
-                        double wsum = 0.0;
-
-                        G_warning(_("Points are (nearly) co-linear, using "
-                                    "weighted average"));
-
-                        result = 0.0;
-                        for (n = in_lo; n <= in_hi; n++) {
-                            if (isnull[n])
-                                continue;
-
-                            weight = weight_func(ts[i], ts[n], max_ts);
-                            result += values[n] * weight;
-                            wsum += weight;
-                        }
-                        result /= wsum;
-                    }
-                    if (result < lo)
-                        result = lo;
-                    if (result > hi)
-                        result = hi;
-                    outputs[i].buf[col] = result;
-                }
-            }
-            else {
-                for (i = 0; i < num_outputs; i++) {
-                    struct output *out = &outputs[i];
-
-                    Rast_set_d_null_value(&out->buf[col], 1);
-                }
-            }
-        }
-
-        for (i = 0; i < num_outputs; i++)
-            Rast_put_d_row(outputs[i].fd, outputs[i].buf);
+    rowblock_run(&rb, lwr_cell, &l);
+    rowblock_free(&rb);
+
+    for (t = 0; t < nprocs; t++) {
+        G_free(ws[t].values);
+        G_free(ws[t].values2);
+        G_free(ws[t].resultn);
+        G_free(ws[t].isnull);
+        G_free(ws[t].key);
+        G_free_matrix(ws[t].m);
+        G_free_vector(ws[t].a);
+        G_free_vector(ws[t].a2);
+        G_free_vector(ws[t].B);
+        free_cache(&ws[t].cache);
     }
-
-    G_percent(row, nrows, 2);
+    G_free(ws);
 
     /* close input and output maps */
     for (i = 0; i < num_outputs; i++) {
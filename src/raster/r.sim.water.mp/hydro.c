@@ -110,6 +110,88 @@ double infil_val;
 
 struct History history; /* holds meta-data (title, comments,..) */
 
+/* ************************************************************ */
+/*       propagate one walker located in cell (k, l) one step;
+ *       only cell (k, l) of gama, inf, and dif is updated */
+/* ************************************************************ */
+
+static void propagate_walker(int lw, int k, int l, double stxm, double stym,
+                             double addac, double conn, unsigned long long key)
+{
+    unsigned int counter = 0;
+    double decr, d1, hhc, velx, vely, gaux, gauy;
+    float eff;
+
+    if (zz[k][l] == UNDEF) {
+        w[lw][2] = 1e-10; /* eliminate walker if it is out of area */
+        return;
+    }
+
+    if (infil != NULL) { /* infiltration part */
+        if (inf[k][l] - si[k][l] > 0.) {
+            decr = pow(addac * w[lw][2], 3. / 5.); /* decreasing factor in m */
+            if (inf[k][l] > decr) {
+                inf[k][l] -= decr; /* decrease infilt. in cell and eliminate
+                                      the walker */
+                w[lw][2] = 0.;
+            }
+            else {
+                w[lw][2] -= pow(inf[k][l], 5. / 3.) /
+                            addac; /* use just proportional part of the
+                                      walker weight */
+                inf[k][l] = 0.;
+            }
+        }
+    }
+
+    gama[k][l] += (addac * w[lw][2]); /* add walker weigh to water depth or
+                                         conc. */
+    d1 = gama[k][l] * conn;
+    walker_gasdev(key, &counter, &gaux, &gauy);
+    hhc = pow(d1, 3. / 5.);
+
+    if (hhc > hhmax && wdepth == NULL) { /* increased diffusion if
+                                            w.depth > hhmax */
+        dif[k][l] = (halpha + 1) * deldif;
+        velx = vavg[lw][0];
+        vely = vavg[lw][1];
+    }
+    else {
+        dif[k][l] = deldif;
+        velx = v1[k][l];
+        vely = v2[k][l];
+    }
+
+    if (traps != NULL && trap[k][l] != 0.) { /* traps */
+        eff = walker_rand(key, &counter); /* random generator */
+
+        if (eff <= trap[k][l]) {
+            velx = -0.1 * v1[k][l]; /* move it slightly back */
+            vely = -0.1 * v2[k][l];
+        }
+    }
+
+    w[lw][0] += (velx + dif[k][l] * gaux); /* move the walker */
+    w[lw][1] += (vely + dif[k][l] * gauy);
+
+    if (hhc > hhmax && wdepth == NULL) {
+        vavg[lw][0] = hbeta * (vavg[lw][0] + v1[k][l]);
+        vavg[lw][1] = hbeta * (vavg[lw][1] + v2[k][l]);
+    }
+
+    if (w[lw][0] <= xmin || w[lw][1] <= ymin || w[lw][0] >= xmax ||
+        w[lw][1] >= ymax) {
+        w[lw][2] = 1e-10; /* eliminate walker if it is out of area */
+    }
+    else {
+        if (wdepth != NULL) {
+            l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
+            k = (int)((w[lw][1] + stym) / stepy) - my - 1;
+            w[lw][2] *= sigma[k][l];
+        }
+    }
+}
+
 /* **************************************************** */
 /*       create walker representation of si */
 /* ******************************************************** */
@@ -134,12 +216,15 @@ void main_loop(void)
     int mitfac;
     /*  int mitfac, p; */
     double x, y;
-    double velx, vely, stxm, stym;
-    double factor, conn, gaux, gauy;
-    double d1, addac, decr;
+    double stxm, stym;
+    double factor, conn;
+    double d1, addac;
     double barea, sarea, walkwe;
     double gen, gen2, wei2, wei3, wei, weifac;
-    float eff;
+    /* walkers grouped by bands of band_rows rows for parallel propagation */
+    int nbands, band_rows, iband, iwalk;
+    int *walker_band, *walker_order, *band_counts, *band_start;
+    unsigned long long walker_seed;
 
     nblock = 1;
     icoub = 0;
@@ -155,6 +240,19 @@ void main_loop(void)
     /* Create the observation points */
     create_observation_points();
 
+    /* bands are small enough for dynamic load balancing; results do not
+     * depend on the number of bands or threads */
+    nbands = 16 * omp_get_max_threads();
+    if (nbands > my)
+        nbands = my;
+    band_rows = (my + nbands - 1) / nbands;
+    nbands = (my + band_rows - 1) / band_rows;
+    band_counts = G_malloc(sizeof(int) * omp_get_max_threads() * nbands);
+    band_start = G_malloc(sizeof(int) * (nbands + 1));
+
+    /* seed walker random streams from the global generator */
+    walker_seed = ((unsigned long long)G_lrand48() << 31) ^ G_lrand48();
+
     G_debug(2, " maxwa, nblock %d %d", maxwa, nblock);
 
     //---------------------------------------------------------------------------------------------------------------
@@ -306,6 +404,8 @@ void main_loop(void)
         }
         //}
         nwalk = lw;
+        walker_band = G_malloc(sizeof(int) * (nwalk ? nwalk : 1));
+        walker_order = G_malloc(sizeof(int) * (nwalk ? nwalk : 1));
         G_debug(2, " nwalk, maxw %d %d", nwalk, MAXW);
         G_debug(2, " walkwe (walk weight),frac %f %f", walkwe, frac);
 #ifdef PARALLEL
@@ -329,9 +429,6 @@ void main_loop(void)
 
         G_debug(2, "main loop over the projection time... ");
 
-        // double *gaux_arr = (double *)G_calloc((nwalk), sizeof(double *));;
-        // double *gauy_arr = (double *)G_calloc((nwalk), sizeof(double *));;
-        // int stop = -1;
         G_message("miter %d", miter);
         for (i = 1; i <= miter;
              i++) { /* iteration loop depending on simulation time and deltap */
@@ -375,145 +472,74 @@ void main_loop(void)
             nwalka = 0;
             nstack = 0;
 
-            /*for (lw = 0; lw < nwalk; lw++) {
-                if (w[lw][2] > EPS) {
-                    ++nwalka;
-                    gaux_arr[lw] = gasdev();
-                    gauy_arr[lw] = gasdev();
-                }
-            }*/
-            // int chunk_size = (int)nwalk/(4 * omp_get_thread_num());
-
-#pragma omp parallel firstprivate(l, lw, k, decr, d1, hhc, velx, vely, eff, \
-                                      gaux, gauy) // nwalka
+            /* group active walkers by bands of rows; each band is
+             * propagated by one thread, so walkers in a cell update gama,
+             * inf, and dif in the same order as in serial and no locks or
+             * thread-local grids are needed */
+#pragma omp parallel private(lw, k, l)
             {
-                int steps =
-                    (int)((((double)nwalk) / ((double)omp_get_num_threads())) +
-                          0.5);
                 int tid = omp_get_thread_num();
-                int min_loop = tid * steps;
-                int max_loop =
-                    ((tid + 1) * steps) > nwalk ? nwalk : (tid + 1) * steps;
-                /*#pragma omp critical
-                        {
-                        G_message("tid: %d min_loop: %d max_loop: %d nwalk: %d,
-                   steps: %d", tid, min_loop, max_loop, nwalk, steps);
-                        }*/
-                // #pragma omp for schedule(static,1)
-                for (lw = min_loop; lw < max_loop; lw++) {
-                    // G_message(_("nthreads %d"),omp_get_num_threads());
-                    // G_message("\n tid: %d", omp_get_thread_num());
-                    if (w[lw][2] > EPS) { /* check the walker weight */
-                                          // #pragma omp atomic
-                        ++nwalka;
-                        l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
-                        k = (int)((w[lw][1] + stym) / stepy) - my - 1;
-                        // G_message("k_%d l_%d", k,l);
-                        if (l > mx - 1 || k > my - 1 || k < 0 || l < 0) {
-
-                            G_debug(2, " k,l=%d,%d", k, l);
-                            printf("    lw,w=%d %f %f", lw, w[lw][1], w[lw][2]);
-                            G_debug(2, "    stxym=%f %f", stxm, stym);
-                            printf("    step=%f %f", stepx, stepy);
-                            G_debug(2, "    m=%d %d", my, mx);
-                            printf("    nwalka,nwalk=%d %d", nwalka, nwalk);
-                            G_debug(2, "  ");
-                        }
+                int nthreads = omp_get_num_threads();
+                int first = (int)((long long)nwalk * tid / nthreads);
+                int last = (int)((long long)nwalk * (tid + 1) / nthreads);
+                int *count = band_counts + tid * nbands;
+                int band;
+
+                for (band = 0; band < nbands; band++)
+                    count[band] = 0;
+
+                for (lw = first; lw < last; lw++) {
+                    walker_band[lw] = -1;
+                    if (w[lw][2] <= EPS) /* check the walker weight */
+                        continue;
+                    l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
+                    k = (int)((w[lw][1] + stym) / stepy) - my - 1;
+                    if (l > mx - 1 || k > my - 1 || k < 0 || l < 0) {
+                        G_debug(2, " k,l=%d,%d lw,w=%d %f %f", k, l, lw,
+                                w[lw][1], w[lw][2]);
+                        w[lw][2] = 1e-10; /* eliminate walker if it is out
+                                             of area */
+                        continue;
+                    }
+                    walker_band[lw] = k / band_rows;
+                    count[walker_band[lw]]++;
+                }
 
-                        if (zz[k][l] != UNDEF) {
-                            if (infil != NULL) { /* infiltration part */
-                                if (inf[k][l] - si[k][l] > 0.) {
-
-                                    decr = pow(
-                                        addac * w[lw][2],
-                                        3. / 5.); /* decreasing factor in m */
-                                    //                                #pragma
-                                    //                                omp
-                                    // critical
-                                    //{
-                                    if (inf[k][l] > decr) {
-                                        inf[k][l] -=
-                                            decr; /* decrease infilt. in cell
-                                                     and eliminate the walker */
-                                        w[lw][2] = 0.;
-                                    }
-                                    else {
-                                        w[lw][2] -=
-                                            pow(inf[k][l], 5. / 3.) /
-                                            addac; /* use just proportional part
-                                                      of the walker weight */
-                                        inf[k][l] = 0.;
-                                    }
-                                    //}
-                                }
-                            }
-
-                            // #pragma omp critical
-                            //{
-                            gama[k][l] +=
-                                (addac * w[lw][2]); /* add walker weigh to water
-                                                       depth or conc. */
-                            d1 = gama[k][l] * conn;
-                            //
-                            //}
-                            gasdev_for_paralel(&gaux, &gauy);
-                            hhc = pow(d1, 3. / 5.);
-
-                            if (hhc > hhmax &&
-                                wdepth == NULL) { /* increased diffusion if
-                                                     w.depth > hhmax */
-                                dif[k][l] = (halpha + 1) * deldif;
-                                velx = vavg[lw][0];
-                                vely = vavg[lw][1];
-                            }
-                            else {
-                                dif[k][l] = deldif;
-                                velx = v1[k][l];
-                                vely = v2[k][l];
-                            }
-
-                            if (traps != NULL && trap[k][l] != 0.) { /* traps */
-
-                                eff = simwe_rand(); /* random generator */
-
-                                if (eff <= trap[k][l]) {
-                                    velx = -0.1 *
-                                           v1[k][l]; /* move it slightly back */
-                                    vely = -0.1 * v2[k][l];
-                                }
-                            }
-
-                            w[lw][0] +=
-                                (velx + dif[k][l] * gaux); /* move the walker */
-                            w[lw][1] += (vely + dif[k][l] * gauy);
-
-                            if (hhc > hhmax && wdepth == NULL) {
-                                vavg[lw][0] = hbeta * (vavg[lw][0] + v1[k][l]);
-                                vavg[lw][1] = hbeta * (vavg[lw][1] + v2[k][l]);
-                            }
-
-                            if (w[lw][0] <= xmin || w[lw][1] <= ymin ||
-                                w[lw][0] >= xmax || w[lw][1] >= ymax) {
-                                w[lw][2] = 1e-10; /* eliminate walker if it is
-                                                     out of area */
-                            }
-                            else {
-                                if (wdepth != NULL) {
-                                    l = (int)((w[lw][0] + stxm) / stepx) - mx -
-                                        1;
-                                    k = (int)((w[lw][1] + stym) / stepy) - my -
-                                        1;
-                                    w[lw][2] *= sigma[k][l];
-                                }
-
-                            } /* else */
-                        }     /*DEFined area */
-                        else {
-                            w[lw][2] = 1e-10; /* eliminate walker if it is out
-                                                 of area */
+#pragma omp barrier
+#pragma omp single
+                {
+                    /* band-major prefix sum keeps walkers in index order
+                     * within each band */
+                    int t, pos = 0;
+
+                    for (band = 0; band < nbands; band++) {
+                        band_start[band] = pos;
+                        for (t = 0; t < nthreads; t++) {
+                            int n = band_counts[t * nbands + band];
+
+                            band_counts[t * nbands + band] = pos;
+                            pos += n;
                         }
                     }
-                } /* lw loop */
+                    band_start[nbands] = pos;
+                }
+
+                for (lw = first; lw < last; lw++)
+                    if (walker_band[lw] >= 0)
+                        walker_order[count[walker_band[lw]]++] = lw;
+            }
+            nwalka = band_start[nbands];
+
+#pragma omp parallel for schedule(dynamic) private(iwalk, lw, k, l)
+            for (iband = 0; iband < nbands; iband++) {
+                for (iwalk = band_start[iband]; iwalk < band_start[iband + 1];
+                     iwalk++) {
+                    lw = walker_order[iwalk];
+                    l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
+                    k = (int)((w[lw][1] + stym) / stepy) - my - 1;
+                    propagate_walker(lw, k, l, stxm, stym, addac, conn,
+                                     walker_key(walker_seed, iblock, i, lw));
+                }
             }
             /* Changes made by Soeren 8. Mar 2011 to replace the site walker
              * output implementation */
@@ -613,8 +639,13 @@ void main_loop(void)
         }
         if (erdep != NULL)
             erod(gama);
+
+        G_free(walker_band);
+        G_free(walker_order);
     }
     /*                       ........ end of iblock loop */
+    G_free(band_counts);
+    G_free(band_start);
 
 #ifdef PARALLEL
     printTimeDiff("L1");
@@ -58,3 +58,47 @@ void gasdev_for_paralel(double *x, double *y)
     (*y) = vv1 * fac;
     (*x) = vv2 * fac;
 }
+
+/* counter-based random numbers for walkers; each walker draws from its own
+ * stream given by a key, so the numbers do not depend on the order in which
+ * threads process walkers */
+static unsigned long long mix64(unsigned long long z)
+{
+    /* splitmix64 finalizer */
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+unsigned long long walker_key(unsigned long long seed, int iblock, int iter,
+                              int lw)
+{
+    unsigned long long key =
+        mix64(seed + 0x9e3779b97f4a7c15ULL *
+                         (((unsigned long long)iblock << 32) | (unsigned)iter));
+
+    return mix64(key ^ (unsigned long long)lw);
+}
+
+double walker_rand(unsigned long long key, unsigned int *counter)
+{
+    unsigned long long z = mix64(key + 0x9e3779b97f4a7c15ULL * ++(*counter));
+
+    /* 53 random bits in [0, 1) */
+    return (double)(z >> 11) * (1. / 9007199254740992.);
+}
+
+void walker_gasdev(unsigned long long key, unsigned int *counter, double *x,
+                   double *y)
+{
+    double r = 0., vv1, vv2, fac;
+
+    while (r >= 1. || r == 0.) {
+        vv1 = walker_rand(key, counter) * 2. - 1.;
+        vv2 = walker_rand(key, counter) * 2. - 1.;
+        r = vv1 * vv1 + vv2 * vv2;
+    }
+    fac = sqrt(log(r) * -2. / r);
+    (*y) = vv1 * fac;
+    (*x) = vv2 * fac;
+}
@@ -60,6 +60,10 @@ extern int output_et(void);
 extern double simwe_rand(void);
 extern double gasdev(void);
 extern void gasdev_for_paralel(double *x, double *y);
+extern unsigned long long walker_key(unsigned long long, int, int, int);
+extern double walker_rand(unsigned long long, unsigned int *);
+extern void walker_gasdev(unsigned long long, unsigned int *, double *,
+                          double *);
 extern double amax1(double, double);
 extern double amin1(double, double);
 extern int min(int, int);
@@ -127,6 +127,17 @@ double lumcline2_parallel(
 
     unsigned char *horizonpointer);
 
+/* rsunrow.c */
+
+struct SunRowCells *alloc_row_cells(int size);
+void free_row_cells(struct SunRowCells *rc);
+void add_row_cell(struct SunRowCells *rc, int col,
+                  struct SunGeometryConstDay *sunGeom,
+                  struct SunGeometryVarDay *sunVarGeom,
+                  struct SunGeometryVarSlope *sunSlopeGeom,
+                  struct SolarRadVar *sunRadVar, unsigned char *horizonpointer);
+void joules2_row(struct SunRowCells *rc, int allDay, double step, int diffuse);
+
 typedef double (*BeamRadFunc)(double sh, double *bh,
                               struct SunGeometryVarDay *sunVarGeom,
                               struct SunGeometryVarSlope *sunSlopeGeom,
@@ -39,6 +39,7 @@ Thomas.Huld@jrc.it (c) 2003-2013 by The GRASS Development Team
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #ifdef USE_OPENCL
 #ifdef __APPLE__
@@ -69,6 +70,9 @@ Thomas.Huld@jrc.it (c) 2003-2013 by The GRASS Development Team
 #define BSKY           1.0
 #define DSKY           1.0
 #define DIST           "1.0"
+#define DAY_STEP       "1"
+#define HORIZON_STEP   "5"
+#define ROW_CHUNK      64
 
 #define SCALING_FACTOR 150.
 const double invScale = 1. / SCALING_FACTOR;
@@ -100,6 +104,7 @@ const char *coefdh = NULL;
 const char *incidout = NULL;
 const char *longin = NULL;
 const char *horizon = NULL;
+const char *horizonOutput = NULL;
 const char *beam_rad = NULL;
 const char *insol_time = NULL;
 const char *diff_rad = NULL;
@@ -154,10 +159,22 @@ void joules2(struct SunGeometryConstDay *sunGeom,
 
 void calculate(double singleSlope, double singleAspect, double singleAlbedo,
                double singleLinke, struct GridGeometry gridGeom);
+void calculate_days(double singleSlope, double singleAspect,
+                    double singleAlbedo, double singleLinke,
+                    struct GridGeometry gridGeom);
+void trace_horizons(float **dem, int offset, int numRows,
+                    unsigned char *horizons, struct GridGeometry gridGeom,
+                    double zmax);
+void save_horizons(struct GridGeometry gridGeom);
+static void trace_partition(int offset, struct GridGeometry gridGeom,
+                            double zmax);
+static void store_row_cells(struct SunRowCells *rc, int j);
 double com_declin(int);
 
 int n, m, ip, jp;
 int d, day;
+int startDay, endDay, dayStep = 1, monthly = FALSE, traceHorizon = FALSE;
+int rowKernel = FALSE;
 int saveMemory, numPartitions = 1;
 long int shadowoffset = 0;
 int varCount_global = 0;
@@ -250,7 +267,8 @@ int main(int argc, char *argv[])
             *lin, *albedo, *longin, *alb, *latin, *coefbh, *coefdh, *incidout,
             *beam_rad, *insol_time, *diff_rad, *refl_rad, *glob_rad, *day,
             *step, *declin, *ltime, *dist, *horizon, *horizonstep,
-            *numPartitions, *civilTime, *threads;
+            *numPartitions, *civilTime, *threads, *startDay, *endDay,
+            *dayStep, *period, *horizonOutput, *kernel;
     } parm;
 #endif
 #ifndef PARALLEL
@@ -260,7 +278,8 @@ int main(int argc, char *argv[])
             *lin, *albedo, *longin, *alb, *latin, *coefbh, *coefdh, *incidout,
             *beam_rad, *insol_time, *diff_rad, *refl_rad, *glob_rad, *day,
             *step, *declin, *ltime, *dist, *horizon, *horizonstep,
-            *numPartitions, *civilTime;
+            *numPartitions, *civilTime, *startDay, *endDay, *dayStep,
+            *period, *horizonOutput, *kernel;
     } parm;
 #endif
 
@@ -423,6 +442,13 @@ int main(int argc, char *argv[])
         _("Angle step size for multidirectional horizon [degrees]");
     parm.horizonstep->guisection = _("Input");
 
+    parm.horizonOutput = G_define_standard_option(G_OPT_R_BASENAME_OUTPUT);
+    parm.horizonOutput->key = "horizon_output";
+    parm.horizonOutput->required = NO;
+    parm.horizonOutput->description =
+        _("Basename of output horizon maps traced from the elevation");
+    parm.horizonOutput->guisection = _("Output");
+
     parm.incidout = G_define_option();
     parm.incidout->key = "incidout";
     parm.incidout->type = TYPE_STRING;
@@ -484,11 +510,50 @@ int main(int argc, char *argv[])
     parm.day = G_define_option();
     parm.day->key = "day";
     parm.day->type = TYPE_INTEGER;
-    parm.day->required = YES;
+    parm.day->required = NO;
     parm.day->description = _("No. of day of the year (1-365)");
     parm.day->options = "1-365";
     parm.day->guisection = _("Time");
 
+    parm.startDay = G_define_option();
+    parm.startDay->key = "start_day";
+    parm.startDay->type = TYPE_INTEGER;
+    parm.startDay->required = NO;
+    parm.startDay->description =
+        _("First day of the year of a multi-day series (1-365)");
+    parm.startDay->options = "1-365";
+    parm.startDay->guisection = _("Time");
+
+    parm.endDay = G_define_option();
+    parm.endDay->key = "end_day";
+    parm.endDay->type = TYPE_INTEGER;
+    parm.endDay->required = NO;
+    parm.endDay->description =
+        _("Last day of the year of a multi-day series (1-365)");
+    parm.endDay->options = "1-365";
+    parm.endDay->guisection = _("Time");
+
+    parm.dayStep = G_define_option();
+    parm.dayStep->key = "day_step";
+    parm.dayStep->type = TYPE_INTEGER;
+    parm.dayStep->answer = DAY_STEP;
+    parm.dayStep->required = NO;
+    parm.dayStep->description = _("Step between days of a multi-day series");
+    parm.dayStep->options = "1-365";
+    parm.dayStep->guisection = _("Time");
+
+    parm.period = G_define_option();
+    parm.period->key = "period";
+    parm.period->type = TYPE_STRING;
+    parm.period->answer = "day";
+    parm.period->required = NO;
+    parm.period->options = "day,month";
+    parm.period->description = _("Output period of a multi-day series");
+    parm.period->descriptions =
+        _("day;One output map per computed day;"
+          "month;Monthly sums of the computed days (mode 2 only)");
+    parm.period->guisection = _("Time");
+
     parm.step = G_define_option();
     parm.step->key = "step";
     parm.step->type = TYPE_DOUBLE;
@@ -525,6 +590,19 @@ int main(int argc, char *argv[])
         _("Number of threads which will be used for parallel compute");
     parm.threads->guisection = _("Parameters");
 #endif
+
+    parm.kernel = G_define_option();
+    parm.kernel->key = "kernel";
+    parm.kernel->type = TYPE_STRING;
+    parm.kernel->answer = "scalar";
+    parm.kernel->required = NO;
+    parm.kernel->options = "scalar,vector";
+    parm.kernel->description = _("Irradiance kernel");
+    parm.kernel->descriptions =
+        _("scalar;One cell at a time;"
+          "vector;Chunks of cells of a row at once, vectorized "
+          "(not with shadows searched without horizons)");
+    parm.kernel->guisection = _("Parameters");
     /*
      * parm.startTime = G_define_option();
      * parm.startTime->key = "start_time";
@@ -574,6 +652,11 @@ int main(int argc, char *argv[])
     flag.saveMemory->description =
         _("Use the low-memory version of the program");
 
+    G_option_required(parm.day, parm.startDay, NULL);
+    G_option_exclusive(parm.day, parm.startDay, NULL);
+    G_option_exclusive(parm.declin, parm.startDay, NULL);
+    G_option_collective(parm.startDay, parm.endDay, NULL);
+
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
@@ -605,6 +688,7 @@ int main(int argc, char *argv[])
     longin = parm.longin->answer;
 
     civiltime = parm.civilTime->answer;
+    rowKernel = strcmp(parm.kernel->answer, "vector") == 0;
 #ifdef PARALLEL
     sscanf(parm.threads->answer, "%d", &threads);
     if (threads < 1) {
@@ -658,7 +742,18 @@ int main(int argc, char *argv[])
     if ((insol_time != NULL) && (incidout != NULL))
         G_fatal_error(_("insol_time and incidout are incompatible options"));
 
-    sscanf(parm.day->answer, "%d", &day);
+    if (parm.startDay->answer != NULL) {
+        sscanf(parm.startDay->answer, "%d", &startDay);
+        sscanf(parm.endDay->answer, "%d", &endDay);
+        sscanf(parm.dayStep->answer, "%d", &dayStep);
+        if (startDay > endDay)
+            G_fatal_error(_("start_day must not be greater than end_day"));
+        monthly = strcmp(parm.period->answer, "month") == 0;
+        day = startDay;
+    }
+    else {
+        sscanf(parm.day->answer, "%d", &day);
+    }
 
     if (sscanf(parm.step->answer, "%lf", &step) != 1)
         G_fatal_error(_("Error reading time step size"));
@@ -684,6 +779,9 @@ int main(int argc, char *argv[])
         if (insol_time != NULL)
             G_fatal_error(_("Time and insol_time are incompatible options"));
 
+        if (monthly)
+            G_fatal_error(_("Monthly sums require mode 2 (no time parameter)"));
+
         G_message(_("Mode 1: instantaneous solar incidence angle & irradiance "
                     "using a set local time"));
         sscanf(parm.ltime->answer, "%lf", &timo);
@@ -756,9 +854,31 @@ int main(int argc, char *argv[])
         cdh = DSKY;
     sscanf(parm.dist->answer, "%lf", &dist);
 
+    /* Without horizon maps, horizons are traced from the elevation once
+     * if a horizon step is given or for a multi-day series, and the shadows of
+     * all time steps are taken from them instead of searching the terrain at
+     * every time step. */
+    horizonOutput = parm.horizonOutput->answer;
+    if (useShadow() && !useHorizonData() &&
+        (parm.horizonstep->answer != NULL || parm.startDay->answer != NULL ||
+         horizonOutput != NULL)) {
+        traceHorizon = TRUE;
+        if (parm.horizonstep->answer == NULL) {
+            str_step = HORIZON_STEP;
+            sscanf(str_step, "%lf", &horizonStep);
+            setHorizonInterval(deg2rad * horizonStep);
+        }
+        G_message(_("Tracing horizons every %g degrees"), horizonStep);
+    }
+    else if (horizonOutput != NULL)
+        G_fatal_error(_("<%s> requires shadows computed from the elevation "
+                        "without horizon maps"),
+                      parm.horizonOutput->key);
+
     if (parm.numPartitions->answer != NULL) {
         sscanf(parm.numPartitions->answer, "%d", &numPartitions);
-        if (useShadow() && (!useHorizonData()) && (numPartitions != 1)) {
+        if (useShadow() && (!useHorizonData()) && !traceHorizon &&
+            (numPartitions != 1)) {
             /* If you calculate shadows on the fly, the number of partitions
              * must be one.
              */
@@ -774,7 +894,7 @@ int main(int argc, char *argv[])
      * on the fly. If you calculate without shadow effects or if you have the
      * shadows pre-calculated, there is no problem. */
 
-    if (saveMemory && useShadow() && (!useHorizonData()))
+    if (saveMemory && useShadow() && (!useHorizonData()) && !traceHorizon)
         G_fatal_error(_("If you want to save memory and to use shadows, "
                         "you must use pre-calculated horizons."));
 
@@ -801,6 +921,9 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (traceHorizon)
+        arrayNumInt = (int)(360. / horizonStep);
+
     if (ttime != NULL) {
 
         tim = (timo - 12) * 15;
@@ -854,10 +977,23 @@ int main(int argc, char *argv[])
     if ((G_projection() == PROJECTION_LL))
         ll_correction = TRUE;
 
-    G_debug(3, "calculate() starts...");
-    calculate(singleSlope, singleAspect, singleAlbedo, singleLinke, gridGeom);
-    G_debug(3, "OUTGR() starts...");
-    OUTGR();
+    if (horizonOutput != NULL) {
+        G_debug(3, "save_horizons() starts...");
+        save_horizons(gridGeom);
+    }
+
+    if (parm.startDay->answer != NULL) {
+        G_debug(3, "calculate_days() starts...");
+        calculate_days(singleSlope, singleAspect, singleAlbedo, singleLinke,
+                       gridGeom);
+    }
+    else {
+        G_debug(3, "calculate() starts...");
+        calculate(singleSlope, singleAspect, singleAlbedo, singleLinke,
+                  gridGeom);
+        G_debug(3, "OUTGR() starts...");
+        OUTGR();
+    }
 #ifdef PARALLEL
     printTimeDiff("M4");
 #endif
@@ -1026,7 +1162,7 @@ int INPUT_part(int offset, double *zmax)
         fr2 = Rast_open_old(coefdh, "");
     }
 
-    if (useHorizonData()) {
+    if (horizon != NULL) {
         if (horizonarray == NULL) {
             horizonarray = (unsigned char *)G_calloc(arrayNumInt * numRows * n,
                                                      sizeof(char));
@@ -1079,7 +1215,7 @@ int INPUT_part(int offset, double *zmax)
      * }
      */
 
-    if (useHorizonData()) {
+    if (horizon != NULL) {
 
         for (i = 0; i < arrayNumInt; i++) {
             for (row = m - offset - 1; row >= finalRow; row--) {
@@ -1221,7 +1357,7 @@ int INPUT_part(int offset, double *zmax)
         Rast_close(fr2);
     }
 
-    if (useHorizonData()) {
+    if (horizon != NULL) {
         for (i = 0; i < arrayNumInt; i++) {
             Rast_close(fd_shad[i]);
             G_free(horizonbuf[i]);
@@ -1768,7 +1904,8 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     double dayRad;
     double latid_l, cos_u, cos_v, sin_u, sin_v;
     double sin_phi_l, tan_lam_l;
-    double zmax;
+    /* kept for the later days of a multi-day series */
+    static double zmax = -BIG;
     double longitTime = 0.;
     double locTimeOffset;
     double latitude, longitude;
@@ -1863,7 +2000,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     //                 globrad[j][i] = UNDEFZ;
     //         }
     //     }
-    if (incidout != NULL) {
+    if (incidout != NULL && lumcl == NULL) {
         lumcl = (float **)G_calloc((m), sizeof(float *));
         for (l = 0; l < m; l++) {
             lumcl[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1874,7 +2011,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
         }
     }
 
-    if (beam_rad != NULL) {
+    if (beam_rad != NULL && beam == NULL) {
         beam = (float **)G_calloc((m), sizeof(float *));
         for (l = 0; l < m; l++) {
             beam[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1886,7 +2023,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
         }
     }
 
-    if (insol_time != NULL) {
+    if (insol_time != NULL && insol == NULL) {
         insol = (float **)G_calloc((m), sizeof(float *));
         for (l = 0; l < m; l++) {
             insol[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1898,7 +2035,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
         }
     }
 
-    if (diff_rad != NULL) {
+    if (diff_rad != NULL && diff == NULL) {
         diff = (float **)G_calloc((m), sizeof(float *));
         for (l = 0; l < m; l++) {
             diff[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1910,7 +2047,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
         }
     }
 
-    if (refl_rad != NULL) {
+    if (refl_rad != NULL && refl == NULL) {
         refl = (float **)G_calloc((m), sizeof(float *));
         for (l = 0; l < m; l++) {
             refl[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1922,7 +2059,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
         }
     }
 
-    if (glob_rad != NULL) {
+    if (glob_rad != NULL && globrad == NULL) {
         globrad = (float **)G_calloc((m), sizeof(float *));
         for (l = 0; l < m; l++) {
             globrad[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1957,16 +2094,27 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     printTimeDiff("M2");
 #endif
     int shadowoffset_base = shadowoffset;
+    int vectorRow, rowChunk;
     for (j = 0; j < m; j++) {
         G_percent(j, m - 1, 2);
 
         if (j % (numRows) == 0) {
-            INPUT_part(j, &zmax);
+            /* a single partition is read only once for all days */
+            if (numPartitions > 1 || z == NULL)
+                INPUT_part(j, &zmax);
+            if (traceHorizon) {
+                trace_partition(j, gridGeom, zmax);
+                setUseHorizonData(TRUE);
+            }
             arrayOffset = 0;
             shadowoffset = 0;
         }
         sunVarGeom.zmax = zmax;
         shadowoffset_base = (j % (numRows)) * n * arrayNumInt;
+        /* the vector kernel cannot search shadows without horizons */
+        vectorRow =
+            rowKernel && someRadiation && (!useShadow() || useHorizonData());
+        rowChunk = vectorRow ? ROW_CHUNK : 1;
 #pragma omp parallel firstprivate(                                           \
         q1, tan_lam_l, z1, i, shadowoffset, longitTime, coslat, coslatsq,    \
             func, latitude, longitude, sin_phi_l, latid_l, sin_u, cos_u,     \
@@ -1976,7 +2124,10 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
             insol_time, diff_rad, refl_rad, glob_rad, mapset, per, decimals, \
             str_step)
         {
-#pragma omp for schedule(dynamic)
+            struct SunRowCells *rowCells =
+                vectorRow ? alloc_row_cells(ROW_CHUNK) : NULL;
+
+#pragma omp for schedule(dynamic, rowChunk)
             for (i = 0; i < n; i++) {
                 shadowoffset = shadowoffset_base + (arrayNumInt * i);
                 // G_message("\n tid: %d", omp_get_thread_num());
@@ -2123,7 +2274,11 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
                     double Prefl_e = 0.;
                     double Pinsol_t = 0.;
 
-                    if (someRadiation) {
+                    if (rowCells != NULL)
+                        add_row_cell(rowCells, i, &sunGeom, &sunVarGeom,
+                                     &sunSlopeGeom, &sunRadVar,
+                                     horizonarray + shadowoffset);
+                    else if (someRadiation) {
                         joules2(
                             &sunGeom, &sunVarGeom, &sunSlopeGeom, &sunRadVar,
                             &gridGeom, horizonarray + shadowoffset, latitude,
@@ -2144,7 +2299,15 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 
                 } /* undefs */
                   // shadowoffset += arrayNumInt;
+
+                /* chunks of the dynamic schedule end at multiples of
+                 * rowChunk */
+                if (rowCells != NULL && rowCells->ncells > 0 &&
+                    ((i + 1) % rowChunk == 0 || i == n - 1))
+                    store_row_cells(rowCells, j);
             }
+            if (rowCells != NULL)
+                free_row_cells(rowCells);
         }
         arrayOffset++;
     }
@@ -2255,6 +2418,374 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 
 } /* End of ) function */
 
+/* evaluates the cells of row j collected for the vector kernel and stores
+ * the results like after joules2() */
+static void store_row_cells(struct SunRowCells *rc, int j)
+{
+    int k;
+
+    joules2_row(rc, ttime == NULL, step,
+                (diff_rad != NULL) || (refl_rad != NULL) || (glob_rad != NULL));
+
+    for (k = 0; k < rc->ncells; k++) {
+        int i = rc->col[k];
+
+        if (beam_rad != NULL)
+            beam[j][i] = (float)rc->beam_e[k];
+        if (insol_time != NULL)
+            insol[j][i] = (float)rc->insol_t[k];
+        if (diff_rad != NULL)
+            diff[j][i] = (float)rc->diff_e[k];
+        if (refl_rad != NULL)
+            refl[j][i] = (float)rc->refl_e[k];
+        if (glob_rad != NULL)
+            globrad[j][i] =
+                (float)(rc->beam_e[k] + rc->diff_e[k] + rc->refl_e[k]);
+    }
+    rc->ncells = 0;
+}
+
+/* returns the month (0-11) of a day of a non-leap year */
+static int day_month(int no_of_day)
+{
+    static const int month_end[12] = {31,  59,  90,  120, 151, 181,
+                                      212, 243, 273, 304, 334, 365};
+    int i;
+
+    for (i = 0; i < 11 && no_of_day > month_end[i]; i++)
+        ;
+
+    return i;
+}
+
+#define NUM_OUTPUTS 6
+
+/* Computes every day_step-th day from start_day to end_day with the input
+ * maps and horizons loaded only once. Each output is written as a series of
+ * <name>_<day> maps or, with period=month, as <name>_<month> maps of the sums
+ * of the computed days in each month. */
+void calculate_days(double singleSlope, double singleAspect,
+                    double singleAlbedo, double singleLinke,
+                    struct GridGeometry gridGeom)
+{
+    const char **outputs[NUM_OUTPUTS] = {&incidout, &beam_rad, &insol_time,
+                                         &diff_rad, &refl_rad, &glob_rad};
+    float ***grids[NUM_OUTPUTS] = {&lumcl, &beam, &insol,
+                                   &diff,  &refl, &globrad};
+    const char *basenames[NUM_OUTPUTS];
+    char *names[NUM_OUTPUTS];
+    float **sums[NUM_OUTPUTS];
+    float **swap;
+    int firstDay = startDay;
+    int i, j, k;
+
+    for (k = 0; k < NUM_OUTPUTS; k++) {
+        basenames[k] = *outputs[k];
+        names[k] = NULL;
+        sums[k] = NULL;
+        if (monthly && basenames[k] != NULL)
+            sums[k] = G_alloc_fmatrix(m, n);
+    }
+
+    for (day = startDay; day <= endDay; day += dayStep) {
+        int lastDay = day + dayStep > endDay ||
+                      day_month(day + dayStep) != day_month(day);
+
+        G_message(_("Day %d"), day);
+
+        for (k = 0; k < NUM_OUTPUTS; k++) {
+            if (basenames[k] == NULL)
+                continue;
+            names[k] = G_generate_basename(
+                basenames[k], monthly ? day_month(day) + 1 : day,
+                monthly ? 2 : 3, 0);
+            *outputs[k] = names[k];
+        }
+
+        declination = com_declin(day);
+        sunrise_min = 24.;
+        sunrise_max = 0.;
+        sunset_min = 24.;
+        sunset_max = 0.;
+        calculate(singleSlope, singleAspect, singleAlbedo, singleLinke,
+                  gridGeom);
+
+        if (!monthly)
+            OUTGR();
+        else {
+            for (k = 0; k < NUM_OUTPUTS; k++) {
+                float **grid = *grids[k];
+
+                if (sums[k] == NULL)
+                    continue;
+                for (j = 0; j < m; j++)
+                    for (i = 0; i < n; i++) {
+                        if (grid[j][i] == UNDEFZ)
+                            sums[k][j][i] = UNDEFZ;
+                        else
+                            sums[k][j][i] += grid[j][i];
+                    }
+            }
+
+            if (lastDay) {
+                Rast_append_format_history(
+                    &hist, " Days [1-365]:                             %d-%d",
+                    firstDay, day);
+                for (k = 0; k < NUM_OUTPUTS; k++) {
+                    if (sums[k] == NULL)
+                        continue;
+                    swap = *grids[k];
+                    *grids[k] = sums[k];
+                    sums[k] = swap;
+                }
+                OUTGR();
+                for (k = 0; k < NUM_OUTPUTS; k++) {
+                    if (sums[k] == NULL)
+                        continue;
+                    swap = *grids[k];
+                    *grids[k] = sums[k];
+                    sums[k] = swap;
+                    for (j = 0; j < m; j++)
+                        for (i = 0; i < n; i++)
+                            sums[k][j][i] = 0.;
+                }
+                firstDay = day + dayStep;
+            }
+        }
+
+        for (k = 0; k < NUM_OUTPUTS; k++) {
+            if (names[k] == NULL)
+                continue;
+            G_free(names[k]);
+            names[k] = NULL;
+        }
+    }
+
+    for (k = 0; k < NUM_OUTPUTS; k++) {
+        *outputs[k] = basenames[k];
+        if (sums[k] != NULL)
+            G_free_fmatrix(sums[k]);
+    }
+}
+
+/* Traces the horizons of numRows rows of dem starting at offset in
+ * arrayNumInt directions starting due east and stores them in horizons the
+ * same way as horizon maps are read into horizonarray, so that lumcline2()
+ * finds the shadows of all time steps without searching(). The terrain is
+ * sampled like in searching(): every stepxy, taking the nearest grid point
+ * and stopping at nulls, at the region boundary or when nothing higher than
+ * zmax can shade the cell. Horizons below the flat horizon are stored as 0. */
+void trace_horizons(float **dem, int offset, int numRows,
+                    unsigned char *horizons, struct GridGeometry gridGeom,
+                    double zmax)
+{
+    int row;
+
+#pragma omp parallel for schedule(dynamic)
+    for (row = offset; row < offset + numRows; row++) {
+        unsigned char *horizonpointer =
+            horizons + (size_t)arrayNumInt * n * (row - offset);
+        double yg0 = (double)row * gridGeom.stepy;
+        double rowcoslatsq = 1.;
+        int col, k;
+
+        if (ll_correction) {
+            double rowcoslat = cos(deg2rad * (ymin + yg0));
+
+            rowcoslatsq = rowcoslat * rowcoslat;
+        }
+
+        for (col = 0; col < n; col++, horizonpointer += arrayNumInt) {
+            double xg0 = (double)col * gridGeom.stepx;
+            double z_orig = dem[row][col];
+
+            if (z_orig == UNDEFZ)
+                continue;
+
+            for (k = 0; k < arrayNumInt; k++) {
+                double angle = k * getHorizonInterval();
+                double stepsinangle = gridGeom.stepxy * sin(angle);
+                double stepcosangle = gridGeom.stepxy * cos(angle);
+                double xx0 = xg0, yy0 = yg0;
+                double tanmax = 0.;
+
+                while (1) {
+                    double dx, dy, length, curvature_diff, zp;
+                    int i, j;
+
+                    xx0 += stepcosangle;
+                    yy0 += stepsinangle;
+                    if (xx0 + 0.5 * gridGeom.stepx < 0 ||
+                        xx0 + 0.5 * gridGeom.stepx > gridGeom.deltx ||
+                        yy0 + 0.5 * gridGeom.stepy < 0 ||
+                        yy0 + 0.5 * gridGeom.stepy > gridGeom.delty)
+                        break;
+
+                    i = (int)(xx0 * invstepx + offsetx);
+                    j = (int)(yy0 * invstepy + offsety);
+                    if (i > n - 1 || j > m - 1)
+                        break;
+                    if ((zp = dem[j][i]) == UNDEFZ)
+                        break;
+
+                    dx = (double)i * gridGeom.stepx - xg0;
+                    dy = (double)j * gridGeom.stepy - yg0;
+                    if (ll_correction)
+                        length = DEGREEINMETERS *
+                                 sqrt(rowcoslatsq * dx * dx + dy * dy);
+                    else
+                        length = sqrt(dx * dx + dy * dy);
+                    if (length <= 0.)
+                        continue;
+
+                    curvature_diff =
+                        EARTHRADIUS * (1. - cos(length / EARTHRADIUS));
+                    if (zp - z_orig - curvature_diff > tanmax * length)
+                        tanmax = (zp - z_orig - curvature_diff) / length;
+                    if (z_orig + curvature_diff + tanmax * length > zmax)
+                        break;
+                }
+
+                horizonpointer[k] = (unsigned char)rint(
+                    SCALING_FACTOR * AMIN1(atan(tanmax), 255 * invScale));
+            }
+        }
+    }
+}
+
+/* reads the whole elevation in the row order of z for tracing horizons of
+ * partitioned input */
+static float **read_elevation(double *zmax)
+{
+    float **dem = G_alloc_fmatrix(m, n);
+    FCELL *cell = Rast_allocate_f_buf();
+    int fd = Rast_open_old(elevin, "");
+    int row, j;
+
+    if (!dem)
+        G_fatal_error(_("Out of memory"));
+
+    for (row = 0; row < m; row++) {
+        float *demrow = dem[m - row - 1];
+
+        Rast_get_f_row(fd, cell, row);
+        for (j = 0; j < n; j++) {
+            if (Rast_is_f_null_value(cell + j))
+                demrow[j] = UNDEFZ;
+            else {
+                demrow[j] = (float)cell[j];
+                *zmax = AMAX1(*zmax, demrow[j]);
+            }
+        }
+    }
+
+    Rast_close(fd);
+    G_free(cell);
+
+    return dem;
+}
+
+/* Traces the horizons of the partition starting at offset into horizonarray.
+ * Without partitions, all horizons are traced once from z; otherwise, the
+ * whole elevation is kept in memory for tracing, which is still much less
+ * than horizons of all partitions. */
+static void trace_partition(int offset, struct GridGeometry gridGeom,
+                            double zmax)
+{
+    static float **dem = NULL;
+    static double demmax = -BIG;
+    int numRows = m / numPartitions;
+
+    if (numPartitions == 1) {
+        if (horizonarray == NULL) {
+            horizonarray = (unsigned char *)G_calloc(
+                (size_t)arrayNumInt * m * n, sizeof(char));
+            G_message(_("Tracing horizons in %d directions..."), arrayNumInt);
+            trace_horizons(z, 0, m, horizonarray, gridGeom, zmax);
+        }
+        return;
+    }
+
+    if (dem == NULL)
+        dem = read_elevation(&demmax);
+    if (horizonarray == NULL)
+        horizonarray = (unsigned char *)G_calloc(
+            (size_t)arrayNumInt * numRows * n, sizeof(char));
+
+    trace_horizons(dem, offset, AMIN1(numRows, m - offset), horizonarray,
+                   gridGeom, demmax);
+}
+
+/* Traces the horizons in blocks of rows like the partitions and writes them
+ * as horizon maps <horizon_output>_<angle> in radians, which can be used as
+ * horizon_basename in later runs. Without partitions, the traced horizons
+ * are also kept for the calculation; otherwise, the calculation reads the
+ * saved maps one partition at a time. */
+void save_horizons(struct GridGeometry gridGeom)
+{
+    int numRows = m / numPartitions;
+    size_t rowBytes = (size_t)arrayNumInt * n;
+    int *fd_horizon = (int *)G_calloc(arrayNumInt, sizeof(int));
+    FCELL *cell = Rast_allocate_f_buf();
+    size_t horizonDecimals = G_get_num_decimals(str_step);
+    unsigned char *horizons;
+    float **dem;
+    double demmax = -BIG;
+    int start, end, row, i, j;
+
+    for (i = 0; i < arrayNumInt; i++) {
+        char *name = G_generate_basename(horizonOutput, i * horizonStep, 3,
+                                         horizonDecimals);
+
+        fd_horizon[i] = Rast_open_fp_new(name);
+        G_free(name);
+    }
+
+    dem = read_elevation(&demmax);
+    horizons = (unsigned char *)G_calloc(
+        rowBytes * (numPartitions == 1 ? m : numRows), sizeof(char));
+
+    G_message(_("Tracing horizons in %d directions..."), arrayNumInt);
+    /* maps are written from north, the last row of z */
+    for (end = m; end > 0; end -= numRows) {
+        start = end > numRows ? end - numRows : 0;
+        trace_horizons(dem, start, end - start, horizons, gridGeom, demmax);
+
+        for (row = end - 1; row >= start; row--) {
+            unsigned char *horizonpointer =
+                horizons + rowBytes * (row - start);
+
+            G_percent(m - row, m, 2);
+            for (i = 0; i < arrayNumInt; i++) {
+                const unsigned char *h = horizonpointer + i;
+
+                for (j = 0; j < n; j++) {
+                    if (dem[row][j] == UNDEFZ)
+                        Rast_set_f_null_value(cell + j, 1);
+                    else
+                        cell[j] = (FCELL)(invScale * h[(size_t)arrayNumInt * j]);
+                }
+                Rast_put_f_row(fd_horizon[i], cell);
+            }
+        }
+    }
+
+    for (i = 0; i < arrayNumInt; i++)
+        Rast_close(fd_horizon[i]);
+    G_free(fd_horizon);
+    G_free(cell);
+    G_free_fmatrix(dem);
+
+    if (numPartitions == 1)
+        horizonarray = horizons;
+    else {
+        G_free(horizons);
+        horizon = horizonOutput;
+        traceHorizon = FALSE;
+    }
+    setUseHorizonData(TRUE);
+}
+
 double com_declin(int no_of_day)
 {
     double d1, decl;
@@ -0,0 +1,364 @@
+/****************************************************************************
+ r.sun.mp: rsunrow.c. Row kernel evaluating the clear-sky irradiance of
+   joules2() for a chunk of cells of a row at once. The cells are stored as
+   a structure of arrays and every time step is evaluated over all cells, so
+   the compiler can vectorize the cell loops.
+****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <grass/gis.h>
+#include "sunradstruct.h"
+#include "local_proto.h"
+#include "rsunglobals.h"
+
+static void sun_step(struct SunRowCells *rc, int diffuse);
+
+struct SunRowCells *alloc_row_cells(int size)
+{
+    struct SunRowCells *rc = G_malloc(sizeof *rc);
+
+    rc->size = size;
+    rc->ncells = 0;
+    rc->col = G_malloc(size * sizeof(int));
+    rc->firstStep = G_malloc(size * sizeof(int));
+    rc->lastStep = G_malloc(size * sizeof(int));
+    rc->sloped = G_malloc(size * sizeof(int));
+    rc->horizonpointer = G_malloc(size * sizeof(unsigned char *));
+
+#define ALLOC_ARRAY(a) rc->a = G_malloc(size * sizeof(double))
+    ALLOC_ARRAY(lum_C11);
+    ALLOC_ARRAY(lum_C13);
+    ALLOC_ARRAY(lum_C22);
+    ALLOC_ARRAY(lum_C31);
+    ALLOC_ARRAY(lum_C33);
+    ALLOC_ARRAY(sunrise_time);
+    ALLOC_ARRAY(sunset_time);
+    ALLOC_ARRAY(coslongit_l);
+    ALLOC_ARRAY(sinlongit_l);
+    ALLOC_ARRAY(lum_C31_l);
+    ALLOC_ARRAY(lum_C33_l);
+    ALLOC_ARRAY(aspect);
+    ALLOC_ARRAY(cosslope);
+    ALLOC_ARRAY(sinslope);
+    ALLOC_ARRAY(fg);
+    ALLOC_ARRAY(r_sky);
+    ALLOC_ARRAY(elevationCorr);
+    ALLOC_ARRAY(airMass2Linke);
+    ALLOC_ARRAY(tn);
+    ALLOC_ARRAY(A1);
+    ALLOC_ARRAY(A2);
+    ALLOC_ARRAY(A3);
+    ALLOC_ARRAY(cbh);
+    ALLOC_ARRAY(cdh);
+    ALLOC_ARRAY(alb);
+    ALLOC_ARRAY(costime);
+    ALLOC_ARRAY(sintime);
+    ALLOC_ARRAY(weight);
+    ALLOC_ARRAY(beam_e);
+    ALLOC_ARRAY(diff_e);
+    ALLOC_ARRAY(refl_e);
+    ALLOC_ARRAY(insol_t);
+#undef ALLOC_ARRAY
+
+    return rc;
+}
+
+void free_row_cells(struct SunRowCells *rc)
+{
+    G_free(rc->col);
+    G_free(rc->firstStep);
+    G_free(rc->lastStep);
+    G_free(rc->horizonpointer);
+    G_free(rc->lum_C11);
+    G_free(rc->lum_C13);
+    G_free(rc->lum_C22);
+    G_free(rc->lum_C31);
+    G_free(rc->lum_C33);
+    G_free(rc->sunrise_time);
+    G_free(rc->sunset_time);
+    G_free(rc->coslongit_l);
+    G_free(rc->sinlongit_l);
+    G_free(rc->lum_C31_l);
+    G_free(rc->lum_C33_l);
+    G_free(rc->aspect);
+    G_free(rc->sloped);
+    G_free(rc->cosslope);
+    G_free(rc->sinslope);
+    G_free(rc->fg);
+    G_free(rc->r_sky);
+    G_free(rc->elevationCorr);
+    G_free(rc->airMass2Linke);
+    G_free(rc->tn);
+    G_free(rc->A1);
+    G_free(rc->A2);
+    G_free(rc->A3);
+    G_free(rc->cbh);
+    G_free(rc->cdh);
+    G_free(rc->alb);
+    G_free(rc->costime);
+    G_free(rc->sintime);
+    G_free(rc->weight);
+    G_free(rc->beam_e);
+    G_free(rc->diff_e);
+    G_free(rc->refl_e);
+    G_free(rc->insol_t);
+    G_free(rc);
+}
+
+/* adds a cell prepared for joules2(); everything that does not change
+ * during the day is computed here once instead of at every time step */
+void add_row_cell(struct SunRowCells *rc, int col,
+                  struct SunGeometryConstDay *sunGeom,
+                  struct SunGeometryVarDay *sunVarGeom,
+                  struct SunGeometryVarSlope *sunSlopeGeom,
+                  struct SolarRadVar *sunRadVar, unsigned char *horizonpointer)
+{
+    int k = rc->ncells++;
+    double linke = sunRadVar->linke;
+    double slope = sunSlopeGeom->slope;
+    double A1b;
+
+    rc->col[k] = col;
+    rc->horizonpointer[k] = horizonpointer;
+    rc->G_norm_extra = sunRadVar->G_norm_extra;
+
+    rc->lum_C11[k] = sunGeom->lum_C11;
+    rc->lum_C13[k] = sunGeom->lum_C13;
+    rc->lum_C22[k] = sunGeom->lum_C22;
+    rc->lum_C31[k] = sunGeom->lum_C31;
+    rc->lum_C33[k] = sunGeom->lum_C33;
+    rc->sunrise_time[k] = sunGeom->sunrise_time;
+    rc->sunset_time[k] = sunGeom->sunset_time;
+    rc->costime[k] = cos(sunGeom->timeAngle);
+    rc->sintime[k] = sin(sunGeom->timeAngle);
+
+    /* cos(-timeAngle - longit_l) in lumcline2() */
+    rc->coslongit_l[k] = cos(sunSlopeGeom->longit_l);
+    rc->sinlongit_l[k] = sin(sunSlopeGeom->longit_l);
+    rc->lum_C31_l[k] = sunSlopeGeom->lum_C31_l;
+    rc->lum_C33_l[k] = sunSlopeGeom->lum_C33_l;
+
+    /* brad() */
+    rc->elevationCorr[k] = exp(-sunVarGeom->z_orig / 8434.5);
+    rc->airMass2Linke[k] = 0.8662 * linke;
+    rc->cbh[k] = sunRadVar->cbh;
+
+    /* drad() */
+    rc->aspect[k] = sunSlopeGeom->aspect;
+    rc->sloped[k] = sunSlopeGeom->aspect != UNDEF && slope != 0.;
+    rc->cosslope[k] = cos(slope);
+    rc->sinslope[k] = sin(slope);
+    rc->r_sky[k] = (1. + rc->cosslope[k]) / 2.;
+    rc->fg[k] = rc->sinslope[k] - slope * rc->cosslope[k] -
+                M_PI * sin(0.5 * slope) * sin(0.5 * slope);
+    rc->tn[k] = -0.015843 + linke * (0.030543 + 0.0003797 * linke);
+    A1b = 0.26463 + linke * (-0.061581 + 0.0031408 * linke);
+    rc->A1[k] = A1b * rc->tn[k] < 0.0022 ? 0.0022 / rc->tn[k] : A1b;
+    rc->A2[k] = 2.04020 + linke * (0.018945 - 0.011161 * linke);
+    rc->A3[k] = -1.3025 + linke * (0.039231 + 0.0085079 * linke);
+    rc->cdh[k] = sunRadVar->cdh;
+    rc->alb[k] = sunRadVar->alb;
+
+    rc->beam_e[k] = rc->diff_e[k] = rc->refl_e[k] = rc->insol_t[k] = 0.;
+}
+
+/* Computes the same sums as joules2() for all added cells; the caller resets
+ * ncells after taking the results. For all-day radiation, the time steps of
+ * all cells lie on the same grid of step hours, so the sine and cosine of the
+ * time angle are shared and cells before their sunrise or after their sunset
+ * get a zero weight. */
+void joules2_row(struct SunRowCells *rc, int allDay, double step, int diffuse)
+{
+    int k, s, firstStep = INT_MAX, lastStep = INT_MIN;
+
+    if (!allDay) {
+        for (k = 0; k < rc->ncells; k++)
+            rc->weight[k] = 1.;
+        sun_step(rc, diffuse);
+        return;
+    }
+
+    for (k = 0; k < rc->ncells; k++) {
+        int srStepNo = (int)(rc->sunrise_time[k] / step);
+        double firstAngle, lastAngle;
+
+        rc->firstStep[k] =
+            rc->sunrise_time[k] - srStepNo * step > 0.5 * step ? srStepNo + 1
+                                                                : srStepNo;
+        /* joules2() always does the first step and then steps until the
+         * time angle passes the sunset */
+        firstAngle = ((rc->firstStep[k] + 0.5) * step - 12) * HOURANGLE;
+        lastAngle = (rc->sunset_time[k] - 12) * HOURANGLE;
+        rc->lastStep[k] = rc->firstStep[k];
+        if (lastAngle > firstAngle)
+            rc->lastStep[k] +=
+                (int)((lastAngle - firstAngle) / (step * HOURANGLE));
+
+        if (rc->firstStep[k] < firstStep)
+            firstStep = rc->firstStep[k];
+        if (rc->lastStep[k] > lastStep)
+            lastStep = rc->lastStep[k];
+    }
+
+    for (s = firstStep; s <= lastStep; s++) {
+        double timeAngle = ((s + 0.5) * step - 12) * HOURANGLE;
+        double costime = cos(timeAngle), sintime = sin(timeAngle);
+
+#pragma omp simd
+        for (k = 0; k < rc->ncells; k++) {
+            rc->costime[k] = costime;
+            rc->sintime[k] = sintime;
+            rc->weight[k] =
+                s >= rc->firstStep[k] && s <= rc->lastStep[k] ? step : 0.;
+        }
+        sun_step(rc, diffuse);
+    }
+}
+
+/* one time step of com_par(), lumcline2(), brad() and drad() for all cells
+ * with a nonzero weight */
+static void sun_step(struct SunRowCells *rc, int diffuse)
+{
+    int shadowData = useShadow() && useHorizonData();
+    double horizonInterval = getHorizonInterval();
+    double G_norm_extra = rc->G_norm_extra;
+    int k;
+
+#pragma omp simd
+    for (k = 0; k < rc->ncells; k++) {
+        double sinSolarAltitude, solarAltitude, solarAzimuth;
+        double lum_Lx, lum_Ly, pom, s0, bh = 0.;
+        int isShadow = 0;
+
+        if (rc->weight[k] <= 0.)
+            continue;
+
+        /* com_par(); the altitude is positive exactly if its sine is */
+        sinSolarAltitude =
+            rc->lum_C31[k] * rc->costime[k] + rc->lum_C33[k];
+        if (sinSolarAltitude <= 0.)
+            continue;
+        solarAltitude = asin(sinSolarAltitude);
+
+        lum_Lx = -rc->lum_C22[k] * rc->sintime[k];
+        lum_Ly = rc->lum_C11[k] * rc->costime[k] + rc->lum_C13[k];
+        pom = sqrt(lum_Lx * lum_Lx + lum_Ly * lum_Ly);
+        if (pom > EPS) {
+            solarAzimuth = acos(lum_Ly / pom);
+            if (lum_Lx < 0)
+                solarAzimuth = pi2 - solarAzimuth;
+        }
+        else
+            solarAzimuth = UNDEF;
+
+        /* lumcline2() */
+        if (shadowData) {
+            unsigned char *horizonpointer = rc->horizonpointer[k];
+            double sunAzimuthAngle = solarAzimuth < 0.5 * M_PI
+                                         ? 0.5 * M_PI - solarAzimuth
+                                         : 2.5 * M_PI - solarAzimuth;
+            double horizPos = sunAzimuthAngle / horizonInterval;
+            int lowPos = (int)horizPos;
+            int highPos = lowPos + 1 == arrayNumInt ? 0 : lowPos + 1;
+            double frac = horizPos - lowPos;
+            double horizonHeight =
+                invScale * ((1. - frac) * horizonpointer[lowPos] +
+                            frac * horizonpointer[highPos]);
+
+            isShadow = horizonHeight > solarAltitude;
+        }
+        s0 = 0.;
+        if (!isShadow) {
+            /* cos(-timeAngle - longit_l) */
+            s0 = rc->lum_C31_l[k] * (rc->costime[k] * rc->coslongit_l[k] -
+                                     rc->sintime[k] * rc->sinlongit_l[k]) +
+                 rc->lum_C33_l[k];
+            if (s0 < 0.)
+                s0 = 0.;
+        }
+
+        /* brad() */
+        if (!isShadow && s0 > 0.) {
+            double temp1 =
+                0.1594 + solarAltitude * (1.123 + 0.065656 * solarAltitude);
+            double temp2 =
+                1. + solarAltitude * (28.9344 + 277.3971 * solarAltitude);
+            double h0refract = solarAltitude + 0.061359 * temp1 / temp2;
+            double opticalAirMass =
+                rc->elevationCorr[k] /
+                (sin(h0refract) +
+                 0.50572 * pow(h0refract * rad2deg + 6.07995, -1.6364));
+            double rayl =
+                opticalAirMass <= 20.
+                    ? 1. / (6.6296 +
+                            opticalAirMass *
+                                (1.7513 +
+                                 opticalAirMass *
+                                     (-0.1202 +
+                                      opticalAirMass *
+                                          (0.0065 - opticalAirMass * 0.00013))))
+                    : 1. / (10.4 + 0.718 * opticalAirMass);
+
+            bh = rc->cbh[k] * G_norm_extra * sinSolarAltitude *
+                 exp(-rayl * opticalAirMass * rc->airMass2Linke[k]);
+            rc->insol_t[k] += rc->weight[k];
+            rc->beam_e[k] += rc->weight[k] *
+                             (rc->sloped[k] ? bh * s0 / sinSolarAltitude : bh);
+        }
+
+        /* drad() */
+        if (diffuse) {
+            double fd = rc->A1[k] + rc->A2[k] * sinSolarAltitude +
+                        rc->A3[k] * sinSolarAltitude * sinSolarAltitude;
+            double dh = rc->cdh[k] * G_norm_extra * fd * rc->tn[k];
+
+            if (rc->sloped[k]) {
+                double kb = bh / (G_norm_extra * sinSolarAltitude);
+                double fg = rc->fg[k], r_sky = rc->r_sky[k], fx;
+
+                if (isShadow || s0 <= 0.)
+                    fx = r_sky + fg * 0.252271;
+                else if (solarAltitude >= 0.1)
+                    fx = ((0.00263 - kb * (0.712 + 0.6883 * kb)) * fg +
+                          r_sky) *
+                             (1. - kb) +
+                         kb * s0 / sinSolarAltitude;
+                else {
+                    double a_ln = solarAzimuth - rc->aspect[k];
+
+                    if (a_ln > M_PI)
+                        a_ln -= pi2;
+                    else if (a_ln < -M_PI)
+                        a_ln += pi2;
+                    fx = ((0.00263 - 0.712 * kb - 0.6883 * kb * kb) * fg +
+                          r_sky) *
+                             (1. - kb) +
+                         kb * rc->sinslope[k] * cos(a_ln) /
+                             (0.1 - 0.008 * solarAltitude);
+                }
+                rc->diff_e[k] += rc->weight[k] * dh * fx;
+                rc->refl_e[k] += rc->weight[k] * rc->alb[k] * (bh + dh) *
+                                 (1 - rc->cosslope[k]) / 2.;
+            }
+            else
+                rc->diff_e[k] += rc->weight[k] * dh;
+        }
+    }
+}
@@ -88,3 +88,47 @@ struct GridGeometry {
     double sinlat;
     double coslat;
 };
+
+/* cells of a row chunk for joules2_row(), stored as a structure of arrays */
+struct SunRowCells {
+    int size;
+    int ncells;
+    int *col;
+    int *firstStep;
+    int *lastStep;
+    unsigned char **horizonpointer;
+    double G_norm_extra;
+    double *lum_C11;
+    double *lum_C13;
+    double *lum_C22;
+    double *lum_C31;
+    double *lum_C33;
+    double *sunrise_time;
+    double *sunset_time;
+    double *coslongit_l;
+    double *sinlongit_l;
+    double *lum_C31_l;
+    double *lum_C33_l;
+    double *aspect;
+    int *sloped;
+    double *cosslope;
+    double *sinslope;
+    double *fg;
+    double *r_sky;
+    double *elevationCorr;
+    double *airMass2Linke;
+    double *tn;
+    double *A1;
+    double *A2;
+    double *A3;
+    double *cbh;
+    double *cdh;
+    double *alb;
+    double *costime;
+    double *sintime;
+    double *weight;
+    double *beam_e;
+    double *diff_e;
+    double *refl_e;
+    double *insol_t;
+};
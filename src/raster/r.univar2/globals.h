@@ -23,6 +23,17 @@
 #include <grass/glocale.h>
 
 /*- Parameters and global variables -----------------------------------------*/
+
+/* mergeable quantile sketch, items of level l have weight 2^l */
+typedef struct {
+    int k; /* a level is compacted when it has k items */
+    int n_levels;
+    double **items;
+    int *n;
+    int *n_alloc;
+    char *parity;
+} quantile_sketch;
+
 typedef struct {
     int zone;
     char *cat;
@@ -67,6 +78,7 @@ typedef struct {
 
     RASTER_MAP_TYPE map_type;
     DCELL *array;
+    quantile_sketch *sketch;
     void *nextp;
     int n_alloc;
 } univar_stat;
@@ -82,13 +94,14 @@ typedef struct {
 /* command line options are the same for raster and raster3d maps */
 typedef struct {
     struct Option *inputfile, *zonefile, *percentile, *tolerance, *output_file,
-        *separator;
+        *separator, *quantile_error, *nprocs;
     struct Flag *shell_style, *extended, *table;
     int n_perc;
     int *index_perc;
     double *quant_perc;
     double *perc;
     double tol;
+    int sketch_k; /* 0 to keep all values */
 } param_type;
 
 extern param_type param;
@@ -99,7 +112,10 @@ void heapsort_double(double *data, int n);
 void heapsort_float(float *data, int n);
 void heapsort_int(int *data, int n);
 
-int compute_stats(univar_stat *, double, int);
+void compute_stats(univar_stat *, double);
+void merge_stats(univar_stat *, univar_stat *);
+int stats_general(univar_stat *);
+int stats_extend(univar_stat *);
 
 /* int print_stats(univar_stat *); */
 int print_stats_table(univar_stat *);
@@ -107,4 +123,11 @@ int print_stats_table(univar_stat *);
 univar_stat *create_univar_stat_struct();
 void free_univar_stat_struct(univar_stat *stats);
 
+int sketch_size(double, double);
+quantile_sketch *sketch_create(int);
+void sketch_free(quantile_sketch *);
+void sketch_add(quantile_sketch *, double);
+void sketch_merge(quantile_sketch *, const quantile_sketch *);
+int sketch_sorted(const quantile_sketch *, double **, size_t **);
+
 #endif
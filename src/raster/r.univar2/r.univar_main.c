@@ -18,8 +18,16 @@
 
 #include <assert.h>
 #include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "globals.h"
 
+/* rows read at once and processed in parallel */
+#define BLOCK_ROWS 256
+/* rows with their own partial statistics, merged in row order */
+#define CHUNK_ROWS 16
+
 param_type param;
 zone_type zone_info;
 
@@ -63,6 +71,18 @@ void set_params()
                                      "to another when computing the mode");
     param.tolerance->guisection = _("Extended");
 
+    param.quantile_error = G_define_option();
+    param.quantile_error->key = "quantile_error";
+    param.quantile_error->type = TYPE_DOUBLE;
+    param.quantile_error->required = NO;
+    param.quantile_error->options = "0-1";
+    param.quantile_error->description =
+        _("Maximum relative rank error of percentiles (if given, percentiles "
+          "are estimated with bounded memory instead of storing all values)");
+    param.quantile_error->guisection = _("Extended");
+
+    param.nprocs = G_define_standard_option(G_OPT_M_NPROCS);
+
     param.separator = G_define_standard_option(G_OPT_F_SEP);
     param.separator->guisection = _("Formatting");
 
@@ -87,6 +107,7 @@ void set_params()
 
 static int open_raster(const char *infile);
 static univar_stat *univar_stat_with_percentiles();
+static void set_zones(univar_stat *stats, int rasters);
 static void process_raster(univar_stat *stats, int fd, int fdz,
                            const struct Cell_head *region);
 static void init_zones(int fdz, const struct Cell_head *region);
@@ -141,7 +162,8 @@ int main(int argc, char *argv[])
     struct GModule *module;
     univar_stat *stats;
     char **p, *z;
-    int fd, fdz, cell_type, min, max;
+    int fd, fdz, cell_type, min, max, z_idx;
+    int nprocs;
     struct Range zone_range;
     const char *mapset, *name;
 
@@ -170,6 +192,21 @@ int main(int argc, char *argv[])
 
     G_get_window(&region);
 
+#ifdef _OPENMP
+    nprocs = atoi(param.nprocs->answer);
+    if (nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), param.nprocs->key);
+    omp_set_num_threads(nprocs);
+#pragma omp parallel
+#pragma omp single
+    nprocs = omp_get_num_threads();
+    G_message(n_("Using %d thread for serial computation",
+                 "Using %d threads for parallel computation", nprocs),
+              nprocs);
+#else
+    nprocs = 1;
+#endif
+
     /* table field separator */
     zone_info.sep = param.separator->answer;
     if (strcmp(zone_info.sep, "\\t") == 0)
@@ -215,10 +252,23 @@ int main(int argc, char *argv[])
     for (p = (char **)param.inputfile->answers, rasters = 0; *p; p++, rasters++)
         ;
 
+    param.sketch_k = 0;
+    if (param.quantile_error->answer) {
+        double error = atof(param.quantile_error->answer);
+
+        if (error <= 0 || error >= 1)
+            G_fatal_error(_("<%s> must be between 0 and 1"),
+                          param.quantile_error->key);
+        param.sketch_k = sketch_size(error, (double)region.rows *
+                                                region.cols * rasters);
+    }
+
     /* process all input rasters */
     int map_type = param.extended->answer ? -2 : -1;
 
     stats = ((map_type == -1) ? create_univar_stat_struct(-1, 0) : 0);
+    if (stats)
+        set_zones(stats, rasters);
 
     for (p = param.inputfile->answers; *p; p++) {
         fd = open_raster(*p);
@@ -233,6 +283,7 @@ int main(int argc, char *argv[])
                 assert(stats == 0);
                 map_type = this_type;
                 stats = univar_stat_with_percentiles(map_type);
+                set_zones(stats, rasters);
             }
             else if (this_type != map_type) {
                 G_fatal_error(_("Raster <%s> type mismatch"), *p);
@@ -244,6 +295,15 @@ int main(int argc, char *argv[])
         Rast_close(fd);
     }
 
+    /* finish the statistics of all zones */
+    for (z_idx = 0; z_idx < zone_info.n_zones; z_idx++) {
+        if (stats[z_idx].n == 0)
+            continue;
+        stats_general(&stats[z_idx]);
+        if (param.extended->answer)
+            stats_extend(&stats[z_idx]);
+    }
+
     /* close zoning raster */
     if (z)
         Rast_close(fdz);
@@ -297,79 +357,121 @@ static univar_stat *univar_stat_with_percentiles()
 
     stats = create_univar_stat_struct();
     for (z = 0; z < n_zones; z++) {
-        stats[z].size = zone_info.len[z];
-        stats[z].zone = z + zone_info.min;
-        stats[z].cat = Rast_get_c_cat(&stats[z].zone, &(zone_info.cats));
         stats[z].perc = (double *)G_calloc(n_perc, sizeof(double));
     }
     return stats;
 }
 
-static void process_raster(univar_stat *stats, int fd, int fdz,
-                           const struct Cell_head *region)
+static void set_zones(univar_stat *stats, int rasters)
 {
-    /* use G_window_rows(), G_window_cols() here? */
-    const unsigned int rows = region->rows;
-    const unsigned int cols = region->cols;
+    unsigned int z;
+    unsigned int n_zones = zone_info.n_zones;
 
-    const RASTER_MAP_TYPE map_type = Rast_get_map_type(fd);
-    const size_t value_sz = Rast_cell_size(map_type);
-    unsigned int row;
-    void *raster_row;
-    CELL *zoneraster_row;
+    for (z = 0; z < n_zones; z++) {
+        stats[z].size = zone_info.len[z] * rasters;
+        stats[z].zone = z + zone_info.min;
+        stats[z].cat = Rast_get_c_cat(&stats[z].zone, &(zone_info.cats));
+    }
+}
 
-    raster_row = Rast_allocate_buf(map_type);
-    zoneraster_row = Rast_allocate_c_buf();
+static void process_row(univar_stat *stats, void *ptr, CELL *zptr,
+                        unsigned int cols, RASTER_MAP_TYPE map_type,
+                        size_t value_sz)
+{
+    unsigned int col;
 
-    for (row = 0; row < rows; row++) {
-        void *ptr;
-        CELL *zptr;
-        unsigned int col;
+    for (col = 0; col < cols; col++) {
+        double val;
+        int zone = 0;
 
-        Rast_get_row(fd, raster_row, row, map_type);
-        Rast_get_c_row(fdz, zoneraster_row, row);
-        zptr = zoneraster_row;
+        if (Rast_is_c_null_value(zptr)) {
+            ptr = G_incr_void_ptr(ptr, value_sz);
+            zptr++;
+            continue;
+        }
+        zone = *zptr - zone_info.min;
 
-        ptr = raster_row;
+        /* can't do stats with NULL cells in input map */
+        if (Rast_is_null_value(ptr, map_type)) {
+            ptr = G_incr_void_ptr(ptr, value_sz);
+            zptr++;
+            continue;
+        }
 
-        for (col = 0; col < cols; col++) {
-            double val;
-            int zone = 0;
+        val = ((map_type == DCELL_TYPE)   ? *((DCELL *)ptr)
+               : (map_type == FCELL_TYPE) ? *((FCELL *)ptr)
+                                          : *((CELL *)ptr));
 
-            if (Rast_is_c_null_value(zptr)) {
-                ptr = G_incr_void_ptr(ptr, value_sz);
-                zptr++;
-                continue;
-            }
-            zone = *zptr - zone_info.min;
-            /* count all including NULL cells in input map */
-            /*stats[zone].size++;
-             G _debug(3, "Col: %u, zone: %d", col, zone); */
+        compute_stats(&stats[zone], val);
 
-            /* can't do stats with NULL cells in input map */
-            if (Rast_is_null_value(ptr, map_type)) {
-                ptr = G_incr_void_ptr(ptr, value_sz);
-                zptr++;
-                continue;
-            }
+        ptr = G_incr_void_ptr(ptr, value_sz);
+        zptr++;
+    }
+}
 
-            if (param.extended->answer && stats[zone].array == NULL) {
-                stats[zone].n_alloc = zone_info.len[zone] + 1;
-                stats[zone].array =
-                    (DCELL *)G_calloc(stats[zone].n_alloc, sizeof(DCELL));
-            }
+static void process_raster(univar_stat *stats, int fd, int fdz,
+                           const struct Cell_head *region)
+{
+    /* use G_window_rows(), G_window_cols() here? */
+    const unsigned int rows = region->rows;
+    const unsigned int cols = region->cols;
 
-            val = ((map_type == DCELL_TYPE)   ? *((DCELL *)ptr)
-                   : (map_type == FCELL_TYPE) ? *((FCELL *)ptr)
-                                              : *((CELL *)ptr));
+    const RASTER_MAP_TYPE map_type = Rast_get_map_type(fd);
+    const size_t value_sz = Rast_cell_size(map_type);
+    unsigned int row, row1, row2;
+    int chunk, n_chunks, z;
+    void *raster_rows;
+    CELL *zoneraster_rows;
+    univar_stat *partial[BLOCK_ROWS / CHUNK_ROWS];
+
+    raster_rows = G_malloc((size_t)BLOCK_ROWS * cols * value_sz);
+    zoneraster_rows = G_malloc((size_t)BLOCK_ROWS * cols * sizeof(CELL));
+
+    for (row1 = 0; row1 < rows; row1 += BLOCK_ROWS) {
+        row2 = row1 + BLOCK_ROWS;
+        if (row2 > rows)
+            row2 = rows;
+
+        /* rows are read sequentially */
+        for (row = row1; row < row2; row++) {
+            Rast_get_row(fd,
+                         G_incr_void_ptr(raster_rows, (size_t)(row - row1) *
+                                                          cols * value_sz),
+                         row, map_type);
+            Rast_get_c_row(fdz, zoneraster_rows + (size_t)(row - row1) * cols,
+                           row);
+        }
 
-            compute_stats(&stats[zone], val, zone_info.len[zone]);
+        /* each chunk of rows collects its own statistics, merged in row
+         * order, such that results do not depend on the number of threads */
+        n_chunks = (row2 - row1 + CHUNK_ROWS - 1) / CHUNK_ROWS;
+        for (chunk = 0; chunk < n_chunks; chunk++)
+            partial[chunk] = create_univar_stat_struct();
+
+#pragma omp parallel for schedule(dynamic) private(row)
+        for (chunk = 0; chunk < n_chunks; chunk++) {
+            unsigned int crow2 = row1 + (chunk + 1) * CHUNK_ROWS;
+
+            if (crow2 > row2)
+                crow2 = row2;
+            for (row = row1 + chunk * CHUNK_ROWS; row < crow2; row++) {
+                process_row(partial[chunk],
+                            G_incr_void_ptr(raster_rows, (size_t)(row - row1) *
+                                                             cols * value_sz),
+                            zoneraster_rows + (size_t)(row - row1) * cols,
+                            cols, map_type, value_sz);
+            }
+        }
 
-            ptr = G_incr_void_ptr(ptr, value_sz);
-            zptr++;
+        for (chunk = 0; chunk < n_chunks; chunk++) {
+            for (z = 0; z < zone_info.n_zones; z++)
+                merge_stats(&stats[z], &partial[chunk][z]);
+            G_free(partial[chunk]);
         }
-        G_percent(row, rows, 2);
+        G_percent(row2, rows, 2);
     }
-    G_percent(rows, rows, 2);
+
+    G_free(raster_rows);
+    G_free(zoneraster_rows);
     return;
 }
@@ -0,0 +1,190 @@
+/*
+ *  Mergeable quantile sketch with bounded memory
+ *
+ *   Copyright (C) 2004-2010 by the GRASS Development Team
+ *
+ *      This program is free software under the GNU General Public
+ *      License (>=v2). Read the file COPYING that comes with GRASS
+ *      for details.
+ *
+ *   Values are collected in levels. When a level is full, it is sorted
+ *   and every other value is moved to the next level with double weight
+ *   (alternating between odd and even positions), so that the total
+ *   weight is kept. Two sketches are merged by merging their levels.
+ */
+
+#include "globals.h"
+
+typedef struct {
+    double value;
+    size_t weight;
+} weighted_value;
+
+/* *************************************************************** */
+/* **** size of levels for given relative rank error ************* */
+/* *************************************************************** */
+int sketch_size(double error, double n)
+{
+    int levels, k;
+
+    /* each level adds a rank error of at most 2 n / k */
+    levels = n > 2 ? (int)ceil(log(n) / log(2.0)) : 1;
+    k = (int)ceil(2.0 * levels / error);
+    if (k < 2)
+        k = 2;
+    return k + k % 2;
+}
+
+quantile_sketch *sketch_create(int k)
+{
+    quantile_sketch *sketch;
+
+    sketch = (quantile_sketch *)G_malloc(sizeof(quantile_sketch));
+    sketch->k = k;
+    sketch->n_levels = 0;
+    sketch->items = NULL;
+    sketch->n = NULL;
+    sketch->n_alloc = NULL;
+    sketch->parity = NULL;
+
+    return sketch;
+}
+
+void sketch_free(quantile_sketch *sketch)
+{
+    int l;
+
+    for (l = 0; l < sketch->n_levels; l++)
+        G_free(sketch->items[l]);
+    G_free(sketch->items);
+    G_free(sketch->n);
+    G_free(sketch->n_alloc);
+    G_free(sketch->parity);
+    G_free(sketch);
+}
+
+static void add_level(quantile_sketch *sketch)
+{
+    int l = sketch->n_levels++;
+
+    sketch->items = (double **)G_realloc(sketch->items,
+                                         sketch->n_levels * sizeof(double *));
+    sketch->n = (int *)G_realloc(sketch->n, sketch->n_levels * sizeof(int));
+    sketch->n_alloc =
+        (int *)G_realloc(sketch->n_alloc, sketch->n_levels * sizeof(int));
+    sketch->parity =
+        (char *)G_realloc(sketch->parity, sketch->n_levels * sizeof(char));
+    sketch->items[l] = NULL;
+    sketch->n[l] = 0;
+    sketch->n_alloc[l] = 0;
+    sketch->parity[l] = 0;
+}
+
+static void level_add(quantile_sketch *sketch, int l, double value)
+{
+    if (sketch->n[l] == sketch->n_alloc[l]) {
+        sketch->n_alloc[l] = sketch->n_alloc[l] ? 2 * sketch->n_alloc[l] : 16;
+        sketch->items[l] = (double *)G_realloc(
+            sketch->items[l], sketch->n_alloc[l] * sizeof(double));
+    }
+    sketch->items[l][sketch->n[l]++] = value;
+}
+
+static void compact_level(quantile_sketch *sketch, int l)
+{
+    int i, n;
+    double *items;
+
+    if (l + 1 == sketch->n_levels)
+        add_level(sketch);
+    items = sketch->items[l];
+    heapsort_double(items, sketch->n[l]);
+
+    /* an odd value stays in this level */
+    n = sketch->n[l] - sketch->n[l] % 2;
+    for (i = sketch->parity[l]; i < n; i += 2)
+        level_add(sketch, l + 1, items[i]);
+    sketch->parity[l] = !sketch->parity[l];
+    if (sketch->n[l] % 2) {
+        items[0] = items[sketch->n[l] - 1];
+        sketch->n[l] = 1;
+    }
+    else
+        sketch->n[l] = 0;
+}
+
+static void compact(quantile_sketch *sketch)
+{
+    int l;
+
+    for (l = 0; l < sketch->n_levels; l++) {
+        if (sketch->n[l] >= sketch->k)
+            compact_level(sketch, l);
+    }
+}
+
+void sketch_add(quantile_sketch *sketch, double value)
+{
+    if (sketch->n_levels == 0)
+        add_level(sketch);
+    level_add(sketch, 0, value);
+    if (sketch->n[0] >= sketch->k)
+        compact(sketch);
+}
+
+void sketch_merge(quantile_sketch *dst, const quantile_sketch *src)
+{
+    int l, i;
+
+    while (dst->n_levels < src->n_levels)
+        add_level(dst);
+    for (l = 0; l < src->n_levels; l++) {
+        for (i = 0; i < src->n[l]; i++)
+            level_add(dst, l, src->items[l][i]);
+    }
+    compact(dst);
+}
+
+static int cmp_weighted_value(const void *a, const void *b)
+{
+    const weighted_value *wa = a, *wb = b;
+
+    if (wa->value < wb->value)
+        return -1;
+    if (wa->value > wb->value)
+        return 1;
+    return 0;
+}
+
+/* *************************************************************** */
+/* **** sorted values of the sketch with their weights *********** */
+/* *************************************************************** */
+int sketch_sorted(const quantile_sketch *sketch, double **values,
+                  size_t **weights)
+{
+    int l, i, n;
+    weighted_value *all;
+
+    n = 0;
+    for (l = 0; l < sketch->n_levels; l++)
+        n += sketch->n[l];
+    all = (weighted_value *)G_malloc(n * sizeof(weighted_value));
+    n = 0;
+    for (l = 0; l < sketch->n_levels; l++) {
+        for (i = 0; i < sketch->n[l]; i++, n++) {
+            all[n].value = sketch->items[l][i];
+            all[n].weight = (size_t)1 << l;
+        }
+    }
+    qsort(all, n, sizeof(weighted_value), cmp_weighted_value);
+
+    *values = (double *)G_malloc(n * sizeof(double));
+    *weights = (size_t *)G_malloc(n * sizeof(size_t));
+    for (i = 0; i < n; i++) {
+        (*values)[i] = all[i].value;
+        (*weights)[i] = all[i].weight;
+    }
+    G_free(all);
+
+    return n;
+}
@@ -11,6 +11,8 @@
  *
  */
 
+#include <string.h>
+
 #include "globals.h"
 /*
 #include "../../lib/raster/rasterlib.dox"
@@ -72,6 +74,7 @@ univar_stat *create_univar_stat_struct()
         stats[z].size = 0;
         stats[z].map_type = 0;
         stats[z].array = NULL;
+        stats[z].sketch = NULL;
         stats[z].nextp = NULL;
         stats[z].n_alloc = 0;
     }
@@ -119,13 +122,13 @@ void index_combinations(int n, int **indexes)
     return;
 }
 
-void sort_mode_double(double *array, int n, double tol, double *mode,
-                      int *occurrences)
+void sort_mode_double(double *array, size_t *weights, int n, double tol,
+                      double *mode, int *occurrences)
 {
     int previous = array[0];
-    int i = 1, counter = 1;
+    int i = 1, counter = weights ? weights[0] : 1;
     *mode = (double)array[0];
-    *occurrences = 1;
+    *occurrences = counter;
 
     if (n > 1) {
         while (i < n) {
@@ -135,10 +138,10 @@ void sort_mode_double(double *array, int n, double tol, double *mode,
                     *mode = (double)previous;
                 }
                 previous = array[i];
-                counter = 1;
+                counter = weights ? weights[i] : 1;
             }
             else {
-                counter += 1;
+                counter += weights ? weights[i] : 1;
             }
             i += 1;
         }
@@ -169,34 +172,71 @@ void mode_double(double *array, int n, double tol, double *mode,
     return;
 }
 
+/* value of given rank in sorted values, weights are optional */
+static double value_at_rank(double *values, size_t *weights, int n,
+                            size_t rank)
+{
+    int i;
+    size_t cum = 0;
+
+    if (weights == NULL)
+        return values[rank];
+    for (i = 0; i < n; i++) {
+        cum += weights[i];
+        if (cum > rank)
+            return values[i];
+    }
+    return values[n - 1];
+}
+
 int stats_extend(univar_stat *stat)
 {
     int p, qind_25, qind_75;
     int n = stat->n;
+    int n_values = n;
+    double *values;
+    size_t *weights = NULL;
+
+    if (stat->sketch) {
+        n_values = sketch_sorted(stat->sketch, &values, &weights);
+    }
+    else {
+        heapsort_double(stat->array, n);
+        values = stat->array;
+    }
 
     for (p = 0; p < param.n_perc; p++) {
         param.index_perc[p] = (int)(n * 1e-2 * param.perc[p] - 0.5);
-        stat->perc[p] = stat->array[param.index_perc[p]];
+        stat->perc[p] =
+            value_at_rank(values, weights, n_values, param.index_perc[p]);
     }
     qind_25 = (int)(n * 0.25 - 0.5);
     qind_75 = (int)(n * 0.75 - 0.5);
 
-    heapsort_double(stat->array, n);
-
-    stat->quartile_25 = stat->array[qind_25];
+    stat->quartile_25 = value_at_rank(values, weights, n_values, qind_25);
     /*               odd ?     odd                              : even   */
     stat->median =
-        ((n % 2) ? (stat->array[(int)(n / 2)])
-                 : (stat->array[n / 2 - 1] + stat->array[n / 2]) / 2.0);
-    stat->quartile_75 = stat->array[qind_75];
+        ((n % 2) ? value_at_rank(values, weights, n_values, n / 2)
+                 : (value_at_rank(values, weights, n_values, n / 2 - 1) +
+                    value_at_rank(values, weights, n_values, n / 2)) /
+                       2.0);
+    stat->quartile_75 = value_at_rank(values, weights, n_values, qind_75);
 
-    sort_mode_double(stat->array, n, param.tol, &stat->mode,
+    sort_mode_double(values, weights, n_values, param.tol, &stat->mode,
                      &stat->occurrences);
 
     /* free the memory after compute the extended statistics */
-    G_free(stat->array);
-    stat->array = NULL;
-    stat->n_alloc = 0;
+    if (stat->sketch) {
+        G_free(values);
+        G_free(weights);
+        sketch_free(stat->sketch);
+        stat->sketch = NULL;
+    }
+    else {
+        G_free(stat->array);
+        stat->array = NULL;
+        stat->n_alloc = 0;
+    }
     return 0;
 }
 
@@ -235,7 +275,7 @@ int stats_general(univar_stat *s)
     return 0;
 }
 
-int compute_stats(univar_stat *stat, double val, int len)
+void compute_stats(univar_stat *stat, double val)
 {
     stat->sum += val;
     stat->sum2 += val * val;
@@ -245,23 +285,68 @@ int compute_stats(univar_stat *stat, double val, int len)
     stat->min = (isnan(stat->min) || val < stat->min) ? val : stat->min;
     stat->max = (isnan(stat->max) || val > stat->max) ? val : stat->max;
 
-    if (stat->array != NULL)
-        G_debug(3, "Compute_stats, zone: %d, val=%f, %d/%d, n_alloc:%d",
-                stat->zone, val, stat->n, stat->size, stat->n_alloc);
-    stat->array[stat->n] = val;
+    if (param.extended->answer) {
+        if (param.sketch_k > 0) {
+            if (stat->sketch == NULL)
+                stat->sketch = sketch_create(param.sketch_k);
+            sketch_add(stat->sketch, val);
+        }
+        else {
+            if (stat->n == stat->n_alloc) {
+                /* size is known only for the final statistics */
+                stat->n_alloc = stat->n_alloc ? stat->n_alloc * 1.5 + 1
+                                : stat->size > 0 ? stat->size
+                                                 : 1024;
+                stat->array = (DCELL *)G_realloc(
+                    stat->array, stat->n_alloc * sizeof(DCELL));
+            }
+            stat->array[stat->n] = val;
+        }
+    }
 
     stat->n++;
+}
 
-    if (stat->n == stat->size) {
-        G_debug(3, "    Finish the zone: %d, sum=%f", stat->zone, stat->sum);
-        /* finish this zone */
-        stats_general(stat);
-        if (stat->array != NULL) {
-            stats_extend(stat);
-            return 1;
+/* *************************************************************** */
+/* **** add partial statistics of a zone ************************* */
+/* *************************************************************** */
+void merge_stats(univar_stat *stat, univar_stat *part)
+{
+    if (part->n == 0)
+        return;
+
+    stat->sum += part->sum;
+    stat->sum2 += part->sum2;
+    stat->sum3 += part->sum3;
+    stat->sum4 += part->sum4;
+    stat->sum_abs += part->sum_abs;
+    stat->min =
+        (isnan(stat->min) || part->min < stat->min) ? part->min : stat->min;
+    stat->max =
+        (isnan(stat->max) || part->max > stat->max) ? part->max : stat->max;
+
+    if (part->array != NULL) {
+        if (stat->n + part->n > stat->n_alloc) {
+            stat->n_alloc = stat->n + part->n;
+            stat->array = (DCELL *)G_realloc(stat->array,
+                                             stat->n_alloc * sizeof(DCELL));
         }
+        memcpy(stat->array + stat->n, part->array, part->n * sizeof(DCELL));
+        G_free(part->array);
+        part->array = NULL;
     }
-    return 0;
+    if (part->sketch != NULL) {
+        if (stat->sketch == NULL)
+            stat->sketch = part->sketch;
+        else {
+            sketch_merge(stat->sketch, part->sketch);
+            sketch_free(part->sketch);
+        }
+        part->sketch = NULL;
+    }
+
+    stat->n += part->n;
+    part->n = 0;
 }
 
 /* *************************************************************** */